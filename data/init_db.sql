@@ -16,6 +16,7 @@ CREATE TABLE IF NOT EXISTS PERFUME_MAKLERS (
     address VARCHAR(200),
     birth_year INTEGER,
     user_id INTEGER,
+    version INTEGER NOT NULL DEFAULT 0,
     FOREIGN KEY (user_id) REFERENCES PERFUME_USERS(id)
 );
 
@@ -28,7 +29,24 @@ CREATE TABLE IF NOT EXISTS PERFUME_GOODS (
     supplier VARCHAR(100),
     expiry_date DATE,
     quantity INTEGER NOT NULL DEFAULT 0,
-    created_at DATETIME DEFAULT CURRENT_TIMESTAMP
+    created_at DATETIME DEFAULT CURRENT_TIMESTAMP,
+    version INTEGER NOT NULL DEFAULT 0,
+    supplier_id INTEGER,
+    type_id INTEGER,
+    FOREIGN KEY (supplier_id) REFERENCES PERFUME_SUPPLIERS(id),
+    FOREIGN KEY (type_id) REFERENCES PERFUME_GOOD_TYPES(id)
+);
+
+-- Create supplier and good type dimensions (goods and deals refer to them
+-- by id, see db_init for the triggers that keep them in step)
+CREATE TABLE IF NOT EXISTS PERFUME_SUPPLIERS (
+    id INTEGER PRIMARY KEY AUTOINCREMENT,
+    name VARCHAR(100) NOT NULL UNIQUE
+);
+
+CREATE TABLE IF NOT EXISTS PERFUME_GOOD_TYPES (
+    id INTEGER PRIMARY KEY AUTOINCREMENT,
+    name VARCHAR(50) NOT NULL UNIQUE
 );
 
 -- Create deals table
@@ -43,8 +61,12 @@ CREATE TABLE IF NOT EXISTS PERFUME_DEALS (
     good_id INTEGER NOT NULL,
     buyer VARCHAR(100) NOT NULL,
     created_at DATETIME DEFAULT CURRENT_TIMESTAMP,
+    supplier_id INTEGER,
+    type_id INTEGER,
     FOREIGN KEY (makler_id) REFERENCES PERFUME_MAKLERS(id),
-    FOREIGN KEY (good_id) REFERENCES PERFUME_GOODS(id)
+    FOREIGN KEY (good_id) REFERENCES PERFUME_GOODS(id),
+    FOREIGN KEY (supplier_id) REFERENCES PERFUME_SUPPLIERS(id),
+    FOREIGN KEY (type_id) REFERENCES PERFUME_GOOD_TYPES(id)
 );
 
 -- Create makler statistics table
@@ -60,6 +82,57 @@ CREATE TABLE IF NOT EXISTS PERFUME_MAKLERSTATS (
     UNIQUE(makler_id, good_name, good_type)
 );
 
+-- Create daily sales rollup (kept by the deal path, rebuilt from the journal)
+CREATE TABLE IF NOT EXISTS PERFUME_DAILY_SALES (
+    day DATE NOT NULL,
+    good_id INTEGER NOT NULL,
+    makler_id INTEGER NOT NULL,
+    supplier_id INTEGER NOT NULL DEFAULT 0,
+    type_id INTEGER NOT NULL DEFAULT 0,
+    deal_count INTEGER NOT NULL DEFAULT 0,
+    total_quantity INTEGER NOT NULL DEFAULT 0,
+    total_amount DECIMAL(12,2) NOT NULL DEFAULT 0,
+    PRIMARY KEY (day, good_id, makler_id, supplier_id, type_id)
+);
+
+-- Create change feed of committed deals (seq is the consumer cursor)
+CREATE TABLE IF NOT EXISTS PERFUME_DEAL_FEED (
+    seq INTEGER PRIMARY KEY AUTOINCREMENT,
+    deal_id INTEGER NOT NULL,
+    committed_at DATETIME DEFAULT CURRENT_TIMESTAMP
+);
+
+-- Create search terms and their FTS5 indexes (kept in step by triggers,
+-- see db_init for the triggers)
+CREATE TABLE IF NOT EXISTS PERFUME_SEARCH_TERMS (
+    id INTEGER PRIMARY KEY,
+    kind TEXT NOT NULL,
+    ref_id INTEGER NOT NULL DEFAULT 0,
+    label TEXT NOT NULL,
+    detail TEXT NOT NULL DEFAULT '',
+    UNIQUE(kind, label, ref_id)
+);
+
+CREATE VIRTUAL TABLE IF NOT EXISTS PERFUME_SEARCH USING fts5(
+    label, detail, content='PERFUME_SEARCH_TERMS', content_rowid='id',
+    tokenize='unicode61 remove_diacritics 2', prefix='1 2 3'
+);
+
+CREATE VIRTUAL TABLE IF NOT EXISTS PERFUME_SEARCH_TRIGRAMS USING fts5(
+    label, content='PERFUME_SEARCH_TERMS', content_rowid='id', tokenize='trigram'
+);
+
+-- Create distinct-buyer HyperLogLog sketches per day and good type,
+-- makler or supplier (maintained by the application, see hll.h)
+CREATE TABLE IF NOT EXISTS PERFUME_BUYER_SKETCHES (
+    id INTEGER PRIMARY KEY,
+    dimension VARCHAR(10) NOT NULL,
+    key VARCHAR(100) NOT NULL,
+    day DATE NOT NULL,
+    sketch BLOB NOT NULL,
+    UNIQUE (dimension, key, day)
+);
+
 -- Create indexes for performance
 CREATE INDEX IF NOT EXISTS idx_users_username ON PERFUME_USERS(username);
 CREATE INDEX IF NOT EXISTS idx_maklers_user_id ON PERFUME_MAKLERS(user_id);
@@ -3,13 +3,72 @@
 
 #include "types.h"
 
+// Passwords are stored as "$scrypt$ln=14,r=8,p=1$<salt>$<key>" (hex).
+// Rows still holding a plain password are rehashed on their next login.
+#define AUTH_SCRYPT_LOG_N 14
+#define AUTH_SCRYPT_R 8
+#define AUTH_SCRYPT_P 1
+
+// Session tokens skip the key derivation on later logins. The cache is
+// bounded: issuing into a full cache replaces the oldest token.
+#define AUTH_TOKEN_SLOTS 256
+#define AUTH_TOKEN_TTL 3600   // seconds
+#define AUTH_TOKEN_SIZE 37    // 4 hex digits of slot, 32 of secret, NUL
+
+// Login attempts are throttled per username and per source with token
+// buckets, checked before the database is touched: a burst, then a
+// steady rate. Throttled attempts fail like a wrong password.
+#define AUTH_USER_BURST 5
+#define AUTH_USER_PER_SECOND 0.1
+#define AUTH_SOURCE_BURST 20
+#define AUTH_SOURCE_PER_SECOND 1.0
+#define AUTH_LIMIT_SLOTS 1024
+#define AUTH_LOCAL_SOURCE "local"
+
+// Capabilities: what a session may do, compiled from its role when the
+// session starts, so checking one is a bit test with no database access.
+// Besides the CLI commands and menus, the API they call checks them:
+// creating deals and goods, listing every deal, running and scheduling
+// reports.
+typedef unsigned Capabilities;
+
+#define CAP_CREATE_DEAL     (1u << 0)   // deals, holds
+#define CAP_VIEW_OWN_DEALS  (1u << 1)   // own deals and statistics
+#define CAP_VIEW_ALL_DEALS  (1u << 2)   // every deal, the deal feed
+#define CAP_VIEW_GOODS      (1u << 3)   // goods list, search
+#define CAP_MANAGE_GOODS    (1u << 4)   // add goods, stock updates
+#define CAP_MANAGE_USERS    (1u << 5)   // add users and maklers
+#define CAP_RUN_REPORTS     (1u << 6)   // reports, statistics, snapshots
+#define CAP_VIEW_METRICS    (1u << 7)
+#define CAP_MANAGE_DATA     (1u << 8)   // journal replay
+#define CAP_ALL             0xFFFFFFFFu
+
+Capabilities auth_role_capabilities(UserRole role);
+const char* auth_role_name(UserRole role);
+int auth_parse_role(const char *name);  // -1 if unknown
+
+// Capabilities of the current session (none before login). Command mode
+// has no login and sets them directly: everything, or a role's with --role.
+int auth_can(Capabilities required);
+Capabilities auth_capabilities();
+void auth_set_capabilities(Capabilities capabilities);
+
 // Authentication functions
-User* auth_login(const char *username, const char *password);
+User* auth_login(const char *username, const char *password);  // from AUTH_LOCAL_SOURCE
+User* auth_login_from(const char *username, const char *password, const char *source);
+void auth_reset_limits();
 void auth_logout(User *current_user);
 int auth_check_permission(const User *user, UserRole required_role);
-char* auth_hash_password(const char *password);  // For testing only, not secure
+char* auth_hash_password(const char *password);  // salted, to be freed; NULL on failure
 int auth_verify_password(const char *password, const char *hash);
 
+// Token logins: auth_login issues one for the session, auth_login_token
+// accepts it until it expires or is revoked (logout revokes it)
+User* auth_login_token(const char *token);
+const char* auth_session_token();
+void auth_revoke_token(const char *token);
+void auth_revoke_user(int user_id);
+
 // Session management
 void auth_start_session(User *user);
 void auth_end_session();
@@ -0,0 +1,33 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include <stdio.h>
+#include "reports.h"
+
+#define CLI_MAX_ARGS 32
+#define CLI_MAX_LINE 1024
+
+// Non-interactive command mode: "add-good name=... price=..."
+// argv[0] is the command name, the rest are key=value arguments.
+// Returns 0 on success, -1 on failure (the error goes to stderr).
+int cli_run_command(int argc, char *argv[]);
+
+// Runs a file of commands ("-" for stdin) on the open connection inside
+// a single transaction; the first failing command rolls back the script
+int cli_run_script(const char *path);
+
+// Runs a report by name into a file (NULL = stdout) in the given format
+int cli_run_report(const char *name, const char *format_name, const char *out_path,
+                   const ReportParams *params);
+
+// Same, answered from a snapshot file without opening the database
+int cli_run_snapshot_report(const char *snapshot_path, const char *name, const char *format_name,
+                            const char *out_path, const ReportParams *params);
+
+// Splits a script line into arguments in place; double quotes group
+// words and '#' starts a comment. Returns the argument count.
+int cli_split_line(char *line, char *argv[], int max_args);
+
+void cli_print_commands(FILE *out);
+
+#endif // CLI_H
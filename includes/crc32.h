@@ -0,0 +1,11 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3, as used by zip and PNG). Start with crc = 0 and
+// pass the previous result to continue over several buffers.
+uint32_t crc32_update(uint32_t crc, const void *data, size_t size);
+
+#endif // CRC32_H
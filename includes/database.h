@@ -1,14 +1,58 @@
 #ifndef DATABASE_H
 #define DATABASE_H
 
+#include <stdint.h>
 #include <sqlite3.h>
 #include "types.h"
 
+// Returned by the *_if_version updates when the row changed since it was read
+#define DB_CONFLICT -2
+
 // Database initialization
 int db_init(const char *db_path);
+
+// In-memory database for tests and benchmarks: a private one for a NULL
+// name, else one shared by every connection in the process that opens the
+// same name (db_open_connection included; connections take table locks
+// instead of WAL snapshots). If template_path is given, its database is
+// copied in first. The database is gone when its last connection closes.
+int db_init_memory(const char *name, const char *template_path);
+
+// Writes a compact copy of the open database to path (replacing it) to
+// seed db_init_memory from
+int db_save_template(const char *path);
 void db_close();
 sqlite3* db_get_connection();
 
+// Another connection to the same database file (for scheduled reports);
+// closed with sqlite3_close
+sqlite3* db_open_connection();
+
+// Exchanges the connection the db_* functions use, and its transaction
+// depth, with the given ones
+void db_swap_connection(sqlite3 **conn, int *depth);
+
+// Statement wrappers (instrumented)
+int db_prepare(const char *sql, sqlite3_stmt **stmt);
+int db_step(sqlite3_stmt *stmt);
+int db_finalize(sqlite3_stmt *stmt);
+
+// Transactions (nested calls become savepoints)
+int db_begin_transaction();
+int db_commit_transaction();
+int db_rollback_transaction();
+int db_transaction_depth();
+
+// SQLITE_BUSY results seen by this connection (another connection held
+// the lock); counted with or without metrics
+uint64_t db_busy_count();
+
+// Read sessions: every query until db_end_read sees the same committed
+// state while other connections keep writing (WAL). Nested inside a
+// transaction they also see its own uncommitted writes.
+int db_begin_read();
+int db_end_read();
+
 // User operations
 int db_create_user(const User *user);
 User* db_get_user_by_username(const char *username);
@@ -21,27 +65,86 @@ Makler* db_get_makler_by_id(int id);
 Makler* db_get_makler_by_user_id(int user_id);
 Makler** db_get_all_maklers(int *count);
 int db_update_makler(const Makler *makler);
+int db_update_makler_if_version(Makler *makler);
 int db_delete_makler(int id);
 
 // Good operations
-int db_create_good(const Good *good);
+int db_create_good(const Good *good);  // needs CAP_MANAGE_GOODS
 Good* db_get_good_by_id(int id);
+int db_get_good_cached(int good_id, int refresh, Good *out);
 Good** db_get_all_goods(int *count);
 int db_update_good(const Good *good);
+int db_update_good_if_version(Good *good);
 int db_delete_good(int id);
 int db_check_good_availability(int good_id, int quantity_needed);
+int db_set_good_quantity(int good_id, int quantity);
+int db_journal_stock();
 
 // Deal operations
 int db_create_deal(const Deal *deal);
+int db_create_deal_if_version(const Deal *deal, int good_version);
 Deal** db_get_deals_by_makler(int makler_id, int *count);
 Deal** db_get_all_deals(int *count);
 Deal** db_get_deals_by_date_range(time_t start_date, time_t end_date, int *count);
 int db_update_stats_on_deal(const Deal *deal);
 
+// Listing without copies: the visitor gets a view of the current row whose
+// text points into SQLite's buffers, valid only until it returns. Text is
+// NUL-terminated, and NULL for an SQL NULL.
+typedef struct {
+    const char *text;
+    int length;
+} DbText;
+
+typedef struct {
+    int id;
+    DbText deal_date;    // YYYY-MM-DD HH:MM:SS
+    DbText good_name;
+    DbText good_type;
+    int quantity;
+    double total_amount;
+    int makler_id;
+    int good_id;
+    DbText buyer;
+} DealView;
+
+typedef struct {
+    int id;
+    DbText name;
+    DbText type;
+    double unit_price;
+    DbText supplier;
+    DbText expiry_date;
+    int quantity;
+} GoodView;
+
+// Visitors return non-zero to stop early
+typedef int (*DealVisitor)(const DealView *deal, void *ctx);
+typedef int (*GoodVisitor)(const GoodView *good, void *ctx);
+
+// Deals in deal_date, id order; makler_id 0 is every makler and NULL dates
+// (YYYY-MM-DD, inclusive) are open. Return the rows visited or -1.
+int db_visit_deals(int makler_id, const char *start_date, const char *end_date,
+                   DealVisitor visit, void *ctx);
+// Goods in id order
+int db_visit_goods(GoodVisitor visit, void *ctx);
+
 // Makler statistics operations
 MaklerStats* db_get_makler_stats(int makler_id, int *count);
 int db_update_makler_stats(const Deal *deal);
 
+// Aggregates derived from deals: makler stats, the daily rollup and the
+// distinct-buyer sketches
+int db_update_daily_sales(const Deal *deal);
+int db_update_buyer_sketches(const Deal *deal);
+int db_apply_deal_aggregates(const Deal *deal);
+int db_reset_aggregates();
+
+// Estimated distinct buyers for a good type, makler id or supplier
+// ("type", "makler", "supplier") over whole days; NULL dates are open
+long long db_distinct_buyers(const char *dimension, const char *key,
+                             const char *start_date, const char *end_date);
+
 // Helper functions
 void db_free_user(User *user);
 void db_free_makler(Makler *makler);
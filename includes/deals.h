@@ -3,7 +3,8 @@
 
 #include "types.h"
 
-// Deal management
+// Deal management; creating needs CAP_CREATE_DEAL, listing every deal
+// CAP_VIEW_ALL_DEALS
 int deals_create_deal(int good_id, int quantity, const char *buyer, int makler_id);
 Deal** deals_get_makler_deals(int makler_id, int *count);
 Deal** deals_get_all_deals(int *count);
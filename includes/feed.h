@@ -0,0 +1,39 @@
+#ifndef FEED_H
+#define FEED_H
+
+#include "types.h"
+
+#define FEED_DEFAULT_BATCH 256
+#define FEED_DEFAULT_POLL_MS 200
+#define FEED_BUSY_TIMEOUT_MS 5000
+
+// Change feed of committed deals. Every deal gets a sequence number in
+// the same transaction that creates it, so consumers keep the last seq
+// they processed and only ever read what came after it.
+typedef struct {
+    long long seq;
+    Deal deal;
+} FeedEvent;
+
+// Return non-zero to stop reading
+typedef int (*FeedVisitor)(const FeedEvent *event, void *ctx);
+
+// Highest committed sequence number, 0 for an empty feed, -1 on error
+long long feed_last_seq();
+
+// Visits up to limit events with seq > after_seq in order. Returns the
+// number visited or -1; *last_seq is set to the last visited seq.
+int feed_read(long long after_seq, int limit, FeedVisitor visit, void *ctx, long long *last_seq);
+
+// Replays from after_seq, then waits for new commits (from this or any
+// other process) and delivers them as they arrive. Events are fetched in
+// batches of batch_size and handed to the visitor one at a time, so a
+// slow consumer holds the reader back instead of growing a queue.
+// Returns the last delivered seq once the visitor stops or feed_stop()
+// is called, -1 on error.
+long long feed_follow(long long after_seq, int batch_size, int poll_ms, FeedVisitor visit, void *ctx);
+
+// Makes feed_follow return; safe to call from a signal handler
+void feed_stop();
+
+#endif // FEED_H
@@ -0,0 +1,44 @@
+#ifndef HLL_H
+#define HLL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sqlite3.h>
+
+// HyperLogLog distinct counts: 2^14 registers give a standard error of
+// about 0.8%. Sketches are stored sparse (sorted index/rank pairs) while
+// they are small and dense (one byte per register) once they aren't.
+#define HLL_PRECISION 14
+#define HLL_REGISTERS (1 << HLL_PRECISION)
+#define HLL_SPARSE_MAX 1024
+
+// Encoded sketches start with a format byte
+#define HLL_FORMAT_SPARSE 'S'
+#define HLL_FORMAT_DENSE 'D'
+#define HLL_DENSE_SIZE (1 + HLL_REGISTERS)
+
+typedef struct {
+    uint8_t registers[HLL_REGISTERS];
+} Hll;
+
+uint64_t hll_hash(const char *value, size_t length);
+
+// Register index and rank (position of the first set bit) for a hash
+void hll_position(uint64_t hash, int *index, uint8_t *rank);
+
+void hll_clear(Hll *hll);
+void hll_add(Hll *hll, uint64_t hash);
+
+// Takes the register-wise maximum with an encoded sketch; -1 if malformed
+int hll_merge_encoded(Hll *hll, const void *sketch, int size);
+
+double hll_estimate(const Hll *hll);
+
+// SQL functions on encoded sketches:
+//   hll_add(sketch, value)  sketch with value added (NULL = empty sketch)
+//   hll_sketch(value)       aggregate, sketch of all values
+//   hll_merge(sketch)       aggregate, union of sketches
+//   hll_count(sketch)       estimated distinct count
+int hll_register_sql(sqlite3 *db);
+
+#endif // HLL_H
@@ -0,0 +1,63 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include "types.h"
+
+// Append-only deal journal. Records are buffered while a transaction is
+// open and written in one sequential write when the outermost transaction
+// commits; fsync is batched by record count and elapsed time.
+#define JOURNAL_MAGIC "PBJRNL\r\n"
+#define JOURNAL_VERSION 2  // 2: deals carry their supplier and type ids
+
+#define JOURNAL_DEFAULT_SYNC_RECORDS 64
+#define JOURNAL_DEFAULT_SYNC_MS 100
+
+typedef enum {
+    JOURNAL_DEAL = 1,       // a committed deal
+    JOURNAL_STOCK_SET = 2   // absolute stock of a good
+} JournalRecordType;
+
+typedef struct {
+    JournalRecordType type;
+    Deal deal;              // JOURNAL_DEAL
+    int good_id;            // JOURNAL_STOCK_SET
+    int quantity;
+} JournalRecord;
+
+// sync_records = 1 syncs every commit, 0 only on journal_sync/close. A torn
+// tail left by a crash is truncated away so new records follow the last
+// intact one.
+int journal_open(const char *path, int sync_records, int sync_ms);
+void journal_close();
+int journal_enabled();
+
+// Buffered until journal_commit
+void journal_append_deal(const Deal *deal);
+void journal_append_stock(int good_id, int quantity);
+
+// Transaction hooks used by database.c
+size_t journal_mark();
+void journal_rollback_to(size_t mark);
+int journal_commit();
+int journal_sync();
+
+// Reads every intact record in order; stops at a torn or corrupt tail,
+// whose size is returned in *truncated_bytes. Returns the record count
+// or -1 if the file can't be read.
+typedef int (*JournalVisitor)(const JournalRecord *record, void *ctx);
+long journal_read(const char *path, JournalVisitor visit, void *ctx, long *truncated_bytes);
+
+typedef struct {
+    long records;
+    long deals;
+    long stock_sets;
+    long truncated_bytes;
+} JournalReplayStats;
+
+// Rebuilds makler stats, daily rollups and the stock of journaled goods
+// from the journal in one transaction. Refused when the database holds
+// deals the journal has no record of, whose statistics would be lost.
+int journal_replay(const char *path, JournalReplayStats *stats);
+
+#endif // JOURNAL_H
@@ -0,0 +1,119 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sqlite3.h>
+
+// Latency histogram with log-linear buckets (HDR-style): values below
+// 8 ns are exact, above that every power of two is split into 8 sub-buckets
+// which keeps the relative error of a percentile under 12.5%.
+#define METRICS_HIST_SUB_BITS 3
+#define METRICS_HIST_SUB_BUCKETS (1 << METRICS_HIST_SUB_BITS)
+#define METRICS_HIST_BUCKETS (64 * METRICS_HIST_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t counts[METRICS_HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+} MetricsHistogram;
+
+// Per-function probe, registered on first call
+typedef struct MetricsProbe {
+    const char *name;
+    uint64_t calls;
+    uint64_t rows;
+    uint64_t statements;
+    uint64_t prepare_ns;
+    uint64_t step_ns;
+    uint64_t vm_steps;
+    uint64_t fullscan_steps;
+    uint64_t sorts;
+    uint64_t autoindexes;
+    MetricsHistogram latency;
+    int registered;
+    struct MetricsProbe *next;
+} MetricsProbe;
+
+// Named event counter, registered on first increment
+typedef struct MetricsCounter {
+    const char *name;
+    uint64_t value;
+    int registered;
+    struct MetricsCounter *next;
+} MetricsCounter;
+
+typedef struct MetricsScope {
+    MetricsProbe *probe;
+    uint64_t start_ns;
+    struct MetricsScope *parent;
+} MetricsScope;
+
+// Histogram helpers (always available, also used by the load-test driver)
+uint64_t metrics_now_ns();
+void metrics_hist_record(MetricsHistogram *hist, uint64_t value);
+void metrics_hist_merge(MetricsHistogram *dst, const MetricsHistogram *src);
+uint64_t metrics_hist_percentile(const MetricsHistogram *hist, double percentile);
+
+// Reporting
+void metrics_dump(FILE *out);
+int metrics_dump_to_file(const char *path);
+void metrics_reset();
+int metrics_enabled();
+
+// Current value of a counter by name (0 if never counted)
+uint64_t metrics_counter_value(const char *name);
+
+// Dump on signal. The handler only raises a flag; metrics_poll() writes it
+// out and runs at every menu, command, database step and idle feed poll.
+// A process blocked reading input dumps once the input arrives.
+void metrics_install_signal_handler(int signo);
+
+// Dump to a file at process exit (--stats-dump)
+void metrics_set_exit_dump(const char *path);
+
+#ifdef ENABLE_METRICS
+
+void metrics_scope_begin(MetricsScope *scope, MetricsProbe *probe);
+void metrics_scope_end(MetricsScope *scope);
+
+// Installs another chain of open scopes and returns the current one
+// (used when switching between scheduled tasks)
+MetricsScope* metrics_swap_scope(MetricsScope *scope);
+
+// Hooks called by the statement wrappers in database.c
+void metrics_on_prepare(uint64_t elapsed_ns);
+void metrics_on_step(uint64_t elapsed_ns, int rc);
+void metrics_on_finalize(sqlite3_stmt *stmt);
+void metrics_counter_add(MetricsCounter *counter, uint64_t n);
+void metrics_poll();
+
+// Instrument the enclosing function: call count, rows, latency and
+// statement stats are attributed to it until it returns.
+#define METRICS_FUNC() \
+    static MetricsProbe metrics_probe_ = { .name = __func__ }; \
+    MetricsScope metrics_scope_ __attribute__((cleanup(metrics_scope_end))); \
+    metrics_scope_begin(&metrics_scope_, &metrics_probe_)
+
+// Count an event under a fixed name, e.g. METRICS_COUNT("auth_throttled", 1)
+#define METRICS_COUNT(name_, n) do { \
+        static MetricsCounter metrics_counter_ = { .name = name_ }; \
+        metrics_counter_add(&metrics_counter_, n); \
+    } while (0)
+
+#else
+
+static inline void metrics_on_prepare(uint64_t elapsed_ns) { (void)elapsed_ns; }
+static inline void metrics_on_step(uint64_t elapsed_ns, int rc) { (void)elapsed_ns; (void)rc; }
+static inline void metrics_on_finalize(sqlite3_stmt *stmt) { (void)stmt; }
+static inline MetricsScope* metrics_swap_scope(MetricsScope *scope) { return scope; }
+
+#define METRICS_FUNC() ((void)0)
+#define METRICS_COUNT(name_, n) ((void)0)
+#define metrics_poll() ((void)0)
+
+#endif // ENABLE_METRICS
+
+#endif // METRICS_H
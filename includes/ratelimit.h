@@ -0,0 +1,27 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdint.h>
+
+#define RATELIMIT_KEY_SIZE 64
+
+// Token buckets keyed by string in a fixed table. A key's bucket holds up
+// to `burst` tokens and refills at `per_second`; each attempt takes one.
+// Lookups probe a bounded window, so a check is O(1) however many keys
+// are seen. When the window is taken, a bucket that has refilled
+// completely (indistinguishable from a new one) is reused. If none has,
+// the new key is throttled: evicting a bucket that is still refilling
+// would hand its key a fresh burst.
+typedef struct RateLimiter RateLimiter;
+
+RateLimiter* ratelimit_create(int slots, double burst, double per_second);
+void ratelimit_free(RateLimiter *limiter);
+
+// Takes a token from key's bucket: 1 if there was one, 0 if throttled.
+// now_ns is a monotonic clock (metrics_now_ns).
+int ratelimit_take(RateLimiter *limiter, const char *key, uint64_t now_ns);
+
+// Forgets every bucket
+void ratelimit_reset(RateLimiter *limiter);
+
+#endif // RATELIMIT_H
@@ -0,0 +1,49 @@
+#ifndef REPORT_CACHE_H
+#define REPORT_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Rendered report output, keyed by a string naming the report, its
+// parameters and the output format, and stamped with the data version it
+// was produced at. A lookup at any other version drops the entry. Entries
+// are evicted least recently used first once the entry count or the bytes
+// held (entry, key and output) would go over the limits; an output larger
+// than the byte limit is never kept.
+#define REPORT_CACHE_MAX_ENTRIES 64
+#define REPORT_CACHE_MAX_BYTES (4 * 1024 * 1024)
+#define REPORT_CACHE_KEY_SIZE 1024
+
+// Changes on any commit the connection can see: PRAGMA data_version counts
+// other connections' commits, sqlite3_total_changes64 the connection's own
+typedef struct {
+    const void *connection;
+    long long data_version;
+    long long changes;
+} ReportCacheVersion;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;      // including lookups that found a stale entry
+    uint64_t evictions;   // for room, not for staleness
+    int entries;
+    size_t bytes;
+} ReportCacheStats;
+
+// Output cached for key at version, or NULL. The pointer stays valid until
+// the next call that changes the cache.
+const char* report_cache_get(const char *key, const ReportCacheVersion *version,
+                             size_t *length, int *sections);
+
+// Keeps a copy of output; returns -1 if it doesn't fit or memory runs out
+int report_cache_put(const char *key, const ReportCacheVersion *version,
+                     const char *output, size_t length, int sections);
+
+// Limits default to the constants above; 0 entries turns the cache off
+void report_cache_set_limits(int max_entries, size_t max_bytes);
+size_t report_cache_max_output();
+
+void report_cache_clear();
+void report_cache_stats(ReportCacheStats *stats);
+
+#endif // REPORT_CACHE_H
@@ -0,0 +1,62 @@
+#ifndef REPORT_WRITER_H
+#define REPORT_WRITER_H
+
+#include <stdio.h>
+
+#define REPORT_WRITER_BUFFER_SIZE (64 * 1024)
+
+// Output formats
+typedef enum {
+    REPORT_FORMAT_TABLE,  // aligned columns for the console
+    REPORT_FORMAT_CSV,    // RFC 4180, one header row per section
+    REPORT_FORMAT_JSONL   // one JSON object per row
+} ReportFormat;
+
+typedef enum {
+    REPORT_COL_TEXT,
+    REPORT_COL_INT,
+    REPORT_COL_REAL
+} ReportColumnType;
+
+// Column description: header is shown in tables, key is used by CSV/JSON
+typedef struct {
+    const char *header;
+    const char *key;
+    ReportColumnType type;
+    int width;  // table column width, 0 = unpadded
+} ReportColumn;
+
+#define REPORT_COLUMN_COUNT(columns) ((int)(sizeof(columns) / sizeof((columns)[0])))
+
+typedef struct ReportWriter ReportWriter;
+
+// Writer lifecycle
+ReportWriter* report_writer_create(FILE *out, ReportFormat format);
+void report_writer_free(ReportWriter *rw);
+void report_writer_flush(ReportWriter *rw);
+ReportFormat report_writer_format(const ReportWriter *rw);
+int report_writer_sections(const ReportWriter *rw);
+int report_format_parse(const char *name, ReportFormat *format);
+
+// Recording keeps a copy of everything written from now on, up to limit
+// bytes, so it can be replayed later. Stopping returns the copy (the
+// caller frees it) and the sections it holds, or NULL if it outgrew the
+// limit.
+int report_writer_record(ReportWriter *rw, size_t limit);
+char* report_writer_stop_recording(ReportWriter *rw, size_t *length, int *sections);
+void report_writer_replay(ReportWriter *rw, const char *output, size_t length, int sections);
+
+// Sections and rows
+void report_writer_begin(ReportWriter *rw, const char *section, const char *title,
+                         const ReportColumn *columns, int column_count);
+void report_writer_end(ReportWriter *rw);
+void report_writer_text(ReportWriter *rw, const char *value);
+void report_writer_text_n(ReportWriter *rw, const char *value, int length);
+void report_writer_int(ReportWriter *rw, long long value);
+void report_writer_real(ReportWriter *rw, double value);
+void report_writer_end_row(ReportWriter *rw);
+
+// Free-form line, only shown in table output
+void report_writer_note(ReportWriter *rw, const char *fmt, ...);
+
+#endif // REPORT_WRITER_H
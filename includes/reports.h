@@ -1,20 +1,69 @@
 #ifndef REPORTS_H
 #define REPORTS_H
 
+#include <stdio.h>
 #include "types.h"
+#include "report_writer.h"
+#include "topk.h"
 
-// Report functions
-void reports_sales_by_good(const char *start_date, const char *end_date);
-void reports_buyers_by_good(const char *good_name);
-void reports_popular_good_type();
-void reports_max_deals_makler();
-void reports_sales_by_supplier();
-void reports_makler_deals(int makler_id, const char *date);
+// Parameters for running a report by name
+typedef struct {
+    const char *start_date;  // YYYY-MM-DD
+    const char *end_date;    // YYYY-MM-DD
+    const char *good_name;
+    const char *date;        // YYYY-MM-DD
+    int makler_id;
+    const char *by;          // top: good, makler, buyer or supplier; sales-series: good, type, makler or supplier
+    const char *metric;      // top, sales-series: quantity (default), amount or deals
+    int limit;               // top: K, 0 = TOPK_DEFAULT_LIMIT
+    const char *bucket;      // sales-series: day, week or month (default)
+    int window;              // sales-series: moving average periods, 0 = default
+    const char *key;         // distinct-buyers: one type, makler id or supplier
+    int deadline_ms;         // run through the scheduler and stop after this long, 0 = no limit
+} ReportParams;
+
+// Label of the group holding deals of goods without a supplier or type
+#define REPORTS_NONE "(none)"
+
+#define SERIES_DEFAULT_WINDOW 3
+#define SERIES_MAX_WINDOW 366
+
+// Report output (defaults to an aligned table on stdout)
+void reports_set_output(ReportWriter *rw);
+ReportWriter* reports_output();
+
+// Run a report by name, e.g. "sales-by-good"; returns -1 if unknown, a
+// required parameter is missing, the session lacks CAP_RUN_REPORTS or
+// the report failed
+int reports_run(const char *name, const ReportParams *params);
+int reports_check_params(const char *name, const ReportParams *params);
+void reports_print_catalog(FILE *out);
+
+// Report functions; those returning int return -1 when a query failed or
+// was interrupted, so the output may be incomplete
+int reports_sales_by_good(const char *start_date, const char *end_date);
+int reports_buyers_by_good(const char *good_name);
+int reports_popular_good_type();
+int reports_max_deals_makler();
+int reports_sales_by_supplier();
+int reports_makler_deals(int makler_id, const char *date);
+int reports_deals_by_period(const char *start_date, const char *end_date);
+int reports_goods();
+void reports_search(const char *query, int kinds, int limit);
+int reports_top(TopKDimension dimension, TopKMetric metric, int limit,
+                const char *start_date, const char *end_date);
+int reports_sales_series(const char *by, const char *bucket, TopKMetric metric, int window,
+                         const char *start_date, const char *end_date);
+int reports_distinct_buyers(const char *by, const char *key, const char *start_date, const char *end_date);
 void reports_update_stock(const char *date);
 
+// Writes a ranked Top-K result; shared with the snapshot reports
+void reports_write_top(ReportWriter *rw, TopK *topk, TopKDimension dimension, TopKMetric metric,
+                       const char *start_date, const char *end_date);
+
 // Statistics functions
 int stats_update_on_deal(const Deal *deal);
-void stats_show_makler_stats(int makler_id);
-void stats_show_all_stats();
+int stats_show_makler_stats(int makler_id);
+int stats_show_all_stats();
 
 #endif // REPORTS_H
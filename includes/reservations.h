@@ -0,0 +1,43 @@
+#ifndef RESERVATIONS_H
+#define RESERVATIONS_H
+
+#include <stdint.h>
+
+#define RESERVATION_DEFAULT_TTL_SECONDS 900
+
+// Timer wheel: 100 ms ticks, one revolution every ~102 s; longer holds
+// stay in their slot until the revolution they expire in
+#define RESERVATION_TICK_MS 100
+#define RESERVATION_WHEEL_SLOTS 1024
+
+// Time-limited holds on good quantity, kept in memory by this process.
+// A hold makes the quantity unavailable to other deals until it is
+// confirmed, released or expires; no database transaction stays open.
+// Holds are per process: other processes don't see the held quantity,
+// and holds end with the process (the makler menu session keeps them).
+
+// Places a hold; returns the hold id, or -1 if the good doesn't have
+// enough unreserved stock
+int reservations_hold(int good_id, int quantity, int makler_id, int ttl_seconds);
+
+// Turns a hold into a deal in one transaction; returns the deal id or -1
+// (the hold is kept if the deal can't be created, dropped if it expired)
+int reservations_confirm(int hold_id, const char *buyer);
+
+int reservations_release(int hold_id);
+
+// Quantity of a good held by live holds
+int reservations_reserved(int good_id);
+int reservations_active_count();
+
+// Releases expired holds; called by every other entry point, so holds
+// expire without anyone scanning for them. Returns the number released.
+int reservations_expire();
+
+// Drops every hold
+void reservations_reset();
+
+// Monotonic millisecond clock, replaceable for tests (NULL = default)
+void reservations_set_clock(uint64_t (*clock_ms)());
+
+#endif // RESERVATIONS_H
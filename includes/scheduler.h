@@ -0,0 +1,65 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "reports.h"
+
+// Cooperative scheduler for reports. Each task runs as a coroutine on its
+// own connection to the database file and gives way between result rows
+// once it has run for a slice, so a long report is spread over many
+// short turns instead of holding the caller for its whole run. Deadlines
+// and cancellation stop a task inside a statement too (progress handler
+// and sqlite3_interrupt). A query that computes everything before its
+// first row (an aggregate over the whole table) can't yield, but is still
+// stopped at its deadline.
+#define SCHEDULER_MAX_TASKS 16
+#define SCHEDULER_STACK_SIZE (256 * 1024)
+#define SCHEDULER_SLICE_MS 2
+#define SCHEDULER_PROGRESS_OPS 1000   // VM instructions between checks
+
+typedef enum {
+    TASK_UNKNOWN,        // no such task, or its slot was reused
+    TASK_READY,
+    TASK_DONE,
+    TASK_FAILED,         // the task function returned an error
+    TASK_CANCELLED,
+    TASK_TIMED_OUT
+} TaskState;
+
+typedef int (*SchedulerFn)(void *arg);
+
+// Queues fn(arg) with output going to rw (NULL for the default report
+// output) and a deadline in milliseconds from now (0 for none). Returns
+// the task id, or -1 when every slot is busy or the database is not a
+// file that a second connection can open.
+int scheduler_submit(SchedulerFn fn, void *arg, ReportWriter *rw, int deadline_ms);
+
+// Queues a report by name if the session has CAP_RUN_REPORTS; params and
+// the strings it points to must stay valid until the task finishes
+int scheduler_submit_report(const char *name, const ReportParams *params, ReportWriter *rw,
+                            int deadline_ms);
+
+// Gives every unfinished task one slice and returns how many remain.
+// Must be called outside a transaction on the main connection.
+int scheduler_run_slice();
+
+// Runs slices until every task has finished
+int scheduler_run_all();
+
+// Stops a task at its next check; its output so far is kept
+int scheduler_cancel(int task);
+
+// Finished tasks keep their state until their slot is reused
+TaskState scheduler_state(int task);
+const char* scheduler_state_name(TaskState state);
+
+// Called by db_step after each row: yields if a task's slice is over
+void scheduler_row_boundary();
+
+// Whether the running task has been cancelled or has run out of time, so
+// its output may be cut short; 0 outside a task
+int scheduler_task_stopping();
+
+// Cancels whatever is unfinished and closes the task connections
+void scheduler_close();
+
+#endif // SCHEDULER_H
@@ -0,0 +1,20 @@
+#ifndef SCRYPT_H
+#define SCRYPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_SIZE 32
+
+// SHA-256 (FIPS 180-4) and PBKDF2-HMAC-SHA256 (RFC 8018)
+void sha256(const void *data, size_t size, uint8_t digest[SHA256_SIZE]);
+void pbkdf2_sha256(const void *password, size_t password_size, const void *salt, size_t salt_size,
+                   uint64_t iterations, uint8_t *out, size_t out_size);
+
+// scrypt (RFC 7914): memory-hard key derivation using 128 * r * n bytes.
+// n must be a power of two greater than 1; returns -1 on bad parameters
+// or when the memory can't be allocated.
+int scrypt(const void *password, size_t password_size, const void *salt, size_t salt_size,
+           uint64_t n, uint32_t r, uint32_t p, uint8_t *out, size_t out_size);
+
+#endif // SCRYPT_H
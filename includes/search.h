@@ -0,0 +1,35 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#define SEARCH_MAX_QUERY 200
+#define SEARCH_DEFAULT_RESULTS 20
+#define SEARCH_MAX_RESULTS 500
+
+// Kinds of indexed terms, combinable as a mask
+typedef enum {
+    SEARCH_GOOD = 1,
+    SEARCH_BUYER = 2,
+    SEARCH_SUPPLIER = 4,
+    SEARCH_ALL = 7
+} SearchKind;
+
+typedef struct {
+    SearchKind kind;
+    int ref_id;          // good id, 0 for buyers and suppliers
+    char label[100];     // good name, buyer or supplier
+    char detail[160];    // good type and supplier
+    int fuzzy;           // found by trigram similarity, not by prefix
+    double score;        // lower is better
+} SearchResult;
+
+// Ranked search over goods, buyers and suppliers. Every word of the query
+// is matched as a prefix; if that finds fewer than max_results, terms
+// sharing the most trigrams with the query (substrings, typos) follow.
+// max_results is at most SEARCH_MAX_RESULTS. Returns the number of results
+// or -1 on error.
+int search_query(const char *query, int kinds, SearchResult *results, int max_results);
+
+const char* search_kind_name(SearchKind kind);
+int search_kind_parse(const char *name, int *kinds);
+
+#endif // SEARCH_H
@@ -0,0 +1,23 @@
+#ifndef SLOWLOG_H
+#define SLOWLOG_H
+
+#include <stdint.h>
+#include <sqlite3.h>
+
+#define SLOWLOG_DEFAULT_THRESHOLD_MS 100.0
+#define SLOWLOG_DEFAULT_MAX_BYTES (1024 * 1024)
+#define SLOWLOG_DEFAULT_MAX_FILES 5
+
+// Slow query log: statements whose execution time reaches the threshold
+// are written together with their bound parameters, scan counters and
+// EXPLAIN QUERY PLAN output. The file is rotated to path.1 .. path.N.
+int slowlog_open(const char *path, double threshold_ms, long max_bytes, int max_files);
+void slowlog_close();
+int slowlog_enabled();
+void slowlog_set_threshold(double threshold_ms);
+
+// Called from db_finalize with the time spent preparing and stepping the
+// statement (exec) and the time between prepare and finalize (wall)
+void slowlog_record(sqlite3_stmt *stmt, uint64_t exec_ns, uint64_t wall_ns, int rows);
+
+#endif // SLOWLOG_H
@@ -0,0 +1,32 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "reports.h"
+
+// Binary snapshot of the reporting data: goods, maklers, the string
+// dictionaries and the deals as sorted column arrays. A reporting process
+// maps the file read-only and answers reports without touching SQLite.
+#define SNAPSHOT_MAGIC "PBSNAP\r\n"
+#define SNAPSHOT_VERSION 2   // 2: deals carry their supplier
+
+typedef struct Snapshot Snapshot;
+
+// Writes a snapshot of the open database; the file is replaced atomically.
+// Returns the number of deals written or -1 on error.
+int snapshot_write(const char *path);
+
+// Maps and validates a snapshot (magic, version, checksums, bounds)
+Snapshot* snapshot_open(const char *path);
+void snapshot_close(Snapshot *snap);
+
+int snapshot_deal_count(const Snapshot *snap);
+int snapshot_good_count(const Snapshot *snap);
+int64_t snapshot_created_at(const Snapshot *snap);
+
+// Runs a report by name against the snapshot, writing through
+// reports_output(); returns -1 if unknown, unsupported or a parameter
+// is missing
+int snapshot_run_report(const Snapshot *snap, const char *name, const ReportParams *params);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,36 @@
+#ifndef STATSTORE_H
+#define STATSTORE_H
+
+#include <stddef.h>
+#include "types.h"
+
+// Per-makler statistics kept in memory, keyed like PERFUME_MAKLERSTATS by
+// (makler, good name, good type). Deals update the store when their
+// transaction commits; the changes reach the table in batches, and reads
+// are answered from memory.
+#define STATSTORE_FLUSH_DEALS 64
+#define STATSTORE_FLUSH_MS 1000
+
+// Records a deal's totals; applied when the outermost transaction commits
+// (at once outside a transaction)
+int statstore_add(const Deal *deal);
+
+// Copy of one makler's rows in table order, to be freed by the caller.
+// Reloads from the table first if another connection has committed.
+MaklerStats* statstore_get(int makler_id, int *count);
+
+// Writes every change not yet in PERFUME_MAKLERSTATS in one transaction
+int statstore_flush();
+
+// Number of committed deals not yet flushed
+int statstore_unflushed();
+
+// Forgets everything; the next read loads the table again
+void statstore_reset();
+
+// Transaction hooks used by database.c
+size_t statstore_mark();
+void statstore_rollback_to(size_t mark);
+void statstore_commit();
+
+#endif // STATSTORE_H
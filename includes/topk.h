@@ -0,0 +1,56 @@
+#ifndef TOPK_H
+#define TOPK_H
+
+#define TOPK_DEFAULT_LIMIT 10
+#define TOPK_MAX_LIMIT 1000
+#define TOPK_LABEL_SIZE 100
+
+// Ranked dimensions and metrics for the "top" report
+typedef enum {
+    TOPK_GOOD,
+    TOPK_MAKLER,
+    TOPK_BUYER,
+    TOPK_SUPPLIER
+} TopKDimension;
+
+typedef enum {
+    TOPK_QUANTITY,
+    TOPK_AMOUNT,
+    TOPK_DEALS
+} TopKMetric;
+
+typedef struct {
+    long long id;               // good or makler id, 0 for buyers and suppliers
+    char label[TOPK_LABEL_SIZE];
+    double score;
+    long long deals;
+    long long quantity;
+    double amount;
+} TopKEntry;
+
+// Keeps the best K of a stream of candidates in a bounded min-heap, so
+// ranking n groups costs O(n log K) time and O(K) memory. Ties on score
+// rank by label, then id, so results are deterministic.
+typedef struct TopK TopK;
+
+TopK* topk_create(int limit);
+void topk_free(TopK *topk);
+
+// Returns 1 if the candidate is kept (so far), 0 if it was rejected
+int topk_offer(TopK *topk, long long id, const char *label,
+               long long deals, long long quantity, double amount);
+
+// Sorts the kept entries best first and returns their count; the heap
+// can't be offered to afterwards
+int topk_sorted(TopK *topk, const TopKEntry **entries);
+
+// Metric used to score candidates (TOPK_QUANTITY by default)
+void topk_set_metric(TopK *topk, TopKMetric metric);
+
+// Names as used by --by and --metric; -1 if unknown
+int topk_parse_dimension(const char *name);
+int topk_parse_metric(const char *name);
+const char* topk_dimension_title(TopKDimension dimension);
+const char* topk_metric_title(TopKMetric metric);
+
+#endif // TOPK_H
@@ -6,7 +6,8 @@
 // User roles
 typedef enum {
     ROLE_ADMIN,
-    ROLE_MAKLER
+    ROLE_MAKLER,
+    ROLE_ANALYST    // read-only: deals, goods, reports
 } UserRole;
 
 // User structure
@@ -25,6 +26,7 @@ typedef struct {
     char address[200];
     int birth_year;
     int user_id;
+    int version;  // bumped by every update, see db_update_makler_if_version
 } Makler;
 
 // Good structure
@@ -37,6 +39,7 @@ typedef struct {
     char expiry_date[11]; // YYYY-MM-DD
     int quantity;
     time_t created_at;
+    int version;  // bumped by every update, see db_update_good_if_version
 } Good;
 
 // Deal structure
@@ -51,6 +54,8 @@ typedef struct {
     int good_id;
     char buyer[100];
     time_t created_at;
+    int supplier_id;  // the good's at commit, 0 for none
+    int type_id;
 } Deal;
 
 // Makler statistics structure
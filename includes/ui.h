@@ -2,6 +2,7 @@
 #define UI_H
 
 #include "types.h"
+#include "database.h"
 
 // UI functions
 void ui_show_main_menu();
@@ -24,6 +25,10 @@ void ui_display_good(const Good *good);
 void ui_display_deal(const Deal *deal);
 void ui_display_stats(const MaklerStats *stats);
 
+// Row visitors for db_visit_goods and db_visit_deals
+int ui_display_good_view(const GoodView *good, void *ctx);
+int ui_display_deal_view(const DealView *deal, void *ctx);
+
 // Error handling
 void ui_show_error(const char *message);
 void ui_show_success(const char *message);
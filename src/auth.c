@@ -1,38 +1,310 @@
 #include "auth.h"
 #include "database.h"
+#include "metrics.h"
+#include "ratelimit.h"
+#include "scrypt.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/random.h>
+
+#define SALT_SIZE 16
+#define KEY_SIZE 32
+#define SECRET_SIZE 16
+#define HASH_PREFIX "$scrypt$"
+
+typedef struct {
+    uint8_t secret[SECRET_SIZE];
+    User user;               // password_hash left empty
+    time_t expires_at;
+    int live;
+} TokenSlot;
 
 static User *current_user = NULL;
+static Capabilities session_capabilities = 0;
+
+static const char *role_names[] = { "admin", "makler", "analyst" };
+
+static const Capabilities role_capabilities[] = {
+    [ROLE_ADMIN] = CAP_ALL,
+    [ROLE_MAKLER] = CAP_CREATE_DEAL | CAP_VIEW_OWN_DEALS | CAP_VIEW_GOODS,
+    [ROLE_ANALYST] = CAP_VIEW_ALL_DEALS | CAP_VIEW_GOODS | CAP_RUN_REPORTS | CAP_VIEW_METRICS,
+};
+
+#define ROLE_COUNT (int)(sizeof(role_names) / sizeof(role_names[0]))
+static char session_token[AUTH_TOKEN_SIZE] = "";
+
+static TokenSlot token_slots[AUTH_TOKEN_SLOTS];
+static int next_token_slot = 0;
+
+static RateLimiter *user_limiter = NULL;
+static RateLimiter *source_limiter = NULL;
+
+static int random_bytes(void *out, size_t size) {
+    uint8_t *p = out;
+    while (size > 0) {
+        ssize_t got = getrandom(p, size, 0);
+        if (got < 0) {
+            perror("getrandom");
+            return -1;
+        }
+        p += got;
+        size -= (size_t)got;
+    }
+    return 0;
+}
+
+static void to_hex(const uint8_t *bytes, size_t size, char *out) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < size; i++) {
+        out[i * 2] = digits[bytes[i] >> 4];
+        out[i * 2 + 1] = digits[bytes[i] & 0xF];
+    }
+    out[size * 2] = '\0';
+}
+
+static int from_hex(const char *hex, uint8_t *out, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        unsigned value;
+        if (sscanf(hex + i * 2, "%2x", &value) != 1) return -1;
+        out[i] = (uint8_t)value;
+    }
+    return 0;
+}
+
+// Compares in time independent of where the first difference is
+static int equal_secret(const void *a, const void *b, size_t size) {
+    const uint8_t *x = a, *y = b;
+    uint8_t diff = 0;
+    for (size_t i = 0; i < size; i++) diff |= x[i] ^ y[i];
+    return diff == 0;
+}
 
-// Simple "hash" - just copies password for testing only (not secure)
 char* auth_hash_password(const char *password) {
-    char *hash = malloc(strlen(password) + 1);
-    strcpy(hash, password);
+    METRICS_FUNC();
+    uint8_t salt[SALT_SIZE], key[KEY_SIZE];
+    if (random_bytes(salt, sizeof(salt)) != 0 ||
+        scrypt(password, strlen(password), salt, sizeof(salt), 1ULL << AUTH_SCRYPT_LOG_N,
+               AUTH_SCRYPT_R, AUTH_SCRYPT_P, key, sizeof(key)) != 0) {
+        fprintf(stderr, "Failed to hash password\n");
+        return NULL;
+    }
+    
+    char salt_hex[SALT_SIZE * 2 + 1], key_hex[KEY_SIZE * 2 + 1];
+    to_hex(salt, sizeof(salt), salt_hex);
+    to_hex(key, sizeof(key), key_hex);
+    
+    char *hash = malloc(128);
+    if (!hash) return NULL;
+    snprintf(hash, 128, HASH_PREFIX "ln=%d,r=%d,p=%d$%s$%s",
+             AUTH_SCRYPT_LOG_N, AUTH_SCRYPT_R, AUTH_SCRYPT_P, salt_hex, key_hex);
     return hash;
 }
 
+static int is_current_hash(const char *hash) {
+    int log_n, r, p;
+    return sscanf(hash, HASH_PREFIX "ln=%d,r=%d,p=%d$", &log_n, &r, &p) == 3 &&
+           log_n == AUTH_SCRYPT_LOG_N && r == AUTH_SCRYPT_R && p == AUTH_SCRYPT_P;
+}
+
 int auth_verify_password(const char *password, const char *hash) {
-    return strcmp(password, hash) == 0;
+    METRICS_FUNC();
+    // Rows from before hashing hold the password itself; compared over the
+    // longer of the two so a wrong length doesn't answer sooner
+    if (strncmp(hash, HASH_PREFIX, strlen(HASH_PREFIX)) != 0) {
+        size_t password_length = strlen(password), hash_length = strlen(hash);
+        size_t longest = password_length > hash_length ? password_length : hash_length;
+        uint8_t diff = password_length != hash_length;
+        for (size_t i = 0; i < longest; i++) {
+            uint8_t x = i < password_length ? (uint8_t)password[i] : 0;
+            uint8_t y = i < hash_length ? (uint8_t)hash[i] : 0;
+            diff |= x ^ y;
+        }
+        return diff == 0;
+    }
+    
+    int log_n, r, p, consumed = 0;
+    char salt_hex[SALT_SIZE * 2 + 1], key_hex[KEY_SIZE * 2 + 1];
+    if (sscanf(hash, HASH_PREFIX "ln=%d,r=%d,p=%d$%32[0-9a-f]$%64[0-9a-f]%n",
+               &log_n, &r, &p, salt_hex, key_hex, &consumed) != 5 ||
+        hash[consumed] != '\0' || log_n < 1 || log_n > 24 || r < 1 || p < 1 ||
+        strlen(salt_hex) != SALT_SIZE * 2 || strlen(key_hex) != KEY_SIZE * 2) {
+        fprintf(stderr, "Malformed password hash\n");
+        return 0;
+    }
+    
+    uint8_t salt[SALT_SIZE], expected[KEY_SIZE], key[KEY_SIZE];
+    from_hex(salt_hex, salt, sizeof(salt));
+    from_hex(key_hex, expected, sizeof(expected));
+    if (scrypt(password, strlen(password), salt, sizeof(salt), 1ULL << log_n,
+               (uint32_t)r, (uint32_t)p, key, sizeof(key)) != 0) {
+        fprintf(stderr, "Failed to hash password\n");
+        return 0;
+    }
+    return equal_secret(key, expected, sizeof(key));
+}
+
+// Costs what verifying against a current hash does, so a missing user or a
+// plain row takes as long to refuse as a hashed one
+static void verify_dummy(const char *password) {
+    static char dummy_hash[128] = "";
+    if (!dummy_hash[0]) {
+        char zeros[KEY_SIZE * 2 + 1];
+        memset(zeros, '0', KEY_SIZE * 2);
+        zeros[KEY_SIZE * 2] = '\0';
+        snprintf(dummy_hash, sizeof(dummy_hash), HASH_PREFIX "ln=%d,r=%d,p=%d$%.*s$%s",
+                 AUTH_SCRYPT_LOG_N, AUTH_SCRYPT_R, AUTH_SCRYPT_P, SALT_SIZE * 2, zeros, zeros);
+    }
+    auth_verify_password(password, dummy_hash);
+}
+
+// Stores a fresh hash for a row that is plain or has older parameters
+static void upgrade_hash(User *user, const char *password) {
+    if (is_current_hash(user->password_hash)) return;
+    
+    char *hash = auth_hash_password(password);
+    if (!hash) return;
+    snprintf(user->password_hash, sizeof(user->password_hash), "%s", hash);
+    free(hash);
+    if (db_update_user(user) != 0) {
+        fprintf(stderr, "Failed to upgrade password hash for %s\n", user->username);
+    }
+}
+
+static int issue_token(const User *user, char *token) {
+    int slot = next_token_slot;
+    next_token_slot = (next_token_slot + 1) % AUTH_TOKEN_SLOTS;
+    
+    TokenSlot *entry = &token_slots[slot];
+    if (random_bytes(entry->secret, sizeof(entry->secret)) != 0) {
+        entry->live = 0;
+        return -1;
+    }
+    entry->user = *user;
+    entry->user.password_hash[0] = '\0';
+    entry->expires_at = time(NULL) + AUTH_TOKEN_TTL;
+    entry->live = 1;
+    
+    snprintf(token, AUTH_TOKEN_SIZE, "%04x", slot);
+    to_hex(entry->secret, sizeof(entry->secret), token + 4);
+    return 0;
+}
+
+// The slot is named by the token, so checking it is one comparison
+static TokenSlot* find_token(const char *token) {
+    unsigned slot;
+    uint8_t secret[SECRET_SIZE];
+    if (!token || strlen(token) != AUTH_TOKEN_SIZE - 1 ||
+        sscanf(token, "%4x", &slot) != 1 || slot >= AUTH_TOKEN_SLOTS ||
+        from_hex(token + 4, secret, sizeof(secret)) != 0) {
+        return NULL;
+    }
+    
+    TokenSlot *entry = &token_slots[slot];
+    if (!entry->live || !equal_secret(entry->secret, secret, sizeof(secret))) return NULL;
+    if (entry->expires_at <= time(NULL)) {
+        entry->live = 0;
+        return NULL;
+    }
+    return entry;
+}
+
+// Takes a token from the source's bucket, then the username's
+static int login_allowed(const char *username, const char *source) {
+    if (!user_limiter) {
+        user_limiter = ratelimit_create(AUTH_LIMIT_SLOTS, AUTH_USER_BURST, AUTH_USER_PER_SECOND);
+        source_limiter = ratelimit_create(AUTH_LIMIT_SLOTS, AUTH_SOURCE_BURST, AUTH_SOURCE_PER_SECOND);
+        if (!user_limiter || !source_limiter) {
+            ratelimit_free(user_limiter);
+            ratelimit_free(source_limiter);
+            user_limiter = source_limiter = NULL;
+            return 0;
+        }
+    }
+    
+    uint64_t now = metrics_now_ns();
+    if (!ratelimit_take(source_limiter, source, now)) {
+        METRICS_COUNT("auth_throttled_source", 1);
+        fprintf(stderr, "Too many login attempts from %s, try again later\n", source);
+        return 0;
+    }
+    if (!ratelimit_take(user_limiter, username, now)) {
+        METRICS_COUNT("auth_throttled_user", 1);
+        fprintf(stderr, "Too many login attempts for %s, try again later\n", username);
+        return 0;
+    }
+    return 1;
+}
+
+void auth_reset_limits() {
+    if (user_limiter) ratelimit_reset(user_limiter);
+    if (source_limiter) ratelimit_reset(source_limiter);
 }
 
 User* auth_login(const char *username, const char *password) {
+    return auth_login_from(username, password, AUTH_LOCAL_SOURCE);
+}
+
+User* auth_login_from(const char *username, const char *password, const char *source) {
+    METRICS_FUNC();
+    METRICS_COUNT("auth_attempts", 1);
+    if (!login_allowed(username, source ? source : AUTH_LOCAL_SOURCE)) {
+        return NULL;
+    }
+    
     User *user = db_get_user_by_username(username);
     if (!user) {
+        verify_dummy(password);
+        METRICS_COUNT("auth_failed", 1);
         return NULL;
     }
     
-    // Simple password verification (for testing only)
-    if (strcmp(password, user->password_hash) != 0) {
+    if (strncmp(user->password_hash, HASH_PREFIX, strlen(HASH_PREFIX)) != 0) {
+        verify_dummy(password);
+    }
+    if (!auth_verify_password(password, user->password_hash)) {
+        METRICS_COUNT("auth_failed", 1);
         db_free_user(user);
         return NULL;
     }
+    upgrade_hash(user, password);
     
     auth_start_session(user);
     return user;
 }
 
+User* auth_login_token(const char *token) {
+    TokenSlot *entry = find_token(token);
+    if (!entry) return NULL;
+    
+    User *user = malloc(sizeof(User));
+    if (!user) return NULL;
+    *user = entry->user;
+    
+    current_user = user;
+    session_capabilities = auth_role_capabilities(user->role);
+    snprintf(session_token, sizeof(session_token), "%s", token);
+    return user;
+}
+
+const char* auth_session_token() {
+    return session_token[0] ? session_token : NULL;
+}
+
+void auth_revoke_token(const char *token) {
+    TokenSlot *entry = find_token(token);
+    if (entry) entry->live = 0;
+}
+
+void auth_revoke_user(int user_id) {
+    for (int i = 0; i < AUTH_TOKEN_SLOTS; i++) {
+        if (token_slots[i].live && token_slots[i].user.id == user_id) {
+            token_slots[i].live = 0;
+        }
+    }
+}
+
 void auth_logout(User *user) {
     auth_end_session();
     if (user) {
@@ -40,6 +312,33 @@ void auth_logout(User *user) {
     }
 }
 
+Capabilities auth_role_capabilities(UserRole role) {
+    return (int)role >= 0 && (int)role < ROLE_COUNT ? role_capabilities[role] : 0;
+}
+
+const char* auth_role_name(UserRole role) {
+    return (int)role >= 0 && (int)role < ROLE_COUNT ? role_names[role] : "unknown";
+}
+
+int auth_parse_role(const char *name) {
+    for (int i = 0; name && i < ROLE_COUNT; i++) {
+        if (strcmp(role_names[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+int auth_can(Capabilities required) {
+    return (session_capabilities & required) == required;
+}
+
+Capabilities auth_capabilities() {
+    return session_capabilities;
+}
+
+void auth_set_capabilities(Capabilities capabilities) {
+    session_capabilities = capabilities;
+}
+
 int auth_check_permission(const User *user, UserRole required_role) {
     if (!user) return 0;
     if (user->role == ROLE_ADMIN) return 1; // Admin has all permissions
@@ -48,10 +347,19 @@ int auth_check_permission(const User *user, UserRole required_role) {
 
 void auth_start_session(User *user) {
     current_user = user;
+    session_capabilities = user ? auth_role_capabilities(user->role) : 0;
+    if (!user || issue_token(user, session_token) != 0) {
+        session_token[0] = '\0';
+    }
 }
 
 void auth_end_session() {
+    if (session_token[0]) {
+        auth_revoke_token(session_token);
+        session_token[0] = '\0';
+    }
     current_user = NULL;
+    session_capabilities = 0;
 }
 
 User* auth_get_current_user() {
@@ -0,0 +1,710 @@
+#include "cli.h"
+#include "database.h"
+#include "auth.h"
+#include "deals.h"
+#include "metrics.h"
+#include "snapshot.h"
+#include "journal.h"
+#include "feed.h"
+#include "reservations.h"
+#include "search.h"
+#include "scheduler.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+// Parsed command line: the command name and its key=value arguments
+typedef struct {
+    const char *command;
+    const char *positional;  // first argument without '=', e.g. a report name
+    int count;
+    const char *keys[CLI_MAX_ARGS];
+    const char *values[CLI_MAX_ARGS];
+    char storage[CLI_MAX_LINE];
+} CliArgs;
+
+typedef struct {
+    const char *name;
+    const char *usage;
+    Capabilities required;
+    int (*run)(const CliArgs *args);
+} CliCommand;
+
+static int cli_parse_args(int argc, char *argv[], CliArgs *args) {
+    args->command = argv[0];
+    args->positional = NULL;
+    args->count = 0;
+    
+    size_t used = 0;
+    for (int i = 1; i < argc; i++) {
+        const char *eq = strchr(argv[i], '=');
+        if (!eq) {
+            if (args->positional) {
+                fprintf(stderr, "%s: unexpected argument '%s'\n", args->command, argv[i]);
+                return -1;
+            }
+            args->positional = argv[i];
+            continue;
+        }
+        
+        size_t key_length = (size_t)(eq - argv[i]);
+        if (args->count == CLI_MAX_ARGS || used + key_length + 1 > sizeof(args->storage)) {
+            fprintf(stderr, "%s: too many arguments\n", args->command);
+            return -1;
+        }
+        memcpy(args->storage + used, argv[i], key_length);
+        args->storage[used + key_length] = '\0';
+        args->keys[args->count] = args->storage + used;
+        args->values[args->count] = eq + 1;
+        args->count++;
+        used += key_length + 1;
+    }
+    return 0;
+}
+
+static const char* cli_arg(const CliArgs *args, const char *key) {
+    for (int i = 0; i < args->count; i++) {
+        if (strcmp(args->keys[i], key) == 0) {
+            return args->values[i];
+        }
+    }
+    return NULL;
+}
+
+static const char* cli_require(const CliArgs *args, const char *key) {
+    const char *value = cli_arg(args, key);
+    if (!value || !*value) {
+        fprintf(stderr, "%s: missing %s=\n", args->command, key);
+        return NULL;
+    }
+    return value;
+}
+
+// Integer argument; returns -1 if it is missing (when required) or malformed
+static int cli_int(const CliArgs *args, const char *key, int required, int *out) {
+    const char *value = required ? cli_require(args, key) : cli_arg(args, key);
+    if (!value) return required ? -1 : 0;
+    
+    char *end;
+    errno = 0;
+    long number = strtol(value, &end, 10);
+    if (errno != 0 || *value == '\0' || *end != '\0') {
+        fprintf(stderr, "%s: %s= must be an integer\n", args->command, key);
+        return -1;
+    }
+    *out = (int)number;
+    return 0;
+}
+
+static int cli_double(const CliArgs *args, const char *key, double *out) {
+    const char *value = cli_require(args, key);
+    if (!value) return -1;
+    
+    char *end;
+    double number = strtod(value, &end);
+    if (*end != '\0') {
+        fprintf(stderr, "%s: %s= must be a number\n", args->command, key);
+        return -1;
+    }
+    *out = number;
+    return 0;
+}
+
+// Copies a required text argument into a fixed-size field
+static int cli_text(const CliArgs *args, const char *key, char *buffer, size_t size) {
+    const char *value = cli_require(args, key);
+    if (!value) return -1;
+    snprintf(buffer, size, "%s", value);
+    return 0;
+}
+
+// Commands
+
+static int cmd_add_good(const CliArgs *args) {
+    Good good = {0};
+    if (cli_text(args, "name", good.name, sizeof(good.name)) != 0 ||
+        cli_text(args, "type", good.type, sizeof(good.type)) != 0 ||
+        cli_double(args, "price", &good.unit_price) != 0 ||
+        cli_int(args, "quantity", 1, &good.quantity) != 0) {
+        return -1;
+    }
+    const char *supplier = cli_arg(args, "supplier");
+    const char *expiry = cli_arg(args, "expiry");
+    snprintf(good.supplier, sizeof(good.supplier), "%s", supplier ? supplier : "");
+    snprintf(good.expiry_date, sizeof(good.expiry_date), "%s", expiry ? expiry : "");
+    
+    int good_id = db_create_good(&good);
+    if (good_id <= 0) {
+        fprintf(stderr, "add-good: failed to add good\n");
+        return -1;
+    }
+    printf("good_id=%d\n", good_id);
+    return 0;
+}
+
+static int cmd_add_makler(const CliArgs *args) {
+    Makler makler = {0};
+    User user = {0};
+    const char *password = NULL;
+    
+    if (cli_text(args, "name", makler.name, sizeof(makler.name)) != 0 ||
+        cli_text(args, "username", user.username, sizeof(user.username)) != 0 ||
+        !(password = cli_require(args, "password")) ||
+        cli_int(args, "birth-year", 0, &makler.birth_year) != 0) {
+        return -1;
+    }
+    const char *address = cli_arg(args, "address");
+    snprintf(makler.address, sizeof(makler.address), "%s", address ? address : "");
+    
+    char *hash = auth_hash_password(password);
+    if (!hash) return -1;
+    snprintf(user.password_hash, sizeof(user.password_hash), "%s", hash);
+    free(hash);
+    user.role = ROLE_MAKLER;
+    
+    // User and makler rows are created together or not at all
+    if (db_begin_transaction() != 0) return -1;
+    
+    makler.user_id = db_create_user(&user);
+    int makler_id = makler.user_id > 0 ? db_create_makler(&makler) : -1;
+    if (makler_id <= 0) {
+        db_rollback_transaction();
+        fprintf(stderr, "add-makler: failed to add makler\n");
+        return -1;
+    }
+    if (db_commit_transaction() != 0) {
+        db_rollback_transaction();
+        return -1;
+    }
+    
+    printf("makler_id=%d\n", makler_id);
+    return 0;
+}
+
+static int cmd_add_user(const CliArgs *args) {
+    User user = {0};
+    const char *password = NULL;
+    const char *role_name = NULL;
+    
+    if (cli_text(args, "username", user.username, sizeof(user.username)) != 0 ||
+        !(password = cli_require(args, "password")) ||
+        !(role_name = cli_require(args, "role"))) {
+        return -1;
+    }
+    int role = auth_parse_role(role_name);
+    if (role < 0) {
+        fprintf(stderr, "add-user: unknown role '%s'\n", role_name);
+        return -1;
+    }
+    user.role = (UserRole)role;
+    
+    char *hash = auth_hash_password(password);
+    if (!hash) return -1;
+    snprintf(user.password_hash, sizeof(user.password_hash), "%s", hash);
+    free(hash);
+    
+    int user_id = db_create_user(&user);
+    if (user_id <= 0) {
+        fprintf(stderr, "add-user: failed to add user\n");
+        return -1;
+    }
+    printf("user_id=%d\n", user_id);
+    return 0;
+}
+
+static int cmd_create_deal(const CliArgs *args) {
+    int good_id, quantity, makler_id;
+    const char *buyer;
+    if (cli_int(args, "good", 1, &good_id) != 0 ||
+        cli_int(args, "quantity", 1, &quantity) != 0 ||
+        cli_int(args, "makler", 1, &makler_id) != 0 ||
+        !(buyer = cli_require(args, "buyer"))) {
+        return -1;
+    }
+    if (quantity <= 0) {
+        fprintf(stderr, "create-deal: quantity= must be positive\n");
+        return -1;
+    }
+    
+    char buyer_name[100];
+    snprintf(buyer_name, sizeof(buyer_name), "%s", buyer);
+    
+    int deal_id = deals_create_deal(good_id, quantity, buyer_name, makler_id);
+    if (deal_id <= 0) {
+        fprintf(stderr, "create-deal: failed to create deal (good %d, quantity %d)\n", good_id, quantity);
+        return -1;
+    }
+    printf("deal_id=%d\n", deal_id);
+    return 0;
+}
+
+static int cmd_hold(const CliArgs *args) {
+    int good_id, quantity, makler_id, ttl = RESERVATION_DEFAULT_TTL_SECONDS;
+    if (cli_int(args, "good", 1, &good_id) != 0 ||
+        cli_int(args, "quantity", 1, &quantity) != 0 ||
+        cli_int(args, "makler", 1, &makler_id) != 0 ||
+        cli_int(args, "ttl", 0, &ttl) != 0) {
+        return -1;
+    }
+    
+    int hold_id = reservations_hold(good_id, quantity, makler_id, ttl);
+    if (hold_id < 0) {
+        fprintf(stderr, "hold: not enough unreserved stock of good %d\n", good_id);
+        return -1;
+    }
+    printf("hold_id=%d\n", hold_id);
+    return 0;
+}
+
+static int cmd_confirm(const CliArgs *args) {
+    int hold_id;
+    char buyer[100];
+    if (cli_int(args, "hold", 1, &hold_id) != 0 ||
+        cli_text(args, "buyer", buyer, sizeof(buyer)) != 0) {
+        return -1;
+    }
+    
+    int deal_id = reservations_confirm(hold_id, buyer);
+    if (deal_id < 0) {
+        fprintf(stderr, "confirm: hold %d was not turned into a deal\n", hold_id);
+        return -1;
+    }
+    printf("deal_id=%d\n", deal_id);
+    return 0;
+}
+
+static int cmd_release(const CliArgs *args) {
+    int hold_id;
+    if (cli_int(args, "hold", 1, &hold_id) != 0) return -1;
+    if (reservations_release(hold_id) != 0) {
+        fprintf(stderr, "release: hold %d doesn't exist or has expired\n", hold_id);
+        return -1;
+    }
+    return 0;
+}
+
+static int cmd_update_stock(const CliArgs *args) {
+    const char *date = cli_require(args, "date");
+    if (!date) return -1;
+    reports_update_stock(date);
+    return 0;
+}
+
+static int cmd_report(const CliArgs *args) {
+    if (!args->positional) {
+        fprintf(stderr, "report: missing report name\n");
+        reports_print_catalog(stderr);
+        return -1;
+    }
+    
+    ReportParams params = {0};
+    params.start_date = cli_arg(args, "from");
+    params.end_date = cli_arg(args, "to");
+    params.date = cli_arg(args, "date");
+    params.good_name = cli_arg(args, "good");
+    if (cli_int(args, "makler", 0, &params.makler_id) != 0) return -1;
+    params.by = cli_arg(args, "by");
+    params.metric = cli_arg(args, "metric");
+    if (cli_int(args, "limit", 0, &params.limit) != 0) return -1;
+    params.bucket = cli_arg(args, "bucket");
+    if (cli_int(args, "window", 0, &params.window) != 0) return -1;
+    params.key = cli_arg(args, "key");
+    if (cli_int(args, "deadline", 0, &params.deadline_ms) != 0) return -1;
+    
+    const char *format = cli_arg(args, "format");
+    const char *snapshot = cli_arg(args, "snapshot");
+    if (snapshot) {
+        return cli_run_snapshot_report(snapshot, args->positional, format ? format : "table",
+                                       cli_arg(args, "out"), &params);
+    }
+    return cli_run_report(args->positional, format ? format : "table", cli_arg(args, "out"), &params);
+}
+
+static int cmd_snapshot_write(const CliArgs *args) {
+    const char *path = cli_require(args, "out");
+    if (!path) return -1;
+    
+    int deals = snapshot_write(path);
+    if (deals < 0) {
+        return -1;
+    }
+    printf("snapshot=%s deals=%d\n", path, deals);
+    return 0;
+}
+
+static int cmd_journal_replay(const CliArgs *args) {
+    const char *path = cli_require(args, "in");
+    if (!path) return -1;
+    
+    JournalReplayStats stats;
+    if (journal_replay(path, &stats) != 0) {
+        fprintf(stderr, "journal-replay: replay failed, nothing was changed\n");
+        return -1;
+    }
+    printf("records=%ld deals=%ld stock_sets=%ld truncated_bytes=%ld\n",
+           stats.records, stats.deals, stats.stock_sets, stats.truncated_bytes);
+    return 0;
+}
+
+static const ReportColumn feed_columns[] = {
+    { "Seq", "seq", REPORT_COL_INT, 8 },
+    { "Deal", "deal_id", REPORT_COL_INT, 6 },
+    { "Date", "deal_date", REPORT_COL_TEXT, 19 },
+    { "Good ID", "good_id", REPORT_COL_INT, 7 },
+    { "Good", "good_name", REPORT_COL_TEXT, 20 },
+    { "Type", "good_type", REPORT_COL_TEXT, 12 },
+    { "Qty", "quantity", REPORT_COL_INT, 5 },
+    { "Amount", "total_amount", REPORT_COL_REAL, 10 },
+    { "Makler", "makler_id", REPORT_COL_INT, 6 },
+    { "Buyer", "buyer", REPORT_COL_TEXT, 0 },
+};
+
+static int feed_write_event(const FeedEvent *event, void *ctx) {
+    ReportWriter *rw = (ReportWriter *)ctx;
+    char date_str[20];
+    strftime(date_str, sizeof(date_str), "%Y-%m-%d %H:%M:%S", localtime(&event->deal.deal_date));
+    
+    report_writer_int(rw, event->seq);
+    report_writer_int(rw, event->deal.id);
+    report_writer_text(rw, date_str);
+    report_writer_int(rw, event->deal.good_id);
+    report_writer_text(rw, event->deal.good_name);
+    report_writer_text(rw, event->deal.good_type);
+    report_writer_int(rw, event->deal.quantity);
+    report_writer_real(rw, event->deal.total_amount);
+    report_writer_int(rw, event->deal.makler_id);
+    report_writer_text(rw, event->deal.buyer);
+    report_writer_end_row(rw);
+    return 0;
+}
+
+// Follow mode hands every event to the consumer as it commits
+static int feed_write_event_flushed(const FeedEvent *event, void *ctx) {
+    feed_write_event(event, ctx);
+    report_writer_flush((ReportWriter *)ctx);
+    return 0;
+}
+
+static void feed_handle_signal(int sig) {
+    (void)sig;
+    feed_stop();
+}
+
+static int cmd_feed(const CliArgs *args) {
+    long long after_seq = 0;
+    const char *from = cli_arg(args, "from");
+    if (from) {
+        char *end;
+        errno = 0;
+        after_seq = strtoll(from, &end, 10);
+        if (errno != 0 || *end != '\0' || after_seq < 0) {
+            fprintf(stderr, "feed: from must be a sequence number, got '%s'\n", from);
+            return -1;
+        }
+    }
+    
+    int limit = 0, follow = 0;
+    if (cli_int(args, "limit", 0, &limit) != 0) return -1;
+    if (cli_int(args, "follow", 0, &follow) != 0) return -1;
+    
+    const char *format_name = cli_arg(args, "format");
+    ReportFormat format;
+    if (report_format_parse(format_name ? format_name : "jsonl", &format) != 0) {
+        fprintf(stderr, "Unknown report format: %s\n", format_name);
+        return -1;
+    }
+    
+    ReportWriter *previous = reports_output();
+    report_writer_flush(previous);
+    
+    ReportWriter *rw = report_writer_create(stdout, format);
+    report_writer_begin(rw, "feed", "Deal Feed", feed_columns, REPORT_COLUMN_COUNT(feed_columns));
+    
+    long long last_seq = after_seq;
+    int rc = 0;
+    if (follow) {
+        // Runs until interrupted; a consumer that stops reading blocks us on stdout
+        void (*old_int)(int) = signal(SIGINT, feed_handle_signal);
+        void (*old_term)(int) = signal(SIGTERM, feed_handle_signal);
+        last_seq = feed_follow(after_seq, FEED_DEFAULT_BATCH, FEED_DEFAULT_POLL_MS,
+                               feed_write_event_flushed, rw);
+        signal(SIGINT, old_int);
+        signal(SIGTERM, old_term);
+        rc = last_seq < 0 ? -1 : 0;
+    } else {
+        rc = feed_read(after_seq, limit, feed_write_event, rw, &last_seq) < 0 ? -1 : 0;
+    }
+    
+    report_writer_end(rw);
+    report_writer_free(rw);
+    
+    // The cursor to resume from goes to stderr so stdout stays pure data
+    if (rc == 0) {
+        fprintf(stderr, "last_seq=%lld\n", last_seq);
+    }
+    return rc;
+}
+
+static int cmd_search(const CliArgs *args) {
+    const char *query = args->positional ? args->positional : cli_require(args, "q");
+    if (!query) return -1;
+    
+    int kinds = SEARCH_ALL, limit = SEARCH_DEFAULT_RESULTS;
+    const char *kind = cli_arg(args, "kind");
+    if (kind && search_kind_parse(kind, &kinds) != 0) {
+        fprintf(stderr, "search: kind must be good, buyer, supplier or all\n");
+        return -1;
+    }
+    if (cli_int(args, "limit", 0, &limit) != 0) return -1;
+    if (limit < 1 || limit > SEARCH_MAX_RESULTS) {
+        fprintf(stderr, "search: limit must be between 1 and %d\n", SEARCH_MAX_RESULTS);
+        return -1;
+    }
+    
+    reports_search(query, kinds, limit);
+    return 0;
+}
+
+static int cmd_stats(const CliArgs *args) {
+    int makler_id = 0;
+    if (cli_int(args, "makler", 0, &makler_id) != 0) return -1;
+    
+    if (makler_id > 0) {
+        stats_show_makler_stats(makler_id);
+    } else {
+        stats_show_all_stats();
+    }
+    return 0;
+}
+
+static int cmd_list_goods(const CliArgs *args) {
+    (void)args;
+    reports_goods();
+    return 0;
+}
+
+static int cmd_list_deals(const CliArgs *args) {
+    reports_deals_by_period(cli_arg(args, "from"), cli_arg(args, "to"));
+    return 0;
+}
+
+static int cmd_metrics(const CliArgs *args) {
+    (void)args;
+    metrics_dump(stdout);
+    return 0;
+}
+
+static const CliCommand commands[] = {
+    { "add-good",     "name= type= price= quantity= [supplier=] [expiry=YYYY-MM-DD]", CAP_MANAGE_GOODS,   cmd_add_good },
+    { "add-makler",   "name= username= password= [address=] [birth-year=]",          CAP_MANAGE_USERS,   cmd_add_makler },
+    { "add-user",     "username= password= role=admin|makler|analyst",               CAP_MANAGE_USERS,   cmd_add_user },
+    { "create-deal",  "good=ID quantity=N buyer= makler=ID",                         CAP_CREATE_DEAL,    cmd_create_deal },
+    { "hold",         "good=ID quantity=N makler=ID [ttl=SECONDS]",                  CAP_CREATE_DEAL,    cmd_hold },
+    { "confirm",      "hold=ID buyer=",                                              CAP_CREATE_DEAL,    cmd_confirm },
+    { "release",      "hold=ID",                                                     CAP_CREATE_DEAL,    cmd_release },
+    { "update-stock", "date=YYYY-MM-DD",                                             CAP_MANAGE_GOODS,   cmd_update_stock },
+    { "report",       "NAME [from=] [to=] [date=] [good=] [makler=] [by=] [metric=] [limit=] [bucket=] [window=] [key=] [deadline=MS] [format=] [out=] [snapshot=]", CAP_RUN_REPORTS, cmd_report },
+    { "snapshot-write", "out=FILE",                                                  CAP_RUN_REPORTS,    cmd_snapshot_write },
+    { "journal-replay", "in=FILE",                                                   CAP_MANAGE_DATA,    cmd_journal_replay },
+    { "feed",         "[from=SEQ] [limit=N] [follow=1] [format=jsonl]",              CAP_VIEW_ALL_DEALS, cmd_feed },
+    { "search",       "TEXT|q= [kind=good|buyer|supplier] [limit=N]",                CAP_VIEW_GOODS,     cmd_search },
+    { "stats",        "[makler=ID]",                                                 CAP_RUN_REPORTS,    cmd_stats },
+    { "list-goods",   "",                                                            CAP_VIEW_GOODS,     cmd_list_goods },
+    { "list-deals",   "[from=YYYY-MM-DD] [to=YYYY-MM-DD]",                           CAP_VIEW_ALL_DEALS, cmd_list_deals },
+    { "metrics",      "",                                                            CAP_VIEW_METRICS,   cmd_metrics },
+};
+
+int cli_run_command(int argc, char *argv[]) {
+    METRICS_FUNC();
+    metrics_poll();
+    if (argc < 1) return -1;
+    
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (strcmp(commands[i].name, argv[0]) == 0) {
+            CliArgs args;
+            if (cli_parse_args(argc, argv, &args) != 0) {
+                return -1;
+            }
+            if (!auth_can(commands[i].required)) {
+                fprintf(stderr, "%s: permission denied\n", argv[0]);
+                return -1;
+            }
+            return commands[i].run(&args);
+        }
+    }
+    
+    fprintf(stderr, "Unknown command: %s\n", argv[0]);
+    cli_print_commands(stderr);
+    return -1;
+}
+
+int cli_split_line(char *line, char *argv[], int max_args) {
+    int argc = 0;
+    char *read = line;
+    
+    while (*read) {
+        while (*read == ' ' || *read == '\t' || *read == '\r' || *read == '\n') {
+            read++;
+        }
+        if (*read == '\0' || *read == '#') break;
+        if (argc == max_args) return -1;
+        
+        // Unquote in place: the argument never grows, so writing trails reading
+        char *write = read;
+        argv[argc++] = write;
+        int quoted = 0;
+        while (*read && (quoted || (*read != ' ' && *read != '\t' && *read != '\r' && *read != '\n'))) {
+            if (*read == '"') {
+                quoted = !quoted;
+                read++;
+            } else if (*read == '\\' && quoted && read[1]) {
+                *write++ = read[1];
+                read += 2;
+            } else {
+                *write++ = *read++;
+            }
+        }
+        if (quoted) return -1;
+        if (*read) read++;
+        *write = '\0';
+    }
+    return argc;
+}
+
+int cli_run_script(const char *path) {
+    METRICS_FUNC();
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!in) {
+        fprintf(stderr, "Can't open script: %s\n", path);
+        return -1;
+    }
+    
+    int rc = db_begin_transaction();
+    char line[CLI_MAX_LINE];
+    int line_number = 0;
+    int executed = 0;
+    
+    while (rc == 0 && fgets(line, sizeof(line), in)) {
+        line_number++;
+        if (!strchr(line, '\n') && !feof(in)) {
+            fprintf(stderr, "%s:%d: line too long\n", path, line_number);
+            rc = -1;
+            break;
+        }
+        
+        char *argv[CLI_MAX_ARGS + 1];
+        int argc = cli_split_line(line, argv, CLI_MAX_ARGS + 1);
+        if (argc < 0) {
+            fprintf(stderr, "%s:%d: unterminated quote or too many arguments\n", path, line_number);
+            rc = -1;
+        } else if (argc > 0) {
+            rc = cli_run_command(argc, argv);
+            if (rc != 0) {
+                fprintf(stderr, "%s:%d: %s failed\n", path, line_number, argv[0]);
+            }
+            executed++;
+        }
+    }
+    
+    if (in != stdin) {
+        fclose(in);
+    }
+    
+    if (rc == 0) {
+        rc = db_commit_transaction();
+    }
+    if (rc != 0) {
+        if (db_transaction_depth() > 0) {
+            db_rollback_transaction();
+        }
+        fprintf(stderr, "Script rolled back, nothing was changed\n");
+        return -1;
+    }
+    
+    fprintf(stderr, "%d commands executed\n", executed);
+    return 0;
+}
+
+// Time-boxed: the report runs as a scheduler task and is stopped at its
+// deadline, keeping the rows written so far. -2 when it didn't finish.
+static int run_scheduled_report(const char *name, ReportWriter *rw, const ReportParams *params) {
+    int task = scheduler_submit_report(name, params, rw, params->deadline_ms);
+    if (task < 0) return -1;
+    if (scheduler_run_all() < 0) return -2;
+    
+    TaskState state = scheduler_state(task);
+    if (state == TASK_TIMED_OUT) {
+        report_writer_flush(rw);
+        fprintf(stderr, "%s: stopped at its %d ms deadline\n", name, params->deadline_ms);
+    }
+    return state == TASK_DONE ? 0 : -2;
+}
+
+// Runs a report against the live database, or the snapshot when one is given
+static int run_report(const Snapshot *snap, const char *name, const char *format_name,
+                      const char *out_path, const ReportParams *params) {
+    if (!auth_can(CAP_RUN_REPORTS)) {
+        fprintf(stderr, "%s: permission denied\n", name);
+        return -1;
+    }
+    ReportFormat format;
+    if (report_format_parse(format_name, &format) != 0) {
+        fprintf(stderr, "Unknown report format: %s\n", format_name);
+        return -1;
+    }
+    
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Can't open output file: %s\n", out_path);
+        return -1;
+    }
+    
+    ReportWriter *previous = reports_output();
+    report_writer_flush(previous);
+    
+    ReportWriter *rw = report_writer_create(out, format);
+    reports_set_output(rw);
+    int rc;
+    if (snap) {
+        rc = snapshot_run_report(snap, name, params);
+    } else if (params->deadline_ms > 0) {
+        rc = run_scheduled_report(name, rw, params);
+    } else {
+        rc = reports_run(name, params);
+    }
+    reports_set_output(previous);
+    report_writer_free(rw);
+    
+    if (out != stdout) {
+        fclose(out);
+    }
+    if (rc == -1) {
+        reports_print_catalog(stderr);
+    }
+    return rc == 0 ? 0 : -1;
+}
+
+int cli_run_report(const char *name, const char *format_name, const char *out_path,
+                   const ReportParams *params) {
+    return run_report(NULL, name, format_name, out_path, params);
+}
+
+int cli_run_snapshot_report(const char *snapshot_path, const char *name, const char *format_name,
+                            const char *out_path, const ReportParams *params) {
+    Snapshot *snap = snapshot_open(snapshot_path);
+    if (!snap) {
+        return -1;
+    }
+    int rc = run_report(snap, name, format_name, out_path, params);
+    snapshot_close(snap);
+    return rc;
+}
+
+void cli_print_commands(FILE *out) {
+    fprintf(out, "Commands:\n");
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        fprintf(out, "  %-14s %s\n", commands[i].name, commands[i].usage);
+    }
+}
@@ -1,14 +1,302 @@
 #include "database.h"
+#include "metrics.h"
+#include "slowlog.h"
+#include "journal.h"
+#include "hll.h"
+#include "statstore.h"
+#include "auth.h"
+#include "scheduler.h"
+#include "report_cache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 static sqlite3 *db = NULL;
+static int transaction_depth = 0;
 
-int db_init(const char *db_path) {
-    int rc = sqlite3_open(db_path, &db);
+// Journal buffer position at the start of each savepoint
+#define MAX_TRANSACTION_DEPTH 32
+static size_t journal_marks[MAX_TRANSACTION_DEPTH];
+static size_t statstore_marks[MAX_TRANSACTION_DEPTH];
+
+// Goods read by the deal path, by id. Entries are used without being
+// re-read: db_create_deal_if_version compares the version on commit and
+// the caller refreshes on DB_CONFLICT. Committed changes only ever raise
+// versions, but a rollback lowers them again, so it empties the cache by
+// starting a new epoch.
+#define GOOD_CACHE_SIZE 256
+static Good good_cache[GOOD_CACHE_SIZE];
+static unsigned good_cache_epochs[GOOD_CACHE_SIZE];
+static unsigned good_cache_epoch = 1;
+
+// SQLITE_BUSY results from steps, BEGIN and COMMIT on this connection
+static uint64_t busy_count = 0;
+
+// 1 if the table has the column, 0 if not (or there is no such table)
+static int db_has_column(const char *table, const char *column) {
+    sqlite3_stmt *stmt;
+    if (db_prepare("SELECT 1 FROM pragma_table_info(?) WHERE name = ?;", &stmt) != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, column, -1, SQLITE_STATIC);
+    int exists = db_step(stmt) == SQLITE_ROW;
+    db_finalize(stmt);
+    return exists;
+}
+
+// Adds a column to a table created by an older version of the schema
+static int db_ensure_column(const char *table, const char *column, const char *definition) {
+    int exists = db_has_column(table, column);
+    if (exists != 0) return exists < 0 ? -1 : 0;
+    
+    char sql[256];
+    snprintf(sql, sizeof(sql), "ALTER TABLE %s ADD COLUMN %s %s;", table, column, definition);
+    char *err_msg = 0;
+    if (sqlite3_exec(db, sql, 0, 0, &err_msg) != SQLITE_OK) {
+        fprintf(stderr, "SQL error: %s\n", err_msg);
+        sqlite3_free(err_msg);
+        return -1;
+    }
+    return 0;
+}
+
+static int db_exec_all(const char **sql, size_t count) {
+    char *err_msg = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (sqlite3_exec(db, sql[i], 0, 0, &err_msg) != SQLITE_OK) {
+            fprintf(stderr, "SQL error: %s\n", err_msg);
+            sqlite3_free(err_msg);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Keeps the dimension keys of goods in step with their names wherever
+// goods are written from, and tags deals inserted without them. Runs
+// after db_ensure_column, as the triggers use the new columns.
+static int db_init_dimensions() {
+    const char *sql[] = {
+        "CREATE TRIGGER IF NOT EXISTS dimension_goods_ai AFTER INSERT ON PERFUME_GOODS BEGIN"
+        "    INSERT OR IGNORE INTO PERFUME_GOOD_TYPES (name) VALUES (NEW.type);"
+        "    INSERT OR IGNORE INTO PERFUME_SUPPLIERS (name)"
+        "    SELECT NEW.supplier WHERE COALESCE(NEW.supplier, '') <> '';"
+        "    UPDATE PERFUME_GOODS SET"
+        "        type_id = (SELECT id FROM PERFUME_GOOD_TYPES WHERE name = NEW.type),"
+        "        supplier_id = (SELECT id FROM PERFUME_SUPPLIERS WHERE name = NEW.supplier)"
+        "    WHERE id = NEW.id;"
+        " END;",
+        
+        "CREATE TRIGGER IF NOT EXISTS dimension_goods_au AFTER UPDATE OF type, supplier ON PERFUME_GOODS BEGIN"
+        "    INSERT OR IGNORE INTO PERFUME_GOOD_TYPES (name) VALUES (NEW.type);"
+        "    INSERT OR IGNORE INTO PERFUME_SUPPLIERS (name)"
+        "    SELECT NEW.supplier WHERE COALESCE(NEW.supplier, '') <> '';"
+        "    UPDATE PERFUME_GOODS SET"
+        "        type_id = (SELECT id FROM PERFUME_GOOD_TYPES WHERE name = NEW.type),"
+        "        supplier_id = (SELECT id FROM PERFUME_SUPPLIERS WHERE name = NEW.supplier)"
+        "    WHERE id = NEW.id;"
+        " END;",
+        
+        // db_create_deal tags deals itself; this catches other inserts
+        "CREATE TRIGGER IF NOT EXISTS dimension_deals_ai AFTER INSERT ON PERFUME_DEALS "
+        "WHEN NEW.type_id IS NULL BEGIN"
+        "    INSERT OR IGNORE INTO PERFUME_GOOD_TYPES (name) VALUES (NEW.good_type);"
+        "    UPDATE PERFUME_DEALS SET"
+        "        type_id = (SELECT id FROM PERFUME_GOOD_TYPES WHERE name = NEW.good_type),"
+        "        supplier_id = (SELECT supplier_id FROM PERFUME_GOODS WHERE id = NEW.good_id)"
+        "    WHERE id = NEW.id;"
+        " END;"
+    };
+    if (db_exec_all(sql, sizeof(sql) / sizeof(sql[0])) != 0) {
+        return -1;
+    }
+    
+    // Backfill once for databases created before the dimensions existed
+    // (or filled without the triggers): deals go by their good's current
+    // supplier, the best guess there is
+    sqlite3_stmt *stmt;
+    if (db_prepare("SELECT 1 FROM PERFUME_GOOD_TYPES LIMIT 1;", &stmt) != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    int filled = db_step(stmt) == SQLITE_ROW;
+    db_finalize(stmt);
+    if (filled) return 0;
+    
+    const char *backfill[] = {
+        "BEGIN;",
+        
+        "INSERT OR IGNORE INTO PERFUME_GOOD_TYPES (name) "
+        "SELECT type FROM PERFUME_GOODS UNION SELECT good_type FROM PERFUME_DEALS ORDER BY 1;",
+        
+        "INSERT OR IGNORE INTO PERFUME_SUPPLIERS (name) "
+        "SELECT DISTINCT supplier FROM PERFUME_GOODS WHERE COALESCE(supplier, '') <> '' ORDER BY 1;",
+        
+        "UPDATE PERFUME_GOODS SET"
+        "    type_id = (SELECT id FROM PERFUME_GOOD_TYPES t WHERE t.name = type),"
+        "    supplier_id = (SELECT id FROM PERFUME_SUPPLIERS s WHERE s.name = supplier);",
+        
+        "UPDATE PERFUME_DEALS SET"
+        "    type_id = (SELECT id FROM PERFUME_GOOD_TYPES t WHERE t.name = good_type),"
+        "    supplier_id = (SELECT g.supplier_id FROM PERFUME_GOODS g WHERE g.id = good_id);",
+        
+        "COMMIT;"
+    };
+    if (db_exec_all(backfill, sizeof(backfill) / sizeof(backfill[0])) != 0) {
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        return -1;
+    }
+    return 0;
+}
+
+// Aggregates grouped by the supplier and type deals were tagged with at
+// commit, so a good changing supplier doesn't move its past sales. Runs
+// after db_init_dimensions, whose backfill the rollups are built from.
+static int db_init_rollups() {
+    // Rollups keyed without the dimensions are derived data: rebuild them
+    int current = db_has_column("PERFUME_DAILY_SALES", "supplier_id");
+    if (current < 0 ||
+        (!current && sqlite3_exec(db, "DROP TABLE IF EXISTS PERFUME_DAILY_SALES;", NULL, NULL, NULL) != SQLITE_OK)) {
+        fprintf(stderr, "Can't rebuild the daily rollup: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    
+    const char *sql[] = {
+        // Daily rollup kept by the deal path and rebuilt by journal replay;
+        // it keeps the history that reports_update_stock deletes. Supplier
+        // 0 is a good without one.
+        "CREATE TABLE IF NOT EXISTS PERFUME_DAILY_SALES ("
+        "    day DATE NOT NULL,"
+        "    good_id INTEGER NOT NULL,"
+        "    makler_id INTEGER NOT NULL,"
+        "    supplier_id INTEGER NOT NULL DEFAULT 0,"
+        "    type_id INTEGER NOT NULL DEFAULT 0,"
+        "    deal_count INTEGER NOT NULL DEFAULT 0,"
+        "    total_quantity INTEGER NOT NULL DEFAULT 0,"
+        "    total_amount DECIMAL(12,2) NOT NULL DEFAULT 0,"
+        "    PRIMARY KEY (day, good_id, makler_id, supplier_id, type_id)"
+        ");",
+        
+        // Backfill once for databases created before the rollup existed
+        "INSERT INTO PERFUME_DAILY_SALES (day, good_id, makler_id, supplier_id, type_id, "
+        "deal_count, total_quantity, total_amount) "
+        "SELECT date(deal_date), good_id, makler_id, COALESCE(supplier_id, 0), COALESCE(type_id, 0), "
+        "COUNT(*), SUM(quantity), SUM(total_amount) "
+        "FROM PERFUME_DEALS "
+        "WHERE NOT EXISTS (SELECT 1 FROM PERFUME_DAILY_SALES) "
+        "GROUP BY 1, 2, 3, 4, 5;",
+        
+        "INSERT INTO PERFUME_BUYER_SKETCHES (dimension, key, day, sketch) "
+        "SELECT 'type', good_type, date(deal_date), hll_sketch(buyer) FROM PERFUME_DEALS "
+        "WHERE NOT EXISTS (SELECT 1 FROM PERFUME_BUYER_SKETCHES) GROUP BY 2, 3 "
+        "UNION ALL SELECT 'makler', makler_id, date(deal_date), hll_sketch(buyer) FROM PERFUME_DEALS "
+        "WHERE NOT EXISTS (SELECT 1 FROM PERFUME_BUYER_SKETCHES) GROUP BY 2, 3 "
+        "UNION ALL SELECT 'supplier', s.name, date(d.deal_date), hll_sketch(d.buyer) "
+        "FROM PERFUME_DEALS d JOIN PERFUME_SUPPLIERS s ON s.id = d.supplier_id "
+        "WHERE NOT EXISTS (SELECT 1 FROM PERFUME_BUYER_SKETCHES) "
+        "GROUP BY 2, 3;"
+    };
+    return db_exec_all(sql, sizeof(sql) / sizeof(sql[0]));
+}
+
+// Name the in-memory database was opened under, for db_open_connection
+static char memory_uri[128];
+
+static int db_open(const char *path, int flags) {
+    int rc = sqlite3_open_v2(path, &db, flags, NULL);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        db = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static int db_setup();
+
+int db_init(const char *db_path) {
+    METRICS_FUNC();
+    if (db_open(db_path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) != 0) {
+        return -1;
+    }
+    return db_setup();
+}
+
+// Replaces the contents of the open database with the template's
+static int db_load_template(const char *template_path) {
+    sqlite3 *source;
+    if (sqlite3_open_v2(template_path, &source, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Can't open template: %s\n", sqlite3_errmsg(source));
+        sqlite3_close(source);
+        return -1;
+    }
+    
+    sqlite3_backup *backup = sqlite3_backup_init(db, "main", source, "main");
+    int rc = backup ? sqlite3_backup_step(backup, -1) : sqlite3_errcode(db);
+    if (backup) sqlite3_backup_finish(backup);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Can't copy template %s: %s\n", template_path, sqlite3_errstr(rc));
+        sqlite3_close(source);
+        return -1;
+    }
+    sqlite3_close(source);
+    return 0;
+}
+
+int db_init_memory(const char *name, const char *template_path) {
+    METRICS_FUNC();
+    memory_uri[0] = '\0';
+    if (name) {
+        snprintf(memory_uri, sizeof(memory_uri), "file:%s?mode=memory&cache=shared", name);
+    }
+    
+    if (db_open(name ? memory_uri : ":memory:",
+                SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI) != 0) {
+        memory_uri[0] = '\0';
+        return -1;
+    }
+    if (template_path && db_load_template(template_path) != 0) {
+        db_close();
+        return -1;
+    }
+    return db_setup();
+}
+
+int db_save_template(const char *path) {
+    METRICS_FUNC();
+    if (!db) return -1;
+    
+    // VACUUM INTO refuses to overwrite
+    remove(path);
+    sqlite3_stmt *stmt;
+    if (db_prepare("VACUUM INTO ?;", &stmt) != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+    int rc = db_step(stmt);
+    db_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Can't write template %s: %s\n", path, sqlite3_errmsg(db));
+        return -1;
+    }
+    return 0;
+}
+
+// Schema and per-connection state for a freshly opened database
+static int db_setup() {
+    // Statistics held for a previous connection don't apply to this one
+    statstore_reset();
+    
+    // Readers keep their snapshot without blocking writers, and the other
+    // way round. In-memory databases answer "memory" and stay as they are.
+    sqlite3_exec(db, "PRAGMA journal_mode=WAL;", NULL, NULL, NULL);
+    
+    // Sketch functions are used by the schema backfill below
+    if (hll_register_sql(db) != 0) {
         return -1;
     }
     
@@ -28,6 +316,7 @@ int db_init(const char *db_path) {
         "    address VARCHAR(200),"
         "    birth_year INTEGER,"
         "    user_id INTEGER,"
+        "    version INTEGER NOT NULL DEFAULT 0,"
         "    FOREIGN KEY (user_id) REFERENCES PERFUME_USERS(id)"
         ");",
         
@@ -39,7 +328,25 @@ int db_init(const char *db_path) {
         "    supplier VARCHAR(100),"
         "    expiry_date DATE,"
         "    quantity INTEGER NOT NULL DEFAULT 0,"
-        "    created_at DATETIME DEFAULT CURRENT_TIMESTAMP"
+        "    created_at DATETIME DEFAULT CURRENT_TIMESTAMP,"
+        "    version INTEGER NOT NULL DEFAULT 0,"
+        "    supplier_id INTEGER,"
+        "    type_id INTEGER,"
+        "    FOREIGN KEY (supplier_id) REFERENCES PERFUME_SUPPLIERS(id),"
+        "    FOREIGN KEY (type_id) REFERENCES PERFUME_GOOD_TYPES(id)"
+        ");",
+        
+        // Dimensions: one row per supplier and good type name. Goods point
+        // at them, and deals are tagged with the good's at commit, so
+        // reports group deals on integers without reading the goods.
+        "CREATE TABLE IF NOT EXISTS PERFUME_SUPPLIERS ("
+        "    id INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "    name VARCHAR(100) NOT NULL UNIQUE"
+        ");",
+        
+        "CREATE TABLE IF NOT EXISTS PERFUME_GOOD_TYPES ("
+        "    id INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "    name VARCHAR(50) NOT NULL UNIQUE"
         ");",
         
         "CREATE TABLE IF NOT EXISTS PERFUME_DEALS ("
@@ -53,8 +360,12 @@ int db_init(const char *db_path) {
         "    good_id INTEGER NOT NULL,"
         "    buyer VARCHAR(100) NOT NULL,"
         "    created_at DATETIME DEFAULT CURRENT_TIMESTAMP,"
+        "    supplier_id INTEGER,"
+        "    type_id INTEGER,"
         "    FOREIGN KEY (makler_id) REFERENCES PERFUME_MAKLERS(id),"
-        "    FOREIGN KEY (good_id) REFERENCES PERFUME_GOODS(id)"
+        "    FOREIGN KEY (good_id) REFERENCES PERFUME_GOODS(id),"
+        "    FOREIGN KEY (supplier_id) REFERENCES PERFUME_SUPPLIERS(id),"
+        "    FOREIGN KEY (type_id) REFERENCES PERFUME_GOOD_TYPES(id)"
         ");",
         
         "CREATE TABLE IF NOT EXISTS PERFUME_MAKLERSTATS ("
@@ -67,38 +378,399 @@ int db_init(const char *db_path) {
         "    updated_at DATETIME DEFAULT CURRENT_TIMESTAMP,"
         "    FOREIGN KEY (makler_id) REFERENCES PERFUME_MAKLERS(id),"
         "    UNIQUE(makler_id, good_name, good_type)"
-        ");"
+        ");",
+        
+        // Change feed: one row per committed deal, in commit order
+        "CREATE TABLE IF NOT EXISTS PERFUME_DEAL_FEED ("
+        "    seq INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "    deal_id INTEGER NOT NULL,"
+        "    committed_at DATETIME DEFAULT CURRENT_TIMESTAMP"
+        ");",
+        
+        "INSERT INTO PERFUME_DEAL_FEED (deal_id) "
+        "SELECT id FROM PERFUME_DEALS "
+        "WHERE NOT EXISTS (SELECT 1 FROM PERFUME_DEAL_FEED) "
+        "ORDER BY id;",
+        
+        // Search terms: goods, suppliers and buyers, one row each. The two
+        // FTS5 indexes read their text from here: words with prefixes for
+        // lookups as you type, trigrams for substrings and typos.
+        "CREATE TABLE IF NOT EXISTS PERFUME_SEARCH_TERMS ("
+        "    id INTEGER PRIMARY KEY,"
+        "    kind TEXT NOT NULL,"
+        "    ref_id INTEGER NOT NULL DEFAULT 0,"
+        "    label TEXT NOT NULL,"
+        "    detail TEXT NOT NULL DEFAULT '',"
+        "    UNIQUE(kind, label, ref_id)"
+        ");",
+        
+        "CREATE VIRTUAL TABLE IF NOT EXISTS PERFUME_SEARCH USING fts5("
+        "    label, detail, content='PERFUME_SEARCH_TERMS', content_rowid='id',"
+        "    tokenize='unicode61 remove_diacritics 2', prefix='1 2 3'"
+        ");",
+        
+        "CREATE VIRTUAL TABLE IF NOT EXISTS PERFUME_SEARCH_TRIGRAMS USING fts5("
+        "    label, content='PERFUME_SEARCH_TERMS', content_rowid='id', tokenize='trigram'"
+        ");",
+        
+        "CREATE TRIGGER IF NOT EXISTS search_terms_ai AFTER INSERT ON PERFUME_SEARCH_TERMS BEGIN"
+        "    INSERT INTO PERFUME_SEARCH (rowid, label, detail) VALUES (NEW.id, NEW.label, NEW.detail);"
+        "    INSERT INTO PERFUME_SEARCH_TRIGRAMS (rowid, label) VALUES (NEW.id, NEW.label);"
+        " END;",
+        
+        "CREATE TRIGGER IF NOT EXISTS search_terms_ad AFTER DELETE ON PERFUME_SEARCH_TERMS BEGIN"
+        "    INSERT INTO PERFUME_SEARCH (PERFUME_SEARCH, rowid, label, detail) VALUES ('delete', OLD.id, OLD.label, OLD.detail);"
+        "    INSERT INTO PERFUME_SEARCH_TRIGRAMS (PERFUME_SEARCH_TRIGRAMS, rowid, label) VALUES ('delete', OLD.id, OLD.label);"
+        " END;",
+        
+        "CREATE TRIGGER IF NOT EXISTS search_terms_au AFTER UPDATE ON PERFUME_SEARCH_TERMS BEGIN"
+        "    INSERT INTO PERFUME_SEARCH (PERFUME_SEARCH, rowid, label, detail) VALUES ('delete', OLD.id, OLD.label, OLD.detail);"
+        "    INSERT INTO PERFUME_SEARCH_TRIGRAMS (PERFUME_SEARCH_TRIGRAMS, rowid, label) VALUES ('delete', OLD.id, OLD.label);"
+        "    INSERT INTO PERFUME_SEARCH (rowid, label, detail) VALUES (NEW.id, NEW.label, NEW.detail);"
+        "    INSERT INTO PERFUME_SEARCH_TRIGRAMS (rowid, label) VALUES (NEW.id, NEW.label);"
+        " END;",
+        
+        // Goods and buyers feed the terms wherever they are written from
+        "CREATE TRIGGER IF NOT EXISTS search_goods_ai AFTER INSERT ON PERFUME_GOODS BEGIN"
+        "    INSERT INTO PERFUME_SEARCH_TERMS (kind, ref_id, label, detail)"
+        "    VALUES ('good', NEW.id, NEW.name, NEW.type || ' ' || COALESCE(NEW.supplier, ''));"
+        "    INSERT OR IGNORE INTO PERFUME_SEARCH_TERMS (kind, label)"
+        "    SELECT 'supplier', NEW.supplier WHERE COALESCE(NEW.supplier, '') <> '';"
+        " END;",
+        
+        "CREATE TRIGGER IF NOT EXISTS search_goods_au AFTER UPDATE OF name, type, supplier ON PERFUME_GOODS BEGIN"
+        "    UPDATE PERFUME_SEARCH_TERMS SET label = NEW.name, detail = NEW.type || ' ' || COALESCE(NEW.supplier, '')"
+        "    WHERE kind = 'good' AND ref_id = NEW.id;"
+        "    INSERT OR IGNORE INTO PERFUME_SEARCH_TERMS (kind, label)"
+        "    SELECT 'supplier', NEW.supplier WHERE COALESCE(NEW.supplier, '') <> '';"
+        " END;",
+        
+        "CREATE TRIGGER IF NOT EXISTS search_goods_ad AFTER DELETE ON PERFUME_GOODS BEGIN"
+        "    DELETE FROM PERFUME_SEARCH_TERMS WHERE kind = 'good' AND ref_id = OLD.id;"
+        " END;",
+        
+        "CREATE TRIGGER IF NOT EXISTS search_deals_ai AFTER INSERT ON PERFUME_DEALS BEGIN"
+        "    INSERT OR IGNORE INTO PERFUME_SEARCH_TERMS (kind, label) VALUES ('buyer', NEW.buyer);"
+        " END;",
+        
+        // Backfill once for databases created before search existed
+        "INSERT INTO PERFUME_SEARCH_TERMS (kind, ref_id, label, detail) "
+        "SELECT 'good', id, name, type || ' ' || COALESCE(supplier, '') FROM PERFUME_GOODS "
+        "WHERE NOT EXISTS (SELECT 1 FROM PERFUME_SEARCH_TERMS) "
+        "UNION ALL SELECT DISTINCT 'supplier', 0, supplier, '' FROM PERFUME_GOODS "
+        "WHERE COALESCE(supplier, '') <> '' AND NOT EXISTS (SELECT 1 FROM PERFUME_SEARCH_TERMS) "
+        "UNION ALL SELECT DISTINCT 'buyer', 0, buyer, '' FROM PERFUME_DEALS "
+        "WHERE NOT EXISTS (SELECT 1 FROM PERFUME_SEARCH_TERMS);",
+        
+        // Distinct-buyer sketches (see hll.h) per day and good type, makler
+        // or supplier; merged over any range of days
+        "CREATE TABLE IF NOT EXISTS PERFUME_BUYER_SKETCHES ("
+        "    id INTEGER PRIMARY KEY,"
+        "    dimension VARCHAR(10) NOT NULL,"
+        "    key VARCHAR(100) NOT NULL,"
+        "    day DATE NOT NULL,"
+        "    sketch BLOB NOT NULL,"
+        "    UNIQUE (dimension, key, day)"
+        ");",
+        
+        // Deal listings by period and makler (also in data/init_db.sql)
+        "CREATE INDEX IF NOT EXISTS idx_deals_date ON PERFUME_DEALS(deal_date);",
+        "CREATE INDEX IF NOT EXISTS idx_deals_makler ON PERFUME_DEALS(makler_id);"
     };
     
-    char *err_msg = 0;
-    for (int i = 0; i < 5; i++) {
-        rc = sqlite3_exec(db, sql[i], 0, 0, &err_msg);
-        if (rc != SQLITE_OK) {
-            fprintf(stderr, "SQL error: %s\n", err_msg);
-            sqlite3_free(err_msg);
-            return -1;
-        }
+    if (db_exec_all(sql, sizeof(sql) / sizeof(sql[0])) != 0) {
+        return -1;
     }
     
-    return 0;
+    // Databases created before row versions and dimensions existed
+    if (db_ensure_column("PERFUME_GOODS", "version", "INTEGER NOT NULL DEFAULT 0") != 0 ||
+        db_ensure_column("PERFUME_MAKLERS", "version", "INTEGER NOT NULL DEFAULT 0") != 0 ||
+        db_ensure_column("PERFUME_GOODS", "supplier_id", "INTEGER REFERENCES PERFUME_SUPPLIERS(id)") != 0 ||
+        db_ensure_column("PERFUME_GOODS", "type_id", "INTEGER REFERENCES PERFUME_GOOD_TYPES(id)") != 0 ||
+        db_ensure_column("PERFUME_DEALS", "supplier_id", "INTEGER REFERENCES PERFUME_SUPPLIERS(id)") != 0 ||
+        db_ensure_column("PERFUME_DEALS", "type_id", "INTEGER REFERENCES PERFUME_GOOD_TYPES(id)") != 0) {
+        return -1;
+    }
+    
+    if (db_init_dimensions() != 0) {
+        return -1;
+    }
+    return db_init_rollups();
 }
 
 void db_close() {
+    scheduler_close();
+    if (db && transaction_depth == 0) {
+        statstore_flush();
+    }
+    statstore_reset();
+    // Cached reports are versioned by connection, and a new one may get
+    // the same address
+    report_cache_clear();
+    transaction_depth = 0;
+    good_cache_epoch++;
     if (db) {
         sqlite3_close(db);
         db = NULL;
     }
+    memory_uri[0] = '\0';
 }
 
 sqlite3* db_get_connection() {
     return db;
 }
 
+sqlite3* db_open_connection() {
+    // A named in-memory database is reached through its shared cache
+    const char *path = memory_uri[0] ? memory_uri : db ? sqlite3_db_filename(db, "main") : NULL;
+    if (!db || !path || !path[0]) {
+        fprintf(stderr, "Another connection needs a database file\n");
+        return NULL;
+    }
+    
+    sqlite3 *conn;
+    if (sqlite3_open_v2(path, &conn, SQLITE_OPEN_READWRITE | SQLITE_OPEN_URI, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(conn));
+        sqlite3_close(conn);
+        return NULL;
+    }
+    if (hll_register_sql(conn) != 0) {
+        sqlite3_close(conn);
+        return NULL;
+    }
+    return conn;
+}
+
+void db_swap_connection(sqlite3 **conn, int *depth) {
+    sqlite3 *previous = db;
+    db = *conn;
+    *conn = previous;
+    
+    int previous_depth = transaction_depth;
+    transaction_depth = *depth;
+    *depth = previous_depth;
+}
+
+// Statement wrappers: every query in the application goes through these,
+// so instrumentation sees prepare and step time separately and the slow
+// query log can time each statement from prepare to finalize
+#define MAX_TRACKED_STMTS 16
+
+typedef struct {
+    sqlite3_stmt *stmt;
+    uint64_t prepared_at;
+    uint64_t exec_ns;
+    int rows;
+} StmtTiming;
+
+static StmtTiming tracked_stmts[MAX_TRACKED_STMTS];
+
+static int stmt_timing_enabled() {
+#ifdef ENABLE_METRICS
+    return 1;
+#else
+    return slowlog_enabled();
+#endif
+}
+
+static StmtTiming* stmt_timing_find(sqlite3_stmt *stmt) {
+    for (int i = 0; i < MAX_TRACKED_STMTS; i++) {
+        if (tracked_stmts[i].stmt == stmt) {
+            return &tracked_stmts[i];
+        }
+    }
+    return NULL;
+}
+
+int db_prepare(const char *sql, sqlite3_stmt **stmt) {
+    if (!stmt_timing_enabled()) {
+        return sqlite3_prepare_v2(db, sql, -1, stmt, 0);
+    }
+    
+    uint64_t start = metrics_now_ns();
+    int rc = sqlite3_prepare_v2(db, sql, -1, stmt, 0);
+    uint64_t elapsed = metrics_now_ns() - start;
+    metrics_on_prepare(elapsed);
+    
+    if (rc == SQLITE_OK && slowlog_enabled()) {
+        StmtTiming *timing = stmt_timing_find(NULL);
+        if (timing) {
+            timing->stmt = *stmt;
+            timing->prepared_at = start;
+            timing->exec_ns = elapsed;
+            timing->rows = 0;
+        }
+    }
+    return rc;
+}
+
+int db_step(sqlite3_stmt *stmt) {
+    // A dump asked for by signal is written between steps, so long
+    // reports and scripts don't hold it back
+    metrics_poll();
+    if (!stmt_timing_enabled()) {
+        int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_BUSY) busy_count++;
+        if (rc == SQLITE_ROW) scheduler_row_boundary();
+        return rc;
+    }
+    
+    uint64_t start = metrics_now_ns();
+    int rc = sqlite3_step(stmt);
+    uint64_t elapsed = metrics_now_ns() - start;
+    metrics_on_step(elapsed, rc);
+    if (rc == SQLITE_BUSY) busy_count++;
+    
+    StmtTiming *timing = stmt_timing_find(stmt);
+    if (timing) {
+        timing->exec_ns += elapsed;
+        if (rc == SQLITE_ROW) timing->rows++;
+    }
+    // Scheduled reports give way between rows
+    if (rc == SQLITE_ROW) scheduler_row_boundary();
+    return rc;
+}
+
+int db_finalize(sqlite3_stmt *stmt) {
+    metrics_on_finalize(stmt);
+    
+    StmtTiming *timing = stmt ? stmt_timing_find(stmt) : NULL;
+    if (timing) {
+        slowlog_record(stmt, timing->exec_ns, metrics_now_ns() - timing->prepared_at, timing->rows);
+        timing->stmt = NULL;
+    }
+    return sqlite3_finalize(stmt);
+}
+
+// Transactions nest: the outermost level is a real BEGIN/COMMIT, inner
+// levels are savepoints, so a deal created inside a batch script commits
+// together with the rest of the script
+
+int db_begin_transaction() {
+    if (transaction_depth == MAX_TRANSACTION_DEPTH) {
+        fprintf(stderr, "Transactions nested too deeply\n");
+        return -1;
+    }
+    
+    char sql[48];
+    if (transaction_depth == 0) {
+        snprintf(sql, sizeof(sql), "BEGIN TRANSACTION");
+    } else {
+        snprintf(sql, sizeof(sql), "SAVEPOINT nested_%d", transaction_depth);
+    }
+    
+    char *err_msg = 0;
+    if (sqlite3_exec(db, sql, 0, 0, &err_msg) != SQLITE_OK) {
+        if (sqlite3_errcode(db) == SQLITE_BUSY) busy_count++;
+        fprintf(stderr, "Failed to begin transaction: %s\n", err_msg);
+        sqlite3_free(err_msg);
+        return -1;
+    }
+    journal_marks[transaction_depth] = journal_mark();
+    statstore_marks[transaction_depth] = statstore_mark();
+    transaction_depth++;
+    return 0;
+}
+
+int db_commit_transaction() {
+    if (transaction_depth == 0) return -1;
+    
+    char sql[48];
+    if (transaction_depth == 1) {
+        snprintf(sql, sizeof(sql), "COMMIT");
+    } else {
+        snprintf(sql, sizeof(sql), "RELEASE nested_%d", transaction_depth - 1);
+    }
+    
+    char *err_msg = 0;
+    if (sqlite3_exec(db, sql, 0, 0, &err_msg) != SQLITE_OK) {
+        if (sqlite3_errcode(db) == SQLITE_BUSY) busy_count++;
+        fprintf(stderr, "Failed to commit transaction: %s\n", err_msg);
+        sqlite3_free(err_msg);
+        return -1;
+    }
+    transaction_depth--;
+    
+    // Journal records and statistics follow only once the data is committed
+    if (transaction_depth == 0) {
+        journal_commit();
+        statstore_commit();
+    }
+    return 0;
+}
+
+int db_rollback_transaction() {
+    if (transaction_depth == 0) return -1;
+    
+    char sql[80];
+    if (transaction_depth == 1) {
+        snprintf(sql, sizeof(sql), "ROLLBACK");
+    } else {
+        snprintf(sql, sizeof(sql), "ROLLBACK TO nested_%d; RELEASE nested_%d",
+                 transaction_depth - 1, transaction_depth - 1);
+    }
+    
+    transaction_depth--;
+    journal_rollback_to(journal_marks[transaction_depth]);
+    statstore_rollback_to(statstore_marks[transaction_depth]);
+    good_cache_epoch++;
+    if (sqlite3_exec(db, sql, 0, 0, 0) != SQLITE_OK) {
+        fprintf(stderr, "Failed to roll back transaction: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    return 0;
+}
+
+int db_transaction_depth() {
+    return transaction_depth;
+}
+
+uint64_t db_busy_count() {
+    return busy_count;
+}
+
+int db_begin_read() {
+    // Statistics held in memory go out first so queries on the table agree
+    if (transaction_depth == 0) {
+        statstore_flush();
+    }
+    if (db_begin_transaction() != 0) return -1;
+    if (transaction_depth > 1) return 0;
+    
+    // BEGIN is deferred; the first read is what pins the snapshot
+    sqlite3_stmt *stmt;
+    if (db_prepare("SELECT COUNT(*) FROM sqlite_master;", &stmt) != SQLITE_OK) {
+        fprintf(stderr, "Failed to begin read: %s\n", sqlite3_errmsg(db));
+        db_rollback_transaction();
+        return -1;
+    }
+    int rc = db_step(stmt);
+    db_finalize(stmt);
+    if (rc != SQLITE_ROW) {
+        fprintf(stderr, "Failed to begin read: %s\n", sqlite3_errmsg(db));
+        db_rollback_transaction();
+        return -1;
+    }
+    return 0;
+}
+
+int db_end_read() {
+    return db_commit_transaction();
+}
+
+// Writes journal records of a statement that ran outside a transaction
+static void journal_autocommit() {
+    if (transaction_depth == 0) {
+        journal_commit();
+    }
+}
+
 int db_create_user(const User *user) {
+    METRICS_FUNC();
     char *sql = "INSERT INTO PERFUME_USERS (username, password_hash, role) VALUES (?, ?, ?);";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return -1;
@@ -106,21 +778,22 @@ int db_create_user(const User *user) {
     
     sqlite3_bind_text(stmt, 1, user->username, -1, SQLITE_STATIC);
     sqlite3_bind_text(stmt, 2, user->password_hash, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, user->role == ROLE_ADMIN ? "admin" : "makler", -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, auth_role_name(user->role), -1, SQLITE_STATIC);
     
-    rc = sqlite3_step(stmt);
+    rc = db_step(stmt);
     if (rc != SQLITE_DONE) {
         fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return -1;
     }
     
     int user_id = sqlite3_last_insert_rowid(db);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     return user_id;
 }
 
 User* db_get_user_by_username(const char *username) {
+    METRICS_FUNC();
     char *sql = "SELECT id, username, password_hash, role, created_at FROM PERFUME_USERS WHERE username = ?;";
     sqlite3_stmt *stmt;
     
@@ -128,7 +801,7 @@ User* db_get_user_by_username(const char *username) {
         return NULL;
     }
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return NULL;
@@ -136,16 +809,16 @@ User* db_get_user_by_username(const char *username) {
     
     sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
     
-    rc = sqlite3_step(stmt);
+    rc = db_step(stmt);
     
     if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return NULL;
     }
     
     User *user = (User *)malloc(sizeof(User));
     if (!user) {
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return NULL;
     }
     
@@ -153,43 +826,46 @@ User* db_get_user_by_username(const char *username) {
     strcpy(user->username, (const char *)sqlite3_column_text(stmt, 1));
     strcpy(user->password_hash, (const char *)sqlite3_column_text(stmt, 2));
     const char *role_str = (const char *)sqlite3_column_text(stmt, 3);
-    user->role = strcmp(role_str, "admin") == 0 ? ROLE_ADMIN : ROLE_MAKLER;
+    int role = auth_parse_role(role_str);
+    user->role = role >= 0 ? (UserRole)role : ROLE_MAKLER;
     user->created_at = (time_t)sqlite3_column_int64(stmt, 4);
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     return user;
 }
 
 int db_update_user(const User *user) {
+    METRICS_FUNC();
     char *sql = "UPDATE PERFUME_USERS SET password_hash = ?, role = ? WHERE id = ?;";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return -1;
     }
     
     sqlite3_bind_text(stmt, 1, user->password_hash, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, user->role == ROLE_ADMIN ? "admin" : "makler", -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, auth_role_name(user->role), -1, SQLITE_STATIC);
     sqlite3_bind_int(stmt, 3, user->id);
     
-    rc = sqlite3_step(stmt);
+    rc = db_step(stmt);
     if (rc != SQLITE_DONE) {
         fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return -1;
     }
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     return 0;
 }
 
 int db_delete_user(int user_id) {
+    METRICS_FUNC();
     char *sql = "DELETE FROM PERFUME_USERS WHERE id = ?;";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return -1;
@@ -197,22 +873,23 @@ int db_delete_user(int user_id) {
     
     sqlite3_bind_int(stmt, 1, user_id);
     
-    rc = sqlite3_step(stmt);
+    rc = db_step(stmt);
     if (rc != SQLITE_DONE) {
         fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return -1;
     }
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     return 0;
 }
 
 int db_create_makler(const Makler *makler) {
+    METRICS_FUNC();
     char *sql = "INSERT INTO PERFUME_MAKLERS (name, address, birth_year, user_id) VALUES (?, ?, ?, ?);";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return -1;
@@ -223,23 +900,24 @@ int db_create_makler(const Makler *makler) {
     sqlite3_bind_int(stmt, 3, makler->birth_year);
     sqlite3_bind_int(stmt, 4, makler->user_id);
     
-    rc = sqlite3_step(stmt);
+    rc = db_step(stmt);
     if (rc != SQLITE_DONE) {
         fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return -1;
     }
     
     int makler_id = sqlite3_last_insert_rowid(db);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     return makler_id;
 }
 
 Makler* db_get_makler_by_id(int id) {
-    char *sql = "SELECT id, name, address, birth_year, user_id FROM PERFUME_MAKLERS WHERE id = ?;";
+    METRICS_FUNC();
+    char *sql = "SELECT id, name, address, birth_year, user_id, version FROM PERFUME_MAKLERS WHERE id = ?;";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return NULL;
@@ -247,15 +925,15 @@ Makler* db_get_makler_by_id(int id) {
     
     sqlite3_bind_int(stmt, 1, id);
     
-    rc = sqlite3_step(stmt);
+    rc = db_step(stmt);
     if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return NULL;
     }
     
     Makler *makler = (Makler *)malloc(sizeof(Makler));
     if (!makler) {
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return NULL;
     }
     
@@ -264,16 +942,18 @@ Makler* db_get_makler_by_id(int id) {
     strcpy(makler->address, (const char *)sqlite3_column_text(stmt, 2));
     makler->birth_year = sqlite3_column_int(stmt, 3);
     makler->user_id = sqlite3_column_int(stmt, 4);
+    makler->version = sqlite3_column_int(stmt, 5);
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     return makler;
 }
 
 Makler* db_get_makler_by_user_id(int user_id) {
-    char *sql = "SELECT id, name, address, birth_year, user_id FROM PERFUME_MAKLERS WHERE user_id = ?;";
+    METRICS_FUNC();
+    char *sql = "SELECT id, name, address, birth_year, user_id, version FROM PERFUME_MAKLERS WHERE user_id = ?;";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return NULL;
@@ -281,15 +961,15 @@ Makler* db_get_makler_by_user_id(int user_id) {
     
     sqlite3_bind_int(stmt, 1, user_id);
     
-    rc = sqlite3_step(stmt);
+    rc = db_step(stmt);
     if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return NULL;
     }
     
     Makler *makler = (Makler *)malloc(sizeof(Makler));
     if (!makler) {
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return NULL;
     }
     
@@ -298,16 +978,18 @@ Makler* db_get_makler_by_user_id(int user_id) {
     strcpy(makler->address, (const char *)sqlite3_column_text(stmt, 2));
     makler->birth_year = sqlite3_column_int(stmt, 3);
     makler->user_id = sqlite3_column_int(stmt, 4);
+    makler->version = sqlite3_column_int(stmt, 5);
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     return makler;
 }
 
 Makler** db_get_all_maklers(int *count) {
-    char *sql = "SELECT id, name, address, birth_year, user_id FROM PERFUME_MAKLERS;";
+    METRICS_FUNC();
+    char *sql = "SELECT id, name, address, birth_year, user_id, version FROM PERFUME_MAKLERS;";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         *count = 0;
@@ -317,17 +999,17 @@ Makler** db_get_all_maklers(int *count) {
     *count = 0;
     Makler **maklers = NULL;
     
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
+    while (db_step(stmt) == SQLITE_ROW) {
         maklers = (Makler **)realloc(maklers, sizeof(Makler *) * (*count + 1));
         if (!maklers) {
             *count = 0;
-            sqlite3_finalize(stmt);
+            db_finalize(stmt);
             return NULL;
         }
         
         maklers[*count] = (Makler *)malloc(sizeof(Makler));
         if (!maklers[*count]) {
-            sqlite3_finalize(stmt);
+            db_finalize(stmt);
             return maklers;
         }
         
@@ -336,19 +1018,21 @@ Makler** db_get_all_maklers(int *count) {
         strcpy(maklers[*count]->address, (const char *)sqlite3_column_text(stmt, 2));
         maklers[*count]->birth_year = sqlite3_column_int(stmt, 3);
         maklers[*count]->user_id = sqlite3_column_int(stmt, 4);
+        maklers[*count]->version = sqlite3_column_int(stmt, 5);
         
         (*count)++;
     }
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     return maklers;
 }
 
 int db_update_makler(const Makler *makler) {
-    char *sql = "UPDATE PERFUME_MAKLERS SET name = ?, address = ?, birth_year = ?, user_id = ? WHERE id = ?;";
+    METRICS_FUNC();
+    char *sql = "UPDATE PERFUME_MAKLERS SET name = ?, address = ?, birth_year = ?, user_id = ?, version = version + 1 WHERE id = ?;";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return -1;
@@ -360,22 +1044,58 @@ int db_update_makler(const Makler *makler) {
     sqlite3_bind_int(stmt, 4, makler->user_id);
     sqlite3_bind_int(stmt, 5, makler->id);
     
-    rc = sqlite3_step(stmt);
+    rc = db_step(stmt);
     if (rc != SQLITE_DONE) {
         fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return -1;
     }
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
+    return 0;
+}
+
+// Updates the makler only if nobody changed it since it was read;
+// on success makler->version is the new version
+int db_update_makler_if_version(Makler *makler) {
+    METRICS_FUNC();
+    char *sql = "UPDATE PERFUME_MAKLERS SET name = ?, address = ?, birth_year = ?, user_id = ?, version = version + 1 "
+                "WHERE id = ? AND version = ?;";
+    sqlite3_stmt *stmt;
+    
+    int rc = db_prepare(sql, &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    
+    sqlite3_bind_text(stmt, 1, makler->name, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, makler->address, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 3, makler->birth_year);
+    sqlite3_bind_int(stmt, 4, makler->user_id);
+    sqlite3_bind_int(stmt, 5, makler->id);
+    sqlite3_bind_int(stmt, 6, makler->version);
+    
+    rc = db_step(stmt);
+    db_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    if (sqlite3_changes(db) == 0) {
+        return DB_CONFLICT;
+    }
+    
+    makler->version++;
     return 0;
 }
 
 int db_delete_makler(int id) {
+    METRICS_FUNC();
     char *sql = "DELETE FROM PERFUME_MAKLERS WHERE id = ?;";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return -1;
@@ -383,22 +1103,27 @@ int db_delete_makler(int id) {
     
     sqlite3_bind_int(stmt, 1, id);
     
-    rc = sqlite3_step(stmt);
+    rc = db_step(stmt);
     if (rc != SQLITE_DONE) {
         fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return -1;
     }
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     return 0;
 }
 
 int db_create_good(const Good *good) {
+    METRICS_FUNC();
+    if (!auth_can(CAP_MANAGE_GOODS)) {
+        fprintf(stderr, "add good: permission denied\n");
+        return -1;
+    }
     char *sql = "INSERT INTO PERFUME_GOODS (name, type, unit_price, supplier, expiry_date, quantity) VALUES (?, ?, ?, ?, ?, ?);";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return -1;
@@ -411,23 +1136,27 @@ int db_create_good(const Good *good) {
     sqlite3_bind_text(stmt, 5, good->expiry_date, -1, SQLITE_STATIC);
     sqlite3_bind_int(stmt, 6, good->quantity);
     
-    rc = sqlite3_step(stmt);
+    rc = db_step(stmt);
     if (rc != SQLITE_DONE) {
         fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return -1;
     }
     
     int good_id = sqlite3_last_insert_rowid(db);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
+    
+    journal_append_stock(good_id, good->quantity);
+    journal_autocommit();
     return good_id;
 }
 
 Good* db_get_good_by_id(int id) {
-    char *sql = "SELECT id, name, type, unit_price, supplier, expiry_date, quantity, created_at FROM PERFUME_GOODS WHERE id = ?;";
+    METRICS_FUNC();
+    char *sql = "SELECT id, name, type, unit_price, supplier, expiry_date, quantity, created_at, version FROM PERFUME_GOODS WHERE id = ?;";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return NULL;
@@ -435,15 +1164,15 @@ Good* db_get_good_by_id(int id) {
     
     sqlite3_bind_int(stmt, 1, id);
     
-    rc = sqlite3_step(stmt);
+    rc = db_step(stmt);
     if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return NULL;
     }
     
     Good *good = (Good *)malloc(sizeof(Good));
     if (!good) {
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return NULL;
     }
     
@@ -455,16 +1184,49 @@ Good* db_get_good_by_id(int id) {
     strcpy(good->expiry_date, (const char *)sqlite3_column_text(stmt, 5));
     good->quantity = sqlite3_column_int(stmt, 6);
     good->created_at = (time_t)sqlite3_column_int64(stmt, 7);
+    good->version = sqlite3_column_int(stmt, 8);
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     return good;
 }
 
+// Copies the good from the cache, or reads it when it isn't cached or
+// refresh is set. Returns 1 for a cache hit, 0 for a fresh read, -1 if
+// the good doesn't exist.
+int db_get_good_cached(int good_id, int refresh, Good *out) {
+    METRICS_FUNC();
+    int slot = (int)((unsigned)good_id % GOOD_CACHE_SIZE);
+    if (!refresh && good_cache_epochs[slot] == good_cache_epoch && good_cache[slot].id == good_id) {
+        *out = good_cache[slot];
+        return 1;
+    }
+    
+    Good *good = db_get_good_by_id(good_id);
+    if (!good) {
+        good_cache_epochs[slot] = 0;
+        return -1;
+    }
+    good_cache[slot] = *good;
+    good_cache_epochs[slot] = good_cache_epoch;
+    *out = *good;
+    db_free_good(good);
+    return 0;
+}
+
+// Drops the good from the cache after it was changed in the database
+static void db_evict_good_cached(int good_id) {
+    int slot = (int)((unsigned)good_id % GOOD_CACHE_SIZE);
+    if (good_cache[slot].id == good_id) {
+        good_cache_epochs[slot] = 0;
+    }
+}
+
 Good** db_get_all_goods(int *count) {
-    char *sql = "SELECT id, name, type, unit_price, supplier, expiry_date, quantity, created_at FROM PERFUME_GOODS;";
+    METRICS_FUNC();
+    char *sql = "SELECT id, name, type, unit_price, supplier, expiry_date, quantity, created_at, version FROM PERFUME_GOODS;";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         *count = 0;
@@ -474,17 +1236,17 @@ Good** db_get_all_goods(int *count) {
     *count = 0;
     Good **goods = NULL;
     
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
+    while (db_step(stmt) == SQLITE_ROW) {
         goods = (Good **)realloc(goods, sizeof(Good *) * (*count + 1));
         if (!goods) {
             *count = 0;
-            sqlite3_finalize(stmt);
+            db_finalize(stmt);
             return NULL;
         }
         
         goods[*count] = (Good *)malloc(sizeof(Good));
         if (!goods[*count]) {
-            sqlite3_finalize(stmt);
+            db_finalize(stmt);
             return goods;
         }
         
@@ -496,19 +1258,21 @@ Good** db_get_all_goods(int *count) {
         strcpy(goods[*count]->expiry_date, (const char *)sqlite3_column_text(stmt, 5));
         goods[*count]->quantity = sqlite3_column_int(stmt, 6);
         goods[*count]->created_at = (time_t)sqlite3_column_int64(stmt, 7);
+        goods[*count]->version = sqlite3_column_int(stmt, 8);
         
         (*count)++;
     }
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     return goods;
 }
 
 int db_update_good(const Good *good) {
-    char *sql = "UPDATE PERFUME_GOODS SET name = ?, type = ?, unit_price = ?, supplier = ?, expiry_date = ?, quantity = ? WHERE id = ?;";
+    METRICS_FUNC();
+    char *sql = "UPDATE PERFUME_GOODS SET name = ?, type = ?, unit_price = ?, supplier = ?, expiry_date = ?, quantity = ?, version = version + 1 WHERE id = ?;";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return -1;
@@ -522,22 +1286,67 @@ int db_update_good(const Good *good) {
     sqlite3_bind_int(stmt, 6, good->quantity);
     sqlite3_bind_int(stmt, 7, good->id);
     
-    rc = sqlite3_step(stmt);
+    rc = db_step(stmt);
     if (rc != SQLITE_DONE) {
         fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return -1;
     }
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
+    db_evict_good_cached(good->id);
+    
+    journal_append_stock(good->id, good->quantity);
+    journal_autocommit();
+    return 0;
+}
+
+// Updates the good only if nobody changed it since it was read;
+// on success good->version is the new version
+int db_update_good_if_version(Good *good) {
+    METRICS_FUNC();
+    char *sql = "UPDATE PERFUME_GOODS SET name = ?, type = ?, unit_price = ?, supplier = ?, expiry_date = ?, quantity = ?, "
+                "version = version + 1 WHERE id = ? AND version = ?;";
+    sqlite3_stmt *stmt;
+    
+    int rc = db_prepare(sql, &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    
+    sqlite3_bind_text(stmt, 1, good->name, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, good->type, -1, SQLITE_STATIC);
+    sqlite3_bind_double(stmt, 3, good->unit_price);
+    sqlite3_bind_text(stmt, 4, good->supplier, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 5, good->expiry_date, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 6, good->quantity);
+    sqlite3_bind_int(stmt, 7, good->id);
+    sqlite3_bind_int(stmt, 8, good->version);
+    
+    rc = db_step(stmt);
+    db_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    if (sqlite3_changes(db) == 0) {
+        return DB_CONFLICT;
+    }
+    
+    good->version++;
+    db_evict_good_cached(good->id);
+    journal_append_stock(good->id, good->quantity);
+    journal_autocommit();
     return 0;
 }
 
 int db_delete_good(int id) {
+    METRICS_FUNC();
     char *sql = "DELETE FROM PERFUME_GOODS WHERE id = ?;";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return -1;
@@ -545,22 +1354,24 @@ int db_delete_good(int id) {
     
     sqlite3_bind_int(stmt, 1, id);
     
-    rc = sqlite3_step(stmt);
+    rc = db_step(stmt);
     if (rc != SQLITE_DONE) {
         fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return -1;
     }
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
+    db_evict_good_cached(id);
     return 0;
 }
 
 int db_check_good_availability(int good_id, int quantity_needed) {
+    METRICS_FUNC();
     char *sql = "SELECT quantity FROM PERFUME_GOODS WHERE id = ?;";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return 0;
@@ -568,28 +1379,88 @@ int db_check_good_availability(int good_id, int quantity_needed) {
     
     sqlite3_bind_int(stmt, 1, good_id);
     
-    rc = sqlite3_step(stmt);
+    rc = db_step(stmt);
     if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
+        db_finalize(stmt);
         return 0;
     }
     
     int available = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     
     return available >= quantity_needed;
 }
 
+int db_set_good_quantity(int good_id, int quantity) {
+    METRICS_FUNC();
+    char *sql = "UPDATE PERFUME_GOODS SET quantity = ?, version = version + 1 WHERE id = ?;";
+    sqlite3_stmt *stmt;
+    
+    int rc = db_prepare(sql, &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    
+    sqlite3_bind_int(stmt, 1, quantity);
+    sqlite3_bind_int(stmt, 2, good_id);
+    
+    rc = db_step(stmt);
+    db_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    db_evict_good_cached(good_id);
+    return 0;
+}
+
+// Records the current stock of every good, e.g. after a bulk stock change
+int db_journal_stock() {
+    METRICS_FUNC();
+    if (!journal_enabled()) return 0;
+    
+    sqlite3_stmt *stmt;
+    int rc = db_prepare("SELECT id, quantity FROM PERFUME_GOODS;", &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    
+    while (db_step(stmt) == SQLITE_ROW) {
+        journal_append_stock(sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1));
+    }
+    
+    db_finalize(stmt);
+    journal_autocommit();
+    return 0;
+}
+
 int db_create_deal(const Deal *deal) {
-    char *sql = "INSERT INTO PERFUME_DEALS (deal_date, good_name, good_type, quantity, total_amount, makler_id, good_id, buyer) VALUES (?, ?, ?, ?, ?, ?, ?, ?);";
+    METRICS_FUNC();
+    return db_create_deal_if_version(deal, -1);
+}
+
+// good_version >= 0 makes the stock update a compare-and-swap: the deal
+// is only written if the good is unchanged since it was read and still
+// has the stock, otherwise DB_CONFLICT is returned
+int db_create_deal_if_version(const Deal *deal, int good_version) {
+    METRICS_FUNC();
+    // Tagged with the good's supplier and type as they are at commit
+    char *sql = "INSERT INTO PERFUME_DEALS (deal_date, good_name, good_type, quantity, total_amount, makler_id, good_id, buyer, "
+                "supplier_id, type_id) VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, "
+                "(SELECT supplier_id FROM PERFUME_GOODS WHERE id = ?7), (SELECT type_id FROM PERFUME_GOODS WHERE id = ?7)) "
+                "RETURNING COALESCE(supplier_id, 0), COALESCE(type_id, 0);";
     sqlite3_stmt *stmt;
     
-    sqlite3_exec(db, "BEGIN TRANSACTION", 0, 0, 0);
+    if (db_begin_transaction() != 0) {
+        return -1;
+    }
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
+        db_rollback_transaction();
         return -1;
     }
     
@@ -605,51 +1476,108 @@ int db_create_deal(const Deal *deal) {
     sqlite3_bind_int(stmt, 7, deal->good_id);
     sqlite3_bind_text(stmt, 8, deal->buyer, -1, SQLITE_STATIC);
     
-    rc = sqlite3_step(stmt);
+    // The aggregates and the journal record carry the tags themselves, as
+    // the row may be deleted before the journal is replayed
+    Deal committed = *deal;
+    rc = db_step(stmt);
+    if (rc == SQLITE_ROW) {
+        committed.supplier_id = sqlite3_column_int(stmt, 0);
+        committed.type_id = sqlite3_column_int(stmt, 1);
+        rc = db_step(stmt);
+    }
     if (rc != SQLITE_DONE) {
         fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
-        sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
+        db_finalize(stmt);
+        db_rollback_transaction();
         return -1;
     }
     
     int deal_id = sqlite3_last_insert_rowid(db);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     
     // Update goods quantity
-    sql = "UPDATE PERFUME_GOODS SET quantity = quantity - ? WHERE id = ?;";
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    if (good_version >= 0) {
+        sql = "UPDATE PERFUME_GOODS SET quantity = quantity - ?, version = version + 1 "
+              "WHERE id = ? AND version = ? AND quantity >= ?;";
+    } else {
+        sql = "UPDATE PERFUME_GOODS SET quantity = quantity - ?, version = version + 1 WHERE id = ?;";
+    }
+    rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
+        db_rollback_transaction();
         return -1;
     }
     
     sqlite3_bind_int(stmt, 1, deal->quantity);
     sqlite3_bind_int(stmt, 2, deal->good_id);
+    if (good_version >= 0) {
+        sqlite3_bind_int(stmt, 3, good_version);
+        sqlite3_bind_int(stmt, 4, deal->quantity);
+    }
     
-    rc = sqlite3_step(stmt);
+    rc = db_step(stmt);
     if (rc != SQLITE_DONE) {
         fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
-        sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
+        db_finalize(stmt);
+        db_rollback_transaction();
         return -1;
     }
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
+    if (sqlite3_changes(db) == 0 && good_version >= 0) {
+        db_rollback_transaction();
+        return DB_CONFLICT;
+    }
+    
+    // Keep a cached copy that matched in step with the row
+    int slot = (int)((unsigned)deal->good_id % GOOD_CACHE_SIZE);
+    if (good_version >= 0 && good_cache_epochs[slot] == good_cache_epoch &&
+        good_cache[slot].id == deal->good_id && good_cache[slot].version == good_version) {
+        good_cache[slot].quantity -= deal->quantity;
+        good_cache[slot].version++;
+    }
+    
+    // Publish to the change feed in the same transaction
+    sql = "INSERT INTO PERFUME_DEAL_FEED (deal_id) VALUES (?);";
+    rc = db_prepare(sql, &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        db_rollback_transaction();
+        return -1;
+    }
     
-    // Update makler stats
-    db_update_makler_stats(deal);
+    sqlite3_bind_int(stmt, 1, deal_id);
     
-    sqlite3_exec(db, "COMMIT", 0, 0, 0);
+    rc = db_step(stmt);
+    db_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
+        db_rollback_transaction();
+        return -1;
+    }
+    
+    // Update makler stats, the daily rollup and the buyer sketches
+    committed.id = deal_id;
+    if (db_apply_deal_aggregates(&committed) != 0) {
+        db_rollback_transaction();
+        return -1;
+    }
+    journal_append_deal(&committed);
+    
+    if (db_commit_transaction() != 0) {
+        db_rollback_transaction();
+        return -1;
+    }
     return deal_id;
 }
 
 Deal** db_get_deals_by_makler(int makler_id, int *count) {
+    METRICS_FUNC();
     char *sql = "SELECT id, deal_date, good_name, good_type, quantity, total_amount, makler_id, good_id, buyer, created_at FROM PERFUME_DEALS WHERE makler_id = ?;";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         *count = 0;
@@ -661,17 +1589,17 @@ Deal** db_get_deals_by_makler(int makler_id, int *count) {
     *count = 0;
     Deal **deals = NULL;
     
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
+    while (db_step(stmt) == SQLITE_ROW) {
         deals = (Deal **)realloc(deals, sizeof(Deal *) * (*count + 1));
         if (!deals) {
             *count = 0;
-            sqlite3_finalize(stmt);
+            db_finalize(stmt);
             return NULL;
         }
         
         deals[*count] = (Deal *)malloc(sizeof(Deal));
         if (!deals[*count]) {
-            sqlite3_finalize(stmt);
+            db_finalize(stmt);
             return deals;
         }
         
@@ -694,15 +1622,16 @@ Deal** db_get_deals_by_makler(int makler_id, int *count) {
         (*count)++;
     }
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     return deals;
 }
 
 Deal** db_get_all_deals(int *count) {
+    METRICS_FUNC();
     char *sql = "SELECT id, deal_date, good_name, good_type, quantity, total_amount, makler_id, good_id, buyer, created_at FROM PERFUME_DEALS;";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         *count = 0;
@@ -712,17 +1641,17 @@ Deal** db_get_all_deals(int *count) {
     *count = 0;
     Deal **deals = NULL;
     
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
+    while (db_step(stmt) == SQLITE_ROW) {
         deals = (Deal **)realloc(deals, sizeof(Deal *) * (*count + 1));
         if (!deals) {
             *count = 0;
-            sqlite3_finalize(stmt);
+            db_finalize(stmt);
             return NULL;
         }
         
         deals[*count] = (Deal *)malloc(sizeof(Deal));
         if (!deals[*count]) {
-            sqlite3_finalize(stmt);
+            db_finalize(stmt);
             return deals;
         }
         
@@ -745,15 +1674,16 @@ Deal** db_get_all_deals(int *count) {
         (*count)++;
     }
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     return deals;
 }
 
 Deal** db_get_deals_by_date_range(time_t start_date, time_t end_date, int *count) {
+    METRICS_FUNC();
     char *sql = "SELECT id, deal_date, good_name, good_type, quantity, total_amount, makler_id, good_id, buyer, created_at FROM PERFUME_DEALS WHERE date(deal_date) BETWEEN date(?) AND date(?);";
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         *count = 0;
@@ -770,17 +1700,17 @@ Deal** db_get_deals_by_date_range(time_t start_date, time_t end_date, int *count
     *count = 0;
     Deal **deals = NULL;
     
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
+    while (db_step(stmt) == SQLITE_ROW) {
         deals = (Deal **)realloc(deals, sizeof(Deal *) * (*count + 1));
         if (!deals) {
             *count = 0;
-            sqlite3_finalize(stmt);
+            db_finalize(stmt);
             return NULL;
         }
         
         deals[*count] = (Deal *)malloc(sizeof(Deal));
         if (!deals[*count]) {
-            sqlite3_finalize(stmt);
+            db_finalize(stmt);
             return deals;
         }
         
@@ -803,83 +1733,326 @@ Deal** db_get_deals_by_date_range(time_t start_date, time_t end_date, int *count
         (*count)++;
     }
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     return deals;
 }
 
-int db_update_stats_on_deal(const Deal *deal) {
-    return db_update_makler_stats(deal);
+static DbText column_view(sqlite3_stmt *stmt, int column) {
+    // Text first: bytes then counts the converted value
+    DbText view;
+    view.text = (const char *)sqlite3_column_text(stmt, column);
+    view.length = sqlite3_column_bytes(stmt, column);
+    return view;
 }
 
-MaklerStats* db_get_makler_stats(int makler_id, int *count) {
-    char *sql = "SELECT id, makler_id, good_name, good_type, total_quantity, total_amount, updated_at FROM PERFUME_MAKLERSTATS WHERE makler_id = ?;";
+int db_visit_deals(int makler_id, const char *start_date, const char *end_date,
+                   DealVisitor visit, void *ctx) {
+    METRICS_FUNC();
+    // Only the bounds that are given go into the statement: a range on the
+    // raw column lets idx_deals_date seek to it, where "?1 IS NULL OR ..."
+    // would walk the whole index
+    char sql[512];
+    snprintf(sql, sizeof(sql),
+             "SELECT id, deal_date, good_name, good_type, quantity, total_amount, makler_id, good_id, buyer "
+             "FROM PERFUME_DEALS WHERE (?3 = 0 OR makler_id = ?3)%s%s "
+             "ORDER BY deal_date, id;",
+             start_date ? " AND deal_date >= ?1" : "",
+             end_date ? " AND deal_date < date(?2, '+1 day')" : "");
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        *count = 0;
-        return NULL;
+        return -1;
     }
     
-    sqlite3_bind_int(stmt, 1, makler_id);
+    sqlite3_bind_text(stmt, 1, start_date, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, end_date, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 3, makler_id);
+    
+    int count = 0;
+    while ((rc = db_step(stmt)) == SQLITE_ROW) {
+        DealView deal;
+        deal.id = sqlite3_column_int(stmt, 0);
+        deal.deal_date = column_view(stmt, 1);
+        deal.good_name = column_view(stmt, 2);
+        deal.good_type = column_view(stmt, 3);
+        deal.quantity = sqlite3_column_int(stmt, 4);
+        deal.total_amount = sqlite3_column_double(stmt, 5);
+        deal.makler_id = sqlite3_column_int(stmt, 6);
+        deal.good_id = sqlite3_column_int(stmt, 7);
+        deal.buyer = column_view(stmt, 8);
+        
+        count++;
+        if (visit(&deal, ctx)) {
+            rc = SQLITE_DONE;
+            break;
+        }
+    }
     
-    *count = 0;
-    MaklerStats *stats = NULL;
+    db_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        // A cancelled scheduled report is interrupted, not failed
+        if (rc != SQLITE_INTERRUPT) fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    return count;
+}
+
+int db_visit_goods(GoodVisitor visit, void *ctx) {
+    METRICS_FUNC();
+    char *sql = "SELECT id, name, type, unit_price, supplier, expiry_date, quantity "
+                "FROM PERFUME_GOODS ORDER BY id;";
+    sqlite3_stmt *stmt;
     
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        stats = (MaklerStats *)realloc(stats, sizeof(MaklerStats) * (*count + 1));
-        if (!stats) {
-            *count = 0;
-            sqlite3_finalize(stmt);
-            return NULL;
-        }
-        
-        stats[*count].id = sqlite3_column_int(stmt, 0);
-        stats[*count].makler_id = sqlite3_column_int(stmt, 1);
-        strcpy(stats[*count].good_name, (const char *)sqlite3_column_text(stmt, 2));
-        strcpy(stats[*count].good_type, (const char *)sqlite3_column_text(stmt, 3));
-        stats[*count].total_quantity = sqlite3_column_int(stmt, 4);
-        stats[*count].total_amount = sqlite3_column_double(stmt, 5);
-        stats[*count].updated_at = (time_t)sqlite3_column_int64(stmt, 6);
+    int rc = db_prepare(sql, &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    
+    int count = 0;
+    while ((rc = db_step(stmt)) == SQLITE_ROW) {
+        GoodView good;
+        good.id = sqlite3_column_int(stmt, 0);
+        good.name = column_view(stmt, 1);
+        good.type = column_view(stmt, 2);
+        good.unit_price = sqlite3_column_double(stmt, 3);
+        good.supplier = column_view(stmt, 4);
+        good.expiry_date = column_view(stmt, 5);
+        good.quantity = sqlite3_column_int(stmt, 6);
         
-        (*count)++;
+        count++;
+        if (visit(&good, ctx)) {
+            rc = SQLITE_DONE;
+            break;
+        }
     }
     
-    sqlite3_finalize(stmt);
-    return stats;
+    db_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        if (rc != SQLITE_INTERRUPT) fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    return count;
+}
+
+int db_update_stats_on_deal(const Deal *deal) {
+    METRICS_FUNC();
+    return db_update_makler_stats(deal);
+}
+
+// Makler statistics are kept in memory and written to PERFUME_MAKLERSTATS
+// in batches (see statstore.h)
+MaklerStats* db_get_makler_stats(int makler_id, int *count) {
+    METRICS_FUNC();
+    return statstore_get(makler_id, count);
 }
 
 int db_update_makler_stats(const Deal *deal) {
-    char *sql = "INSERT INTO PERFUME_MAKLERSTATS (makler_id, good_name, good_type, total_quantity, total_amount) "
-                "VALUES (?, ?, ?, ?, ?) "
-                "ON CONFLICT(makler_id, good_name, good_type) DO UPDATE SET "
+    METRICS_FUNC();
+    return statstore_add(deal);
+}
+
+int db_update_daily_sales(const Deal *deal) {
+    METRICS_FUNC();
+    // Filed under the supplier and type the deal was tagged with at commit
+    char *sql = "INSERT INTO PERFUME_DAILY_SALES (day, good_id, makler_id, supplier_id, type_id, "
+                "deal_count, total_quantity, total_amount) "
+                "VALUES (?1, ?2, ?3, ?6, ?7, 1, ?4, ?5) "
+                "ON CONFLICT(day, good_id, makler_id, supplier_id, type_id) DO UPDATE SET "
+                "deal_count = deal_count + 1, "
                 "total_quantity = total_quantity + excluded.total_quantity, "
-                "total_amount = total_amount + excluded.total_amount, "
-                "updated_at = CURRENT_TIMESTAMP;";
+                "total_amount = total_amount + excluded.total_amount;";
     
     sqlite3_stmt *stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return -1;
     }
     
-    sqlite3_bind_int(stmt, 1, deal->makler_id);
-    sqlite3_bind_text(stmt, 2, deal->good_name, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, deal->good_type, -1, SQLITE_STATIC);
+    char day[11];
+    strftime(day, sizeof(day), "%Y-%m-%d", localtime(&deal->deal_date));
+    
+    sqlite3_bind_text(stmt, 1, day, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, deal->good_id);
+    sqlite3_bind_int(stmt, 3, deal->makler_id);
     sqlite3_bind_int(stmt, 4, deal->quantity);
     sqlite3_bind_double(stmt, 5, deal->total_amount);
+    sqlite3_bind_int(stmt, 6, deal->supplier_id);
+    sqlite3_bind_int(stmt, 7, deal->type_id);
+    
+    rc = db_step(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
+        db_finalize(stmt);
+        return -1;
+    }
+    
+    db_finalize(stmt);
+    return 0;
+}
+
+// Adds a buyer to one day's sketch. Dense sketches are changed in place
+// with incremental blob I/O: one register byte is read and only written
+// if it grows, so a busy day doesn't rewrite 16 KB per deal.
+static int db_add_buyer_sketch(const char *day, const char *dimension, const char *key, const char *buyer) {
+    sqlite3_stmt *stmt;
+    int rc = db_prepare("SELECT id, length(sketch) FROM PERFUME_BUYER_SKETCHES "
+                        "WHERE dimension = ? AND key = ? AND day = ?;", &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    
+    sqlite3_bind_text(stmt, 1, dimension, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, key, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, day, -1, SQLITE_STATIC);
+    
+    sqlite3_int64 row_id = 0;
+    int size = 0;
+    if (db_step(stmt) == SQLITE_ROW) {
+        row_id = sqlite3_column_int64(stmt, 0);
+        size = sqlite3_column_int(stmt, 1);
+    }
+    db_finalize(stmt);
     
-    rc = sqlite3_step(stmt);
+    if (size == HLL_DENSE_SIZE) {
+        int index;
+        uint8_t rank, current;
+        hll_position(hll_hash(buyer, strlen(buyer)), &index, &rank);
+        
+        sqlite3_blob *blob;
+        rc = sqlite3_blob_open(db, "main", "PERFUME_BUYER_SKETCHES", "sketch", row_id, 1, &blob);
+        if (rc == SQLITE_OK) {
+            rc = sqlite3_blob_read(blob, &current, 1, 1 + index);
+            if (rc == SQLITE_OK && rank > current) {
+                rc = sqlite3_blob_write(blob, &rank, 1, 1 + index);
+            }
+            sqlite3_blob_close(blob);
+        }
+        if (rc != SQLITE_OK) {
+            fprintf(stderr, "Sketch update failed: %s\n", sqlite3_errmsg(db));
+            return -1;
+        }
+        return 0;
+    }
+    
+    // Sparse sketches are small; hll_add rewrites them and turns them
+    // dense once they outgrow HLL_SPARSE_MAX entries
+    if (row_id) {
+        rc = db_prepare("UPDATE PERFUME_BUYER_SKETCHES SET sketch = hll_add(sketch, ?2) WHERE id = ?1;", &stmt);
+    } else {
+        rc = db_prepare("INSERT INTO PERFUME_BUYER_SKETCHES (dimension, key, day, sketch) "
+                        "VALUES (?3, ?4, ?5, hll_add(NULL, ?2));", &stmt);
+    }
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    
+    if (row_id) {
+        sqlite3_bind_int64(stmt, 1, row_id);
+    } else {
+        sqlite3_bind_text(stmt, 3, dimension, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 4, key, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 5, day, -1, SQLITE_STATIC);
+    }
+    sqlite3_bind_text(stmt, 2, buyer, -1, SQLITE_STATIC);
+    
+    rc = db_step(stmt);
+    db_finalize(stmt);
     if (rc != SQLITE_DONE) {
         fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        return -1;
+    }
+    return 0;
+}
+
+int db_update_buyer_sketches(const Deal *deal) {
+    METRICS_FUNC();
+    char day[11];
+    strftime(day, sizeof(day), "%Y-%m-%d", localtime(&deal->deal_date));
+    char makler[16];
+    snprintf(makler, sizeof(makler), "%d", deal->makler_id);
+    
+    if (db_add_buyer_sketch(day, "type", deal->good_type, deal->buyer) != 0 ||
+        db_add_buyer_sketch(day, "makler", makler, deal->buyer) != 0) {
         return -1;
     }
     
-    sqlite3_finalize(stmt);
+    // Filed under the supplier the deal was committed under, which the
+    // good may no longer have by the time the journal is replayed
+    if (deal->supplier_id == 0) return 0;
+    sqlite3_stmt *stmt;
+    int rc = db_prepare("SELECT name FROM PERFUME_SUPPLIERS WHERE id = ?;", &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    sqlite3_bind_int(stmt, 1, deal->supplier_id);
+    
+    rc = db_step(stmt);
+    if (rc == SQLITE_ROW) {
+        rc = db_add_buyer_sketch(day, "supplier", (const char *)sqlite3_column_text(stmt, 0), deal->buyer);
+    } else if (rc == SQLITE_DONE) {
+        rc = 0;
+    } else {
+        fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
+        rc = -1;
+    }
+    db_finalize(stmt);
+    return rc;
+}
+
+long long db_distinct_buyers(const char *dimension, const char *key,
+                             const char *start_date, const char *end_date) {
+    METRICS_FUNC();
+    sqlite3_stmt *stmt;
+    int rc = db_prepare("SELECT hll_count(hll_merge(sketch)) FROM PERFUME_BUYER_SKETCHES "
+                        "WHERE dimension = ?1 AND key = ?2 "
+                        "AND (?3 IS NULL OR day >= ?3) AND (?4 IS NULL OR day <= ?4);", &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    
+    sqlite3_bind_text(stmt, 1, dimension, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, key, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, start_date, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 4, end_date, -1, SQLITE_STATIC);
+    
+    long long count = -1;
+    if (db_step(stmt) == SQLITE_ROW) {
+        count = sqlite3_column_int64(stmt, 0);
+    } else {
+        fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
+    }
+    db_finalize(stmt);
+    return count;
+}
+
+int db_apply_deal_aggregates(const Deal *deal) {
+    METRICS_FUNC();
+    if (db_update_makler_stats(deal) != 0 || db_update_daily_sales(deal) != 0) {
+        return -1;
+    }
+    return db_update_buyer_sketches(deal);
+}
+
+int db_reset_aggregates() {
+    METRICS_FUNC();
+    char *err_msg = 0;
+    int rc = sqlite3_exec(db, "DELETE FROM PERFUME_MAKLERSTATS; DELETE FROM PERFUME_DAILY_SALES; "
+                          "DELETE FROM PERFUME_BUYER_SKETCHES;", 0, 0, &err_msg);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "SQL error: %s\n", err_msg);
+        sqlite3_free(err_msg);
+        return -1;
+    }
+    statstore_reset();
     return 0;
 }
 
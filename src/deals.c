@@ -1,48 +1,78 @@
 #include "deals.h"
+#include "auth.h"
 #include "database.h"
+#include "metrics.h"
+#include "reports.h"
+#include "reservations.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+// Commit attempts before a deal gives up on a good that keeps changing
+#define DEALS_MAX_ATTEMPTS 4
+
 int deals_create_deal(int good_id, int quantity, const char *buyer, int makler_id) {
-    // Validate availability
-    if (!db_check_good_availability(good_id, quantity)) {
+    METRICS_FUNC();
+    if (!auth_can(CAP_CREATE_DEAL)) {
+        fprintf(stderr, "create deal: permission denied\n");
         return -1;
     }
+    // Stock held for other maklers is not available to this deal
+    int needed = quantity + reservations_reserved(good_id);
     
-    // Get good information
-    Good *good = db_get_good_by_id(good_id);
-    if (!good) {
-        return -1;
+    for (int attempt = 0; attempt < DEALS_MAX_ATTEMPTS; attempt++) {
+        // A cached good may be stale; the versioned commit below catches that
+        Good good;
+        int cached = db_get_good_cached(good_id, attempt > 0, &good);
+        if (cached < 0) {
+            return -1;
+        }
+        
+        // Validate availability
+        if (good.quantity < needed) {
+            if (cached) continue;  // re-check against a fresh read
+            return -1;
+        }
+        
+        // Create deal
+        Deal deal = {0};
+        deal.deal_date = time(NULL);
+        strcpy(deal.good_name, good.name);
+        strcpy(deal.good_type, good.type);
+        deal.quantity = quantity;
+        deal.total_amount = good.unit_price * quantity;
+        deal.makler_id = makler_id;
+        deal.good_id = good_id;
+        snprintf(deal.buyer, sizeof(deal.buyer), "%s", buyer);
+        
+        int result = db_create_deal_if_version(&deal, good.version);
+        if (result != DB_CONFLICT) {
+            return result;
+        }
     }
     
-    // Create deal
-    Deal deal = {0};
-    deal.deal_date = time(NULL);
-    strcpy(deal.good_name, good->name);
-    strcpy(deal.good_type, good->type);
-    deal.quantity = quantity;
-    deal.total_amount = good->unit_price * quantity;
-    deal.makler_id = makler_id;
-    deal.good_id = good_id;
-    strcpy(deal.buyer, buyer);
-    
-    int result = db_create_deal(&deal);
-    db_free_good(good);
-    
-    return result;
+    fprintf(stderr, "Good %d kept changing while the deal was created, giving up\n", good_id);
+    return -1;
 }
 
 Deal** deals_get_makler_deals(int makler_id, int *count) {
+    METRICS_FUNC();
     return db_get_deals_by_makler(makler_id, count);
 }
 
 Deal** deals_get_all_deals(int *count) {
+    METRICS_FUNC();
+    if (!auth_can(CAP_VIEW_ALL_DEALS)) {
+        fprintf(stderr, "all deals: permission denied\n");
+        *count = 0;
+        return NULL;
+    }
     return db_get_all_deals(count);
 }
 
 double deals_calculate_total(int good_id, int quantity) {
+    METRICS_FUNC();
     Good *good = db_get_good_by_id(good_id);
     if (!good) {
         return 0.0;
@@ -55,10 +85,12 @@ double deals_calculate_total(int good_id, int quantity) {
 }
 
 int deals_validate_availability(int good_id, int quantity) {
-    return db_check_good_availability(good_id, quantity);
+    METRICS_FUNC();
+    return db_check_good_availability(good_id, quantity + reservations_reserved(good_id));
 }
 
 int deals_validate_expiry(int good_id) {
+    METRICS_FUNC();
     Good *good = db_get_good_by_id(good_id);
     if (!good) {
         return 0;
@@ -80,6 +112,7 @@ int deals_validate_expiry(int good_id) {
 }
 
 void deals_show_stats_by_good(const char *start_date, const char *end_date) {
+    METRICS_FUNC();
     sqlite3 *db = db_get_connection();
     if (!db) return;
     
@@ -89,7 +122,7 @@ void deals_show_stats_by_good(const char *start_date, const char *end_date) {
                 "GROUP BY good_name;";
     
     sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return;
@@ -98,22 +131,31 @@ void deals_show_stats_by_good(const char *start_date, const char *end_date) {
     sqlite3_bind_text(stmt, 1, start_date, -1, SQLITE_STATIC);
     sqlite3_bind_text(stmt, 2, end_date, -1, SQLITE_STATIC);
     
-    printf("\nSales by Good (from %s to %s):\n", start_date, end_date);
-    printf("%-30s %-15s %-15s\n", "Good Name", "Total Quantity", "Total Amount");
-    printf("----------------------------------------------------------------\n");
+    static const ReportColumn columns[] = {
+        { "Good Name", "good_name", REPORT_COL_TEXT, 30 },
+        { "Total Quantity", "total_quantity", REPORT_COL_INT, 15 },
+        { "Total Amount", "total_amount", REPORT_COL_REAL, 15 },
+    };
+    char title[128];
+    snprintf(title, sizeof(title), "Sales by Good (from %s to %s)", start_date, end_date);
     
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char *good_name = (const char *)sqlite3_column_text(stmt, 0);
-        int total_quantity = sqlite3_column_int(stmt, 1);
-        double total_amount = sqlite3_column_double(stmt, 2);
-        
-        printf("%-30s %-15d %-15.2f\n", good_name, total_quantity, total_amount);
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "stats_by_good", title, columns, REPORT_COLUMN_COUNT(columns));
+    
+    while (db_step(stmt) == SQLITE_ROW) {
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 0));
+        report_writer_int(rw, sqlite3_column_int(stmt, 1));
+        report_writer_real(rw, sqlite3_column_double(stmt, 2));
+        report_writer_end_row(rw);
     }
     
-    sqlite3_finalize(stmt);
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    db_finalize(stmt);
 }
 
 void deals_show_popular_good() {
+    METRICS_FUNC();
     sqlite3 *db = db_get_connection();
     if (!db) return;
     
@@ -124,26 +166,31 @@ void deals_show_popular_good() {
                 "LIMIT 1;";
     
     sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return;
     }
     
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char *good_name = (const char *)sqlite3_column_text(stmt, 0);
-        int total_quantity = sqlite3_column_int(stmt, 1);
+    if (db_step(stmt) == SQLITE_ROW) {
+        static const ReportColumn columns[] = {
+            { "Good Name", "good_name", REPORT_COL_TEXT, 30 },
+            { "Total Quantity", "total_quantity", REPORT_COL_INT, 15 },
+        };
         
-        printf("\nMost Popular Good:\n");
-        printf("%-30s %-15s\n", "Good Name", "Total Quantity");
-        printf("------------------------------------------------\n");
-        printf("%-30s %-15d\n", good_name, total_quantity);
+        ReportWriter *rw = reports_output();
+        report_writer_begin(rw, "popular_good", "Most Popular Good", columns, REPORT_COLUMN_COUNT(columns));
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 0));
+        report_writer_int(rw, sqlite3_column_int(stmt, 1));
+        report_writer_end(rw);
+        report_writer_flush(rw);
     }
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
 }
 
 void deals_show_max_deals_makler() {
+    METRICS_FUNC();
     sqlite3 *db = db_get_connection();
     if (!db) return;
     
@@ -155,54 +202,69 @@ void deals_show_max_deals_makler() {
                 "LIMIT 1;";
     
     sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return;
     }
     
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char *makler_name = (const char *)sqlite3_column_text(stmt, 0);
-        int deal_count = sqlite3_column_int(stmt, 1);
+    if (db_step(stmt) == SQLITE_ROW) {
+        static const ReportColumn columns[] = {
+            { "Makler Name", "makler_name", REPORT_COL_TEXT, 30 },
+            { "Deal Count", "deal_count", REPORT_COL_INT, 15 },
+        };
         
-        printf("\nMakler with Most Deals:\n");
-        printf("%-30s %-15s\n", "Makler Name", "Deal Count");
-        printf("------------------------------------------------\n");
-        printf("%-30s %-15d\n", makler_name, deal_count);
+        ReportWriter *rw = reports_output();
+        report_writer_begin(rw, "max_deals_makler", "Makler with Most Deals", columns, REPORT_COLUMN_COUNT(columns));
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 0));
+        report_writer_int(rw, sqlite3_column_int(stmt, 1));
+        report_writer_end(rw);
+        report_writer_flush(rw);
     }
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
 }
 
 void deals_show_sales_by_suppliers() {
+    METRICS_FUNC();
     sqlite3 *db = db_get_connection();
     if (!db) return;
     
-    char sql[] = "SELECT g.supplier, COUNT(d.id) as deal_count, SUM(d.quantity) as total_quantity, SUM(d.total_amount) as total_amount "
-                "FROM PERFUME_DEALS d "
-                "JOIN PERFUME_GOODS g ON d.good_id = g.id "
-                "GROUP BY g.supplier "
-                "ORDER BY total_amount DESC;";
+    // Grouped on the supplier each deal was made under; goods without one
+    // are grouped under "(none)" so the totals add up to all sales
+    char sql[] = "SELECT COALESCE(s.name, '" REPORTS_NONE "'), t.deal_count, t.total_quantity, t.total_amount "
+                "FROM (SELECT COALESCE(supplier_id, 0) as supplier_id, COUNT(*) as deal_count, "
+                "SUM(quantity) as total_quantity, SUM(total_amount) as total_amount "
+                "FROM PERFUME_DEALS GROUP BY 1) t "
+                "LEFT JOIN PERFUME_SUPPLIERS s ON s.id = t.supplier_id "
+                "ORDER BY t.total_amount DESC;";
     
     sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return;
     }
     
-    printf("\nSales by Supplier:\n");
-    printf("%-20s %-12s %-15s %-15s\n", "Supplier", "Deal Count", "Total Quantity", "Total Amount");
-    printf("-------------------------------------------------------------------\n");
+    static const ReportColumn columns[] = {
+        { "Supplier", "supplier", REPORT_COL_TEXT, 20 },
+        { "Deal Count", "deal_count", REPORT_COL_INT, 12 },
+        { "Total Quantity", "total_quantity", REPORT_COL_INT, 15 },
+        { "Total Amount", "total_amount", REPORT_COL_REAL, 15 },
+    };
     
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char *supplier = (const char *)sqlite3_column_text(stmt, 0);
-        int deal_count = sqlite3_column_int(stmt, 1);
-        int total_quantity = sqlite3_column_int(stmt, 2);
-        double total_amount = sqlite3_column_double(stmt, 3);
-        
-        printf("%-20s %-12d %-15d %-15.2f\n", supplier, deal_count, total_quantity, total_amount);
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "sales_by_suppliers", "Sales by Supplier", columns, REPORT_COLUMN_COUNT(columns));
+    
+    while (db_step(stmt) == SQLITE_ROW) {
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 0));
+        report_writer_int(rw, sqlite3_column_int(stmt, 1));
+        report_writer_int(rw, sqlite3_column_int(stmt, 2));
+        report_writer_real(rw, sqlite3_column_double(stmt, 3));
+        report_writer_end_row(rw);
     }
     
-    sqlite3_finalize(stmt);
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    db_finalize(stmt);
 }
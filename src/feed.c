@@ -0,0 +1,146 @@
+#include "feed.h"
+#include "database.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+static volatile sig_atomic_t stop_requested = 0;
+
+void feed_stop() {
+    stop_requested = 1;
+}
+
+long long feed_last_seq() {
+    METRICS_FUNC();
+    sqlite3_stmt *stmt;
+    int rc = db_prepare("SELECT COALESCE(MAX(seq), 0) FROM PERFUME_DEAL_FEED;", &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db_get_connection()));
+        return -1;
+    }
+    
+    long long seq = db_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : -1;
+    db_finalize(stmt);
+    return seq;
+}
+
+static void copy_text(char *buffer, size_t size, const unsigned char *text) {
+    snprintf(buffer, size, "%s", text ? (const char *)text : "");
+}
+
+static time_t parse_deal_date(const char *text) {
+    struct tm tm = {0};
+    if (!text || sscanf(text, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                        &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) {
+        return (time_t)-1;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+int feed_read(long long after_seq, int limit, FeedVisitor visit, void *ctx, long long *last_seq) {
+    METRICS_FUNC();
+    // Range scan on the feed's primary key, then a rowid lookup per deal
+    char *sql = "SELECT f.seq, d.id, d.deal_date, d.good_name, d.good_type, d.quantity, "
+                "d.total_amount, d.makler_id, d.good_id, d.buyer "
+                "FROM PERFUME_DEAL_FEED f JOIN PERFUME_DEALS d ON d.id = f.deal_id "
+                "WHERE f.seq > ? ORDER BY f.seq LIMIT ?;";
+    sqlite3_stmt *stmt;
+    
+    int rc = db_prepare(sql, &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db_get_connection()));
+        return -1;
+    }
+    
+    sqlite3_bind_int64(stmt, 1, after_seq);
+    sqlite3_bind_int(stmt, 2, limit > 0 ? limit : -1);
+    
+    int count = 0;
+    if (last_seq) *last_seq = after_seq;
+    
+    while ((rc = db_step(stmt)) == SQLITE_ROW) {
+        FeedEvent event;
+        memset(&event, 0, sizeof(event));
+        event.seq = sqlite3_column_int64(stmt, 0);
+        event.deal.id = sqlite3_column_int(stmt, 1);
+        event.deal.deal_date = parse_deal_date((const char *)sqlite3_column_text(stmt, 2));
+        copy_text(event.deal.good_name, sizeof(event.deal.good_name), sqlite3_column_text(stmt, 3));
+        copy_text(event.deal.good_type, sizeof(event.deal.good_type), sqlite3_column_text(stmt, 4));
+        event.deal.quantity = sqlite3_column_int(stmt, 5);
+        event.deal.total_amount = sqlite3_column_double(stmt, 6);
+        event.deal.makler_id = sqlite3_column_int(stmt, 7);
+        event.deal.good_id = sqlite3_column_int(stmt, 8);
+        copy_text(event.deal.buyer, sizeof(event.deal.buyer), sqlite3_column_text(stmt, 9));
+        
+        count++;
+        if (last_seq) *last_seq = event.seq;
+        if (visit && visit(&event, ctx) != 0) {
+            rc = SQLITE_DONE;
+            break;
+        }
+    }
+    
+    db_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Feed read failed: %s\n", sqlite3_errmsg(db_get_connection()));
+        return -1;
+    }
+    return count;
+}
+
+// Changes whenever another connection commits to the database file
+static long long data_version() {
+    sqlite3_stmt *stmt;
+    if (db_prepare("PRAGMA data_version;", &stmt) != SQLITE_OK) return -1;
+    long long version = db_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : -1;
+    db_finalize(stmt);
+    return version;
+}
+
+typedef struct {
+    FeedVisitor visit;
+    void *ctx;
+    int stopped;
+} FollowContext;
+
+static int follow_visit(const FeedEvent *event, void *arg) {
+    FollowContext *follow = (FollowContext *)arg;
+    if (follow->visit(event, follow->ctx) != 0) {
+        follow->stopped = 1;
+    }
+    return follow->stopped || stop_requested;
+}
+
+long long feed_follow(long long after_seq, int batch_size, int poll_ms, FeedVisitor visit, void *ctx) {
+    METRICS_FUNC();
+    if (batch_size <= 0) batch_size = FEED_DEFAULT_BATCH;
+    if (poll_ms <= 0) poll_ms = FEED_DEFAULT_POLL_MS;
+    
+    // Writers in other processes briefly lock the file while they commit
+    sqlite3_busy_timeout(db_get_connection(), FEED_BUSY_TIMEOUT_MS);
+    
+    FollowContext follow = { visit, ctx, 0 };
+    long long cursor = after_seq;
+    stop_requested = 0;
+    
+    while (!follow.stopped && !stop_requested) {
+        long long version = data_version();
+        int count = feed_read(cursor, batch_size, follow_visit, &follow, &cursor);
+        if (count < 0) return -1;
+        if (follow.stopped || stop_requested) break;
+        if (count == batch_size) continue;  // still catching up
+        
+        // Caught up: sleep until some connection commits
+        struct timespec pause = { poll_ms / 1000, (long)(poll_ms % 1000) * 1000000L };
+        while (!stop_requested && data_version() == version) {
+            nanosleep(&pause, NULL);
+            metrics_poll();
+        }
+    }
+    return cursor;
+}
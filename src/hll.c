@@ -0,0 +1,295 @@
+#include "hll.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Sparse entries are little-endian uint32 values, index << 8 | rank,
+// sorted by index with at most one entry per register
+#define ENTRY_SIZE 4
+
+uint64_t hll_hash(const char *value, size_t length) {
+    // FNV-1a, then the splitmix64 finalizer so every bit depends on
+    // every input byte (the rank reads the low bits)
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)value[i];
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+void hll_position(uint64_t hash, int *index, uint8_t *rank) {
+    *index = (int)(hash >> (64 - HLL_PRECISION));
+    uint64_t rest = hash << HLL_PRECISION;
+    *rank = rest ? (uint8_t)(__builtin_clzll(rest) + 1) : (uint8_t)(64 - HLL_PRECISION + 1);
+}
+
+void hll_clear(Hll *hll) {
+    memset(hll->registers, 0, sizeof(hll->registers));
+}
+
+void hll_add(Hll *hll, uint64_t hash) {
+    int index;
+    uint8_t rank;
+    hll_position(hash, &index, &rank);
+    if (rank > hll->registers[index]) hll->registers[index] = rank;
+}
+
+static uint32_t read_entry(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void write_entry(uint8_t *p, uint32_t entry) {
+    p[0] = (uint8_t)entry;
+    p[1] = (uint8_t)(entry >> 8);
+    p[2] = (uint8_t)(entry >> 16);
+    p[3] = (uint8_t)(entry >> 24);
+}
+
+static int is_dense(const uint8_t *sketch, int size) {
+    return size == HLL_DENSE_SIZE && sketch[0] == HLL_FORMAT_DENSE;
+}
+
+static int is_sparse(const uint8_t *sketch, int size) {
+    return size >= 1 && sketch[0] == HLL_FORMAT_SPARSE && (size - 1) % ENTRY_SIZE == 0;
+}
+
+int hll_merge_encoded(Hll *hll, const void *sketch, int size) {
+    const uint8_t *bytes = sketch;
+    if (is_dense(bytes, size)) {
+        for (int i = 0; i < HLL_REGISTERS; i++) {
+            if (bytes[1 + i] > hll->registers[i]) hll->registers[i] = bytes[1 + i];
+        }
+        return 0;
+    }
+    if (!is_sparse(bytes, size)) return -1;
+    
+    for (int offset = 1; offset < size; offset += ENTRY_SIZE) {
+        uint32_t entry = read_entry(bytes + offset);
+        uint32_t index = entry >> 8;
+        uint8_t rank = (uint8_t)entry;
+        if (index >= HLL_REGISTERS) return -1;
+        if (rank > hll->registers[index]) hll->registers[index] = rank;
+    }
+    return 0;
+}
+
+double hll_estimate(const Hll *hll) {
+    double sum = 0.0;
+    int zeros = 0;
+    for (int i = 0; i < HLL_REGISTERS; i++) {
+        sum += ldexp(1.0, -hll->registers[i]);
+        if (hll->registers[i] == 0) zeros++;
+    }
+    
+    double m = HLL_REGISTERS;
+    double estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+    // Linear counting is far more accurate while many registers are empty
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log(m / zeros);
+    }
+    return estimate;
+}
+
+// Encodes sparse while few registers are set; the buffer is from sqlite3_malloc
+static uint8_t* hll_encode(const Hll *hll, int *size) {
+    int used = 0;
+    for (int i = 0; i < HLL_REGISTERS; i++) {
+        if (hll->registers[i]) used++;
+    }
+    
+    uint8_t *out;
+    if (used > HLL_SPARSE_MAX) {
+        *size = HLL_DENSE_SIZE;
+        out = sqlite3_malloc(*size);
+        if (!out) return NULL;
+        out[0] = HLL_FORMAT_DENSE;
+        memcpy(out + 1, hll->registers, HLL_REGISTERS);
+        return out;
+    }
+    
+    *size = 1 + used * ENTRY_SIZE;
+    out = sqlite3_malloc(*size);
+    if (!out) return NULL;
+    out[0] = HLL_FORMAT_SPARSE;
+    uint8_t *write = out + 1;
+    for (int i = 0; i < HLL_REGISTERS; i++) {
+        if (!hll->registers[i]) continue;
+        write_entry(write, (uint32_t)i << 8 | hll->registers[i]);
+        write += ENTRY_SIZE;
+    }
+    return out;
+}
+
+static void result_sketch(sqlite3_context *ctx, const Hll *hll) {
+    int size;
+    uint8_t *sketch = hll_encode(hll, &size);
+    if (!sketch) {
+        sqlite3_result_error_nomem(ctx);
+        return;
+    }
+    sqlite3_result_blob(ctx, sketch, size, sqlite3_free);
+}
+
+// Adds to an encoded sketch directly, so the common case (a sparse sketch
+// or a register that doesn't grow) never expands the registers
+static void sql_hll_add(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+    (void)argc;
+    if (sqlite3_value_type(argv[1]) == SQLITE_NULL) {
+        sqlite3_result_value(ctx, argv[0]);
+        return;
+    }
+    
+    const uint8_t *sketch = sqlite3_value_blob(argv[0]);
+    int size = sqlite3_value_bytes(argv[0]);
+    const char *value = (const char *)sqlite3_value_text(argv[1]);
+    int index;
+    uint8_t rank;
+    hll_position(hll_hash(value, (size_t)sqlite3_value_bytes(argv[1])), &index, &rank);
+    
+    if (!sketch || size == 0) {
+        uint8_t created[1 + ENTRY_SIZE] = { HLL_FORMAT_SPARSE };
+        write_entry(created + 1, (uint32_t)index << 8 | rank);
+        sqlite3_result_blob(ctx, created, sizeof(created), SQLITE_TRANSIENT);
+        return;
+    }
+    
+    if (is_dense(sketch, size)) {
+        if (sketch[1 + index] >= rank) {
+            sqlite3_result_value(ctx, argv[0]);
+            return;
+        }
+        uint8_t *updated = sqlite3_malloc(size);
+        if (!updated) {
+            sqlite3_result_error_nomem(ctx);
+            return;
+        }
+        memcpy(updated, sketch, size);
+        updated[1 + index] = rank;
+        sqlite3_result_blob(ctx, updated, size, sqlite3_free);
+        return;
+    }
+    
+    if (!is_sparse(sketch, size)) {
+        sqlite3_result_error(ctx, "hll_add: malformed sketch", -1);
+        return;
+    }
+    
+    // Binary search for the register's entry or its insertion point
+    int count = (size - 1) / ENTRY_SIZE;
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if ((int)(read_entry(sketch + 1 + mid * ENTRY_SIZE) >> 8) < index) lo = mid + 1;
+        else hi = mid;
+    }
+    int found = lo < count && (int)(read_entry(sketch + 1 + lo * ENTRY_SIZE) >> 8) == index;
+    if (found && (uint8_t)read_entry(sketch + 1 + lo * ENTRY_SIZE) >= rank) {
+        sqlite3_result_value(ctx, argv[0]);
+        return;
+    }
+    
+    if (!found && count + 1 > HLL_SPARSE_MAX) {
+        Hll *hll = sqlite3_malloc(sizeof(Hll));
+        if (!hll) {
+            sqlite3_result_error_nomem(ctx);
+            return;
+        }
+        hll_clear(hll);
+        hll_merge_encoded(hll, sketch, size);
+        hll->registers[index] = rank;
+        result_sketch(ctx, hll);
+        sqlite3_free(hll);
+        return;
+    }
+    
+    int new_size = found ? size : size + ENTRY_SIZE;
+    uint8_t *updated = sqlite3_malloc(new_size);
+    if (!updated) {
+        sqlite3_result_error_nomem(ctx);
+        return;
+    }
+    int split = 1 + lo * ENTRY_SIZE;
+    memcpy(updated, sketch, split);
+    write_entry(updated + split, (uint32_t)index << 8 | rank);
+    int tail = found ? split + ENTRY_SIZE : split;
+    memcpy(updated + split + ENTRY_SIZE, sketch + tail, size - tail);
+    sqlite3_result_blob(ctx, updated, new_size, sqlite3_free);
+}
+
+static void sql_hll_sketch_step(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+    (void)argc;
+    Hll *hll = sqlite3_aggregate_context(ctx, sizeof(Hll));
+    if (!hll) {
+        sqlite3_result_error_nomem(ctx);
+        return;
+    }
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+    
+    const char *value = (const char *)sqlite3_value_text(argv[0]);
+    hll_add(hll, hll_hash(value, (size_t)sqlite3_value_bytes(argv[0])));
+}
+
+static void sql_hll_merge_step(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+    (void)argc;
+    Hll *hll = sqlite3_aggregate_context(ctx, sizeof(Hll));
+    if (!hll) {
+        sqlite3_result_error_nomem(ctx);
+        return;
+    }
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+    
+    if (hll_merge_encoded(hll, sqlite3_value_blob(argv[0]), sqlite3_value_bytes(argv[0])) != 0) {
+        sqlite3_result_error(ctx, "hll_merge: malformed sketch", -1);
+    }
+}
+
+static void sql_hll_final(sqlite3_context *ctx) {
+    Hll *hll = sqlite3_aggregate_context(ctx, 0);
+    if (!hll) {
+        sqlite3_result_null(ctx);
+        return;
+    }
+    result_sketch(ctx, hll);
+}
+
+static void sql_hll_count(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+    (void)argc;
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+        sqlite3_result_int64(ctx, 0);
+        return;
+    }
+    
+    Hll *hll = sqlite3_malloc(sizeof(Hll));
+    if (!hll) {
+        sqlite3_result_error_nomem(ctx);
+        return;
+    }
+    hll_clear(hll);
+    if (hll_merge_encoded(hll, sqlite3_value_blob(argv[0]), sqlite3_value_bytes(argv[0])) != 0) {
+        sqlite3_result_error(ctx, "hll_count: malformed sketch", -1);
+    } else {
+        sqlite3_result_int64(ctx, llround(hll_estimate(hll)));
+    }
+    sqlite3_free(hll);
+}
+
+int hll_register_sql(sqlite3 *db) {
+    int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC;
+    if (sqlite3_create_function(db, "hll_add", 2, flags, NULL, sql_hll_add, NULL, NULL) != SQLITE_OK ||
+        sqlite3_create_function(db, "hll_sketch", 1, flags, NULL, NULL,
+                                sql_hll_sketch_step, sql_hll_final) != SQLITE_OK ||
+        sqlite3_create_function(db, "hll_merge", 1, flags, NULL, NULL,
+                                sql_hll_merge_step, sql_hll_final) != SQLITE_OK ||
+        sqlite3_create_function(db, "hll_count", 1, flags, NULL, sql_hll_count, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Failed to register sketch functions: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,544 @@
+#include "journal.h"
+#include "database.h"
+#include "metrics.h"
+#include "crc32.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// File layout (native byte order):
+//
+//   JournalHeader
+//   { JournalFrame, payload } ...
+//
+// The CRC covers the frame type and the payload, so a record torn by a
+// crash is detected and replay stops before it.
+//
+// JOURNAL_DEAL payload:      int32 id, good_id, makler_id, quantity,
+//                            supplier_id, type_id; double total_amount;
+//                            then deal_date ("YYYY-MM-DD HH:MM:SS"),
+//                            good_name, good_type and buyer as uint16
+//                            length + bytes
+// JOURNAL_STOCK_SET payload: int32 good_id, quantity
+
+#define JOURNAL_MAX_PAYLOAD 4096
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} JournalHeader;
+
+typedef struct {
+    uint32_t length;
+    uint32_t crc;
+    uint32_t type;
+} JournalFrame;
+
+static int journal_fd = -1;
+static int sync_every = JOURNAL_DEFAULT_SYNC_RECORDS;
+static uint64_t sync_interval_ns = 0;
+static uint64_t last_sync_ns = 0;
+static int unsynced_records = 0;
+
+// Records of the open transaction, written on commit
+static char *pending = NULL;
+static size_t pending_size = 0;
+static size_t pending_capacity = 0;
+static int pending_records = 0;
+
+static int pending_append(const void *data, size_t size) {
+    if (pending_size + size > pending_capacity) {
+        size_t capacity = pending_capacity ? pending_capacity : 4096;
+        while (capacity < pending_size + size) {
+            capacity *= 2;
+        }
+        char *grown = realloc(pending, capacity);
+        if (!grown) {
+            return -1;
+        }
+        pending = grown;
+        pending_capacity = capacity;
+    }
+    memcpy(pending + pending_size, data, size);
+    pending_size += size;
+    return 0;
+}
+
+int journal_open(const char *path, int sync_records, int sync_ms) {
+    journal_close();
+    
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Can't open journal: %s\n", path);
+        return -1;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    
+    JournalHeader header;
+    if (st.st_size == 0) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+        header.version = JOURNAL_VERSION;
+        if (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header) || fsync(fd) != 0) {
+            fprintf(stderr, "Can't write journal header: %s\n", path);
+            close(fd);
+            return -1;
+        }
+    } else if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+               memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+               header.version != JOURNAL_VERSION) {
+        fprintf(stderr, "Not a journal file (or another version): %s\n", path);
+        close(fd);
+        return -1;
+    } else {
+        // Records appended after a torn tail would be unreachable, since
+        // reading stops at the first bad frame: cut the tail off first
+        long truncated = 0;
+        if (journal_read(path, NULL, NULL, &truncated) < 0) {
+            close(fd);
+            return -1;
+        }
+        if (truncated > 0) {
+            if (ftruncate(fd, st.st_size - truncated) != 0 || fsync(fd) != 0) {
+                fprintf(stderr, "Can't truncate torn journal tail: %s\n", path);
+                close(fd);
+                return -1;
+            }
+            fprintf(stderr, "Journal %s: dropped %ld bytes of torn tail\n", path, truncated);
+        }
+    }
+    
+    journal_fd = fd;
+    sync_every = sync_records;
+    sync_interval_ns = sync_ms > 0 ? (uint64_t)sync_ms * 1000000 : 0;
+    last_sync_ns = metrics_now_ns();
+    unsynced_records = 0;
+    pending_size = 0;
+    pending_records = 0;
+    return 0;
+}
+
+void journal_close() {
+    if (journal_fd < 0) return;
+    journal_commit();
+    journal_sync();
+    close(journal_fd);
+    journal_fd = -1;
+    free(pending);
+    pending = NULL;
+    pending_size = pending_capacity = 0;
+    pending_records = 0;
+}
+
+int journal_enabled() {
+    return journal_fd >= 0;
+}
+
+// Encoding
+
+static void put_int(char **p, int32_t value) {
+    memcpy(*p, &value, sizeof(value));
+    *p += sizeof(value);
+}
+
+static void put_string(char **p, const char *value) {
+    uint16_t length = (uint16_t)strnlen(value, 1024);
+    memcpy(*p, &length, sizeof(length));
+    memcpy(*p + sizeof(length), value, length);
+    *p += sizeof(length) + length;
+}
+
+static void append_record(JournalRecordType type, const char *payload, size_t length) {
+    JournalFrame frame;
+    frame.length = (uint32_t)length;
+    frame.type = (uint32_t)type;
+    frame.crc = crc32_update(crc32_update(0, &frame.type, sizeof(frame.type)), payload, length);
+    
+    size_t mark = pending_size;
+    if (pending_append(&frame, sizeof(frame)) != 0 || pending_append(payload, length) != 0) {
+        pending_size = mark;
+        fprintf(stderr, "Out of memory, journal record dropped\n");
+        return;
+    }
+    pending_records++;
+}
+
+void journal_append_deal(const Deal *deal) {
+    if (journal_fd < 0) return;
+    
+    char date_str[20];
+    strftime(date_str, sizeof(date_str), "%Y-%m-%d %H:%M:%S", localtime(&deal->deal_date));
+    
+    char payload[JOURNAL_MAX_PAYLOAD];
+    char *p = payload;
+    put_int(&p, deal->id);
+    put_int(&p, deal->good_id);
+    put_int(&p, deal->makler_id);
+    put_int(&p, deal->quantity);
+    put_int(&p, deal->supplier_id);
+    put_int(&p, deal->type_id);
+    memcpy(p, &deal->total_amount, sizeof(double));
+    p += sizeof(double);
+    put_string(&p, date_str);
+    put_string(&p, deal->good_name);
+    put_string(&p, deal->good_type);
+    put_string(&p, deal->buyer);
+    
+    append_record(JOURNAL_DEAL, payload, (size_t)(p - payload));
+}
+
+void journal_append_stock(int good_id, int quantity) {
+    if (journal_fd < 0) return;
+    
+    char payload[2 * sizeof(int32_t)];
+    char *p = payload;
+    put_int(&p, good_id);
+    put_int(&p, quantity);
+    append_record(JOURNAL_STOCK_SET, payload, sizeof(payload));
+}
+
+size_t journal_mark() {
+    return pending_size;
+}
+
+void journal_rollback_to(size_t mark) {
+    if (mark > pending_size) return;
+    
+    // Recount records left in the buffer
+    pending_records = 0;
+    for (size_t pos = 0; pos < mark; ) {
+        JournalFrame frame;
+        memcpy(&frame, pending + pos, sizeof(frame));
+        pos += sizeof(frame) + frame.length;
+        pending_records++;
+    }
+    pending_size = mark;
+}
+
+int journal_sync() {
+    if (journal_fd < 0 || unsynced_records == 0) return 0;
+    if (fdatasync(journal_fd) != 0) {
+        fprintf(stderr, "Journal fsync failed\n");
+        return -1;
+    }
+    unsynced_records = 0;
+    last_sync_ns = metrics_now_ns();
+    return 0;
+}
+
+int journal_commit() {
+    METRICS_FUNC();
+    if (journal_fd < 0 || pending_size == 0) return 0;
+    
+    // One sequential write for the whole transaction. A write that fails
+    // part way is cut off again, as records appended behind a partial
+    // frame could never be read.
+    off_t start = lseek(journal_fd, 0, SEEK_END);
+    size_t written = 0;
+    while (written < pending_size) {
+        ssize_t n = write(journal_fd, pending + written, pending_size - written);
+        if (n <= 0) {
+            fprintf(stderr, "Journal write failed\n");
+            if (written > 0 && (start < 0 || ftruncate(journal_fd, start) != 0)) {
+                fprintf(stderr, "Can't cut off a partial journal write, journal closed\n");
+                close(journal_fd);
+                journal_fd = -1;
+            }
+            pending_size = 0;
+            pending_records = 0;
+            return -1;
+        }
+        written += (size_t)n;
+    }
+    unsynced_records += pending_records;
+    pending_size = 0;
+    pending_records = 0;
+    
+    // Group commit: pay for fsync once per batch of records or interval
+    int due = sync_every > 0 && unsynced_records >= sync_every;
+    if (!due && sync_interval_ns > 0 && metrics_now_ns() - last_sync_ns >= sync_interval_ns) {
+        due = 1;
+    }
+    return due ? journal_sync() : 0;
+}
+
+// Reading
+
+static int get_int(const char **p, const char *end, int *value) {
+    int32_t v;
+    if (end - *p < (long)sizeof(v)) return -1;
+    memcpy(&v, *p, sizeof(v));
+    *p += sizeof(v);
+    *value = v;
+    return 0;
+}
+
+static int get_string(const char **p, const char *end, char *buffer, size_t size) {
+    uint16_t length;
+    if (end - *p < (long)sizeof(length)) return -1;
+    memcpy(&length, *p, sizeof(length));
+    *p += sizeof(length);
+    if (end - *p < (long)length || length >= size) return -1;
+    memcpy(buffer, *p, length);
+    buffer[length] = '\0';
+    *p += length;
+    return 0;
+}
+
+static time_t parse_deal_date(const char *text) {
+    struct tm tm = {0};
+    if (sscanf(text, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) {
+        return (time_t)-1;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+static int decode_record(uint32_t type, const char *payload, size_t length, JournalRecord *record) {
+    const char *p = payload;
+    const char *end = payload + length;
+    memset(record, 0, sizeof(*record));
+    record->type = (JournalRecordType)type;
+    
+    if (type == JOURNAL_DEAL) {
+        Deal *deal = &record->deal;
+        char date_str[32];
+        if (get_int(&p, end, &deal->id) != 0 ||
+            get_int(&p, end, &deal->good_id) != 0 ||
+            get_int(&p, end, &deal->makler_id) != 0 ||
+            get_int(&p, end, &deal->quantity) != 0 ||
+            get_int(&p, end, &deal->supplier_id) != 0 ||
+            get_int(&p, end, &deal->type_id) != 0 ||
+            end - p < (long)sizeof(double)) {
+            return -1;
+        }
+        memcpy(&deal->total_amount, p, sizeof(double));
+        p += sizeof(double);
+        if (get_string(&p, end, date_str, sizeof(date_str)) != 0 ||
+            get_string(&p, end, deal->good_name, sizeof(deal->good_name)) != 0 ||
+            get_string(&p, end, deal->good_type, sizeof(deal->good_type)) != 0 ||
+            get_string(&p, end, deal->buyer, sizeof(deal->buyer)) != 0) {
+            return -1;
+        }
+        deal->deal_date = parse_deal_date(date_str);
+        return deal->deal_date == (time_t)-1 ? -1 : 0;
+    }
+    if (type == JOURNAL_STOCK_SET) {
+        return get_int(&p, end, &record->good_id) == 0 &&
+               get_int(&p, end, &record->quantity) == 0 ? 0 : -1;
+    }
+    return -1;
+}
+
+long journal_read(const char *path, JournalVisitor visit, void *ctx, long *truncated_bytes) {
+    METRICS_FUNC();
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Can't open journal: %s\n", path);
+        return -1;
+    }
+    
+    JournalHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != JOURNAL_VERSION) {
+        fprintf(stderr, "Not a journal file (or another version): %s\n", path);
+        fclose(f);
+        return -1;
+    }
+    
+    // A large stdio buffer keeps the scan sequential
+    static char io_buffer[1 << 16];
+    setvbuf(f, io_buffer, _IOFBF, sizeof(io_buffer));
+    
+    char payload[JOURNAL_MAX_PAYLOAD];
+    long count = 0;
+    long good_end = (long)sizeof(header);
+    
+    while (1) {
+        JournalFrame frame;
+        if (fread(&frame, sizeof(frame), 1, f) != 1) break;
+        if (frame.length > sizeof(payload) || fread(payload, 1, frame.length, f) != frame.length) break;
+        
+        uint32_t crc = crc32_update(crc32_update(0, &frame.type, sizeof(frame.type)), payload, frame.length);
+        JournalRecord record;
+        if (crc != frame.crc || decode_record(frame.type, payload, frame.length, &record) != 0) break;
+        
+        good_end += (long)(sizeof(frame) + frame.length);
+        count++;
+        if (visit && visit(&record, ctx) != 0) {
+            fclose(f);
+            return -1;
+        }
+    }
+    
+    fseek(f, 0, SEEK_END);
+    if (truncated_bytes) {
+        *truncated_bytes = ftell(f) - good_end;
+    }
+    fclose(f);
+    return count;
+}
+
+// Replay
+
+typedef struct {
+    int known;           // stock was set by the journal
+    long long quantity;
+} ReplayStock;
+
+typedef struct {
+    JournalReplayStats *stats;
+    ReplayStock *stock;
+    int stock_size;
+} ReplayContext;
+
+static ReplayStock* replay_stock(ReplayContext *ctx, int good_id) {
+    if (good_id < 0) return NULL;
+    if (good_id >= ctx->stock_size) {
+        int size = ctx->stock_size ? ctx->stock_size : 256;
+        while (size <= good_id) size *= 2;
+        ReplayStock *grown = realloc(ctx->stock, sizeof(ReplayStock) * size);
+        if (!grown) return NULL;
+        memset(grown + ctx->stock_size, 0, sizeof(ReplayStock) * (size - ctx->stock_size));
+        ctx->stock = grown;
+        ctx->stock_size = size;
+    }
+    return &ctx->stock[good_id];
+}
+
+static int replay_record(const JournalRecord *record, void *arg) {
+    ReplayContext *ctx = (ReplayContext *)arg;
+    ReplayStock *stock;
+    
+    switch (record->type) {
+        case JOURNAL_DEAL:
+            ctx->stats->deals++;
+            if (db_apply_deal_aggregates(&record->deal) != 0) return -1;
+            stock = replay_stock(ctx, record->deal.good_id);
+            if (stock && stock->known) stock->quantity -= record->deal.quantity;
+            break;
+        case JOURNAL_STOCK_SET:
+            ctx->stats->stock_sets++;
+            stock = replay_stock(ctx, record->good_id);
+            if (stock) {
+                stock->known = 1;
+                stock->quantity = record->quantity;
+            }
+            break;
+    }
+    return 0;
+}
+
+typedef struct {
+    int *ids;
+    long count;
+    long capacity;
+} JournaledDeals;
+
+static int collect_deal_id(const JournalRecord *record, void *arg) {
+    JournaledDeals *deals = (JournaledDeals *)arg;
+    if (record->type != JOURNAL_DEAL) return 0;
+    if (deals->count == deals->capacity) {
+        long capacity = deals->capacity ? deals->capacity * 2 : 1024;
+        int *grown = realloc(deals->ids, sizeof(int) * capacity);
+        if (!grown) return -1;
+        deals->ids = grown;
+        deals->capacity = capacity;
+    }
+    deals->ids[deals->count++] = record->deal.id;
+    return 0;
+}
+
+static int compare_ids(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Counts the deals in the database that have no journal record, or -1 on
+// error. Rows deleted since they were journaled don't matter.
+static long count_unjournaled_deals(const char *path) {
+    JournaledDeals deals = { NULL, 0, 0 };
+    if (journal_read(path, collect_deal_id, &deals, NULL) < 0) {
+        free(deals.ids);
+        return -1;
+    }
+    if (deals.count > 0) {
+        qsort(deals.ids, (size_t)deals.count, sizeof(int), compare_ids);
+    }
+    
+    sqlite3_stmt *stmt;
+    if (db_prepare("SELECT id FROM PERFUME_DEALS;", &stmt) != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db_get_connection()));
+        free(deals.ids);
+        return -1;
+    }
+    long missing = 0;
+    while (db_step(stmt) == SQLITE_ROW) {
+        int id = sqlite3_column_int(stmt, 0);
+        if (deals.count == 0 || !bsearch(&id, deals.ids, (size_t)deals.count, sizeof(int), compare_ids)) {
+            missing++;
+        }
+    }
+    db_finalize(stmt);
+    free(deals.ids);
+    return missing;
+}
+
+int journal_replay(const char *path, JournalReplayStats *stats) {
+    METRICS_FUNC();
+    JournalReplayStats local;
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+    
+    ReplayContext ctx = { stats, NULL, 0 };
+    
+    if (db_begin_transaction() != 0) return -1;
+    
+    // The aggregates are rebuilt from journaled deals alone, so deals made
+    // before the journal was enabled would silently lose their statistics
+    long missing = count_unjournaled_deals(path);
+    if (missing != 0) {
+        if (missing > 0) {
+            fprintf(stderr, "The journal doesn't cover %ld deal(s) in the database, not replayed\n", missing);
+        }
+        db_rollback_transaction();
+        return -1;
+    }
+    
+    if (db_reset_aggregates() != 0) {
+        db_rollback_transaction();
+        return -1;
+    }
+    
+    stats->records = journal_read(path, replay_record, &ctx, &stats->truncated_bytes);
+    int rc = stats->records < 0 ? -1 : 0;
+    
+    // Stock is only rebuilt for goods whose starting stock is journaled
+    for (int id = 0; rc == 0 && id < ctx.stock_size; id++) {
+        if (ctx.stock[id].known) {
+            rc = db_set_good_quantity(id, (int)ctx.stock[id].quantity);
+        }
+    }
+    free(ctx.stock);
+    
+    if (rc != 0) {
+        db_rollback_transaction();
+        return -1;
+    }
+    return db_commit_transaction();
+}
@@ -1,24 +1,39 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
 #include "database.h"
 #include "auth.h"
 #include "ui.h"
 #include "deals.h"
 #include "reports.h"
+#include "metrics.h"
+#include "slowlog.h"
+#include "cli.h"
+#include "journal.h"
+#include "search.h"
+#include "reservations.h"
 
 #define DB_PATH "parfum_bazaar.db"
 
+static int permitted(Capabilities required) {
+    if (auth_can(required)) return 1;
+    ui_show_error("Permission denied.");
+    return 0;
+}
+
 void admin_menu() {
     int choice;
     
     do {
+        metrics_poll();
         ui_show_admin_menu();
         choice = ui_get_int("Enter your choice: ");
         
         switch (choice) {
             case 1: {
                 // Add makler
+                if (!permitted(CAP_MANAGE_USERS)) break;
                 Makler makler = {0};
                 ui_get_string("Name: ", makler.name, sizeof(makler.name));
                 ui_get_string("Address: ", makler.address, sizeof(makler.address));
@@ -29,7 +44,13 @@ void admin_menu() {
                 ui_get_string("Username: ", user.username, sizeof(user.username));
                 char password[50];
                 ui_get_string("Password: ", password, sizeof(password));
-                strcpy(user.password_hash, password);  // Direct password copy for testing
+                char *hash = auth_hash_password(password);
+                if (!hash) {
+                    ui_show_error("Failed to create user for makler.");
+                    break;
+                }
+                snprintf(user.password_hash, sizeof(user.password_hash), "%s", hash);
+                free(hash);
                 user.role = ROLE_MAKLER;
                 
                 int user_id = db_create_user(&user);
@@ -47,6 +68,7 @@ void admin_menu() {
             }
             case 2: {
                 // Add good
+                if (!permitted(CAP_MANAGE_GOODS)) break;
                 Good good = {0};
                 ui_get_string("Name: ", good.name, sizeof(good.name));
                 ui_get_string("Type: ", good.type, sizeof(good.type));
@@ -63,38 +85,44 @@ void admin_menu() {
                 break;
             }
             case 3: {
-                int count;
-                Deal **deals = db_get_all_deals(&count);
+                if (!permitted(CAP_VIEW_ALL_DEALS)) break;
                 printf("\nAll Deals:\n");
-                for (int i = 0; i < count; i++) {
-                    ui_display_deal(deals[i]);
-                    db_free_deal(deals[i]);
-                }
-                free(deals);
+                db_visit_deals(0, NULL, NULL, ui_display_deal_view, NULL);
                 break;
             }
             case 4: {
+                if (!permitted(CAP_RUN_REPORTS)) break;
                 char start[11], end[11];
                 ui_get_date("Start date (YYYY-MM-DD): ", start);
                 ui_get_date("End date (YYYY-MM-DD): ", end);
-                reports_sales_by_good(start, end);
+                ReportParams params = { .start_date = start, .end_date = end };
+                reports_run("sales-by-good", &params);
                 break;
             }
             case 5: {
-                reports_popular_good_type();
+                if (!permitted(CAP_RUN_REPORTS)) break;
+                ReportParams params = {0};
+                reports_run("popular-good-type", &params);
                 break;
             }
             case 6: {
-                reports_max_deals_makler();
+                if (!permitted(CAP_RUN_REPORTS)) break;
+                ReportParams params = {0};
+                reports_run("max-deals-makler", &params);
                 break;
             }
             case 7: {
+                if (!permitted(CAP_VIEW_METRICS)) break;
+                metrics_dump(stdout);
+                break;
+            }
+            case 8: {
                 auth_logout(auth_get_current_user());
                 return;
             }
         }
         ui_wait_enter();
-    } while (choice != 7);
+    } while (choice != 8 && !feof(stdin));
 }
 
 void makler_menu() {
@@ -108,12 +136,14 @@ void makler_menu() {
     }
     
     do {
+        metrics_poll();
         ui_show_makler_menu();
         choice = ui_get_int("Enter your choice: ");
         
         switch (choice) {
             case 1: {
                 // Create deal
+                if (!permitted(CAP_CREATE_DEAL)) break;
                 int good_id = ui_get_int("Good ID: ");
                 int quantity = ui_get_int("Quantity: ");
                 char buyer[100];
@@ -127,73 +157,278 @@ void makler_menu() {
                 break;
             }
             case 2: {
-                int count;
-                Deal **deals = deals_get_makler_deals(makler->id, &count);
+                if (!permitted(CAP_VIEW_OWN_DEALS)) break;
                 printf("\nYour Deals:\n");
-                for (int i = 0; i < count; i++) {
-                    ui_display_deal(deals[i]);
-                    db_free_deal(deals[i]);
-                }
-                free(deals);
+                db_visit_deals(makler->id, NULL, NULL, ui_display_deal_view, NULL);
                 break;
             }
             case 3: {
+                if (!permitted(CAP_VIEW_OWN_DEALS)) break;
                 int count;
                 MaklerStats *stats = db_get_makler_stats(makler->id, &count);
                 printf("\nYour Statistics:\n");
                 for (int i = 0; i < count; i++) {
                     ui_display_stats(&stats[i]);
                 }
+                free(stats);
                 break;
             }
             case 4: {
-                int count;
-                Good **goods = db_get_all_goods(&count);
+                if (!permitted(CAP_VIEW_GOODS)) break;
                 printf("\nAvailable Goods:\n");
-                for (int i = 0; i < count; i++) {
-                    ui_display_good(goods[i]);
-                    db_free_good(goods[i]);
-                }
-                free(goods);
+                db_visit_goods(ui_display_good_view, NULL);
                 break;
             }
             case 5: {
+                if (!permitted(CAP_VIEW_GOODS)) break;
+                char query[SEARCH_MAX_QUERY];
+                ui_get_string("Search for: ", query, sizeof(query));
+                reports_search(query, SEARCH_ALL, SEARCH_DEFAULT_RESULTS);
+                break;
+            }
+            case 6: {
+                // Holds live in this process, so they last as long as the
+                // session and no transaction stays open while negotiating
+                if (!permitted(CAP_CREATE_DEAL)) break;
+                int good_id = ui_get_int("Good ID: ");
+                int quantity = ui_get_int("Quantity: ");
+                int ttl = ui_get_int("Hold for seconds (0 for 900): ");
+                int hold_id = reservations_hold(good_id, quantity, makler->id,
+                                                ttl > 0 ? ttl : RESERVATION_DEFAULT_TTL_SECONDS);
+                if (hold_id > 0) {
+                    char message[64];
+                    snprintf(message, sizeof(message), "Hold %d placed.", hold_id);
+                    ui_show_success(message);
+                } else {
+                    ui_show_error("Not enough unreserved stock.");
+                }
+                break;
+            }
+            case 7: {
+                if (!permitted(CAP_CREATE_DEAL)) break;
+                int hold_id = ui_get_int("Hold ID: ");
+                char buyer[100];
+                ui_get_string("Buyer company: ", buyer, sizeof(buyer));
+                
+                if (reservations_confirm(hold_id, buyer) > 0) {
+                    ui_show_success("Deal created successfully!");
+                } else {
+                    ui_show_error("Failed to confirm hold.");
+                }
+                break;
+            }
+            case 8: {
+                if (!permitted(CAP_CREATE_DEAL)) break;
+                if (reservations_release(ui_get_int("Hold ID: ")) == 0) {
+                    ui_show_success("Hold released.");
+                } else {
+                    ui_show_error("No such hold, or it has expired.");
+                }
+                break;
+            }
+            case 9: {
                 auth_logout(current_user);
                 db_free_makler(makler);
                 return;
             }
         }
         ui_wait_enter();
-    } while (choice != 5);
+    } while (choice != 9 && !feof(stdin));
     
     db_free_makler(makler);
 }
 
-int main() {
+static void print_usage(const char *prog) {
+    printf("Usage: %s [--db PATH] [--stats-dump FILE] [--slow-log FILE] [--slow-ms N]\n", prog);
+    printf("       %s [options] COMMAND [key=value ...]\n", prog);
+    printf("       %s [options] --script FILE\n", prog);
+    printf("  --db PATH          Database file (default: %s)\n", DB_PATH);
+    printf("  --stats-dump FILE  Write function metrics to FILE at exit\n");
+    printf("  --slow-log FILE    Log statements slower than the threshold to FILE\n");
+    printf("  --slow-ms N        Slow query threshold in milliseconds (default: %.0f)\n",
+           SLOWLOG_DEFAULT_THRESHOLD_MS);
+    printf("  --report NAME      Run a report and exit (see the list below)\n");
+    printf("  --format FORMAT    Report format: table, csv or jsonl (default: table)\n");
+    printf("  --out FILE         Write the report to FILE instead of stdout\n");
+    printf("  --from DATE, --to DATE, --date DATE, --good NAME, --makler ID\n");
+    printf("                     Report parameters\n");
+    printf("  --by DIMENSION     top: good, makler, buyer or supplier\n");
+    printf("                     sales-series: good, type, makler or supplier\n");
+    printf("  --metric METRIC    top, sales-series: quantity, amount or deals (default: quantity)\n");
+    printf("  --limit K          top: number of entries (default: %d)\n", TOPK_DEFAULT_LIMIT);
+    printf("  --bucket PERIOD    sales-series: day, week or month (default: month)\n");
+    printf("  --window N         sales-series: moving average periods (default: %d)\n", SERIES_DEFAULT_WINDOW);
+    printf("  --key VALUE        distinct-buyers: one type, makler id or supplier\n");
+    printf("  --deadline MS      Run --report in time slices and stop it after MS milliseconds\n");
+    printf("  --snapshot FILE    Answer --report from a snapshot file instead of the database\n");
+    printf("  --journal FILE     Append committed deals and stock changes to FILE\n");
+    printf("  --journal-sync N   fsync the journal every N records (default: %d, 1 = every commit)\n",
+           JOURNAL_DEFAULT_SYNC_RECORDS);
+    printf("  --script FILE      Run commands from FILE (- for stdin) in one transaction\n");
+    printf("  --role ROLE        Limit commands to what admin, makler or analyst may do\n");
+    printf("Send SIGUSR1 to print function metrics to stderr.\n\n");
+    cli_print_commands(stdout);
+    printf("\n");
+    reports_print_catalog(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    const char *db_path = DB_PATH;
+    const char *slow_log_path = NULL;
+    double slow_ms = SLOWLOG_DEFAULT_THRESHOLD_MS;
+    const char *report_name = NULL;
+    const char *report_format = "table";
+    const char *report_out = NULL;
+    ReportParams report_params = {0};
+    const char *script_path = NULL;
+    const char *snapshot_path = NULL;
+    const char *journal_path = NULL;
+    int journal_sync = JOURNAL_DEFAULT_SYNC_RECORDS;
+    int command_index = 0;
+    const char *role_name = NULL;
+    
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            // Everything from the first non-option on is a command
+            command_index = i;
+            break;
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot_path = argv[++i];
+        } else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc) {
+            journal_path = argv[++i];
+        } else if (strcmp(argv[i], "--journal-sync") == 0 && i + 1 < argc) {
+            journal_sync = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--script") == 0 && i + 1 < argc) {
+            script_path = argv[++i];
+        } else if (strcmp(argv[i], "--role") == 0 && i + 1 < argc) {
+            role_name = argv[++i];
+        } else if (strcmp(argv[i], "--db") == 0 && i + 1 < argc) {
+            db_path = argv[++i];
+        } else if (strcmp(argv[i], "--stats-dump") == 0 && i + 1 < argc) {
+            metrics_set_exit_dump(argv[++i]);
+        } else if (strcmp(argv[i], "--slow-log") == 0 && i + 1 < argc) {
+            slow_log_path = argv[++i];
+        } else if (strcmp(argv[i], "--slow-ms") == 0 && i + 1 < argc) {
+            slow_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            report_name = argv[++i];
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            report_format = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            report_out = argv[++i];
+        } else if (strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+            report_params.start_date = argv[++i];
+        } else if (strcmp(argv[i], "--to") == 0 && i + 1 < argc) {
+            report_params.end_date = argv[++i];
+        } else if (strcmp(argv[i], "--date") == 0 && i + 1 < argc) {
+            report_params.date = argv[++i];
+        } else if (strcmp(argv[i], "--good") == 0 && i + 1 < argc) {
+            report_params.good_name = argv[++i];
+        } else if (strcmp(argv[i], "--makler") == 0 && i + 1 < argc) {
+            report_params.makler_id = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--by") == 0 && i + 1 < argc) {
+            report_params.by = argv[++i];
+        } else if (strcmp(argv[i], "--metric") == 0 && i + 1 < argc) {
+            report_params.metric = argv[++i];
+        } else if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) {
+            report_params.limit = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bucket") == 0 && i + 1 < argc) {
+            report_params.bucket = argv[++i];
+        } else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+            report_params.window = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--key") == 0 && i + 1 < argc) {
+            report_params.key = argv[++i];
+        } else if (strcmp(argv[i], "--deadline") == 0 && i + 1 < argc) {
+            report_params.deadline_ms = atoi(argv[++i]);
+        } else {
+            print_usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+    
+    // Command mode has no login: it runs as the local operator with every
+    // capability, or with a role's when --role names one
+    Capabilities batch_capabilities = CAP_ALL;
+    if (role_name) {
+        int role = auth_parse_role(role_name);
+        if (role < 0) {
+            fprintf(stderr, "Unknown role: %s\n", role_name);
+            return 1;
+        }
+        batch_capabilities = auth_role_capabilities((UserRole)role);
+    }
+    
+    metrics_install_signal_handler(SIGUSR1);
+    
+    if (slow_log_path &&
+        slowlog_open(slow_log_path, slow_ms, SLOWLOG_DEFAULT_MAX_BYTES, SLOWLOG_DEFAULT_MAX_FILES) != 0) {
+        return 1;
+    }
+    
+    // A reporting node serves straight from the mapped snapshot
+    if (snapshot_path && report_name && !script_path && command_index == 0) {
+        auth_set_capabilities(batch_capabilities);
+        int rc = cli_run_snapshot_report(snapshot_path, report_name, report_format, report_out,
+                                         &report_params);
+        slowlog_close();
+        return rc == 0 ? 0 : 1;
+    }
+    
     // Initialize database
-    if (db_init(DB_PATH) != 0) {
+    if (db_init(db_path) != 0) {
         ui_show_error("Failed to initialize database!");
         return 1;
     }
     
+    if (journal_path && journal_open(journal_path, journal_sync, JOURNAL_DEFAULT_SYNC_MS) != 0) {
+        db_close();
+        slowlog_close();
+        return 1;
+    }
+    
+    if (report_name || script_path || command_index > 0) {
+        int rc = 0;
+        auth_set_capabilities(batch_capabilities);
+        if (report_name) {
+            rc = cli_run_report(report_name, report_format, report_out, &report_params);
+        }
+        if (rc == 0 && script_path) {
+            rc = cli_run_script(script_path);
+        }
+        if (rc == 0 && command_index > 0) {
+            rc = cli_run_command(argc - command_index, argv + command_index);
+        }
+        db_close();
+        journal_close();
+        slowlog_close();
+        return rc == 0 ? 0 : 1;
+    }
+    
     User *current_user = NULL;
     
     while (1) {
+        metrics_poll();
         ui_login_screen();
         
         char username[50], password[50];
         ui_get_string("Username: ", username, sizeof(username));
         ui_get_string("Password: ", password, sizeof(password));
         
+        if (feof(stdin)) {
+            break;
+        }
+        
         current_user = auth_login(username, password);
         
         if (current_user) {
             ui_show_success("Login successful!");
             ui_wait_enter();
             
-            if (current_user->role == ROLE_ADMIN) {
+            // Back office for whoever sees all deals (admins, analysts);
+            // its entries check their own capabilities
+            if (auth_can(CAP_VIEW_ALL_DEALS)) {
                 admin_menu();
-            } else if (current_user->role == ROLE_MAKLER) {
+            } else if (auth_can(CAP_CREATE_DEAL)) {
                 makler_menu();
             }
         } else {
@@ -203,5 +438,7 @@ int main() {
     }
     
     db_close();
+    journal_close();
+    slowlog_close();
     return 0;
 }
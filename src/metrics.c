@@ -0,0 +1,275 @@
+#include "metrics.h"
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+static volatile sig_atomic_t dump_requested = 0;
+static char exit_dump_path[256] = "";
+
+uint64_t metrics_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int hist_bucket_index(uint64_t value) {
+    if (value < METRICS_HIST_SUB_BUCKETS) {
+        return (int)value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - METRICS_HIST_SUB_BITS;
+    int sub = (int)((value >> shift) & (METRICS_HIST_SUB_BUCKETS - 1));
+    return (shift + 1) * METRICS_HIST_SUB_BUCKETS + sub;
+}
+
+// Highest value that falls into the bucket
+static uint64_t hist_bucket_value(int index) {
+    if (index < METRICS_HIST_SUB_BUCKETS) {
+        return (uint64_t)index;
+    }
+    int shift = index / METRICS_HIST_SUB_BUCKETS - 1;
+    uint64_t sub = (uint64_t)(index % METRICS_HIST_SUB_BUCKETS);
+    uint64_t lower = (METRICS_HIST_SUB_BUCKETS + sub) << shift;
+    return lower + ((1ULL << shift) - 1);
+}
+
+void metrics_hist_record(MetricsHistogram *hist, uint64_t value) {
+    hist->counts[hist_bucket_index(value)]++;
+    if (hist->total == 0 || value < hist->min) hist->min = value;
+    if (value > hist->max) hist->max = value;
+    hist->total++;
+    hist->sum += value;
+}
+
+void metrics_hist_merge(MetricsHistogram *dst, const MetricsHistogram *src) {
+    if (src->total == 0) return;
+    for (int i = 0; i < METRICS_HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    if (dst->total == 0 || src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+    dst->total += src->total;
+    dst->sum += src->sum;
+}
+
+uint64_t metrics_hist_percentile(const MetricsHistogram *hist, double percentile) {
+    if (hist->total == 0) return 0;
+    
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)hist->total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > hist->total) rank = hist->total;
+    
+    uint64_t seen = 0;
+    for (int i = 0; i < METRICS_HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= rank) {
+            uint64_t value = hist_bucket_value(i);
+            return value > hist->max ? hist->max : value;
+        }
+    }
+    return hist->max;
+}
+
+#ifdef ENABLE_METRICS
+
+static MetricsProbe *probes = NULL;
+static MetricsCounter *counters = NULL;
+static __thread MetricsScope *current_scope = NULL;
+
+void metrics_scope_begin(MetricsScope *scope, MetricsProbe *probe) {
+    if (!probe->registered) {
+        probe->registered = 1;
+        probe->next = probes;
+        probes = probe;
+    }
+    scope->probe = probe;
+    scope->parent = current_scope;
+    current_scope = scope;
+    scope->start_ns = metrics_now_ns();
+}
+
+void metrics_scope_end(MetricsScope *scope) {
+    uint64_t elapsed = metrics_now_ns() - scope->start_ns;
+    scope->probe->calls++;
+    metrics_hist_record(&scope->probe->latency, elapsed);
+    current_scope = scope->parent;
+}
+
+MetricsScope* metrics_swap_scope(MetricsScope *scope) {
+    MetricsScope *previous = current_scope;
+    current_scope = scope;
+    return previous;
+}
+
+// Statements are attributed to the innermost instrumented function
+static MetricsProbe* current_probe() {
+    return current_scope ? current_scope->probe : NULL;
+}
+
+void metrics_on_prepare(uint64_t elapsed_ns) {
+    MetricsProbe *probe = current_probe();
+    if (!probe) return;
+    probe->statements++;
+    probe->prepare_ns += elapsed_ns;
+}
+
+void metrics_on_step(uint64_t elapsed_ns, int rc) {
+    MetricsProbe *probe = current_probe();
+    if (!probe) return;
+    probe->step_ns += elapsed_ns;
+    if (rc == SQLITE_ROW) probe->rows++;
+}
+
+void metrics_on_finalize(sqlite3_stmt *stmt) {
+    MetricsProbe *probe = current_probe();
+    if (!probe || !stmt) return;
+    probe->vm_steps += sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 0);
+    probe->fullscan_steps += sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0);
+    probe->sorts += sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 0);
+    probe->autoindexes += sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, 0);
+}
+
+void metrics_counter_add(MetricsCounter *counter, uint64_t n) {
+    if (!counter->registered) {
+        counter->registered = 1;
+        counter->next = counters;
+        counters = counter;
+    }
+    counter->value += n;
+}
+
+#endif // ENABLE_METRICS
+
+uint64_t metrics_counter_value(const char *name) {
+#ifdef ENABLE_METRICS
+    for (MetricsCounter *c = counters; c; c = c->next) {
+        if (strcmp(c->name, name) == 0) return c->value;
+    }
+#else
+    (void)name;
+#endif
+    return 0;
+}
+
+int metrics_enabled() {
+#ifdef ENABLE_METRICS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void metrics_dump(FILE *out) {
+#ifdef ENABLE_METRICS
+    fprintf(out, "\nFunction Metrics (latency in microseconds):\n");
+    fprintf(out, "%-32s %8s %8s %6s %9s %9s %9s %9s %9s %9s %10s %10s %10s %10s %10s %6s %6s\n",
+            "Function", "Calls", "Rows", "Stmts", "Avg", "p50", "p90", "p99", "p99.9", "Max",
+            "Prepare", "Step", "Other", "VM Steps", "Full Scan", "Sorts", "AutoIx");
+    fprintf(out, "---------------------------------------------------------------------------------------------------------------------------------------------------------------------------------\n");
+    
+    for (MetricsProbe *p = probes; p; p = p->next) {
+        if (p->calls == 0) continue;
+        const MetricsHistogram *h = &p->latency;
+        uint64_t other_ns = h->sum > p->prepare_ns + p->step_ns ? h->sum - p->prepare_ns - p->step_ns : 0;
+        
+        fprintf(out, "%-32s %8llu %8llu %6llu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %10.1f %10.1f %10.1f %10llu %10llu %6llu %6llu\n",
+                p->name,
+                (unsigned long long)p->calls,
+                (unsigned long long)p->rows,
+                (unsigned long long)p->statements,
+                (double)h->sum / (double)h->total / 1000.0,
+                metrics_hist_percentile(h, 50.0) / 1000.0,
+                metrics_hist_percentile(h, 90.0) / 1000.0,
+                metrics_hist_percentile(h, 99.0) / 1000.0,
+                metrics_hist_percentile(h, 99.9) / 1000.0,
+                h->max / 1000.0,
+                p->prepare_ns / 1000.0,
+                p->step_ns / 1000.0,
+                other_ns / 1000.0,
+                (unsigned long long)p->vm_steps,
+                (unsigned long long)p->fullscan_steps,
+                (unsigned long long)p->sorts,
+                (unsigned long long)p->autoindexes);
+    }
+    
+    if (counters) {
+        fprintf(out, "\nCounters:\n");
+        for (MetricsCounter *c = counters; c; c = c->next) {
+            fprintf(out, "%-32s %10llu\n", c->name, (unsigned long long)c->value);
+        }
+    }
+#else
+    fprintf(out, "\nMetrics are disabled in this build (rebuild with METRICS=1).\n");
+#endif
+    fflush(out);
+}
+
+int metrics_dump_to_file(const char *path) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Can't open stats dump file: %s\n", path);
+        return -1;
+    }
+    metrics_dump(out);
+    fclose(out);
+    return 0;
+}
+
+void metrics_reset() {
+#ifdef ENABLE_METRICS
+    for (MetricsProbe *p = probes; p; p = p->next) {
+        p->calls = 0;
+        p->rows = 0;
+        p->statements = 0;
+        p->prepare_ns = 0;
+        p->step_ns = 0;
+        p->vm_steps = 0;
+        p->fullscan_steps = 0;
+        p->sorts = 0;
+        p->autoindexes = 0;
+        memset(&p->latency, 0, sizeof(p->latency));
+    }
+    for (MetricsCounter *c = counters; c; c = c->next) {
+        c->value = 0;
+    }
+#endif
+}
+
+static void metrics_signal_handler(int signo) {
+    (void)signo;
+    dump_requested = 1;
+}
+
+void metrics_install_signal_handler(int signo) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = metrics_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(signo, &sa, NULL);
+}
+
+#ifdef ENABLE_METRICS
+void metrics_poll() {
+    if (dump_requested) {
+        dump_requested = 0;
+        metrics_dump(stderr);
+    }
+}
+#endif
+
+static void metrics_exit_dump() {
+    if (exit_dump_path[0]) {
+        metrics_dump_to_file(exit_dump_path);
+    }
+}
+
+void metrics_set_exit_dump(const char *path) {
+    static int registered = 0;
+    snprintf(exit_dump_path, sizeof(exit_dump_path), "%s", path);
+    if (!registered) {
+        atexit(metrics_exit_dump);
+        registered = 1;
+    }
+}
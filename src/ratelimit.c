@@ -0,0 +1,106 @@
+#include "ratelimit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROBE_WINDOW 8
+
+typedef struct {
+    char key[RATELIMIT_KEY_SIZE];
+    uint64_t hash;
+    double tokens;
+    uint64_t updated_ns;
+    int used;
+} Bucket;
+
+struct RateLimiter {
+    int slots;               // power of two
+    double burst;
+    double per_second;
+    Bucket buckets[];
+};
+
+RateLimiter* ratelimit_create(int slots, double burst, double per_second) {
+    if (slots < PROBE_WINDOW || burst < 1.0 || per_second <= 0.0) {
+        fprintf(stderr, "Invalid rate limit\n");
+        return NULL;
+    }
+    int size = PROBE_WINDOW;
+    while (size < slots) size *= 2;
+    
+    RateLimiter *limiter = calloc(1, sizeof(RateLimiter) + (size_t)size * sizeof(Bucket));
+    if (!limiter) return NULL;
+    limiter->slots = size;
+    limiter->burst = burst;
+    limiter->per_second = per_second;
+    return limiter;
+}
+
+void ratelimit_free(RateLimiter *limiter) {
+    free(limiter);
+}
+
+void ratelimit_reset(RateLimiter *limiter) {
+    for (int i = 0; i < limiter->slots; i++) limiter->buckets[i].used = 0;
+}
+
+static uint64_t key_hash(const char *key) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *p = key; *p; p++) {
+        hash ^= (unsigned char)*p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Tokens in the bucket now; the bucket itself changes only when used
+static double available(const RateLimiter *limiter, const Bucket *bucket, uint64_t now_ns) {
+    double tokens = bucket->tokens;
+    if (now_ns > bucket->updated_ns) {
+        tokens += (double)(now_ns - bucket->updated_ns) / 1e9 * limiter->per_second;
+    }
+    return tokens < limiter->burst ? tokens : limiter->burst;
+}
+
+// Preference for reuse: empty, then refilled completely. A bucket that is
+// still refilling is never reused: its key would start over with a full burst.
+static int reuse_rank(const RateLimiter *limiter, const Bucket *bucket, uint64_t now_ns) {
+    if (!bucket->used) return 2;
+    return available(limiter, bucket, now_ns) >= limiter->burst ? 1 : 0;
+}
+
+int ratelimit_take(RateLimiter *limiter, const char *key, uint64_t now_ns) {
+    uint64_t hash = key_hash(key);
+    unsigned mask = (unsigned)(limiter->slots - 1);
+    Bucket *found = NULL, *victim = NULL;
+    int victim_rank = -1;
+    
+    for (int i = 0; i < PROBE_WINDOW; i++) {
+        Bucket *bucket = &limiter->buckets[(hash + (uint64_t)i) & mask];
+        if (bucket->used && bucket->hash == hash && strncmp(bucket->key, key, RATELIMIT_KEY_SIZE - 1) == 0) {
+            found = bucket;
+            break;
+        }
+        int rank = reuse_rank(limiter, bucket, now_ns);
+        if (rank > 0 && rank > victim_rank) {
+            victim = bucket;
+            victim_rank = rank;
+        }
+    }
+    
+    if (!found) {
+        if (!victim) return 0;  // every bucket in the window is refilling
+        found = victim;
+        snprintf(found->key, sizeof(found->key), "%s", key);
+        found->hash = hash;
+        found->tokens = limiter->burst;
+        found->updated_ns = now_ns;
+        found->used = 1;
+    }
+    
+    found->tokens = available(limiter, found, now_ns);
+    found->updated_ns = now_ns;
+    if (found->tokens < 1.0) return 0;
+    found->tokens -= 1.0;
+    return 1;
+}
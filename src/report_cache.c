@@ -0,0 +1,163 @@
+#include "report_cache.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUCKET_COUNT 256   // power of two
+
+// One allocation: the entry, then its key, then its output
+typedef struct Entry {
+    struct Entry *chain;                 // next in the hash bucket
+    struct Entry *newer, *older;         // recency list
+    uint64_t hash;
+    ReportCacheVersion version;
+    size_t size;                         // bytes charged for the entry
+    size_t length;
+    int sections;
+    char *output;
+    char key[];
+} Entry;
+
+static Entry *buckets[BUCKET_COUNT];
+static Entry *newest = NULL, *oldest = NULL;
+static int max_entries = REPORT_CACHE_MAX_ENTRIES;
+static size_t max_bytes = REPORT_CACHE_MAX_BYTES;
+static ReportCacheStats stats;
+
+static uint64_t key_hash(const char *key) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *p = key; *p; p++) {
+        hash ^= (unsigned char)*p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static Entry** chain_of(uint64_t hash) {
+    return &buckets[hash & (BUCKET_COUNT - 1)];
+}
+
+static void unlink_recency(Entry *entry) {
+    if (entry->newer) entry->newer->older = entry->older;
+    else newest = entry->older;
+    if (entry->older) entry->older->newer = entry->newer;
+    else oldest = entry->newer;
+    entry->newer = entry->older = NULL;
+}
+
+static void link_newest(Entry *entry) {
+    entry->older = newest;
+    entry->newer = NULL;
+    if (newest) newest->newer = entry;
+    newest = entry;
+    if (!oldest) oldest = entry;
+}
+
+static void remove_entry(Entry *entry) {
+    Entry **link = chain_of(entry->hash);
+    while (*link != entry) link = &(*link)->chain;
+    *link = entry->chain;
+    
+    unlink_recency(entry);
+    stats.entries--;
+    stats.bytes -= entry->size;
+    free(entry);
+}
+
+static Entry* find(const char *key, uint64_t hash) {
+    for (Entry *entry = *chain_of(hash); entry; entry = entry->chain) {
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) return entry;
+    }
+    return NULL;
+}
+
+static int same_version(const ReportCacheVersion *a, const ReportCacheVersion *b) {
+    return a->connection == b->connection && a->data_version == b->data_version &&
+           a->changes == b->changes;
+}
+
+const char* report_cache_get(const char *key, const ReportCacheVersion *version,
+                             size_t *length, int *sections) {
+    uint64_t hash = key_hash(key);
+    Entry *entry = find(key, hash);
+    if (entry && !same_version(&entry->version, version)) {
+        remove_entry(entry);
+        entry = NULL;
+    }
+    if (!entry) {
+        stats.misses++;
+        METRICS_COUNT("report_cache_misses", 1);
+        return NULL;
+    }
+    
+    unlink_recency(entry);
+    link_newest(entry);
+    stats.hits++;
+    METRICS_COUNT("report_cache_hits", 1);
+    *length = entry->length;
+    *sections = entry->sections;
+    return entry->output;
+}
+
+int report_cache_put(const char *key, const ReportCacheVersion *version,
+                     const char *output, size_t length, int sections) {
+    size_t key_length = strlen(key);
+    size_t size = sizeof(Entry) + key_length + 1 + length;
+    if (max_entries == 0 || size > max_bytes) return -1;
+    
+    uint64_t hash = key_hash(key);
+    Entry *existing = find(key, hash);
+    if (existing) remove_entry(existing);
+    
+    while (oldest && (stats.entries >= max_entries || stats.bytes + size > max_bytes)) {
+        remove_entry(oldest);
+        stats.evictions++;
+        METRICS_COUNT("report_cache_evictions", 1);
+    }
+    
+    Entry *entry = malloc(size);
+    if (!entry) {
+        fprintf(stderr, "Out of memory for the report cache\n");
+        return -1;
+    }
+    memcpy(entry->key, key, key_length + 1);
+    entry->output = entry->key + key_length + 1;
+    memcpy(entry->output, output, length);
+    entry->hash = hash;
+    entry->version = *version;
+    entry->size = size;
+    entry->length = length;
+    entry->sections = sections;
+    
+    Entry **chain = chain_of(hash);
+    entry->chain = *chain;
+    *chain = entry;
+    link_newest(entry);
+    stats.entries++;
+    stats.bytes += size;
+    return 0;
+}
+
+void report_cache_set_limits(int entries, size_t bytes) {
+    max_entries = entries > 0 ? entries : 0;
+    max_bytes = bytes;
+    while (oldest && (stats.entries > max_entries || stats.bytes > max_bytes)) {
+        remove_entry(oldest);
+        stats.evictions++;
+    }
+}
+
+size_t report_cache_max_output() {
+    return max_entries > 0 && max_bytes > sizeof(Entry) ? max_bytes - sizeof(Entry) : 0;
+}
+
+void report_cache_clear() {
+    while (oldest) {
+        remove_entry(oldest);
+    }
+}
+
+void report_cache_stats(ReportCacheStats *out) {
+    *out = stats;
+}
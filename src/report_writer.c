@@ -0,0 +1,450 @@
+#include "report_writer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#define REPORT_MAX_COLUMNS 16
+
+// Output sink: how a section header, a single field and a row end look
+typedef struct {
+    void (*begin)(ReportWriter *rw, const char *title);
+    void (*field)(ReportWriter *rw, const char *value, int length, ReportColumnType type);
+    void (*end_row)(ReportWriter *rw);
+} ReportSink;
+
+struct ReportWriter {
+    FILE *out;
+    ReportFormat format;
+    const ReportSink *sink;
+    
+    const char *section;
+    ReportColumn columns[REPORT_MAX_COLUMNS];
+    int column_count;
+    int column;          // next column in the current row
+    int sections;        // sections written so far
+    
+    // Recording: a copy of the output from buffer[record_from] on
+    char *recording;
+    size_t recorded;
+    size_t record_capacity;
+    size_t record_limit;
+    size_t record_from;
+    int record_sections;  // sections when recording started
+    
+    size_t used;
+    char buffer[REPORT_WRITER_BUFFER_SIZE];
+};
+
+// Recording
+
+static void record_abandon(ReportWriter *rw) {
+    free(rw->recording);
+    rw->recording = NULL;
+    rw->recorded = rw->record_capacity = 0;
+}
+
+static void record(ReportWriter *rw, const char *data, size_t length) {
+    if (!rw->recording) return;
+    if (rw->recorded + length > rw->record_limit) {
+        record_abandon(rw);
+        return;
+    }
+    if (rw->recorded + length > rw->record_capacity) {
+        size_t capacity = rw->record_capacity * 2;
+        while (capacity < rw->recorded + length) capacity *= 2;
+        if (capacity > rw->record_limit) capacity = rw->record_limit;
+        char *grown = realloc(rw->recording, capacity);
+        if (!grown) {
+            record_abandon(rw);
+            return;
+        }
+        rw->recording = grown;
+        rw->record_capacity = capacity;
+    }
+    memcpy(rw->recording + rw->recorded, data, length);
+    rw->recorded += length;
+}
+
+// Buffered output
+
+// Writes out the buffer; what is recorded is copied here rather than
+// byte by byte as it is written
+static void rw_drain(ReportWriter *rw) {
+    if (rw->recording) {
+        record(rw, rw->buffer + rw->record_from, rw->used - rw->record_from);
+    }
+    rw->record_from = 0;
+    fwrite(rw->buffer, 1, rw->used, rw->out);
+    rw->used = 0;
+}
+
+void report_writer_flush(ReportWriter *rw) {
+    if (!rw) return;
+    if (rw->used > 0) {
+        rw_drain(rw);
+    }
+    fflush(rw->out);
+}
+
+static void rw_put(ReportWriter *rw, const char *data, size_t length) {
+    if (rw->used + length > sizeof(rw->buffer)) {
+        rw_drain(rw);
+        if (length > sizeof(rw->buffer)) {
+            record(rw, data, length);
+            fwrite(data, 1, length, rw->out);
+            return;
+        }
+    }
+    memcpy(rw->buffer + rw->used, data, length);
+    rw->used += length;
+}
+
+static void rw_putc(ReportWriter *rw, char c) {
+    if (rw->used == sizeof(rw->buffer)) {
+        rw_drain(rw);
+    }
+    rw->buffer[rw->used++] = c;
+}
+
+static void rw_puts(ReportWriter *rw, const char *s) {
+    rw_put(rw, s, strlen(s));
+}
+
+static void rw_pad(ReportWriter *rw, int count) {
+    while (count-- > 0) {
+        rw_putc(rw, ' ');
+    }
+}
+
+static void rw_vprintf(ReportWriter *rw, const char *fmt, va_list args) {
+    char line[512];
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(line, sizeof(line), fmt, copy);
+    va_end(copy);
+    
+    if (length < 0) return;
+    if ((size_t)length < sizeof(line)) {
+        rw_put(rw, line, (size_t)length);
+        return;
+    }
+    
+    char *big = malloc((size_t)length + 1);
+    if (!big) return;
+    vsnprintf(big, (size_t)length + 1, fmt, args);
+    rw_put(rw, big, (size_t)length);
+    free(big);
+}
+
+// Aligned table sink
+
+// Display width in characters: UTF-8 continuation bytes take no column
+static int display_width(const char *value, int length) {
+    int width = 0;
+    for (int i = 0; i < length; i++) {
+        if (((unsigned char)value[i] & 0xC0) != 0x80) {
+            width++;
+        }
+    }
+    return width;
+}
+
+static void table_begin(ReportWriter *rw, const char *title) {
+    if (title) {
+        rw_putc(rw, '\n');
+        rw_puts(rw, title);
+        rw_puts(rw, ":\n");
+    }
+    
+    int total = 0;
+    for (int i = 0; i < rw->column_count; i++) {
+        const ReportColumn *col = &rw->columns[i];
+        int header_length = (int)strlen(col->header);
+        if (i > 0) {
+            rw_putc(rw, ' ');
+            total++;
+        }
+        rw_puts(rw, col->header);
+        rw_pad(rw, col->width - header_length);
+        total += col->width > header_length ? col->width : header_length;
+    }
+    rw_putc(rw, '\n');
+    
+    for (int i = 0; i < total; i++) {
+        rw_putc(rw, '-');
+    }
+    rw_putc(rw, '\n');
+}
+
+static void table_field(ReportWriter *rw, const char *value, int length, ReportColumnType type) {
+    (void)type;
+    if (rw->column > 0) {
+        rw_putc(rw, ' ');
+    }
+    rw_put(rw, value, (size_t)length);
+    rw_pad(rw, rw->columns[rw->column].width - display_width(value, length));
+}
+
+static void table_end_row(ReportWriter *rw) {
+    rw_putc(rw, '\n');
+}
+
+// CSV sink
+
+static void csv_begin(ReportWriter *rw, const char *title) {
+    (void)title;
+    if (rw->sections > 0) {
+        rw_putc(rw, '\n');
+    }
+    for (int i = 0; i < rw->column_count; i++) {
+        if (i > 0) rw_putc(rw, ',');
+        rw_puts(rw, rw->columns[i].key);
+    }
+    rw_putc(rw, '\n');
+}
+
+static void csv_field(ReportWriter *rw, const char *value, int length, ReportColumnType type) {
+    if (rw->column > 0) {
+        rw_putc(rw, ',');
+    }
+    
+    int needs_quotes = 0;
+    if (type == REPORT_COL_TEXT) {
+        for (int i = 0; i < length; i++) {
+            char c = value[i];
+            if (c == ',' || c == '"' || c == '\n' || c == '\r') {
+                needs_quotes = 1;
+                break;
+            }
+        }
+        if (length > 0 && (value[0] == ' ' || value[length - 1] == ' ')) {
+            needs_quotes = 1;
+        }
+    }
+    
+    if (!needs_quotes) {
+        rw_put(rw, value, (size_t)length);
+        return;
+    }
+    
+    rw_putc(rw, '"');
+    for (int i = 0; i < length; i++) {
+        if (value[i] == '"') rw_putc(rw, '"');
+        rw_putc(rw, value[i]);
+    }
+    rw_putc(rw, '"');
+}
+
+static void csv_end_row(ReportWriter *rw) {
+    rw_putc(rw, '\n');
+}
+
+// JSON Lines sink
+
+static void json_string(ReportWriter *rw, const char *value, int length) {
+    static const char hex[] = "0123456789abcdef";
+    
+    rw_putc(rw, '"');
+    for (int i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)value[i];
+        switch (c) {
+            case '"':  rw_puts(rw, "\\\""); break;
+            case '\\': rw_puts(rw, "\\\\"); break;
+            case '\n': rw_puts(rw, "\\n"); break;
+            case '\r': rw_puts(rw, "\\r"); break;
+            case '\t': rw_puts(rw, "\\t"); break;
+            default:
+                if (c < 0x20) {
+                    char escaped[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+                    rw_put(rw, escaped, sizeof(escaped));
+                } else {
+                    rw_putc(rw, (char)c);
+                }
+        }
+    }
+    rw_putc(rw, '"');
+}
+
+static void json_begin(ReportWriter *rw, const char *title) {
+    (void)rw;
+    (void)title;
+}
+
+static void json_field(ReportWriter *rw, const char *value, int length, ReportColumnType type) {
+    if (rw->column == 0) {
+        rw_puts(rw, "{\"section\":");
+        json_string(rw, rw->section, (int)strlen(rw->section));
+    }
+    rw_putc(rw, ',');
+    json_string(rw, rw->columns[rw->column].key, (int)strlen(rw->columns[rw->column].key));
+    rw_putc(rw, ':');
+    
+    if (!value) {
+        rw_puts(rw, "null");
+    } else if (type == REPORT_COL_TEXT) {
+        json_string(rw, value, length);
+    } else {
+        rw_put(rw, value, (size_t)length);
+    }
+}
+
+static void json_end_row(ReportWriter *rw) {
+    rw_puts(rw, "}\n");
+}
+
+static const ReportSink sinks[] = {
+    [REPORT_FORMAT_TABLE] = { table_begin, table_field, table_end_row },
+    [REPORT_FORMAT_CSV]   = { csv_begin, csv_field, csv_end_row },
+    [REPORT_FORMAT_JSONL] = { json_begin, json_field, json_end_row },
+};
+
+// Public API
+
+ReportWriter* report_writer_create(FILE *out, ReportFormat format) {
+    ReportWriter *rw = (ReportWriter *)malloc(sizeof(ReportWriter));
+    if (!rw) {
+        return NULL;
+    }
+    
+    rw->out = out;
+    rw->format = format;
+    rw->sink = &sinks[format];
+    rw->section = "";
+    rw->column_count = 0;
+    rw->column = 0;
+    rw->sections = 0;
+    rw->recording = NULL;
+    rw->recorded = rw->record_capacity = 0;
+    rw->record_from = 0;
+    rw->used = 0;
+    return rw;
+}
+
+void report_writer_free(ReportWriter *rw) {
+    if (!rw) return;
+    report_writer_flush(rw);
+    free(rw->recording);
+    free(rw);
+}
+
+ReportFormat report_writer_format(const ReportWriter *rw) {
+    return rw->format;
+}
+
+int report_writer_sections(const ReportWriter *rw) {
+    return rw->sections;
+}
+
+int report_writer_record(ReportWriter *rw, size_t limit) {
+    record_abandon(rw);
+    size_t capacity = limit < 4096 ? limit : 4096;
+    if (capacity == 0 || !(rw->recording = malloc(capacity))) return -1;
+    rw->record_capacity = capacity;
+    rw->record_limit = limit;
+    rw->record_from = rw->used;
+    rw->record_sections = rw->sections;
+    return 0;
+}
+
+char* report_writer_stop_recording(ReportWriter *rw, size_t *length, int *sections) {
+    if (rw->recording) {
+        record(rw, rw->buffer + rw->record_from, rw->used - rw->record_from);
+    }
+    char *recording = rw->recording;
+    *length = rw->recorded;
+    *sections = rw->sections - rw->record_sections;
+    rw->recording = NULL;
+    rw->recorded = rw->record_capacity = 0;
+    return recording;
+}
+
+void report_writer_replay(ReportWriter *rw, const char *output, size_t length, int sections) {
+    rw_put(rw, output, length);
+    rw->sections += sections;
+}
+
+int report_format_parse(const char *name, ReportFormat *format) {
+    if (strcmp(name, "table") == 0) {
+        *format = REPORT_FORMAT_TABLE;
+    } else if (strcmp(name, "csv") == 0) {
+        *format = REPORT_FORMAT_CSV;
+    } else if (strcmp(name, "json") == 0 || strcmp(name, "jsonl") == 0) {
+        *format = REPORT_FORMAT_JSONL;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+void report_writer_begin(ReportWriter *rw, const char *section, const char *title,
+                         const ReportColumn *columns, int column_count) {
+    if (column_count > REPORT_MAX_COLUMNS) {
+        column_count = REPORT_MAX_COLUMNS;
+    }
+    rw->section = section;
+    memcpy(rw->columns, columns, sizeof(ReportColumn) * column_count);
+    rw->column_count = column_count;
+    rw->column = 0;
+    rw->sink->begin(rw, title);
+    rw->sections++;
+}
+
+void report_writer_end(ReportWriter *rw) {
+    if (rw->column > 0) {
+        report_writer_end_row(rw);
+    }
+    rw->column_count = 0;
+}
+
+void report_writer_text_n(ReportWriter *rw, const char *value, int length) {
+    if (rw->column >= rw->column_count) return;
+    if (!value && rw->format != REPORT_FORMAT_JSONL) {
+        value = "";
+        length = 0;
+    }
+    rw->sink->field(rw, value, length, REPORT_COL_TEXT);
+    rw->column++;
+}
+
+void report_writer_text(ReportWriter *rw, const char *value) {
+    report_writer_text_n(rw, value, value ? (int)strlen(value) : 0);
+}
+
+void report_writer_int(ReportWriter *rw, long long value) {
+    if (rw->column >= rw->column_count) return;
+    char text[32];
+    int length = snprintf(text, sizeof(text), "%lld", value);
+    rw->sink->field(rw, text, length, REPORT_COL_INT);
+    rw->column++;
+}
+
+void report_writer_real(ReportWriter *rw, double value) {
+    if (rw->column >= rw->column_count) return;
+    char text[64];
+    int length = snprintf(text, sizeof(text), "%.2f", value);
+    rw->sink->field(rw, text, length, REPORT_COL_REAL);
+    rw->column++;
+}
+
+void report_writer_end_row(ReportWriter *rw) {
+    if (rw->column_count == 0) return;
+    
+    // Missing trailing fields are written empty so every row is complete
+    while (rw->column < rw->column_count) {
+        rw->sink->field(rw, rw->format == REPORT_FORMAT_JSONL ? NULL : "", 0,
+                        rw->columns[rw->column].type);
+        rw->column++;
+    }
+    rw->sink->end_row(rw);
+    rw->column = 0;
+}
+
+void report_writer_note(ReportWriter *rw, const char *fmt, ...) {
+    if (rw->format != REPORT_FORMAT_TABLE) return;
+    
+    va_list args;
+    va_start(args, fmt);
+    rw_vprintf(rw, fmt, args);
+    va_end(args);
+    rw_putc(rw, '\n');
+}
@@ -1,12 +1,36 @@
 #include "reports.h"
+#include "auth.h"
 #include "database.h"
+#include "metrics.h"
+#include "report_cache.h"
+#include "scheduler.h"
+#include "search.h"
+#include "statstore.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-void reports_sales_by_good(const char *start_date, const char *end_date) {
+static ReportWriter *output = NULL;
+static ReportWriter *default_output = NULL;
+
+void reports_set_output(ReportWriter *rw) {
+    output = rw;
+}
+
+ReportWriter* reports_output() {
+    if (output) {
+        return output;
+    }
+    if (!default_output) {
+        default_output = report_writer_create(stdout, REPORT_FORMAT_TABLE);
+    }
+    return default_output;
+}
+
+int reports_sales_by_good(const char *start_date, const char *end_date) {
+    METRICS_FUNC();
     sqlite3 *db = db_get_connection();
-    if (!db) return;
+    if (!db) return -1;
     
     char sql[] = "SELECT good_name, good_type, SUM(quantity) as total_quantity, SUM(total_amount) as total_amount "
                 "FROM PERFUME_DEALS "
@@ -14,34 +38,45 @@ void reports_sales_by_good(const char *start_date, const char *end_date) {
                 "GROUP BY good_name, good_type;";
     
     sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        return;
+        return -1;
     }
     
     sqlite3_bind_text(stmt, 1, start_date, -1, SQLITE_STATIC);
     sqlite3_bind_text(stmt, 2, end_date, -1, SQLITE_STATIC);
     
-    printf("\nSales Report by Good (from %s to %s):\n", start_date, end_date);
-    printf("%-30s %-20s %-15s %-15s\n", "Good Name", "Type", "Total Quantity", "Total Amount");
-    printf("--------------------------------------------------------------------------------\n");
+    static const ReportColumn columns[] = {
+        { "Good Name", "good_name", REPORT_COL_TEXT, 30 },
+        { "Type", "good_type", REPORT_COL_TEXT, 20 },
+        { "Total Quantity", "total_quantity", REPORT_COL_INT, 15 },
+        { "Total Amount", "total_amount", REPORT_COL_REAL, 15 },
+    };
+    char title[128];
+    snprintf(title, sizeof(title), "Sales Report by Good (from %s to %s)", start_date, end_date);
     
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char *good_name = (const char *)sqlite3_column_text(stmt, 0);
-        const char *good_type = (const char *)sqlite3_column_text(stmt, 1);
-        int total_quantity = sqlite3_column_int(stmt, 2);
-        double total_amount = sqlite3_column_double(stmt, 3);
-        
-        printf("%-30s %-20s %-15d %-15.2f\n", good_name, good_type, total_quantity, total_amount);
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "sales_by_good", title, columns, REPORT_COLUMN_COUNT(columns));
+    
+    while ((rc = db_step(stmt)) == SQLITE_ROW) {
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 0));
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 1));
+        report_writer_int(rw, sqlite3_column_int(stmt, 2));
+        report_writer_real(rw, sqlite3_column_double(stmt, 3));
+        report_writer_end_row(rw);
     }
     
-    sqlite3_finalize(stmt);
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    db_finalize(stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
 }
 
-void reports_buyers_by_good(const char *good_name) {
+int reports_buyers_by_good(const char *good_name) {
+    METRICS_FUNC();
     sqlite3 *db = db_get_connection();
-    if (!db) return;
+    if (!db) return -1;
     
     char sql[] = "SELECT buyer, COUNT(*) as deal_count, SUM(quantity) as total_quantity, SUM(total_amount) as total_amount "
                 "FROM PERFUME_DEALS "
@@ -49,250 +84,784 @@ void reports_buyers_by_good(const char *good_name) {
                 "GROUP BY buyer;";
     
     sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        return;
+        return -1;
     }
     
     sqlite3_bind_text(stmt, 1, good_name, -1, SQLITE_STATIC);
     
-    printf("\nBuyers for '%s':\n", good_name);
-    printf("%-30s %-12s %-15s %-15s\n", "Buyer", "Deal Count", "Total Quantity", "Total Amount");
-    printf("--------------------------------------------------------------------------------\n");
+    static const ReportColumn columns[] = {
+        { "Buyer", "buyer", REPORT_COL_TEXT, 30 },
+        { "Deal Count", "deal_count", REPORT_COL_INT, 12 },
+        { "Total Quantity", "total_quantity", REPORT_COL_INT, 15 },
+        { "Total Amount", "total_amount", REPORT_COL_REAL, 15 },
+    };
+    char title[160];
+    snprintf(title, sizeof(title), "Buyers for '%s'", good_name);
     
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char *buyer = (const char *)sqlite3_column_text(stmt, 0);
-        int deal_count = sqlite3_column_int(stmt, 1);
-        int total_quantity = sqlite3_column_int(stmt, 2);
-        double total_amount = sqlite3_column_double(stmt, 3);
-        
-        printf("%-30s %-12d %-15d %-15.2f\n", buyer, deal_count, total_quantity, total_amount);
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "buyers_by_good", title, columns, REPORT_COLUMN_COUNT(columns));
+    
+    while ((rc = db_step(stmt)) == SQLITE_ROW) {
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 0));
+        report_writer_int(rw, sqlite3_column_int(stmt, 1));
+        report_writer_int(rw, sqlite3_column_int(stmt, 2));
+        report_writer_real(rw, sqlite3_column_double(stmt, 3));
+        report_writer_end_row(rw);
     }
     
-    sqlite3_finalize(stmt);
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    db_finalize(stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
 }
 
-void reports_popular_good_type() {
+static int popular_good_type() {
     sqlite3 *db = db_get_connection();
-    if (!db) return;
+    if (!db) return -1;
     
+    // Ties go to the first type by name, as in the snapshot report
     const char *sql = "SELECT good_type, SUM(quantity) as total_quantity, SUM(total_amount) as total_amount "
                       "FROM PERFUME_DEALS "
                       "GROUP BY good_type "
-                      "ORDER BY total_quantity DESC "
+                      "ORDER BY total_quantity DESC, good_type "
                       "LIMIT 1;";
     
     sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        return;
+        return -1;
     }
     
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char *good_type = (const char *)sqlite3_column_text(stmt, 0);
-        int total_quantity = sqlite3_column_int(stmt, 1);
-        double total_amount = sqlite3_column_double(stmt, 2);
-        
-        printf("\nMost Popular Good Type:\n");
-        printf("%-20s %-15s %-15s\n", "Type", "Total Quantity", "Total Amount");
-        printf("-----------------------------------------------------------\n");
-        printf("%-20s %-15d %-15.2f\n", good_type, total_quantity, total_amount);
-        
-        // Show buyers by firm for type
-        const char *buyers_sql = "SELECT buyer, COUNT(*) as deal_count, SUM(quantity) as total_quantity, SUM(total_amount) as total_amount "
-                                 "FROM PERFUME_DEALS "
-                                 "WHERE good_type = ? "
-                                 "GROUP BY buyer;";
-        
-        sqlite3_finalize(stmt);
-        rc = sqlite3_prepare_v2(db, buyers_sql, -1, &stmt, 0);
-        if (rc != SQLITE_OK) {
-            fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-            return;
-        }
-        
-        sqlite3_bind_text(stmt, 1, good_type, -1, SQLITE_STATIC);
-        
-        printf("\nBuyers by Firm for Type '%s':\n", good_type);
-        printf("%-30s %-12s %-15s %-15s\n", "Buyer", "Deal Count", "Total Quantity", "Total Amount");
-        printf("--------------------------------------------------------------------------------\n");
-        
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            const char *buyer = (const char *)sqlite3_column_text(stmt, 0);
-            int deal_count = sqlite3_column_int(stmt, 1);
-            int total_quantity = sqlite3_column_int(stmt, 2);
-            double total_amount = sqlite3_column_double(stmt, 3);
-            
-            printf("%-30s %-12d %-15d %-15.2f\n", buyer, deal_count, total_quantity, total_amount);
-        }
+    rc = db_step(stmt);
+    if (rc != SQLITE_ROW) {
+        db_finalize(stmt);
+        return rc == SQLITE_DONE ? 0 : -1;
     }
     
-    sqlite3_finalize(stmt);
+    static const ReportColumn type_columns[] = {
+        { "Type", "good_type", REPORT_COL_TEXT, 20 },
+        { "Total Quantity", "total_quantity", REPORT_COL_INT, 15 },
+        { "Total Amount", "total_amount", REPORT_COL_REAL, 15 },
+    };
+    
+    // Copy the type out before the statement that owns it is finalized
+    char good_type[50];
+    snprintf(good_type, sizeof(good_type), "%s", (const char *)sqlite3_column_text(stmt, 0));
+    
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "popular_good_type", "Most Popular Good Type",
+                        type_columns, REPORT_COLUMN_COUNT(type_columns));
+    report_writer_text(rw, good_type);
+    report_writer_int(rw, sqlite3_column_int(stmt, 1));
+    report_writer_real(rw, sqlite3_column_double(stmt, 2));
+    report_writer_end(rw);
+    
+    db_finalize(stmt);
+    
+    // Show buyers by firm for type
+    const char *buyers_sql = "SELECT buyer, COUNT(*) as deal_count, SUM(quantity) as total_quantity, SUM(total_amount) as total_amount "
+                             "FROM PERFUME_DEALS "
+                             "WHERE good_type = ? "
+                             "GROUP BY buyer;";
+    
+    rc = db_prepare(buyers_sql, &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        report_writer_flush(rw);
+        return -1;
+    }
+    
+    sqlite3_bind_text(stmt, 1, good_type, -1, SQLITE_STATIC);
+    
+    static const ReportColumn buyer_columns[] = {
+        { "Buyer", "buyer", REPORT_COL_TEXT, 30 },
+        { "Deal Count", "deal_count", REPORT_COL_INT, 12 },
+        { "Total Quantity", "total_quantity", REPORT_COL_INT, 15 },
+        { "Total Amount", "total_amount", REPORT_COL_REAL, 15 },
+    };
+    char title[128];
+    snprintf(title, sizeof(title), "Buyers by Firm for Type '%s'", good_type);
+    
+    report_writer_begin(rw, "buyers_by_type", title, buyer_columns, REPORT_COLUMN_COUNT(buyer_columns));
+    
+    while ((rc = db_step(stmt)) == SQLITE_ROW) {
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 0));
+        report_writer_int(rw, sqlite3_column_int(stmt, 1));
+        report_writer_int(rw, sqlite3_column_int(stmt, 2));
+        report_writer_real(rw, sqlite3_column_double(stmt, 3));
+        report_writer_end_row(rw);
+    }
+    
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    db_finalize(stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+// Both queries read one snapshot, so the second half matches the first
+int reports_popular_good_type() {
+    METRICS_FUNC();
+    if (db_begin_read() != 0) return -1;
+    int rc = popular_good_type();
+    db_end_read();
+    return rc;
 }
 
-void reports_max_deals_makler() {
+static int max_deals_makler() {
     sqlite3 *db = db_get_connection();
-    if (!db) return;
+    if (!db) return -1;
     
-    const char *sql = "SELECT m.name, COUNT(d.id) as deal_count "
-                      "FROM PERFUME_DEALS d "
-                      "JOIN PERFUME_MAKLERS m ON d.makler_id = m.id "
-                      "GROUP BY d.makler_id "
-                      "ORDER BY deal_count DESC "
-                      "LIMIT 1;";
+    // Counted from the deals alone; only the winner's name is looked up.
+    // Ties go to the lowest makler id, as in the snapshot report.
+    const char *sql = "SELECT t.makler_id, m.name, t.deal_count FROM ("
+                      "    SELECT makler_id, COUNT(*) as deal_count FROM PERFUME_DEALS "
+                      "    GROUP BY makler_id ORDER BY deal_count DESC, makler_id LIMIT 1) t "
+                      "JOIN PERFUME_MAKLERS m ON m.id = t.makler_id;";
     
     sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        return;
+        return -1;
     }
     
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char *makler_name = (const char *)sqlite3_column_text(stmt, 0);
-        int deal_count = sqlite3_column_int(stmt, 1);
-        
-        printf("\nMakler with Maximum Deals:\n");
-        printf("%-30s %-15s\n", "Makler Name", "Deal Count");
-        printf("------------------------------------------------\n");
-        printf("%-30s %-15d\n", makler_name, deal_count);
-        
-        printf("\nSuppliers for '%s':\n", makler_name);
-        
-        const char *suppliers_sql = "SELECT DISTINCT g.supplier "
-                                    "FROM PERFUME_DEALS d "
-                                    "JOIN PERFUME_GOODS g ON d.good_id = g.id "
-                                    "JOIN PERFUME_MAKLERS m ON d.makler_id = m.id "
-                                    "WHERE m.name = ?;";
-        
-        sqlite3_finalize(stmt);
-        rc = sqlite3_prepare_v2(db, suppliers_sql, -1, &stmt, 0);
-        if (rc != SQLITE_OK) {
-            fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-            return;
-        }
-        
-        sqlite3_bind_text(stmt, 1, makler_name, -1, SQLITE_STATIC);
-        
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            const char *supplier = (const char *)sqlite3_column_text(stmt, 0);
-            printf("- %s\n", supplier);
-        }
+    rc = db_step(stmt);
+    if (rc != SQLITE_ROW) {
+        db_finalize(stmt);
+        return rc == SQLITE_DONE ? 0 : -1;
+    }
+    
+    static const ReportColumn makler_columns[] = {
+        { "Makler Name", "makler_name", REPORT_COL_TEXT, 30 },
+        { "Deal Count", "deal_count", REPORT_COL_INT, 15 },
+    };
+    
+    int makler_id = sqlite3_column_int(stmt, 0);
+    char makler_name[100];
+    snprintf(makler_name, sizeof(makler_name), "%s", (const char *)sqlite3_column_text(stmt, 1));
+    
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "max_deals_makler", "Makler with Maximum Deals",
+                        makler_columns, REPORT_COLUMN_COUNT(makler_columns));
+    report_writer_text(rw, makler_name);
+    report_writer_int(rw, sqlite3_column_int(stmt, 2));
+    report_writer_end(rw);
+    
+    db_finalize(stmt);
+    
+    const char *suppliers_sql = "SELECT name FROM PERFUME_SUPPLIERS "
+                                "WHERE id IN (SELECT supplier_id FROM PERFUME_DEALS WHERE makler_id = ?) "
+                                "ORDER BY name;";
+    
+    rc = db_prepare(suppliers_sql, &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        report_writer_flush(rw);
+        return -1;
+    }
+    
+    sqlite3_bind_int(stmt, 1, makler_id);
+    
+    static const ReportColumn supplier_columns[] = {
+        { "Supplier", "supplier", REPORT_COL_TEXT, 30 },
+    };
+    char title[160];
+    snprintf(title, sizeof(title), "Suppliers for '%s'", makler_name);
+    
+    report_writer_begin(rw, "makler_suppliers", title, supplier_columns, REPORT_COLUMN_COUNT(supplier_columns));
+    
+    while ((rc = db_step(stmt)) == SQLITE_ROW) {
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 0));
+        report_writer_end_row(rw);
     }
     
-    sqlite3_finalize(stmt);
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    db_finalize(stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
 }
 
-void reports_sales_by_supplier() {
+// Both queries read one snapshot, so the second half matches the first
+int reports_max_deals_makler() {
+    METRICS_FUNC();
+    if (db_begin_read() != 0) return -1;
+    int rc = max_deals_makler();
+    db_end_read();
+    return rc;
+}
+
+int reports_sales_by_supplier() {
+    METRICS_FUNC();
     sqlite3 *db = db_get_connection();
-    if (!db) return;
+    if (!db) return -1;
     
-    char sql[] = "SELECT g.supplier, COUNT(d.id) as deal_count, SUM(d.quantity) as total_quantity, SUM(d.total_amount) as total_amount "
-                "FROM PERFUME_DEALS d "
-                "JOIN PERFUME_GOODS g ON d.good_id = g.id "
-                "GROUP BY g.supplier;";
+    // Deals are grouped on their supplier and makler ids alone; names are
+    // joined to the groups afterwards. Deals of goods without a supplier
+    // form their own "(none)" group, listed last like in the snapshot
+    // report. Rows come out one per supplier and makler in makler id order
+    // and the makler list is built here, since group_concat does not
+    // promise to follow the order of its input.
+    char sql[] = "SELECT t.supplier_id, COALESCE(s.name, '" REPORTS_NONE "'), m.name, "
+                "t.deal_count, t.total_quantity, t.total_amount FROM ("
+                "    SELECT COALESCE(supplier_id, 0) as supplier_id, makler_id, COUNT(*) as deal_count, "
+                "    SUM(quantity) as total_quantity, SUM(total_amount) as total_amount "
+                "    FROM PERFUME_DEALS GROUP BY 1, 2) t "
+                "LEFT JOIN PERFUME_SUPPLIERS s ON s.id = t.supplier_id "
+                "JOIN PERFUME_MAKLERS m ON m.id = t.makler_id "
+                "ORDER BY s.name IS NULL, s.name, t.supplier_id, t.makler_id;";
     
     sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        return;
+        return -1;
     }
     
-    printf("\nSales by Supplier:\n");
-    printf("%-30s %-12s %-15s %-15s\n", "Supplier", "Deal Count", "Total Quantity", "Total Amount");
-    printf("--------------------------------------------------------------------------------\n");
+    static const ReportColumn columns[] = {
+        { "Supplier", "supplier", REPORT_COL_TEXT, 30 },
+        { "Deal Count", "deal_count", REPORT_COL_INT, 12 },
+        { "Total Quantity", "total_quantity", REPORT_COL_INT, 15 },
+        { "Total Amount", "total_amount", REPORT_COL_REAL, 15 },
+        { "Maklers", "maklers", REPORT_COL_TEXT, 0 },
+    };
     
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char *supplier = (const char *)sqlite3_column_text(stmt, 0);
-        int deal_count = sqlite3_column_int(stmt, 1);
-        int total_quantity = sqlite3_column_int(stmt, 2);
-        double total_amount = sqlite3_column_double(stmt, 3);
-        
-        printf("%-30s %-12d %-15d %-15.2f\n", supplier, deal_count, total_quantity, total_amount);
-        
-        // For each supplier, show their maklers
-        char subsql[] = "SELECT DISTINCT m.name "
-                       "FROM PERFUME_DEALS d "
-                       "JOIN PERFUME_MAKLERS m ON d.makler_id = m.id "
-                       "JOIN PERFUME_GOODS g ON d.good_id = g.id "
-                       "WHERE g.supplier = ?;";
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "sales_by_supplier", "Sales by Supplier", columns, REPORT_COLUMN_COUNT(columns));
+    
+    char supplier[256] = "";
+    int current = -1;
+    int deals = 0, quantity = 0;
+    double amount = 0;
+    char *maklers = NULL;
+    size_t length = 0, capacity = 0;
+    
+    for (;;) {
+        rc = db_step(stmt);
+        int more = rc == SQLITE_ROW;
+        int id = more ? sqlite3_column_int(stmt, 0) : -1;
         
-        sqlite3_stmt *substmt;
-        rc = sqlite3_prepare_v2(db, subsql, -1, &substmt, 0);
-        if (rc != SQLITE_OK) {
-            continue;
+        if (current >= 0 && id != current) {
+            report_writer_text(rw, supplier);
+            report_writer_int(rw, deals);
+            report_writer_int(rw, quantity);
+            report_writer_real(rw, amount);
+            report_writer_text_n(rw, maklers ? maklers : "", (int)length);
+            report_writer_end_row(rw);
+            deals = quantity = 0;
+            amount = 0;
+            length = 0;
         }
+        if (!more) break;
         
-        sqlite3_bind_text(substmt, 1, supplier, -1, SQLITE_STATIC);
+        current = id;
+        snprintf(supplier, sizeof(supplier), "%s", (const char *)sqlite3_column_text(stmt, 1));
+        deals += sqlite3_column_int(stmt, 3);
+        quantity += sqlite3_column_int(stmt, 4);
+        amount += sqlite3_column_double(stmt, 5);
         
-        printf("  Maklers: ");
-        int first = 1;
-        while (sqlite3_step(substmt) == SQLITE_ROW) {
-            const char *makler_name = (const char *)sqlite3_column_text(substmt, 0);
-            if (!first) printf(", ");
-            printf("%s", makler_name);
-            first = 0;
+        const char *name = (const char *)sqlite3_column_text(stmt, 2);
+        size_t n = name ? strlen(name) : 0;
+        if (length + n + 2 > capacity) {
+            size_t grown = capacity ? capacity * 2 : 256;
+            while (grown < length + n + 2) grown *= 2;
+            char *p = realloc(maklers, grown);
+            if (!p) continue;
+            maklers = p;
+            capacity = grown;
         }
-        printf("\n");
-        
-        sqlite3_finalize(substmt);
+        if (length > 0) maklers[length++] = ',';
+        memcpy(maklers + length, name ? name : "", n);
+        length += n;
     }
     
-    sqlite3_finalize(stmt);
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    free(maklers);
+    db_finalize(stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
 }
 
-void reports_makler_deals(int makler_id, const char *date) {
+int reports_makler_deals(int makler_id, const char *date) {
+    METRICS_FUNC();
     sqlite3 *db = db_get_connection();
-    if (!db) return;
+    if (!db) return -1;
     
     char sql[] = "SELECT d.id, d.deal_date, d.good_name, d.good_type, d.quantity, d.total_amount, d.buyer "
                 "FROM PERFUME_DEALS d "
-                "WHERE d.makler_id = ? AND date(d.deal_date) = ?;";
+                "WHERE d.makler_id = ? AND date(d.deal_date) = ? "
+                "ORDER BY d.deal_date, d.id;";
     
     sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        return;
+        return -1;
     }
     
     sqlite3_bind_int(stmt, 1, makler_id);
     sqlite3_bind_text(stmt, 2, date, -1, SQLITE_STATIC);
     
-    printf("\nDeals for Makler ID %d on %s:\n", makler_id, date);
-    printf("%-5s %-20s %-30s %-20s %-10s %-15s %-30s\n", "ID", "Date", "Good Name", "Type", "Quantity", "Amount", "Buyer");
-    printf("-------------------------------------------------------------------------------------------------------------------\n");
+    static const ReportColumn columns[] = {
+        { "ID", "id", REPORT_COL_INT, 5 },
+        { "Date", "deal_date", REPORT_COL_TEXT, 20 },
+        { "Good Name", "good_name", REPORT_COL_TEXT, 30 },
+        { "Type", "good_type", REPORT_COL_TEXT, 20 },
+        { "Quantity", "quantity", REPORT_COL_INT, 10 },
+        { "Amount", "total_amount", REPORT_COL_REAL, 15 },
+        { "Buyer", "buyer", REPORT_COL_TEXT, 30 },
+    };
+    char title[128];
+    snprintf(title, sizeof(title), "Deals for Makler ID %d on %s", makler_id, date);
+    
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "makler_deals", title, columns, REPORT_COLUMN_COUNT(columns));
     
     int found = 0;
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
+    while ((rc = db_step(stmt)) == SQLITE_ROW) {
         found = 1;
-        int id = sqlite3_column_int(stmt, 0);
-        const char *deal_date = (const char *)sqlite3_column_text(stmt, 1);
-        const char *good_name = (const char *)sqlite3_column_text(stmt, 2);
-        const char *good_type = (const char *)sqlite3_column_text(stmt, 3);
-        int quantity = sqlite3_column_int(stmt, 4);
-        double total_amount = sqlite3_column_double(stmt, 5);
-        const char *buyer = (const char *)sqlite3_column_text(stmt, 6);
-        
-        printf("%-5d %-20s %-30s %-20s %-10d %-15.2f %-30s\n", 
-               id, deal_date, good_name, good_type, quantity, total_amount, buyer);
+        report_writer_int(rw, sqlite3_column_int(stmt, 0));
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 1));
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 2));
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 3));
+        report_writer_int(rw, sqlite3_column_int(stmt, 4));
+        report_writer_real(rw, sqlite3_column_double(stmt, 5));
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 6));
+        report_writer_end_row(rw);
     }
     
     if (!found) {
-        printf("No deals found for this date.\n");
+        report_writer_note(rw, "No deals found for this date.");
     }
     
-    sqlite3_finalize(stmt);
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    db_finalize(stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+static int write_deal_row(const DealView *deal, void *ctx) {
+    ReportWriter *rw = ctx;
+    report_writer_int(rw, deal->id);
+    report_writer_text_n(rw, deal->deal_date.text, deal->deal_date.length);
+    report_writer_text_n(rw, deal->good_name.text, deal->good_name.length);
+    report_writer_text_n(rw, deal->good_type.text, deal->good_type.length);
+    report_writer_int(rw, deal->quantity);
+    report_writer_real(rw, deal->total_amount);
+    report_writer_int(rw, deal->makler_id);
+    report_writer_int(rw, deal->good_id);
+    report_writer_text_n(rw, deal->buyer.text, deal->buyer.length);
+    report_writer_end_row(rw);
+    return 0;
+}
+
+int reports_deals_by_period(const char *start_date, const char *end_date) {
+    METRICS_FUNC();
+    if (!db_get_connection()) return -1;
+    if (!auth_can(CAP_VIEW_ALL_DEALS)) {
+        fprintf(stderr, "all deals: permission denied\n");
+        return -1;
+    }
+    
+    static const ReportColumn columns[] = {
+        { "ID", "id", REPORT_COL_INT, 5 },
+        { "Date", "deal_date", REPORT_COL_TEXT, 20 },
+        { "Good Name", "good_name", REPORT_COL_TEXT, 30 },
+        { "Type", "good_type", REPORT_COL_TEXT, 20 },
+        { "Quantity", "quantity", REPORT_COL_INT, 10 },
+        { "Amount", "total_amount", REPORT_COL_REAL, 15 },
+        { "Makler", "makler_id", REPORT_COL_INT, 8 },
+        { "Good", "good_id", REPORT_COL_INT, 6 },
+        { "Buyer", "buyer", REPORT_COL_TEXT, 30 },
+    };
+    char title[128];
+    snprintf(title, sizeof(title), "Deals (from %s to %s)",
+             start_date ? start_date : "start", end_date ? end_date : "today");
+    
+    // Rows are written straight from SQLite's buffers
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "deals", title, columns, REPORT_COLUMN_COUNT(columns));
+    int count = db_visit_deals(0, start_date, end_date, write_deal_row, rw);
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    return count < 0 ? -1 : 0;
+}
+
+static int write_good_row(const GoodView *good, void *ctx) {
+    ReportWriter *rw = ctx;
+    report_writer_int(rw, good->id);
+    report_writer_text_n(rw, good->name.text, good->name.length);
+    report_writer_text_n(rw, good->type.text, good->type.length);
+    report_writer_real(rw, good->unit_price);
+    report_writer_text_n(rw, good->supplier.text, good->supplier.length);
+    report_writer_text_n(rw, good->expiry_date.text, good->expiry_date.length);
+    report_writer_int(rw, good->quantity);
+    report_writer_end_row(rw);
+    return 0;
+}
+
+int reports_goods() {
+    METRICS_FUNC();
+    if (!db_get_connection()) return -1;
+    
+    static const ReportColumn columns[] = {
+        { "ID", "id", REPORT_COL_INT, 5 },
+        { "Name", "name", REPORT_COL_TEXT, 30 },
+        { "Type", "type", REPORT_COL_TEXT, 20 },
+        { "Price", "unit_price", REPORT_COL_REAL, 10 },
+        { "Supplier", "supplier", REPORT_COL_TEXT, 25 },
+        { "Expiry", "expiry_date", REPORT_COL_TEXT, 11 },
+        { "Quantity", "quantity", REPORT_COL_INT, 8 },
+    };
+    
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "goods", "Goods", columns, REPORT_COLUMN_COUNT(columns));
+    int count = db_visit_goods(write_good_row, rw);
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    return count < 0 ? -1 : 0;
+}
+
+void reports_search(const char *query, int kinds, int limit) {
+    METRICS_FUNC();
+    if (limit <= 0) limit = SEARCH_DEFAULT_RESULTS;
+    if (limit > SEARCH_MAX_RESULTS) {
+        fprintf(stderr, "Search limit must be at most %d\n", SEARCH_MAX_RESULTS);
+        return;
+    }
+    
+    // Too big for a scheduled report's stack
+    SearchResult *results = malloc(sizeof(SearchResult) * limit);
+    if (!results) {
+        fprintf(stderr, "Out of memory for search results\n");
+        return;
+    }
+    int count = search_query(query, kinds, results, limit);
+    if (count < 0) {
+        fprintf(stderr, "Search failed for '%s'\n", query);
+        free(results);
+        return;
+    }
+    
+    static const ReportColumn columns[] = {
+        { "Kind", "kind", REPORT_COL_TEXT, 9 },
+        { "ID", "id", REPORT_COL_INT, 5 },
+        { "Name", "name", REPORT_COL_TEXT, 30 },
+        { "Details", "detail", REPORT_COL_TEXT, 35 },
+        { "Match", "match", REPORT_COL_TEXT, 0 },
+    };
+    char title[SEARCH_MAX_QUERY + 32];
+    snprintf(title, sizeof(title), "Search results for \"%s\"", query);
+    
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "search", title, columns, REPORT_COLUMN_COUNT(columns));
+    
+    for (int i = 0; i < count; i++) {
+        report_writer_text(rw, search_kind_name(results[i].kind));
+        report_writer_int(rw, results[i].ref_id);
+        report_writer_text(rw, results[i].label);
+        report_writer_text(rw, results[i].detail);
+        report_writer_text(rw, results[i].fuzzy ? "similar" : "prefix");
+        report_writer_end_row(rw);
+    }
+    
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    free(results);
+}
+
+// Groups come from the daily rollup where it has the dimension; buyers
+// aren't rolled up, so they are grouped from the deals over the date index
+static const char *top_queries[] = {
+    [TOPK_GOOD] =
+        "SELECT s.good_id, g.name, SUM(s.deal_count), SUM(s.total_quantity), SUM(s.total_amount) "
+        "FROM PERFUME_DAILY_SALES s JOIN PERFUME_GOODS g ON g.id = s.good_id "
+        "WHERE (?1 IS NULL OR s.day >= ?1) AND (?2 IS NULL OR s.day <= ?2) "
+        "GROUP BY s.good_id;",
+    [TOPK_MAKLER] =
+        "SELECT s.makler_id, m.name, SUM(s.deal_count), SUM(s.total_quantity), SUM(s.total_amount) "
+        "FROM PERFUME_DAILY_SALES s JOIN PERFUME_MAKLERS m ON m.id = s.makler_id "
+        "WHERE (?1 IS NULL OR s.day >= ?1) AND (?2 IS NULL OR s.day <= ?2) "
+        "GROUP BY s.makler_id;",
+    [TOPK_BUYER] =
+        "SELECT 0, buyer, COUNT(*), SUM(quantity), SUM(total_amount) "
+        "FROM PERFUME_DEALS "
+        "WHERE (?1 IS NULL OR deal_date >= ?1) "
+        "AND (?2 IS NULL OR deal_date < date(?2, '+1 day')) "
+        "GROUP BY buyer;",
+    [TOPK_SUPPLIER] =
+        "SELECT 0, COALESCE(sp.name, '" REPORTS_NONE "'), SUM(s.deal_count), SUM(s.total_quantity), "
+        "SUM(s.total_amount) FROM PERFUME_DAILY_SALES s LEFT JOIN PERFUME_SUPPLIERS sp ON sp.id = s.supplier_id "
+        "WHERE (?1 IS NULL OR s.day >= ?1) AND (?2 IS NULL OR s.day <= ?2) "
+        "GROUP BY s.supplier_id;",
+};
+
+int reports_top(TopKDimension dimension, TopKMetric metric, int limit,
+                const char *start_date, const char *end_date) {
+    METRICS_FUNC();
+    sqlite3 *db = db_get_connection();
+    if (!db) return -1;
+    
+    TopK *topk = topk_create(limit);
+    if (!topk) return -1;
+    topk_set_metric(topk, metric);
+    
+    sqlite3_stmt *stmt;
+    int rc = db_prepare(top_queries[dimension], &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        topk_free(topk);
+        return -1;
+    }
+    
+    sqlite3_bind_text(stmt, 1, start_date, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, end_date, -1, SQLITE_STATIC);
+    
+    // Groups stream through the heap instead of being sorted in full
+    while ((rc = db_step(stmt)) == SQLITE_ROW) {
+        topk_offer(topk, sqlite3_column_int64(stmt, 0), (const char *)sqlite3_column_text(stmt, 1),
+                   sqlite3_column_int64(stmt, 2), sqlite3_column_int64(stmt, 3),
+                   sqlite3_column_double(stmt, 4));
+    }
+    db_finalize(stmt);
+    
+    ReportWriter *rw = reports_output();
+    reports_write_top(rw, topk, dimension, metric, start_date, end_date);
+    report_writer_flush(rw);
+    topk_free(topk);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+void reports_write_top(ReportWriter *rw, TopK *topk, TopKDimension dimension, TopKMetric metric,
+                       const char *start_date, const char *end_date) {
+    static const ReportColumn columns[] = {
+        { "Rank", "rank", REPORT_COL_INT, 5 },
+        { "Name", "name", REPORT_COL_TEXT, 30 },
+        { "Deal Count", "deal_count", REPORT_COL_INT, 12 },
+        { "Total Quantity", "total_quantity", REPORT_COL_INT, 15 },
+        { "Total Amount", "total_amount", REPORT_COL_REAL, 15 },
+    };
+    
+    const TopKEntry *entries;
+    int count = topk_sorted(topk, &entries);
+    
+    char title[160];
+    snprintf(title, sizeof(title), "Top %d %s by %s (from %s to %s)", count,
+             topk_dimension_title(dimension), topk_metric_title(metric),
+             start_date ? start_date : "start", end_date ? end_date : "now");
+    
+    report_writer_begin(rw, "top", title, columns, REPORT_COLUMN_COUNT(columns));
+    for (int i = 0; i < count; i++) {
+        report_writer_int(rw, i + 1);
+        report_writer_text(rw, entries[i].label);
+        report_writer_int(rw, entries[i].deals);
+        report_writer_int(rw, entries[i].quantity);
+        report_writer_real(rw, entries[i].amount);
+        report_writer_end_row(rw);
+    }
+    report_writer_end(rw);
+}
+
+// Series buckets start on the first day of their period (weeks on
+// Monday); the step walks from one bucket start to the next
+static const struct {
+    const char *name;
+    const char *title;
+    const char *start;
+    const char *step;
+} series_buckets[] = {
+    { "day",   "Daily",   "s.day",                               "+1 day" },
+    { "week",  "Weekly",  "date(s.day, 'weekday 0', '-6 days')", "+7 days" },
+    { "month", "Monthly", "strftime('%Y-%m-01', s.day)",         "+1 month" },
+};
+
+static const struct {
+    const char *name;
+    const char *title;
+    const char *label;
+    const char *join;
+} series_dimensions[] = {
+    { "good",     "Good",     "g.name",  "JOIN PERFUME_GOODS g ON g.id = s.good_id " },
+    { "type",     "Type",     "COALESCE(t.name, '" REPORTS_NONE "')",
+      "LEFT JOIN PERFUME_GOOD_TYPES t ON t.id = s.type_id " },
+    { "makler",   "Makler",   "m.name",  "JOIN PERFUME_MAKLERS m ON m.id = s.makler_id " },
+    { "supplier", "Supplier", "COALESCE(sp.name, '" REPORTS_NONE "')",
+      "LEFT JOIN PERFUME_SUPPLIERS sp ON sp.id = s.supplier_id " },
+};
+
+// Grid columns by TopKMetric
+static const char *series_metric_columns[] = { "quantity", "amount", "deals" };
+
+#define SERIES_BUCKET_COUNT (int)(sizeof(series_buckets) / sizeof(series_buckets[0]))
+#define SERIES_DIMENSION_COUNT (int)(sizeof(series_dimensions) / sizeof(series_dimensions[0]))
+
+static int series_bucket_index(const char *name) {
+    for (int i = 0; name && i < SERIES_BUCKET_COUNT; i++) {
+        if (strcmp(series_buckets[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+static int series_dimension_index(const char *name) {
+    for (int i = 0; name && i < SERIES_DIMENSION_COUNT; i++) {
+        if (strcmp(series_dimensions[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+int reports_sales_series(const char *by, const char *bucket, TopKMetric metric, int window,
+                         const char *start_date, const char *end_date) {
+    METRICS_FUNC();
+    sqlite3 *db = db_get_connection();
+    if (!db) return -1;
+    
+    int b = series_bucket_index(bucket);
+    int d = series_dimension_index(by);
+    if (b < 0 || d < 0 || window < 1 || window > SERIES_MAX_WINDOW) {
+        fprintf(stderr, "Invalid series parameters\n");
+        return -1;
+    }
+    
+    // Buckets are summed from the daily rollup, so a monthly series reads
+    // one row per day and key instead of every deal. Periods without sales
+    // are filled with zeros so averages and deltas compare adjacent periods.
+    const char *value = series_metric_columns[metric];
+    char sql[2048];
+    snprintf(sql, sizeof(sql),
+             "WITH RECURSIVE buckets AS ("
+             "    SELECT %s AS period, COALESCE(%s, '') AS name, SUM(s.deal_count) AS deals, "
+             "    SUM(s.total_quantity) AS quantity, SUM(s.total_amount) AS amount "
+             "    FROM PERFUME_DAILY_SALES s %s"
+             "    WHERE (?1 IS NULL OR s.day >= ?1) AND (?2 IS NULL OR s.day <= ?2) "
+             "    GROUP BY 2, 1), "
+             "periods(period, last) AS ("
+             "    SELECT MIN(period), MAX(period) FROM buckets "
+             "    UNION ALL "
+             "    SELECT date(period, '%s'), last FROM periods WHERE period < last), "
+             "grid AS ("
+             "    SELECT p.period, n.name, COALESCE(b.deals, 0) AS deals, "
+             "    COALESCE(b.quantity, 0) AS quantity, COALESCE(b.amount, 0) AS amount "
+             "    FROM periods p CROSS JOIN (SELECT DISTINCT name FROM buckets) n "
+             "    LEFT JOIN buckets b ON b.period = p.period AND b.name = n.name) "
+             "SELECT period, name, deals, quantity, amount, "
+             "AVG(%s) OVER (PARTITION BY name ORDER BY period ROWS BETWEEN %d PRECEDING AND CURRENT ROW), "
+             "%s - LAG(%s) OVER (PARTITION BY name ORDER BY period) "
+             "FROM grid ORDER BY name, period;",
+             series_buckets[b].start, series_dimensions[d].label, series_dimensions[d].join,
+             series_buckets[b].step, value, window - 1, value, value);
+    
+    sqlite3_stmt *stmt;
+    int rc = db_prepare(sql, &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    
+    sqlite3_bind_text(stmt, 1, start_date, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, end_date, -1, SQLITE_STATIC);
+    
+    static const ReportColumn columns[] = {
+        { "Period", "period", REPORT_COL_TEXT, 12 },
+        { "Name", "name", REPORT_COL_TEXT, 30 },
+        { "Deal Count", "deal_count", REPORT_COL_INT, 12 },
+        { "Total Quantity", "total_quantity", REPORT_COL_INT, 15 },
+        { "Total Amount", "total_amount", REPORT_COL_REAL, 15 },
+        { "Moving Avg", "moving_avg", REPORT_COL_REAL, 15 },
+        { "Change", "change", REPORT_COL_REAL, 15 },
+    };
+    char title[192];
+    snprintf(title, sizeof(title), "%s %s by %s (from %s to %s, %d-period average)",
+             series_buckets[b].title, topk_metric_title(metric), series_dimensions[d].title,
+             start_date ? start_date : "start", end_date ? end_date : "now", window);
+    
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "sales_series", title, columns, REPORT_COLUMN_COUNT(columns));
+    
+    while ((rc = db_step(stmt)) == SQLITE_ROW) {
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 0));
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 1));
+        report_writer_int(rw, sqlite3_column_int64(stmt, 2));
+        report_writer_int(rw, sqlite3_column_int64(stmt, 3));
+        report_writer_real(rw, sqlite3_column_double(stmt, 4));
+        report_writer_real(rw, sqlite3_column_double(stmt, 5));
+        // The first period has nothing to compare with and is left empty
+        if (sqlite3_column_type(stmt, 6) != SQLITE_NULL) {
+            report_writer_real(rw, sqlite3_column_double(stmt, 6));
+        }
+        report_writer_end_row(rw);
+    }
+    
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    db_finalize(stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+static const char *sketch_dimensions[] = { "type", "makler", "supplier" };
+
+static int sketch_dimension_index(const char *name) {
+    for (int i = 0; name && i < (int)(sizeof(sketch_dimensions) / sizeof(sketch_dimensions[0])); i++) {
+        if (strcmp(sketch_dimensions[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+int reports_distinct_buyers(const char *by, const char *key, const char *start_date, const char *end_date) {
+    METRICS_FUNC();
+    sqlite3 *db = db_get_connection();
+    if (!db) return -1;
+    
+    // Daily sketches are merged instead of counting distinct buyers over
+    // the deals; the counts are estimates within about 1%
+    char sql[] = "SELECT key, hll_count(hll_merge(sketch)) FROM PERFUME_BUYER_SKETCHES "
+                "WHERE dimension = ?1 AND (?2 IS NULL OR key = ?2) "
+                "AND (?3 IS NULL OR day >= ?3) AND (?4 IS NULL OR day <= ?4) "
+                "GROUP BY key ORDER BY key;";
+    
+    sqlite3_stmt *stmt;
+    int rc = db_prepare(sql, &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    
+    sqlite3_bind_text(stmt, 1, by, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, key, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, start_date, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 4, end_date, -1, SQLITE_STATIC);
+    
+    static const ReportColumn columns[] = {
+        { "Key", "key", REPORT_COL_TEXT, 30 },
+        { "Distinct Buyers", "distinct_buyers", REPORT_COL_INT, 16 },
+    };
+    char title[160];
+    snprintf(title, sizeof(title), "Distinct Buyers by %s (from %s to %s, estimated)", by,
+             start_date ? start_date : "start", end_date ? end_date : "now");
+    
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "distinct_buyers", title, columns, REPORT_COLUMN_COUNT(columns));
+    
+    while ((rc = db_step(stmt)) == SQLITE_ROW) {
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 0));
+        report_writer_int(rw, sqlite3_column_int64(stmt, 1));
+        report_writer_end_row(rw);
+    }
+    
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    db_finalize(stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
 }
 
 void reports_update_stock(const char *date) {
+    METRICS_FUNC();
     sqlite3 *db = db_get_connection();
     if (!db) return;
     
-    sqlite3_exec(db, "BEGIN TRANSACTION", 0, 0, 0);
+    if (db_begin_transaction() != 0) return;
     
     // Update goods quantities based on deals
     char sql[] = "UPDATE PERFUME_GOODS "
@@ -301,78 +870,108 @@ void reports_update_stock(const char *date) {
                 "   FROM PERFUME_DEALS d "
                 "   WHERE d.good_id = PERFUME_GOODS.id "
                 "   AND date(d.deal_date) <= ?"
-                ");";
+                "), version = version + 1;";
     
     sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
+        db_rollback_transaction();
         return;
     }
     
     sqlite3_bind_text(stmt, 1, date, -1, SQLITE_STATIC);
     
-    rc = sqlite3_step(stmt);
+    rc = db_step(stmt);
     if (rc != SQLITE_DONE) {
         fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
-        sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
+        db_finalize(stmt);
+        db_rollback_transaction();
         return;
     }
     
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     
     // Delete deals up to the specified date
     const char *delete_sql = "DELETE FROM PERFUME_DEALS WHERE date(deal_date) <= ?;";
     
-    rc = sqlite3_prepare_v2(db, delete_sql, -1, &stmt, 0);
+    rc = db_prepare(delete_sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
+        db_rollback_transaction();
         return;
     }
     
     sqlite3_bind_text(stmt, 1, date, -1, SQLITE_STATIC);
     
-    rc = sqlite3_step(stmt);
+    rc = db_step(stmt);
     if (rc != SQLITE_DONE) {
         fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
-        sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
+        db_finalize(stmt);
+        db_rollback_transaction();
+        return;
+    }
+    
+    db_finalize(stmt);
+    
+    if (db_journal_stock() != 0) {
+        db_rollback_transaction();
         return;
     }
     
-    sqlite3_finalize(stmt);
-    sqlite3_exec(db, "COMMIT", 0, 0, 0);
+    if (db_commit_transaction() != 0) {
+        db_rollback_transaction();
+        return;
+    }
     
-    printf("\nStock updated successfully for date: %s\n", date);
+    ReportWriter *rw = reports_output();
+    report_writer_note(rw, "\nStock updated successfully for date: %s", date);
+    report_writer_flush(rw);
 }
 
 int stats_update_on_deal(const Deal *deal) {
+    METRICS_FUNC();
     return db_update_makler_stats(deal);
 }
 
-void stats_show_makler_stats(int makler_id) {
+int stats_show_makler_stats(int makler_id) {
+    METRICS_FUNC();
     int count;
     MaklerStats *stats = db_get_makler_stats(makler_id, &count);
     
-    printf("\nStatistics for Makler ID %d:\n", makler_id);
-    printf("%-30s %-20s %-15s %-15s\n", "Good Name", "Type", "Total Quantity", "Total Amount");
-    printf("------------------------------------------------------------------------------\n");
+    static const ReportColumn columns[] = {
+        { "Good Name", "good_name", REPORT_COL_TEXT, 30 },
+        { "Type", "good_type", REPORT_COL_TEXT, 20 },
+        { "Total Quantity", "total_quantity", REPORT_COL_INT, 15 },
+        { "Total Amount", "total_amount", REPORT_COL_REAL, 15 },
+    };
+    char title[64];
+    snprintf(title, sizeof(title), "Statistics for Makler ID %d", makler_id);
+    
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "makler_stats", title, columns, REPORT_COLUMN_COUNT(columns));
     
     for (int i = 0; i < count; i++) {
-        printf("%-30s %-20s %-15d %-15.2f\n", 
-               stats[i].good_name, stats[i].good_type, 
-               stats[i].total_quantity, stats[i].total_amount);
+        report_writer_text(rw, stats[i].good_name);
+        report_writer_text(rw, stats[i].good_type);
+        report_writer_int(rw, stats[i].total_quantity);
+        report_writer_real(rw, stats[i].total_amount);
+        report_writer_end_row(rw);
     }
     
+    report_writer_end(rw);
+    report_writer_flush(rw);
     free(stats);
+    return 0;
 }
 
-void stats_show_all_stats() {
+int stats_show_all_stats() {
+    METRICS_FUNC();
     sqlite3 *db = db_get_connection();
-    if (!db) return;
+    if (!db) return -1;
+    
+    // The table is read directly, so write out the statistics held in memory
+    statstore_flush();
     
     char sql[] = "SELECT m.name, s.good_name, s.good_type, s.total_quantity, s.total_amount "
                 "FROM PERFUME_MAKLERSTATS s "
@@ -380,26 +979,270 @@ void stats_show_all_stats() {
                 "ORDER BY m.name, s.good_name;";
     
     sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    int rc = db_prepare(sql, &stmt);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        return;
+        return -1;
     }
     
-    printf("\nAll Makler Statistics:\n");
-    printf("%-20s %-30s %-20s %-15s %-15s\n", "Makler", "Good Name", "Type", "Total Quantity", "Total Amount");
-    printf("----------------------------------------------------------------------------------------------------------\n");
+    static const ReportColumn columns[] = {
+        { "Makler", "makler_name", REPORT_COL_TEXT, 20 },
+        { "Good Name", "good_name", REPORT_COL_TEXT, 30 },
+        { "Type", "good_type", REPORT_COL_TEXT, 20 },
+        { "Total Quantity", "total_quantity", REPORT_COL_INT, 15 },
+        { "Total Amount", "total_amount", REPORT_COL_REAL, 15 },
+    };
     
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char *makler_name = (const char *)sqlite3_column_text(stmt, 0);
-        const char *good_name = (const char *)sqlite3_column_text(stmt, 1);
-        const char *good_type = (const char *)sqlite3_column_text(stmt, 2);
-        int total_quantity = sqlite3_column_int(stmt, 3);
-        double total_amount = sqlite3_column_double(stmt, 4);
-        
-        printf("%-20s %-30s %-20s %-15d %-15.2f\n", 
-               makler_name, good_name, good_type, total_quantity, total_amount);
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "all_stats", "All Makler Statistics", columns, REPORT_COLUMN_COUNT(columns));
+    
+    while ((rc = db_step(stmt)) == SQLITE_ROW) {
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 0));
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 1));
+        report_writer_text(rw, (const char *)sqlite3_column_text(stmt, 2));
+        report_writer_int(rw, sqlite3_column_int(stmt, 3));
+        report_writer_real(rw, sqlite3_column_double(stmt, 4));
+        report_writer_end_row(rw);
     }
     
-    sqlite3_finalize(stmt);
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    db_finalize(stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+// Report catalog for running reports by name (--report)
+
+// Parameters a report cannot run without
+#define NEEDS_RANGE  0x01  // --from and --to
+#define NEEDS_GOOD   0x02
+#define NEEDS_MAKLER 0x04
+#define NEEDS_DATE   0x08
+#define NEEDS_TOP    0x10  // a valid --by, and --metric/--limit if given
+#define NEEDS_SERIES 0x20  // a valid --by, and --bucket/--metric/--window if given
+#define NEEDS_SKETCH 0x40  // --by type, makler or supplier
+
+typedef struct {
+    const char *name;
+    const char *usage;
+    int needs;
+    int (*run)(const ReportParams *params);   // -1 if the report failed
+    int cached;   // 0 for reports answered from memory anyway
+} ReportDefinition;
+
+static int run_sales_by_good(const ReportParams *p) {
+    return reports_sales_by_good(p->start_date, p->end_date);
+}
+
+static int run_buyers_by_good(const ReportParams *p) {
+    return reports_buyers_by_good(p->good_name);
+}
+
+static int run_popular_good_type(const ReportParams *p) {
+    (void)p;
+    return reports_popular_good_type();
+}
+
+static int run_max_deals_makler(const ReportParams *p) {
+    (void)p;
+    return reports_max_deals_makler();
+}
+
+static int run_sales_by_supplier(const ReportParams *p) {
+    (void)p;
+    return reports_sales_by_supplier();
+}
+
+static int run_makler_deals(const ReportParams *p) {
+    return reports_makler_deals(p->makler_id, p->date);
+}
+
+static int run_deals(const ReportParams *p) {
+    return reports_deals_by_period(p->start_date, p->end_date);
+}
+
+static int run_goods(const ReportParams *p) {
+    (void)p;
+    return reports_goods();
+}
+
+static int run_makler_stats(const ReportParams *p) {
+    return stats_show_makler_stats(p->makler_id);
+}
+
+static int run_all_stats(const ReportParams *p) {
+    (void)p;
+    return stats_show_all_stats();
+}
+
+static int run_top(const ReportParams *p) {
+    return reports_top(topk_parse_dimension(p->by), p->metric ? topk_parse_metric(p->metric) : TOPK_QUANTITY,
+                       p->limit ? p->limit : TOPK_DEFAULT_LIMIT, p->start_date, p->end_date);
+}
+
+static int run_sales_series(const ReportParams *p) {
+    return reports_sales_series(p->by, p->bucket ? p->bucket : "month",
+                                p->metric ? topk_parse_metric(p->metric) : TOPK_QUANTITY,
+                                p->window ? p->window : SERIES_DEFAULT_WINDOW, p->start_date, p->end_date);
+}
+
+static int run_distinct_buyers(const ReportParams *p) {
+    return reports_distinct_buyers(p->by, p->key, p->start_date, p->end_date);
+}
+
+static const ReportDefinition report_catalog[] = {
+    { "sales-by-good",     "--from DATE --to DATE",     NEEDS_RANGE,               run_sales_by_good,     1 },
+    { "buyers-by-good",    "--good NAME",               NEEDS_GOOD,                run_buyers_by_good,    1 },
+    { "popular-good-type", "",                          0,                         run_popular_good_type, 1 },
+    { "max-deals-makler",  "",                          0,                         run_max_deals_makler,  1 },
+    { "sales-by-supplier", "",                          0,                         run_sales_by_supplier, 1 },
+    { "makler-deals",      "--makler ID --date DATE",   NEEDS_MAKLER | NEEDS_DATE, run_makler_deals,      1 },
+    { "deals",             "[--from DATE] [--to DATE]", 0,                         run_deals,             1 },
+    { "goods",             "",                          0,                         run_goods,             1 },
+    { "makler-stats",      "--makler ID",               NEEDS_MAKLER,              run_makler_stats,      0 },
+    { "all-stats",         "",                          0,                         run_all_stats,         0 },
+    { "top",               "--by DIMENSION [--metric METRIC] [--limit K] [--from DATE] [--to DATE]", NEEDS_TOP, run_top, 1 },
+    { "sales-series",      "--by DIMENSION [--bucket day|week|month] [--metric METRIC] [--window N] [--from DATE] [--to DATE]", NEEDS_SERIES, run_sales_series, 1 },
+    { "distinct-buyers",   "--by type|makler|supplier [--key VALUE] [--from DATE] [--to DATE]", NEEDS_SKETCH, run_distinct_buyers, 1 },
+};
+
+static const ReportDefinition* find_report(const char *name) {
+    for (size_t i = 0; i < sizeof(report_catalog) / sizeof(report_catalog[0]); i++) {
+        if (strcmp(report_catalog[i].name, name) == 0) {
+            return &report_catalog[i];
+        }
+    }
+    fprintf(stderr, "Unknown report: %s\n", name);
+    return NULL;
+}
+
+int reports_check_params(const char *name, const ReportParams *params) {
+    const ReportDefinition *report = find_report(name);
+    if (!report) return -1;
+    
+    int needs = report->needs;
+    if (((needs & NEEDS_RANGE) && (!params->start_date || !params->end_date)) ||
+        ((needs & NEEDS_GOOD) && !params->good_name) ||
+        ((needs & NEEDS_MAKLER) && params->makler_id <= 0) ||
+        ((needs & NEEDS_DATE) && !params->date) ||
+        ((needs & NEEDS_TOP) && (topk_parse_dimension(params->by) < 0 ||
+                                 (params->metric && topk_parse_metric(params->metric) < 0) ||
+                                 params->limit < 0 || params->limit > TOPK_MAX_LIMIT)) ||
+        ((needs & NEEDS_SERIES) && (series_dimension_index(params->by) < 0 ||
+                                    (params->bucket && series_bucket_index(params->bucket) < 0) ||
+                                    (params->metric && topk_parse_metric(params->metric) < 0) ||
+                                    params->window < 0 || params->window > SERIES_MAX_WINDOW)) ||
+        ((needs & NEEDS_SKETCH) && sketch_dimension_index(params->by) < 0)) {
+        fprintf(stderr, "Report '%s' requires %s\n", report->name, report->usage);
+        return -1;
+    }
+    return 0;
+}
+
+// Result cache
+
+static void key_text(char **p, char *end, const char *value) {
+    // Length-prefixed, so no value can run into the next; '-' for none
+    int n = value ? snprintf(*p, (size_t)(end - *p), "%zu:%s|", strlen(value), value)
+                  : snprintf(*p, (size_t)(end - *p), "-|");
+    *p += n < end - *p ? n : end - *p;
+}
+
+static void key_int(char **p, char *end, long long value) {
+    int n = snprintf(*p, (size_t)(end - *p), "%lld|", value);
+    *p += n < end - *p ? n : end - *p;
+}
+
+// Everything the output depends on besides the data; -1 if it won't fit.
+// CSV output starts differently when the writer already holds a section.
+static int cache_key(const ReportDefinition *report, const ReportParams *params,
+                     ReportWriter *rw, char *key, size_t size) {
+    char *p = key, *end = key + size;
+    key_text(&p, end, report->name);
+    key_int(&p, end, report_writer_format(rw));
+    key_int(&p, end, report_writer_sections(rw) > 0);
+    key_text(&p, end, params->start_date);
+    key_text(&p, end, params->end_date);
+    key_text(&p, end, params->good_name);
+    key_text(&p, end, params->date);
+    key_int(&p, end, params->makler_id);
+    key_text(&p, end, params->by);
+    key_text(&p, end, params->metric);
+    key_int(&p, end, params->limit);
+    key_text(&p, end, params->bucket);
+    key_int(&p, end, params->window);
+    key_text(&p, end, params->key);
+    return p < end - 1 ? 0 : -1;
+}
+
+// Read inside the report's read transaction, so it matches what it sees
+static int cache_version(ReportCacheVersion *version) {
+    sqlite3 *db = db_get_connection();
+    sqlite3_stmt *stmt;
+    if (db_prepare("PRAGMA data_version;", &stmt) != SQLITE_OK) return -1;
+    int rc = db_step(stmt);
+    version->data_version = sqlite3_column_int64(stmt, 0);
+    db_finalize(stmt);
+    
+    version->connection = db;
+    version->changes = sqlite3_total_changes64(db);
+    return rc == SQLITE_ROW ? 0 : -1;
+}
+
+static int run_cached(const ReportDefinition *report, const ReportParams *params) {
+    ReportWriter *rw = reports_output();
+    char key[REPORT_CACHE_KEY_SIZE];
+    ReportCacheVersion version;
+    size_t limit = report_cache_max_output();
+    if (limit == 0 || cache_key(report, params, rw, key, sizeof(key)) != 0 ||
+        cache_version(&version) != 0) {
+        return report->run(params);
+    }
+    
+    size_t length;
+    int sections;
+    const char *cached = report_cache_get(key, &version, &length, &sections);
+    if (cached) {
+        report_writer_replay(rw, cached, length, sections);
+        report_writer_flush(rw);
+        return 0;
+    }
+    
+    // Output cut short by an error, a cancel or a deadline is never kept
+    report_writer_record(rw, limit);
+    int rc = report->run(params);
+    char *recorded = report_writer_stop_recording(rw, &length, &sections);
+    if (recorded && rc == 0 && !scheduler_task_stopping()) {
+        report_cache_put(key, &version, recorded, length, sections);
+    }
+    free(recorded);
+    return rc;
+}
+
+int reports_run(const char *name, const ReportParams *params) {
+    if (!auth_can(CAP_RUN_REPORTS)) {
+        fprintf(stderr, "%s: permission denied\n", name);
+        return -1;
+    }
+    if (reports_check_params(name, params) != 0) {
+        return -1;
+    }
+    
+    // Inside a transaction the report could see changes that are then
+    // rolled back without moving the data version
+    const ReportDefinition *report = find_report(name);
+    int cached = report->cached && db_transaction_depth() == 0;
+    if (db_begin_read() != 0) {
+        return -1;
+    }
+    int rc = cached ? run_cached(report, params) : report->run(params);
+    db_end_read();
+    return rc;
+}
+
+void reports_print_catalog(FILE *out) {
+    fprintf(out, "Reports:\n");
+    for (size_t i = 0; i < sizeof(report_catalog) / sizeof(report_catalog[0]); i++) {
+        fprintf(out, "  %-20s %s\n", report_catalog[i].name, report_catalog[i].usage);
+    }
 }
@@ -0,0 +1,306 @@
+#include "reservations.h"
+#include "deals.h"
+#include "database.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Holds live in one array and are linked into their wheel slot by index,
+// so growing the array doesn't invalidate the lists. Hold ids are
+// sequential and found through a small open-addressing table.
+#define ID_EMPTY -1
+#define ID_DELETED -2
+
+typedef struct {
+    int id;           // 0 = free
+    int good_id;
+    int quantity;
+    int makler_id;
+    uint64_t expires_tick;
+    int prev;         // wheel slot list
+    int next;
+} Hold;
+
+static Hold *holds = NULL;
+static int hold_capacity = 0;
+static int free_list = -1;      // chained through Hold.next
+static int active_count = 0;
+static int next_hold_id = 1;
+
+// Hold id -> index into holds, linear probing, power-of-two size
+static int *id_table = NULL;
+static int id_table_size = 0;
+static int id_table_used = 0;   // live entries and tombstones
+
+static int wheel[RESERVATION_WHEEL_SLOTS];
+static int wheel_ready = 0;
+static uint64_t current_tick = 0;
+
+// Reserved quantity per good id
+static int *reserved = NULL;
+static int reserved_size = 0;
+
+static uint64_t default_clock_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static uint64_t (*clock_ms)() = default_clock_ms;
+
+void reservations_set_clock(uint64_t (*clock)()) {
+    clock_ms = clock ? clock : default_clock_ms;
+    wheel_ready = 0;
+}
+
+static uint64_t now_tick() {
+    return clock_ms() / RESERVATION_TICK_MS;
+}
+
+static void wheel_init() {
+    for (int i = 0; i < RESERVATION_WHEEL_SLOTS; i++) {
+        wheel[i] = -1;
+    }
+    current_tick = now_tick();
+    wheel_ready = 1;
+}
+
+static void wheel_link(int index) {
+    Hold *h = &holds[index];
+    int slot = (int)(h->expires_tick % RESERVATION_WHEEL_SLOTS);
+    h->prev = -1;
+    h->next = wheel[slot];
+    if (wheel[slot] >= 0) holds[wheel[slot]].prev = index;
+    wheel[slot] = index;
+}
+
+static void wheel_unlink(int index) {
+    Hold *h = &holds[index];
+    int slot = (int)(h->expires_tick % RESERVATION_WHEEL_SLOTS);
+    if (h->prev >= 0) holds[h->prev].next = h->next;
+    else wheel[slot] = h->next;
+    if (h->next >= 0) holds[h->next].prev = h->prev;
+}
+
+static int* reserved_slot(int good_id) {
+    if (good_id < 0) return NULL;
+    if (good_id >= reserved_size) {
+        int size = reserved_size ? reserved_size : 256;
+        while (size <= good_id) size *= 2;
+        int *grown = realloc(reserved, sizeof(int) * size);
+        if (!grown) return NULL;
+        memset(grown + reserved_size, 0, sizeof(int) * (size - reserved_size));
+        reserved = grown;
+        reserved_size = size;
+    }
+    return &reserved[good_id];
+}
+
+static int id_probe(int hold_id, int i) {
+    return (int)(((unsigned)hold_id * 2654435761u + (unsigned)i) & (unsigned)(id_table_size - 1));
+}
+
+static int id_table_find(int hold_id) {
+    for (int i = 0; id_table_size > 0 && i < id_table_size; i++) {
+        int pos = id_probe(hold_id, i);
+        int index = id_table[pos];
+        if (index == ID_EMPTY) return -1;
+        if (index >= 0 && holds[index].id == hold_id) return pos;
+    }
+    return -1;
+}
+
+static int id_table_insert(int hold_id, int index);
+
+// Rebuilds the table at a size that keeps it at most half full
+static int id_table_grow() {
+    int size = id_table_size ? id_table_size : 128;
+    while (size < (active_count + 1) * 4) size *= 2;
+    int *table = malloc(sizeof(int) * size);
+    if (!table) return -1;
+    for (int i = 0; i < size; i++) table[i] = ID_EMPTY;
+    
+    int *old = id_table;
+    int old_size = id_table_size;
+    id_table = table;
+    id_table_size = size;
+    id_table_used = 0;
+    for (int i = 0; i < old_size; i++) {
+        if (old[i] >= 0) id_table_insert(holds[old[i]].id, old[i]);
+    }
+    free(old);
+    return 0;
+}
+
+static int id_table_insert(int hold_id, int index) {
+    if ((id_table_used + 1) * 2 > id_table_size && id_table_grow() != 0) return -1;
+    for (int i = 0; ; i++) {
+        int pos = id_probe(hold_id, i);
+        if (id_table[pos] < 0) {
+            if (id_table[pos] == ID_EMPTY) id_table_used++;
+            id_table[pos] = index;
+            return 0;
+        }
+    }
+}
+
+static Hold* hold_find(int hold_id) {
+    int pos = hold_id > 0 ? id_table_find(hold_id) : -1;
+    return pos >= 0 ? &holds[id_table[pos]] : NULL;
+}
+
+static int hold_alloc() {
+    if (free_list < 0) {
+        int capacity = hold_capacity ? hold_capacity * 2 : 64;
+        Hold *grown = realloc(holds, sizeof(Hold) * capacity);
+        if (!grown) return -1;
+        for (int i = capacity - 1; i >= hold_capacity; i--) {
+            grown[i].id = 0;
+            grown[i].next = free_list;
+            free_list = i;
+        }
+        holds = grown;
+        hold_capacity = capacity;
+    }
+    int index = free_list;
+    free_list = holds[index].next;
+    return index;
+}
+
+static void hold_free(int index) {
+    Hold *h = &holds[index];
+    id_table[id_table_find(h->id)] = ID_DELETED;
+    wheel_unlink(index);
+    reserved[h->good_id] -= h->quantity;
+    h->id = 0;
+    h->next = free_list;
+    free_list = index;
+    active_count--;
+}
+
+int reservations_expire() {
+    if (!wheel_ready) wheel_init();
+    
+    uint64_t target = now_tick();
+    if (target <= current_tick) return 0;
+    
+    // Visit each slot the clock passed, at most one full revolution
+    uint64_t steps = target - current_tick;
+    if (steps > RESERVATION_WHEEL_SLOTS) steps = RESERVATION_WHEEL_SLOTS;
+    
+    int released = 0;
+    for (uint64_t tick = target - steps + 1; tick <= target; tick++) {
+        int index = wheel[tick % RESERVATION_WHEEL_SLOTS];
+        while (index >= 0) {
+            int next = holds[index].next;
+            if (holds[index].expires_tick <= target) {
+                hold_free(index);
+                released++;
+            }
+            index = next;
+        }
+    }
+    current_tick = target;
+    return released;
+}
+
+int reservations_reserved(int good_id) {
+    reservations_expire();
+    return good_id >= 0 && good_id < reserved_size ? reserved[good_id] : 0;
+}
+
+int reservations_active_count() {
+    reservations_expire();
+    return active_count;
+}
+
+int reservations_hold(int good_id, int quantity, int makler_id, int ttl_seconds) {
+    METRICS_FUNC();
+    if (quantity <= 0) {
+        fprintf(stderr, "Hold quantity must be positive\n");
+        return -1;
+    }
+    if (ttl_seconds <= 0) ttl_seconds = RESERVATION_DEFAULT_TTL_SECONDS;
+    
+    int held = reservations_reserved(good_id);
+    if (!db_check_good_availability(good_id, held + quantity)) {
+        return -1;
+    }
+    
+    int *slot = reserved_slot(good_id);
+    int index = slot ? hold_alloc() : -1;
+    if (index < 0 || id_table_insert(next_hold_id, index) != 0) {
+        if (index >= 0) {
+            holds[index].next = free_list;
+            free_list = index;
+        }
+        fprintf(stderr, "Out of memory, hold not placed\n");
+        return -1;
+    }
+    
+    Hold *h = &holds[index];
+    h->id = next_hold_id++;
+    h->good_id = good_id;
+    h->quantity = quantity;
+    h->makler_id = makler_id;
+    // Round up so a hold never expires early
+    h->expires_tick = current_tick + ((uint64_t)ttl_seconds * 1000 + RESERVATION_TICK_MS - 1) / RESERVATION_TICK_MS;
+    wheel_link(index);
+    
+    *slot += quantity;
+    active_count++;
+    return h->id;
+}
+
+int reservations_confirm(int hold_id, const char *buyer) {
+    METRICS_FUNC();
+    reservations_expire();
+    Hold *h = hold_find(hold_id);
+    if (!h) {
+        fprintf(stderr, "Hold %d doesn't exist or has expired\n", hold_id);
+        return -1;
+    }
+    
+    // Take the hold off the wheel while the deal is created, so the
+    // deal may use its quantity but nobody else's
+    int index = (int)(h - holds);
+    wheel_unlink(index);
+    reserved[h->good_id] -= h->quantity;
+    int deal_id = deals_create_deal(h->good_id, h->quantity, buyer, h->makler_id);
+    reserved[h->good_id] += h->quantity;
+    wheel_link(index);
+    
+    if (deal_id < 0) {
+        if (h->expires_tick <= current_tick) {
+            hold_free(index);  // its slot was passed while it was off the wheel
+        }
+        return -1;
+    }
+    hold_free(index);
+    return deal_id;
+}
+
+int reservations_release(int hold_id) {
+    reservations_expire();
+    Hold *h = hold_find(hold_id);
+    if (!h) {
+        return -1;
+    }
+    hold_free((int)(h - holds));
+    return 0;
+}
+
+void reservations_reset() {
+    free(holds);
+    free(reserved);
+    free(id_table);
+    holds = NULL;
+    reserved = NULL;
+    id_table = NULL;
+    hold_capacity = reserved_size = id_table_size = id_table_used = 0;
+    free_list = -1;
+    active_count = 0;
+    wheel_ready = 0;
+}
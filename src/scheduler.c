@@ -0,0 +1,278 @@
+#include "scheduler.h"
+#include "auth.h"
+#include "database.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+// Tasks take turns on the caller's thread. Switching into a task swaps
+// in its connection (with its transaction depth), its report output and
+// its metrics scope chain, and switching out swaps them back, so code
+// running in a task uses the db_* and reports_* functions unchanged.
+
+typedef struct {
+    int id;
+    TaskState state;
+    int started;
+    int finished;
+    SchedulerFn fn;
+    void *arg;
+    ReportWriter *output;
+    uint64_t deadline_ns;
+    int cancel_requested;
+    int timed_out;
+    
+    ucontext_t context;
+    void *stack;
+    sqlite3 *conn;             // this slot's connection, kept open for reuse
+    int depth;                 // its transaction depth while switched out
+    MetricsScope *scope;
+    
+    // Copy for scheduler_submit_report
+    const char *report_name;
+    ReportParams report_params;
+} Task;
+
+static Task tasks[SCHEDULER_MAX_TASKS];
+static int next_task_id = 1;
+static Task *current = NULL;
+static ucontext_t scheduler_context;
+static uint64_t slice_start_ns = 0;
+static int slice_over = 0;
+
+// Runs every SCHEDULER_PROGRESS_OPS instructions of a task's statements
+static int progress(void *unused) {
+    (void)unused;
+    Task *task = current;
+    if (!task || task->finished) return 0;
+    
+    uint64_t now = metrics_now_ns();
+    if (task->cancel_requested) return 1;
+    if (task->deadline_ns && now >= task->deadline_ns) {
+        task->timed_out = 1;
+        return 1;
+    }
+    if (now - slice_start_ns >= (uint64_t)SCHEDULER_SLICE_MS * 1000000) {
+        slice_over = 1;
+    }
+    return 0;
+}
+
+static void task_main(int slot) {
+    Task *task = &tasks[slot];
+    int rc = task->fn(task->arg);
+    
+    // A stopped task may leave its read session open
+    task->finished = 1;
+    while (db_transaction_depth() > 0) {
+        if (db_rollback_transaction() != 0) break;
+    }
+    
+    if (task->cancel_requested) task->state = TASK_CANCELLED;
+    else if (task->timed_out) task->state = TASK_TIMED_OUT;
+    else task->state = rc == 0 ? TASK_DONE : TASK_FAILED;
+    // Returning resumes scheduler_context through uc_link
+}
+
+static void resume(Task *task) {
+    ReportWriter *caller_output = reports_output();
+    reports_set_output(task->output);
+    db_swap_connection(&task->conn, &task->depth);
+    MetricsScope *caller_scope = metrics_swap_scope(task->scope);
+    current = task;
+    slice_start_ns = metrics_now_ns();
+    slice_over = 0;
+    
+    swapcontext(&scheduler_context, &task->context);
+    
+    current = NULL;
+    task->scope = metrics_swap_scope(caller_scope);
+    db_swap_connection(&task->conn, &task->depth);
+    reports_set_output(caller_output);
+}
+
+void scheduler_row_boundary() {
+    Task *task = current;
+    if (!task || !slice_over || task->finished) return;
+    
+    // A task holding the write lock would block deal entry while it waits
+    if (sqlite3_txn_state(db_get_connection(), NULL) == SQLITE_TXN_WRITE) return;
+    swapcontext(&task->context, &scheduler_context);
+}
+
+int scheduler_task_stopping() {
+    Task *task = current;
+    return task && (task->cancel_requested || task->timed_out);
+}
+
+static Task* find_task(int id) {
+    if (id <= 0) return NULL;
+    Task *task = &tasks[id % SCHEDULER_MAX_TASKS];
+    return task->id == id ? task : NULL;
+}
+
+static int task_free(const Task *task) {
+    return task->id == 0 || task->state != TASK_READY;
+}
+
+int scheduler_submit(SchedulerFn fn, void *arg, ReportWriter *rw, int deadline_ms) {
+    METRICS_FUNC();
+    if (current) {
+        fprintf(stderr, "Tasks can't submit tasks\n");
+        return -1;
+    }
+    
+    // Ids map to slots, so the next id for a free slot is looked for
+    int id = next_task_id, slot = -1;
+    for (int i = 0; i < SCHEDULER_MAX_TASKS; i++, id++) {
+        if (task_free(&tasks[id % SCHEDULER_MAX_TASKS])) {
+            slot = id % SCHEDULER_MAX_TASKS;
+            break;
+        }
+    }
+    if (slot < 0) {
+        fprintf(stderr, "Too many tasks running\n");
+        return -1;
+    }
+    
+    Task *task = &tasks[slot];
+    if (!task->stack && !(task->stack = malloc(SCHEDULER_STACK_SIZE))) {
+        fprintf(stderr, "Out of memory for a task\n");
+        return -1;
+    }
+    if (!task->conn) {
+        task->conn = db_open_connection();
+        if (!task->conn) return -1;
+        sqlite3_progress_handler(task->conn, SCHEDULER_PROGRESS_OPS, progress, NULL);
+    }
+    
+    task->id = id;
+    task->state = TASK_READY;
+    task->started = task->finished = 0;
+    task->fn = fn;
+    task->arg = arg;
+    task->output = rw ? rw : reports_output();
+    task->deadline_ns = deadline_ms > 0 ? metrics_now_ns() + (uint64_t)deadline_ms * 1000000 : 0;
+    task->cancel_requested = task->timed_out = 0;
+    task->depth = 0;
+    task->scope = NULL;
+    
+    getcontext(&task->context);
+    task->context.uc_stack.ss_sp = task->stack;
+    task->context.uc_stack.ss_size = SCHEDULER_STACK_SIZE;
+    task->context.uc_link = &scheduler_context;
+    makecontext(&task->context, (void (*)())task_main, 1, slot);
+    
+    next_task_id = id + 1;
+    return id;
+}
+
+static int run_report_task(void *arg) {
+    Task *task = arg;
+    return reports_run(task->report_name, &task->report_params);
+}
+
+int scheduler_submit_report(const char *name, const ReportParams *params, ReportWriter *rw,
+                            int deadline_ms) {
+    if (!auth_can(CAP_RUN_REPORTS)) {
+        fprintf(stderr, "%s: permission denied\n", name);
+        return -1;
+    }
+    if (reports_check_params(name, params) != 0) return -1;
+    
+    int id = scheduler_submit(run_report_task, NULL, rw, deadline_ms);
+    Task *task = find_task(id);
+    if (!task) return -1;
+    task->arg = task;
+    task->report_name = name;
+    task->report_params = *params;
+    return id;
+}
+
+// One turn for each unfinished task, in slot order
+static int run_turns() {
+    int remaining = 0;
+    for (int i = 0; i < SCHEDULER_MAX_TASKS; i++) {
+        Task *task = &tasks[i];
+        if (task->id == 0 || task->state != TASK_READY) continue;
+        
+        // Not started yet: nothing to unwind
+        if (!task->started && task->cancel_requested) {
+            task->state = TASK_CANCELLED;
+            continue;
+        }
+        if (task->deadline_ns && metrics_now_ns() >= task->deadline_ns) {
+            if (!task->started) {
+                task->state = TASK_TIMED_OUT;
+                continue;
+            }
+            // Stops the statement it is suspended in; it then unwinds
+            task->timed_out = 1;
+            sqlite3_interrupt(task->conn);
+        }
+        
+        task->started = 1;
+        resume(task);
+        if (task->state == TASK_READY) remaining++;
+    }
+    return remaining;
+}
+
+int scheduler_run_slice() {
+    METRICS_FUNC();
+    if (current) return -1;
+    
+    // Task connections share the savepoint bookkeeping of the main one
+    if (db_transaction_depth() > 0) {
+        fprintf(stderr, "Reports can't be scheduled inside a transaction\n");
+        return -1;
+    }
+    return run_turns();
+}
+
+int scheduler_run_all() {
+    int remaining;
+    while ((remaining = scheduler_run_slice()) > 0) {
+    }
+    return remaining;
+}
+
+int scheduler_cancel(int id) {
+    Task *task = find_task(id);
+    if (!task || task->state != TASK_READY) return -1;
+    
+    task->cancel_requested = 1;
+    if (task->started) sqlite3_interrupt(task->conn);
+    return 0;
+}
+
+TaskState scheduler_state(int id) {
+    Task *task = find_task(id);
+    return task ? task->state : TASK_UNKNOWN;
+}
+
+const char* scheduler_state_name(TaskState state) {
+    static const char *names[] = { "unknown", "ready", "done", "failed", "cancelled", "timed out" };
+    return (int)state >= 0 && state <= TASK_TIMED_OUT ? names[state] : "unknown";
+}
+
+void scheduler_close() {
+    if (current) return;
+    
+    // Started tasks have frames on their stacks; they unwind once resumed
+    for (int i = 0; i < SCHEDULER_MAX_TASKS; i++) {
+        if (tasks[i].id && tasks[i].state == TASK_READY) {
+            scheduler_cancel(tasks[i].id);
+        }
+    }
+    while (run_turns() > 0) {
+    }
+    
+    for (int i = 0; i < SCHEDULER_MAX_TASKS; i++) {
+        if (tasks[i].conn) sqlite3_close(tasks[i].conn);
+        free(tasks[i].stack);
+    }
+    memset(tasks, 0, sizeof(tasks));
+}
@@ -0,0 +1,264 @@
+#include "scrypt.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t block[64];
+    size_t used;
+} Sha256;
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void sha256_compress(uint32_t state[8], const uint8_t block[64]) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+               (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+static void sha256_init(Sha256 *ctx) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+static void sha256_update(Sha256 *ctx, const void *data, size_t size) {
+    const uint8_t *p = data;
+    ctx->length += size;
+    while (size > 0) {
+        size_t take = 64 - ctx->used < size ? 64 - ctx->used : size;
+        memcpy(ctx->block + ctx->used, p, take);
+        ctx->used += take;
+        p += take;
+        size -= take;
+        if (ctx->used == 64) {
+            sha256_compress(ctx->state, ctx->block);
+            ctx->used = 0;
+        }
+    }
+}
+
+static void sha256_final(Sha256 *ctx, uint8_t digest[SHA256_SIZE]) {
+    uint64_t bits = ctx->length * 8;
+    uint8_t pad = 0x80;
+    sha256_update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->used != 56) sha256_update(ctx, &pad, 1);
+    
+    uint8_t length[8];
+    for (int i = 0; i < 8; i++) length[i] = (uint8_t)(bits >> (56 - 8 * i));
+    sha256_update(ctx, length, 8);
+    
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (uint8_t)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)ctx->state[i];
+    }
+}
+
+void sha256(const void *data, size_t size, uint8_t digest[SHA256_SIZE]) {
+    Sha256 ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, size);
+    sha256_final(&ctx, digest);
+}
+
+// HMAC keyed once: the inner and outer states after the padded key block
+typedef struct {
+    Sha256 inner;
+    Sha256 outer;
+} HmacSha256;
+
+static void hmac_init(HmacSha256 *hmac, const void *key, size_t key_size) {
+    uint8_t block[64] = {0};
+    if (key_size > 64) {
+        sha256(key, key_size, block);
+    } else {
+        memcpy(block, key, key_size);
+    }
+    
+    uint8_t pad[64];
+    for (int i = 0; i < 64; i++) pad[i] = block[i] ^ 0x36;
+    sha256_init(&hmac->inner);
+    sha256_update(&hmac->inner, pad, 64);
+    for (int i = 0; i < 64; i++) pad[i] = block[i] ^ 0x5c;
+    sha256_init(&hmac->outer);
+    sha256_update(&hmac->outer, pad, 64);
+}
+
+static void hmac_final(const HmacSha256 *keyed, Sha256 *inner, uint8_t mac[SHA256_SIZE]) {
+    uint8_t digest[SHA256_SIZE];
+    sha256_final(inner, digest);
+    Sha256 outer = keyed->outer;
+    sha256_update(&outer, digest, SHA256_SIZE);
+    sha256_final(&outer, mac);
+}
+
+void pbkdf2_sha256(const void *password, size_t password_size, const void *salt, size_t salt_size,
+                   uint64_t iterations, uint8_t *out, size_t out_size) {
+    HmacSha256 keyed;
+    hmac_init(&keyed, password, password_size);
+    
+    for (uint32_t block = 1; out_size > 0; block++) {
+        uint8_t index[4] = { (uint8_t)(block >> 24), (uint8_t)(block >> 16), (uint8_t)(block >> 8), (uint8_t)block };
+        Sha256 inner = keyed.inner;
+        sha256_update(&inner, salt, salt_size);
+        sha256_update(&inner, index, 4);
+        
+        uint8_t u[SHA256_SIZE], t[SHA256_SIZE];
+        hmac_final(&keyed, &inner, u);
+        memcpy(t, u, SHA256_SIZE);
+        for (uint64_t i = 1; i < iterations; i++) {
+            inner = keyed.inner;
+            sha256_update(&inner, u, SHA256_SIZE);
+            hmac_final(&keyed, &inner, u);
+            for (int j = 0; j < SHA256_SIZE; j++) t[j] ^= u[j];
+        }
+        
+        size_t take = out_size < SHA256_SIZE ? out_size : SHA256_SIZE;
+        memcpy(out, t, take);
+        out += take;
+        out_size -= take;
+    }
+}
+
+static void salsa20_8(uint32_t b[16]) {
+    uint32_t x[16];
+    memcpy(x, b, sizeof(x));
+    for (int i = 0; i < 8; i += 2) {
+        x[4] ^= ROTL(x[0] + x[12], 7);   x[8] ^= ROTL(x[4] + x[0], 9);
+        x[12] ^= ROTL(x[8] + x[4], 13);  x[0] ^= ROTL(x[12] + x[8], 18);
+        x[9] ^= ROTL(x[5] + x[1], 7);    x[13] ^= ROTL(x[9] + x[5], 9);
+        x[1] ^= ROTL(x[13] + x[9], 13);  x[5] ^= ROTL(x[1] + x[13], 18);
+        x[14] ^= ROTL(x[10] + x[6], 7);  x[2] ^= ROTL(x[14] + x[10], 9);
+        x[6] ^= ROTL(x[2] + x[14], 13);  x[10] ^= ROTL(x[6] + x[2], 18);
+        x[3] ^= ROTL(x[15] + x[11], 7);  x[7] ^= ROTL(x[3] + x[15], 9);
+        x[11] ^= ROTL(x[7] + x[3], 13);  x[15] ^= ROTL(x[11] + x[7], 18);
+        x[1] ^= ROTL(x[0] + x[3], 7);    x[2] ^= ROTL(x[1] + x[0], 9);
+        x[3] ^= ROTL(x[2] + x[1], 13);   x[0] ^= ROTL(x[3] + x[2], 18);
+        x[6] ^= ROTL(x[5] + x[4], 7);    x[7] ^= ROTL(x[6] + x[5], 9);
+        x[4] ^= ROTL(x[7] + x[6], 13);   x[5] ^= ROTL(x[4] + x[7], 18);
+        x[11] ^= ROTL(x[10] + x[9], 7);  x[8] ^= ROTL(x[11] + x[10], 9);
+        x[9] ^= ROTL(x[8] + x[11], 13);  x[10] ^= ROTL(x[9] + x[8], 18);
+        x[12] ^= ROTL(x[15] + x[14], 7); x[13] ^= ROTL(x[12] + x[15], 9);
+        x[14] ^= ROTL(x[13] + x[12], 13); x[15] ^= ROTL(x[14] + x[13], 18);
+    }
+    for (int i = 0; i < 16; i++) b[i] += x[i];
+}
+
+// BlockMix over 2r 64-byte blocks; even outputs go to the first half of y
+static void block_mix(const uint32_t *b, uint32_t *y, uint32_t r) {
+    uint32_t x[16];
+    memcpy(x, &b[(2 * r - 1) * 16], 64);
+    for (uint32_t i = 0; i < 2 * r; i++) {
+        for (int j = 0; j < 16; j++) x[j] ^= b[i * 16 + j];
+        salsa20_8(x);
+        memcpy(&y[((i & 1) * r + i / 2) * 16], x, 64);
+    }
+}
+
+static void ro_mix(uint8_t *block, uint64_t n, uint32_t r, uint32_t *v, uint32_t *x, uint32_t *y) {
+    size_t words = 32 * (size_t)r;
+    for (size_t i = 0; i < words; i++) {
+        const uint8_t *p = block + i * 4;
+        x[i] = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+    
+    for (uint64_t i = 0; i < n; i++) {
+        memcpy(&v[i * words], x, words * 4);
+        block_mix(x, y, r);
+        memcpy(x, y, words * 4);
+    }
+    for (uint64_t i = 0; i < n; i++) {
+        // Integerify: the first word of the last 64-byte block
+        uint64_t j = x[(2 * r - 1) * 16] & (n - 1);
+        for (size_t k = 0; k < words; k++) x[k] ^= v[j * words + k];
+        block_mix(x, y, r);
+        memcpy(x, y, words * 4);
+    }
+    
+    for (size_t i = 0; i < words; i++) {
+        uint8_t *p = block + i * 4;
+        p[0] = (uint8_t)x[i];
+        p[1] = (uint8_t)(x[i] >> 8);
+        p[2] = (uint8_t)(x[i] >> 16);
+        p[3] = (uint8_t)(x[i] >> 24);
+    }
+}
+
+int scrypt(const void *password, size_t password_size, const void *salt, size_t salt_size,
+           uint64_t n, uint32_t r, uint32_t p, uint8_t *out, size_t out_size) {
+    if (n < 2 || (n & (n - 1)) != 0 || r == 0 || p == 0 ||
+        (uint64_t)r * p >= (1u << 30) || n > SIZE_MAX / 128 / r) {
+        return -1;
+    }
+    
+    size_t block_size = 128 * (size_t)r;
+    uint8_t *blocks = malloc(block_size * p);
+    uint32_t *v = malloc(block_size * n);
+    uint32_t *xy = malloc(block_size * 2);
+    if (!blocks || !v || !xy) {
+        free(blocks);
+        free(v);
+        free(xy);
+        return -1;
+    }
+    
+    pbkdf2_sha256(password, password_size, salt, salt_size, 1, blocks, block_size * p);
+    for (uint32_t i = 0; i < p; i++) {
+        ro_mix(blocks + i * block_size, n, r, v, xy, xy + block_size / 4);
+    }
+    pbkdf2_sha256(password, password_size, blocks, block_size * p, 1, out, out_size);
+    
+    free(blocks);
+    free(v);
+    free(xy);
+    return 0;
+}
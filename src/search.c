@@ -0,0 +1,172 @@
+#include "search.h"
+#include "database.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+static const char *kind_names[] = { "good", "buyer", "supplier" };
+
+const char* search_kind_name(SearchKind kind) {
+    switch (kind) {
+        case SEARCH_GOOD: return "good";
+        case SEARCH_BUYER: return "buyer";
+        case SEARCH_SUPPLIER: return "supplier";
+        default: return "all";
+    }
+}
+
+int search_kind_parse(const char *name, int *kinds) {
+    if (strcmp(name, "all") == 0) {
+        *kinds = SEARCH_ALL;
+        return 0;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(name, kind_names[i]) == 0) {
+            *kinds = 1 << i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static SearchKind kind_from_text(const char *text) {
+    if (strcmp(text, "buyer") == 0) return SEARCH_BUYER;
+    if (strcmp(text, "supplier") == 0) return SEARCH_SUPPLIER;
+    return SEARCH_GOOD;
+}
+
+// Bytes that belong to a word: ASCII letters and digits, and anything
+// non-ASCII so Cyrillic names stay whole
+static int is_word_byte(unsigned char c) {
+    return isalnum(c) || c >= 0x80;
+}
+
+// Appends a double-quoted FTS5 string (quotes are doubled)
+static int append_quoted(char *out, size_t size, size_t *len, const char *text, size_t n) {
+    if (*len + n * 2 + 3 >= size) return -1;
+    out[(*len)++] = '"';
+    for (size_t i = 0; i < n; i++) {
+        if (text[i] == '"') out[(*len)++] = '"';
+        out[(*len)++] = text[i];
+    }
+    out[(*len)++] = '"';
+    out[*len] = '\0';
+    return 0;
+}
+
+// "rose wat" -> "rose"* "wat"*
+static int build_prefix_query(const char *query, char *out, size_t size) {
+    size_t len = 0;
+    out[0] = '\0';
+    for (const char *p = query; *p; ) {
+        while (*p && !is_word_byte((unsigned char)*p)) p++;
+        const char *start = p;
+        while (*p && is_word_byte((unsigned char)*p)) p++;
+        if (p == start) break;
+        if (len > 0) out[len++] = ' ';
+        if (append_quoted(out, size, &len, start, (size_t)(p - start)) != 0 || len + 2 >= size) return -1;
+        out[len++] = '*';
+        out[len] = '\0';
+    }
+    return len > 0 ? 0 : -1;
+}
+
+// "chanell" -> "cha" OR "han" OR "ane" OR "nel" OR "ell", by UTF-8 characters
+static int build_trigram_query(const char *query, char *out, size_t size) {
+    const char *chars[SEARCH_MAX_QUERY + 1];
+    int count = 0;
+    for (const char *p = query; *p && count < SEARCH_MAX_QUERY; ) {
+        chars[count++] = p;
+        p++;
+        while ((*p & 0xC0) == 0x80) p++;
+    }
+    chars[count] = query + strlen(query);
+    
+    size_t len = 0;
+    out[0] = '\0';
+    for (int i = 0; i + 3 <= count; i++) {
+        if (len > 0) {
+            if (len + 4 >= size) return -1;
+            memcpy(out + len, " OR ", 4);
+            len += 4;
+        }
+        if (append_quoted(out, size, &len, chars[i], (size_t)(chars[i + 3] - chars[i])) != 0) return -1;
+    }
+    return len > 0 ? 0 : -1;
+}
+
+// Runs one ranked FTS query, appending results not seen yet
+static int run_query(const char *sql, const char *match, int kinds, int fuzzy,
+                     SearchResult *results, int count, int max_results, int *ids) {
+    sqlite3_stmt *stmt;
+    if (db_prepare(sql, &stmt) != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db_get_connection()));
+        return -1;
+    }
+    
+    sqlite3_bind_text(stmt, 1, match, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, kinds & SEARCH_GOOD ? 1 : 0);
+    sqlite3_bind_int(stmt, 3, kinds & SEARCH_BUYER ? 1 : 0);
+    sqlite3_bind_int(stmt, 4, kinds & SEARCH_SUPPLIER ? 1 : 0);
+    sqlite3_bind_int(stmt, 5, max_results);
+    
+    int rc;
+    while (count < max_results && (rc = db_step(stmt)) == SQLITE_ROW) {
+        int id = sqlite3_column_int(stmt, 0);
+        int seen = 0;
+        for (int i = 0; i < count && !seen; i++) {
+            seen = ids[i] == id;
+        }
+        if (seen) continue;
+        
+        SearchResult *r = &results[count];
+        memset(r, 0, sizeof(*r));
+        r->kind = kind_from_text((const char *)sqlite3_column_text(stmt, 1));
+        r->ref_id = sqlite3_column_int(stmt, 2);
+        snprintf(r->label, sizeof(r->label), "%s", (const char *)sqlite3_column_text(stmt, 3));
+        snprintf(r->detail, sizeof(r->detail), "%s", (const char *)sqlite3_column_text(stmt, 4));
+        r->score = sqlite3_column_double(stmt, 5);
+        r->fuzzy = fuzzy;
+        ids[count++] = id;
+    }
+    
+    db_finalize(stmt);
+    return count;
+}
+
+int search_query(const char *query, int kinds, SearchResult *results, int max_results) {
+    METRICS_FUNC();
+    if (!query || max_results <= 0 || max_results > SEARCH_MAX_RESULTS ||
+        strlen(query) > SEARCH_MAX_QUERY) {
+        return -1;
+    }
+    
+    // Name matches outrank matches on type or supplier
+    static const char *prefix_sql =
+        "SELECT t.id, t.kind, t.ref_id, t.label, t.detail, bm25(PERFUME_SEARCH, 10.0, 1.0) AS score "
+        "FROM PERFUME_SEARCH JOIN PERFUME_SEARCH_TERMS t ON t.id = PERFUME_SEARCH.rowid "
+        "WHERE PERFUME_SEARCH MATCH ?1 "
+        "AND ((t.kind = 'good' AND ?2) OR (t.kind = 'buyer' AND ?3) OR (t.kind = 'supplier' AND ?4)) "
+        "ORDER BY score LIMIT ?5;";
+    static const char *trigram_sql =
+        "SELECT t.id, t.kind, t.ref_id, t.label, t.detail, bm25(PERFUME_SEARCH_TRIGRAMS) AS score "
+        "FROM PERFUME_SEARCH_TRIGRAMS JOIN PERFUME_SEARCH_TERMS t ON t.id = PERFUME_SEARCH_TRIGRAMS.rowid "
+        "WHERE PERFUME_SEARCH_TRIGRAMS MATCH ?1 "
+        "AND ((t.kind = 'good' AND ?2) OR (t.kind = 'buyer' AND ?3) OR (t.kind = 'supplier' AND ?4)) "
+        "ORDER BY score LIMIT ?5;";
+    
+    char match[SEARCH_MAX_QUERY * 8];
+    int ids[SEARCH_MAX_RESULTS];
+    int count = 0;
+    
+    if (build_prefix_query(query, match, sizeof(match)) == 0) {
+        count = run_query(prefix_sql, match, kinds, 0, results, 0, max_results, ids);
+        if (count < 0) return -1;
+    }
+    
+    if (count < max_results && build_trigram_query(query, match, sizeof(match)) == 0) {
+        count = run_query(trigram_sql, match, kinds, 1, results, count, max_results, ids);
+    }
+    return count;
+}
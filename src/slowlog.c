@@ -0,0 +1,152 @@
+#include "slowlog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PLAN_MAX_DEPTH 64
+
+static FILE *log_file = NULL;
+static char log_path[256];
+static uint64_t threshold_ns = 0;
+static long log_size = 0;
+static long log_max_bytes = SLOWLOG_DEFAULT_MAX_BYTES;
+static int log_max_files = SLOWLOG_DEFAULT_MAX_FILES;
+
+int slowlog_open(const char *path, double threshold_ms, long max_bytes, int max_files) {
+    slowlog_close();
+    
+    log_file = fopen(path, "a");
+    if (!log_file) {
+        fprintf(stderr, "Can't open slow query log: %s\n", path);
+        return -1;
+    }
+    
+    snprintf(log_path, sizeof(log_path), "%s", path);
+    fseek(log_file, 0, SEEK_END);
+    log_size = ftell(log_file);
+    log_max_bytes = max_bytes > 0 ? max_bytes : SLOWLOG_DEFAULT_MAX_BYTES;
+    log_max_files = max_files > 0 ? max_files : SLOWLOG_DEFAULT_MAX_FILES;
+    slowlog_set_threshold(threshold_ms);
+    return 0;
+}
+
+void slowlog_close() {
+    if (log_file) {
+        fclose(log_file);
+        log_file = NULL;
+    }
+}
+
+int slowlog_enabled() {
+    return log_file != NULL;
+}
+
+void slowlog_set_threshold(double threshold_ms) {
+    threshold_ns = threshold_ms > 0 ? (uint64_t)(threshold_ms * 1000000.0) : 0;
+}
+
+// path -> path.1 -> path.2 ... the oldest file falls off the end
+static void slowlog_rotate() {
+    char from[300], to[300];
+    
+    fclose(log_file);
+    log_file = NULL;
+    
+    for (int i = log_max_files - 1; i >= 1; i--) {
+        snprintf(from, sizeof(from), "%s.%d", log_path, i);
+        snprintf(to, sizeof(to), "%s.%d", log_path, i + 1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", log_path);
+    rename(log_path, to);
+    
+    log_file = fopen(log_path, "a");
+    log_size = 0;
+}
+
+static void slowlog_write_plan(FILE *out, sqlite3_stmt *stmt) {
+    sqlite3 *conn = sqlite3_db_handle(stmt);
+    const char *sql = sqlite3_sql(stmt);
+    if (!conn || !sql) return;
+    
+    char *explain_sql = sqlite3_mprintf("EXPLAIN QUERY PLAN %s", sql);
+    if (!explain_sql) return;
+    
+    // Uses the raw API so the plan query itself is not timed or logged
+    sqlite3_stmt *plan;
+    int rc = sqlite3_prepare_v2(conn, explain_sql, -1, &plan, 0);
+    sqlite3_free(explain_sql);
+    if (rc != SQLITE_OK) {
+        fprintf(out, "plan: unavailable (%s)\n", sqlite3_errmsg(conn));
+        return;
+    }
+    
+    int ids[PLAN_MAX_DEPTH];
+    int depth_count = 0;
+    
+    fprintf(out, "plan:\n");
+    while (sqlite3_step(plan) == SQLITE_ROW) {
+        int id = sqlite3_column_int(plan, 0);
+        int parent = sqlite3_column_int(plan, 1);
+        const char *detail = (const char *)sqlite3_column_text(plan, 3);
+        
+        // Nesting depth = position of the parent on the stack of open nodes
+        while (depth_count > 0 && ids[depth_count - 1] != parent) {
+            depth_count--;
+        }
+        fprintf(out, "  %*s%s\n", depth_count * 2, "", detail ? detail : "");
+        if (depth_count < PLAN_MAX_DEPTH) {
+            ids[depth_count++] = id;
+        }
+    }
+    
+    sqlite3_finalize(plan);
+}
+
+void slowlog_record(sqlite3_stmt *stmt, uint64_t exec_ns, uint64_t wall_ns, int rows) {
+    if (!log_file || !stmt || exec_ns < threshold_ns) return;
+    
+    char *buffer = NULL;
+    size_t length = 0;
+    FILE *entry = open_memstream(&buffer, &length);
+    if (!entry) return;
+    
+    char time_str[20];
+    time_t now = time(NULL);
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    
+    fprintf(entry, "# %s exec_ms=%.3f wall_ms=%.3f rows=%d vm_steps=%d fullscan_steps=%d sorts=%d autoindex=%d\n",
+            time_str,
+            exec_ns / 1000000.0,
+            wall_ns / 1000000.0,
+            rows,
+            sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 0),
+            sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0),
+            sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 0),
+            sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, 0));
+    fprintf(entry, "sql: %s\n", sqlite3_sql(stmt));
+    
+    if (sqlite3_bind_parameter_count(stmt) > 0) {
+        char *expanded = sqlite3_expanded_sql(stmt);
+        if (expanded) {
+            fprintf(entry, "bound: %s\n", expanded);
+            sqlite3_free(expanded);
+        }
+    }
+    
+    slowlog_write_plan(entry, stmt);
+    fprintf(entry, "\n");
+    fclose(entry);
+    
+    if (log_size > 0 && log_size + (long)length > log_max_bytes) {
+        slowlog_rotate();
+    }
+    if (log_file) {
+        fwrite(buffer, 1, length, log_file);
+        fflush(log_file);
+        log_size += (long)length;
+    }
+    
+    free(buffer);
+}
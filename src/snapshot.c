@@ -0,0 +1,1278 @@
+#include "snapshot.h"
+#include "database.h"
+#include "metrics.h"
+#include "crc32.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// File layout (native byte order, every section 8-byte aligned):
+//
+//   SnapshotHeader
+//   SnapshotSection[section_count]    directory
+//   section data...
+//
+// Strings live in one pool of NUL-terminated strings referenced by byte
+// offset. Deal text columns are dictionary codes; dictionaries are sorted,
+// so ordering by code is ordering by string, as in SQL GROUP BY.
+// Deals are sorted by date, so date ranges are found by binary search.
+
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+#define SNAPSHOT_NO_CODE 0xFFFFFFFFu
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t section_count;
+    uint32_t header_crc;    // over header (this field 0) and directory
+    int64_t created_at;
+    uint64_t file_size;
+} SnapshotHeader;
+
+typedef struct {
+    uint32_t id;
+    uint32_t crc;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t count;
+} SnapshotSection;
+
+typedef struct {
+    int32_t id;
+    int32_t quantity;
+    double unit_price;
+    uint32_t name;          // string pool offsets
+    uint32_t type;
+    uint32_t supplier;      // code in the supplier dictionary
+    uint32_t expiry_date;
+} SnapshotGood;
+
+typedef struct {
+    int32_t id;
+    int32_t birth_year;
+    int32_t user_id;
+    uint32_t name;
+    uint32_t address;
+    uint32_t reserved;
+} SnapshotMakler;
+
+enum {
+    SECTION_STRINGS,
+    SECTION_GOODS,
+    SECTION_MAKLERS,
+    SECTION_DICT_GOOD_NAMES,
+    SECTION_DICT_GOOD_TYPES,
+    SECTION_DICT_BUYERS,
+    SECTION_DICT_SUPPLIERS,
+    SECTION_DEAL_ID,
+    SECTION_DEAL_TIME,      // seconds since 1970-01-01, wall clock as stored
+    SECTION_DEAL_GOOD,
+    SECTION_DEAL_MAKLER,
+    SECTION_DEAL_QUANTITY,
+    SECTION_DEAL_AMOUNT,
+    SECTION_DEAL_NAME,      // good name code
+    SECTION_DEAL_TYPE,      // good type code
+    SECTION_DEAL_BUYER,     // buyer code
+    SECTION_DEAL_SUPPLIER,  // supplier code at commit, SNAPSHOT_NO_CODE for none
+    SECTION_COUNT
+};
+
+// Element size of each section, 1 for the string pool
+static const size_t section_element_size[SECTION_COUNT] = {
+    [SECTION_STRINGS] = 1,
+    [SECTION_GOODS] = sizeof(SnapshotGood),
+    [SECTION_MAKLERS] = sizeof(SnapshotMakler),
+    [SECTION_DICT_GOOD_NAMES] = sizeof(uint32_t),
+    [SECTION_DICT_GOOD_TYPES] = sizeof(uint32_t),
+    [SECTION_DICT_BUYERS] = sizeof(uint32_t),
+    [SECTION_DICT_SUPPLIERS] = sizeof(uint32_t),
+    [SECTION_DEAL_ID] = sizeof(int32_t),
+    [SECTION_DEAL_TIME] = sizeof(int64_t),
+    [SECTION_DEAL_GOOD] = sizeof(int32_t),
+    [SECTION_DEAL_MAKLER] = sizeof(int32_t),
+    [SECTION_DEAL_QUANTITY] = sizeof(int32_t),
+    [SECTION_DEAL_AMOUNT] = sizeof(double),
+    [SECTION_DEAL_NAME] = sizeof(uint32_t),
+    [SECTION_DEAL_TYPE] = sizeof(uint32_t),
+    [SECTION_DEAL_BUYER] = sizeof(uint32_t),
+    [SECTION_DEAL_SUPPLIER] = sizeof(uint32_t),
+};
+
+struct Snapshot {
+    void *base;
+    size_t size;
+    int64_t created_at;
+    
+    const char *strings;
+    size_t strings_size;
+    
+    const SnapshotGood *goods;
+    int good_count;
+    const SnapshotMakler *maklers;
+    int makler_count;
+    
+    const uint32_t *good_names;
+    int good_name_count;
+    const uint32_t *good_types;
+    int good_type_count;
+    const uint32_t *buyers;
+    int buyer_count;
+    const uint32_t *suppliers;
+    int supplier_count;
+    
+    int deal_count;
+    const int32_t *deal_id;
+    const int64_t *deal_time;
+    const int32_t *deal_good;
+    const int32_t *deal_makler;
+    const int32_t *deal_quantity;
+    const double *deal_amount;
+    const uint32_t *deal_name;
+    const uint32_t *deal_type;
+    const uint32_t *deal_buyer;
+    const uint32_t *deal_supplier;
+};
+
+// Calendar helpers: dates are converted without the local time zone so a
+// snapshot reads the same everywhere
+
+static int64_t days_from_civil(int y, int m, int d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = (int)(y - era * 400);
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static void civil_from_days(int64_t z, int *y, int *m, int *d) {
+    z += 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    int doe = (int)(z - era * 146097);
+    int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = (int)(yoe + era * 400 + (*m <= 2));
+}
+
+// "YYYY-MM-DD[ HH:MM:SS]" to seconds; -1 if it is not a date
+static int64_t parse_datetime(const char *text) {
+    int y, m, d, hh = 0, mm = 0, ss = 0;
+    if (!text || sscanf(text, "%4d-%2d-%2d %2d:%2d:%2d", &y, &m, &d, &hh, &mm, &ss) < 3) {
+        return -1;
+    }
+    if (m < 1 || m > 12 || d < 1 || d > 31) {
+        return -1;
+    }
+    return days_from_civil(y, m, d) * 86400 + hh * 3600 + mm * 60 + ss;
+}
+
+static void format_datetime(int64_t seconds, char *buffer, size_t size) {
+    int y, m, d;
+    int64_t days = seconds / 86400;
+    int rest = (int)(seconds % 86400);
+    civil_from_days(days, &y, &m, &d);
+    snprintf(buffer, size, "%04d-%02d-%02d %02d:%02d:%02d",
+             y, m, d, rest / 3600, rest / 60 % 60, rest % 60);
+}
+
+// Writing
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+    uint64_t count;
+} SnapBuffer;
+
+typedef struct {
+    char **values;
+    int count;
+} SnapDict;
+
+static int buffer_append(SnapBuffer *b, const void *data, size_t size) {
+    if (b->size + size > b->capacity) {
+        size_t capacity = b->capacity ? b->capacity : 4096;
+        while (capacity < b->size + size) {
+            capacity *= 2;
+        }
+        char *grown = realloc(b->data, capacity);
+        if (!grown) {
+            return -1;
+        }
+        b->data = grown;
+        b->capacity = capacity;
+    }
+    memcpy(b->data + b->size, data, size);
+    b->size += size;
+    return 0;
+}
+
+static uint32_t pool_add(SnapBuffer *pool, const char *value) {
+    if (!value || !*value) {
+        return 0;  // offset 0 is the empty string
+    }
+    uint32_t offset = (uint32_t)pool->size;
+    if (buffer_append(pool, value, strlen(value) + 1) != 0) {
+        return 0;
+    }
+    return offset;
+}
+
+// Loads a sorted list of distinct values; NULL becomes the empty string
+static int dict_load(SnapDict *dict, const char *sql) {
+    dict->values = NULL;
+    dict->count = 0;
+    
+    sqlite3_stmt *stmt;
+    if (db_prepare(sql, &stmt) != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db_get_connection()));
+        return -1;
+    }
+    
+    int capacity = 0;
+    while (db_step(stmt) == SQLITE_ROW) {
+        if (dict->count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            char **grown = realloc(dict->values, sizeof(char *) * capacity);
+            if (!grown) {
+                db_finalize(stmt);
+                return -1;
+            }
+            dict->values = grown;
+        }
+        const char *value = (const char *)sqlite3_column_text(stmt, 0);
+        dict->values[dict->count++] = strdup(value ? value : "");
+    }
+    
+    db_finalize(stmt);
+    return 0;
+}
+
+static void dict_free(SnapDict *dict) {
+    for (int i = 0; i < dict->count; i++) {
+        free(dict->values[i]);
+    }
+    free(dict->values);
+}
+
+static uint32_t dict_find(const SnapDict *dict, const char *value) {
+    if (!value) value = "";
+    int lo = 0, hi = dict->count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(dict->values[mid], value);
+        if (cmp == 0) return (uint32_t)mid;
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return SNAPSHOT_NO_CODE;
+}
+
+static int dict_write(SnapBuffer *section, SnapBuffer *pool, const SnapDict *dict) {
+    for (int i = 0; i < dict->count; i++) {
+        uint32_t offset = pool_add(pool, dict->values[i]);
+        if (buffer_append(section, &offset, sizeof(offset)) != 0) {
+            return -1;
+        }
+    }
+    section->count = (uint64_t)dict->count;
+    return 0;
+}
+
+static int collect_goods(SnapBuffer *section, SnapBuffer *pool, const SnapDict *suppliers) {
+    const char *sql = "SELECT id, name, type, unit_price, supplier, expiry_date, quantity "
+                      "FROM PERFUME_GOODS ORDER BY id;";
+    sqlite3_stmt *stmt;
+    if (db_prepare(sql, &stmt) != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db_get_connection()));
+        return -1;
+    }
+    
+    int rc = 0;
+    while (rc == 0 && db_step(stmt) == SQLITE_ROW) {
+        SnapshotGood good = {0};
+        good.id = sqlite3_column_int(stmt, 0);
+        good.name = pool_add(pool, (const char *)sqlite3_column_text(stmt, 1));
+        good.type = pool_add(pool, (const char *)sqlite3_column_text(stmt, 2));
+        good.unit_price = sqlite3_column_double(stmt, 3);
+        good.supplier = dict_find(suppliers, (const char *)sqlite3_column_text(stmt, 4));
+        good.expiry_date = pool_add(pool, (const char *)sqlite3_column_text(stmt, 5));
+        good.quantity = sqlite3_column_int(stmt, 6);
+        rc = buffer_append(section, &good, sizeof(good));
+        section->count++;
+    }
+    
+    db_finalize(stmt);
+    return rc;
+}
+
+static int collect_maklers(SnapBuffer *section, SnapBuffer *pool) {
+    const char *sql = "SELECT id, name, address, birth_year, user_id FROM PERFUME_MAKLERS ORDER BY id;";
+    sqlite3_stmt *stmt;
+    if (db_prepare(sql, &stmt) != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db_get_connection()));
+        return -1;
+    }
+    
+    int rc = 0;
+    while (rc == 0 && db_step(stmt) == SQLITE_ROW) {
+        SnapshotMakler makler = {0};
+        makler.id = sqlite3_column_int(stmt, 0);
+        makler.name = pool_add(pool, (const char *)sqlite3_column_text(stmt, 1));
+        makler.address = pool_add(pool, (const char *)sqlite3_column_text(stmt, 2));
+        makler.birth_year = sqlite3_column_int(stmt, 3);
+        makler.user_id = sqlite3_column_int(stmt, 4);
+        rc = buffer_append(section, &makler, sizeof(makler));
+        section->count++;
+    }
+    
+    db_finalize(stmt);
+    return rc;
+}
+
+static int collect_deals(SnapBuffer *sections, const SnapDict *names, const SnapDict *types,
+                         const SnapDict *buyers, const SnapDict *suppliers) {
+    const char *sql = "SELECT d.id, d.deal_date, d.good_id, d.makler_id, d.quantity, d.total_amount, "
+                      "d.good_name, d.good_type, d.buyer, s.name "
+                      "FROM PERFUME_DEALS d LEFT JOIN PERFUME_SUPPLIERS s ON s.id = d.supplier_id "
+                      "ORDER BY d.deal_date, d.id;";
+    sqlite3_stmt *stmt;
+    if (db_prepare(sql, &stmt) != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db_get_connection()));
+        return -1;
+    }
+    
+    int rc = 0;
+    int count = 0;
+    while (rc == 0 && db_step(stmt) == SQLITE_ROW) {
+        int32_t id = sqlite3_column_int(stmt, 0);
+        int64_t time = parse_datetime((const char *)sqlite3_column_text(stmt, 1));
+        int32_t good = sqlite3_column_int(stmt, 2);
+        int32_t makler = sqlite3_column_int(stmt, 3);
+        int32_t quantity = sqlite3_column_int(stmt, 4);
+        double amount = sqlite3_column_double(stmt, 5);
+        uint32_t name = dict_find(names, (const char *)sqlite3_column_text(stmt, 6));
+        uint32_t type = dict_find(types, (const char *)sqlite3_column_text(stmt, 7));
+        uint32_t buyer = dict_find(buyers, (const char *)sqlite3_column_text(stmt, 8));
+        uint32_t supplier = sqlite3_column_type(stmt, 9) == SQLITE_NULL ? SNAPSHOT_NO_CODE :
+                            dict_find(suppliers, (const char *)sqlite3_column_text(stmt, 9));
+        
+        if (time < 0) {
+            fprintf(stderr, "Deal %d has an invalid date, snapshot not written\n", id);
+            rc = -1;
+            break;
+        }
+        
+        rc |= buffer_append(&sections[SECTION_DEAL_ID], &id, sizeof(id));
+        rc |= buffer_append(&sections[SECTION_DEAL_TIME], &time, sizeof(time));
+        rc |= buffer_append(&sections[SECTION_DEAL_GOOD], &good, sizeof(good));
+        rc |= buffer_append(&sections[SECTION_DEAL_MAKLER], &makler, sizeof(makler));
+        rc |= buffer_append(&sections[SECTION_DEAL_QUANTITY], &quantity, sizeof(quantity));
+        rc |= buffer_append(&sections[SECTION_DEAL_AMOUNT], &amount, sizeof(amount));
+        rc |= buffer_append(&sections[SECTION_DEAL_NAME], &name, sizeof(name));
+        rc |= buffer_append(&sections[SECTION_DEAL_TYPE], &type, sizeof(type));
+        rc |= buffer_append(&sections[SECTION_DEAL_BUYER], &buyer, sizeof(buyer));
+        rc |= buffer_append(&sections[SECTION_DEAL_SUPPLIER], &supplier, sizeof(supplier));
+        count++;
+    }
+    
+    db_finalize(stmt);
+    
+    for (int i = SECTION_DEAL_ID; i <= SECTION_DEAL_SUPPLIER; i++) {
+        sections[i].count = (uint64_t)count;
+    }
+    return rc == 0 ? count : -1;
+}
+
+static size_t align8(size_t value) {
+    return (value + 7) & ~(size_t)7;
+}
+
+static int write_file(const char *path, SnapBuffer *sections) {
+    SnapshotHeader header = {0};
+    SnapshotSection directory[SECTION_COUNT];
+    
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.section_count = SECTION_COUNT;
+    header.created_at = (int64_t)time(NULL);
+    
+    size_t offset = align8(sizeof(header) + sizeof(directory));
+    size_t end = offset;
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        directory[i].id = (uint32_t)i;
+        directory[i].crc = crc32_update(0, sections[i].data, sections[i].size);
+        directory[i].offset = offset;
+        directory[i].size = sections[i].size;
+        directory[i].count = sections[i].count;
+        end = offset + sections[i].size;
+        offset = align8(end);
+    }
+    header.file_size = end;  // no padding after the last section
+    header.header_crc = crc32_update(crc32_update(0, &header, sizeof(header)),
+                                     directory, sizeof(directory));
+    
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        fprintf(stderr, "Can't create snapshot: %s\n", tmp_path);
+        return -1;
+    }
+    
+    static const char padding[8] = {0};
+    size_t written = sizeof(header) + sizeof(directory);
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+             fwrite(directory, sizeof(directory), 1, f) == 1;
+    for (int i = 0; ok && i < SECTION_COUNT; i++) {
+        ok = fwrite(padding, 1, directory[i].offset - written, f) == directory[i].offset - written;
+        if (ok && sections[i].size > 0) {
+            ok = fwrite(sections[i].data, 1, sections[i].size, f) == sections[i].size;
+        }
+        written = directory[i].offset + sections[i].size;
+    }
+    ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    
+    if (fclose(f) != 0 || !ok) {
+        fprintf(stderr, "Failed to write snapshot: %s\n", tmp_path);
+        remove(tmp_path);
+        return -1;
+    }
+    if (rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Failed to replace snapshot: %s\n", path);
+        remove(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+int snapshot_write(const char *path) {
+    METRICS_FUNC();
+    if (!db_get_connection()) return -1;
+    
+    SnapBuffer sections[SECTION_COUNT];
+    memset(sections, 0, sizeof(sections));
+    SnapDict names, types, buyers, suppliers;
+    int deal_count = -1;
+    
+    // One read transaction so every section sees the same data
+    if (db_begin_transaction() != 0) return -1;
+    
+    SnapBuffer *pool = &sections[SECTION_STRINGS];
+    buffer_append(pool, "", 1);
+    
+    int rc = dict_load(&names, "SELECT DISTINCT good_name FROM PERFUME_DEALS ORDER BY 1;");
+    rc |= dict_load(&types, "SELECT DISTINCT good_type FROM PERFUME_DEALS ORDER BY 1;");
+    rc |= dict_load(&buyers, "SELECT DISTINCT buyer FROM PERFUME_DEALS ORDER BY 1;");
+    // Suppliers of the goods, and those deals were tagged with since
+    rc |= dict_load(&suppliers, "SELECT COALESCE(supplier, '') FROM PERFUME_GOODS "
+                                "UNION SELECT name FROM PERFUME_SUPPLIERS ORDER BY 1;");
+    
+    if (rc == 0) {
+        rc |= dict_write(&sections[SECTION_DICT_GOOD_NAMES], pool, &names);
+        rc |= dict_write(&sections[SECTION_DICT_GOOD_TYPES], pool, &types);
+        rc |= dict_write(&sections[SECTION_DICT_BUYERS], pool, &buyers);
+        rc |= dict_write(&sections[SECTION_DICT_SUPPLIERS], pool, &suppliers);
+        rc |= collect_goods(&sections[SECTION_GOODS], pool, &suppliers);
+        rc |= collect_maklers(&sections[SECTION_MAKLERS], pool);
+    }
+    if (rc == 0) {
+        deal_count = collect_deals(sections, &names, &types, &buyers, &suppliers);
+    }
+    db_commit_transaction();
+    
+    pool->count = pool->size;
+    if (deal_count >= 0 && write_file(path, sections) != 0) {
+        deal_count = -1;
+    }
+    
+    dict_free(&names);
+    dict_free(&types);
+    dict_free(&buyers);
+    dict_free(&suppliers);
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        free(sections[i].data);
+    }
+    return deal_count;
+}
+
+// Reading
+
+static int codes_valid(const uint32_t *codes, int count, int limit) {
+    for (int i = 0; i < count; i++) {
+        if (codes[i] >= (uint32_t)limit) return 0;
+    }
+    return 1;
+}
+
+static int offsets_valid(const uint32_t *offsets, int count, size_t strings_size) {
+    for (int i = 0; i < count; i++) {
+        if (offsets[i] >= strings_size) return 0;
+    }
+    return 1;
+}
+
+static int snapshot_validate(Snapshot *snap) {
+    const char *base = (const char *)snap->base;
+    if (snap->size < sizeof(SnapshotHeader)) {
+        return -1;
+    }
+    
+    SnapshotHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.byte_order != SNAPSHOT_BYTE_ORDER) {
+        fprintf(stderr, "Not a snapshot file\n");
+        return -1;
+    }
+    if (header.version != SNAPSHOT_VERSION) {
+        fprintf(stderr, "Unsupported snapshot version %u\n", header.version);
+        return -1;
+    }
+    if (header.section_count != SECTION_COUNT || header.file_size != snap->size ||
+        snap->size < sizeof(header) + sizeof(SnapshotSection) * SECTION_COUNT) {
+        fprintf(stderr, "Snapshot is truncated or malformed\n");
+        return -1;
+    }
+    
+    const SnapshotSection *directory = (const SnapshotSection *)(base + sizeof(header));
+    uint32_t expected_crc = header.header_crc;
+    header.header_crc = 0;
+    uint32_t crc = crc32_update(crc32_update(0, &header, sizeof(header)),
+                                directory, sizeof(SnapshotSection) * SECTION_COUNT);
+    if (crc != expected_crc) {
+        fprintf(stderr, "Snapshot header checksum mismatch\n");
+        return -1;
+    }
+    
+    const void *data[SECTION_COUNT];
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        const SnapshotSection *s = &directory[i];
+        if (s->id != (uint32_t)i || s->offset % 8 != 0 || s->size != s->count * section_element_size[i] ||
+            (s->size > 0 && (s->offset > snap->size || s->size > snap->size - s->offset))) {
+            fprintf(stderr, "Snapshot section %d is out of bounds\n", i);
+            return -1;
+        }
+        if (crc32_update(0, base + s->offset, s->size) != s->crc) {
+            fprintf(stderr, "Snapshot section %d checksum mismatch\n", i);
+            return -1;
+        }
+        data[i] = base + s->offset;
+    }
+    
+    uint64_t deal_count = directory[SECTION_DEAL_ID].count;
+    for (int i = SECTION_DEAL_ID; i <= SECTION_DEAL_SUPPLIER; i++) {
+        if (directory[i].count != deal_count) {
+            fprintf(stderr, "Snapshot deal columns have different lengths\n");
+            return -1;
+        }
+    }
+    
+    snap->created_at = header.created_at;
+    snap->strings = data[SECTION_STRINGS];
+    snap->strings_size = directory[SECTION_STRINGS].size;
+    snap->goods = data[SECTION_GOODS];
+    snap->good_count = (int)directory[SECTION_GOODS].count;
+    snap->maklers = data[SECTION_MAKLERS];
+    snap->makler_count = (int)directory[SECTION_MAKLERS].count;
+    snap->good_names = data[SECTION_DICT_GOOD_NAMES];
+    snap->good_name_count = (int)directory[SECTION_DICT_GOOD_NAMES].count;
+    snap->good_types = data[SECTION_DICT_GOOD_TYPES];
+    snap->good_type_count = (int)directory[SECTION_DICT_GOOD_TYPES].count;
+    snap->buyers = data[SECTION_DICT_BUYERS];
+    snap->buyer_count = (int)directory[SECTION_DICT_BUYERS].count;
+    snap->suppliers = data[SECTION_DICT_SUPPLIERS];
+    snap->supplier_count = (int)directory[SECTION_DICT_SUPPLIERS].count;
+    snap->deal_count = (int)deal_count;
+    snap->deal_id = data[SECTION_DEAL_ID];
+    snap->deal_time = data[SECTION_DEAL_TIME];
+    snap->deal_good = data[SECTION_DEAL_GOOD];
+    snap->deal_makler = data[SECTION_DEAL_MAKLER];
+    snap->deal_quantity = data[SECTION_DEAL_QUANTITY];
+    snap->deal_amount = data[SECTION_DEAL_AMOUNT];
+    snap->deal_name = data[SECTION_DEAL_NAME];
+    snap->deal_type = data[SECTION_DEAL_TYPE];
+    snap->deal_buyer = data[SECTION_DEAL_BUYER];
+    snap->deal_supplier = data[SECTION_DEAL_SUPPLIER];
+    
+    // Every reference must stay inside the file, so reports need no checks
+    if (snap->strings_size == 0 || snap->strings[snap->strings_size - 1] != '\0') {
+        fprintf(stderr, "Snapshot string pool is not terminated\n");
+        return -1;
+    }
+    int valid = offsets_valid(snap->good_names, snap->good_name_count, snap->strings_size) &&
+                offsets_valid(snap->good_types, snap->good_type_count, snap->strings_size) &&
+                offsets_valid(snap->buyers, snap->buyer_count, snap->strings_size) &&
+                offsets_valid(snap->suppliers, snap->supplier_count, snap->strings_size) &&
+                codes_valid(snap->deal_name, snap->deal_count, snap->good_name_count) &&
+                codes_valid(snap->deal_type, snap->deal_count, snap->good_type_count) &&
+                codes_valid(snap->deal_buyer, snap->deal_count, snap->buyer_count);
+    for (int i = 0; valid && i < snap->deal_count; i++) {
+        valid = snap->deal_supplier[i] == SNAPSHOT_NO_CODE ||
+                snap->deal_supplier[i] < (uint32_t)snap->supplier_count;
+    }
+    for (int i = 0; valid && i < snap->good_count; i++) {
+        const SnapshotGood *g = &snap->goods[i];
+        valid = g->name < snap->strings_size && g->type < snap->strings_size &&
+                g->expiry_date < snap->strings_size &&
+                (g->supplier == SNAPSHOT_NO_CODE || g->supplier < (uint32_t)snap->supplier_count);
+    }
+    for (int i = 0; valid && i < snap->makler_count; i++) {
+        valid = snap->maklers[i].name < snap->strings_size &&
+                snap->maklers[i].address < snap->strings_size;
+    }
+    if (!valid) {
+        fprintf(stderr, "Snapshot contains references out of range\n");
+        return -1;
+    }
+    return 0;
+}
+
+Snapshot* snapshot_open(const char *path) {
+    METRICS_FUNC();
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Can't open snapshot: %s\n", path);
+        return NULL;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        fprintf(stderr, "Can't read snapshot: %s\n", path);
+        close(fd);
+        return NULL;
+    }
+    
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Can't map snapshot: %s\n", path);
+        return NULL;
+    }
+    
+    Snapshot *snap = calloc(1, sizeof(Snapshot));
+    if (!snap) {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+    snap->base = base;
+    snap->size = (size_t)st.st_size;
+    
+    if (snapshot_validate(snap) != 0) {
+        fprintf(stderr, "Rejected snapshot: %s\n", path);
+        snapshot_close(snap);
+        return NULL;
+    }
+    return snap;
+}
+
+void snapshot_close(Snapshot *snap) {
+    if (!snap) return;
+    munmap(snap->base, snap->size);
+    free(snap);
+}
+
+int snapshot_deal_count(const Snapshot *snap) {
+    return snap->deal_count;
+}
+
+int snapshot_good_count(const Snapshot *snap) {
+    return snap->good_count;
+}
+
+int64_t snapshot_created_at(const Snapshot *snap) {
+    return snap->created_at;
+}
+
+// Lookups
+
+static const char* snap_string(const Snapshot *snap, uint32_t offset) {
+    return snap->strings + offset;
+}
+
+static const char* snap_dict(const Snapshot *snap, const uint32_t *dict, uint32_t code) {
+    return snap->strings + dict[code];
+}
+
+static uint32_t snap_dict_find(const Snapshot *snap, const uint32_t *dict, int count, const char *value) {
+    int lo = 0, hi = count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(snap->strings + dict[mid], value);
+        if (cmp == 0) return (uint32_t)mid;
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return SNAPSHOT_NO_CODE;
+}
+
+static const SnapshotGood* snap_good(const Snapshot *snap, int id) {
+    int lo = 0, hi = snap->good_count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (snap->goods[mid].id == id) return &snap->goods[mid];
+        if (snap->goods[mid].id < id) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return NULL;
+}
+
+static int snap_makler_index(const Snapshot *snap, int id) {
+    int lo = 0, hi = snap->makler_count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (snap->maklers[mid].id == id) return mid;
+        if (snap->maklers[mid].id < id) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return -1;
+}
+
+// First deal at or after the given time
+static int snap_lower_bound(const Snapshot *snap, int64_t time) {
+    int lo = 0, hi = snap->deal_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (snap->deal_time[mid] < time) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Deal index range [*first, *last) for whole days from start to end;
+// a NULL bound is open. Returns -1 if a date is malformed.
+static int snap_day_range(const Snapshot *snap, const char *start_date, const char *end_date,
+                          int *first, int *last) {
+    *first = 0;
+    *last = snap->deal_count;
+    if (start_date) {
+        int64_t start = parse_datetime(start_date);
+        if (start < 0) return -1;
+        *first = snap_lower_bound(snap, start - start % 86400);
+    }
+    if (end_date) {
+        int64_t end = parse_datetime(end_date);
+        if (end < 0) return -1;
+        *last = snap_lower_bound(snap, end - end % 86400 + 86400);
+    }
+    if (*last < *first) *last = *first;
+    return 0;
+}
+
+typedef struct {
+    long long deals;
+    long long quantity;
+    double amount;
+} SnapTotals;
+
+// Reports: same sections and columns as reports.c
+
+static int bad_date(const char *report) {
+    fprintf(stderr, "Report '%s': dates must be YYYY-MM-DD\n", report);
+    return -1;
+}
+
+static void write_buyer_totals(ReportWriter *rw, const Snapshot *snap, const SnapTotals *totals,
+                               const char *section, const char *title) {
+    static const ReportColumn columns[] = {
+        { "Buyer", "buyer", REPORT_COL_TEXT, 30 },
+        { "Deal Count", "deal_count", REPORT_COL_INT, 12 },
+        { "Total Quantity", "total_quantity", REPORT_COL_INT, 15 },
+        { "Total Amount", "total_amount", REPORT_COL_REAL, 15 },
+    };
+    
+    report_writer_begin(rw, section, title, columns, REPORT_COLUMN_COUNT(columns));
+    for (int b = 0; b < snap->buyer_count; b++) {
+        if (totals[b].deals == 0) continue;
+        report_writer_text(rw, snap_dict(snap, snap->buyers, (uint32_t)b));
+        report_writer_int(rw, totals[b].deals);
+        report_writer_int(rw, totals[b].quantity);
+        report_writer_real(rw, totals[b].amount);
+        report_writer_end_row(rw);
+    }
+    report_writer_end(rw);
+}
+
+static int snap_sales_by_good(const Snapshot *snap, const ReportParams *p) {
+    METRICS_FUNC();
+    int first, last;
+    if (snap_day_range(snap, p->start_date, p->end_date, &first, &last) != 0) {
+        return bad_date("sales-by-good");
+    }
+    
+    // Dense (name, type) grid: codes are small and already in sort order
+    size_t cells = (size_t)snap->good_name_count * (size_t)snap->good_type_count;
+    SnapTotals *totals = calloc(cells ? cells : 1, sizeof(SnapTotals));
+    if (!totals) return -1;
+    
+    for (int i = first; i < last; i++) {
+        SnapTotals *t = &totals[(size_t)snap->deal_name[i] * snap->good_type_count + snap->deal_type[i]];
+        t->deals++;
+        t->quantity += snap->deal_quantity[i];
+        t->amount += snap->deal_amount[i];
+    }
+    
+    static const ReportColumn columns[] = {
+        { "Good Name", "good_name", REPORT_COL_TEXT, 30 },
+        { "Type", "good_type", REPORT_COL_TEXT, 20 },
+        { "Total Quantity", "total_quantity", REPORT_COL_INT, 15 },
+        { "Total Amount", "total_amount", REPORT_COL_REAL, 15 },
+    };
+    char title[128];
+    snprintf(title, sizeof(title), "Sales Report by Good (from %s to %s)", p->start_date, p->end_date);
+    
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "sales_by_good", title, columns, REPORT_COLUMN_COUNT(columns));
+    for (size_t c = 0; c < cells; c++) {
+        if (totals[c].deals == 0) continue;
+        report_writer_text(rw, snap_dict(snap, snap->good_names, (uint32_t)(c / snap->good_type_count)));
+        report_writer_text(rw, snap_dict(snap, snap->good_types, (uint32_t)(c % snap->good_type_count)));
+        report_writer_int(rw, totals[c].quantity);
+        report_writer_real(rw, totals[c].amount);
+        report_writer_end_row(rw);
+    }
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    
+    free(totals);
+    return 0;
+}
+
+static int snap_buyers_by_good(const Snapshot *snap, const ReportParams *p) {
+    METRICS_FUNC();
+    SnapTotals *totals = calloc(snap->buyer_count ? snap->buyer_count : 1, sizeof(SnapTotals));
+    if (!totals) return -1;
+    
+    uint32_t name = snap_dict_find(snap, snap->good_names, snap->good_name_count, p->good_name);
+    for (int i = 0; name != SNAPSHOT_NO_CODE && i < snap->deal_count; i++) {
+        if (snap->deal_name[i] != name) continue;
+        SnapTotals *t = &totals[snap->deal_buyer[i]];
+        t->deals++;
+        t->quantity += snap->deal_quantity[i];
+        t->amount += snap->deal_amount[i];
+    }
+    
+    char title[160];
+    snprintf(title, sizeof(title), "Buyers for '%s'", p->good_name);
+    ReportWriter *rw = reports_output();
+    write_buyer_totals(rw, snap, totals, "buyers_by_good", title);
+    report_writer_flush(rw);
+    
+    free(totals);
+    return 0;
+}
+
+static int snap_popular_good_type(const Snapshot *snap, const ReportParams *p) {
+    METRICS_FUNC();
+    (void)p;
+    if (snap->deal_count == 0) return 0;
+    
+    SnapTotals *type_totals = calloc(snap->good_type_count, sizeof(SnapTotals));
+    SnapTotals *buyer_totals = calloc(snap->buyer_count, sizeof(SnapTotals));
+    if (!type_totals || !buyer_totals) {
+        free(type_totals);
+        free(buyer_totals);
+        return -1;
+    }
+    
+    for (int i = 0; i < snap->deal_count; i++) {
+        SnapTotals *t = &type_totals[snap->deal_type[i]];
+        t->deals++;
+        t->quantity += snap->deal_quantity[i];
+        t->amount += snap->deal_amount[i];
+    }
+    
+    uint32_t best = 0;
+    for (int t = 1; t < snap->good_type_count; t++) {
+        if (type_totals[t].quantity > type_totals[best].quantity) best = (uint32_t)t;
+    }
+    
+    static const ReportColumn type_columns[] = {
+        { "Type", "good_type", REPORT_COL_TEXT, 20 },
+        { "Total Quantity", "total_quantity", REPORT_COL_INT, 15 },
+        { "Total Amount", "total_amount", REPORT_COL_REAL, 15 },
+    };
+    const char *good_type = snap_dict(snap, snap->good_types, best);
+    
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "popular_good_type", "Most Popular Good Type",
+                        type_columns, REPORT_COLUMN_COUNT(type_columns));
+    report_writer_text(rw, good_type);
+    report_writer_int(rw, type_totals[best].quantity);
+    report_writer_real(rw, type_totals[best].amount);
+    report_writer_end(rw);
+    
+    for (int i = 0; i < snap->deal_count; i++) {
+        if (snap->deal_type[i] != best) continue;
+        SnapTotals *t = &buyer_totals[snap->deal_buyer[i]];
+        t->deals++;
+        t->quantity += snap->deal_quantity[i];
+        t->amount += snap->deal_amount[i];
+    }
+    
+    char title[128];
+    snprintf(title, sizeof(title), "Buyers by Firm for Type '%s'", good_type);
+    write_buyer_totals(rw, snap, buyer_totals, "buyers_by_type", title);
+    report_writer_flush(rw);
+    
+    free(type_totals);
+    free(buyer_totals);
+    return 0;
+}
+
+static int snap_max_deals_makler(const Snapshot *snap, const ReportParams *p) {
+    METRICS_FUNC();
+    (void)p;
+    int *deal_counts = calloc(snap->makler_count ? snap->makler_count : 1, sizeof(int));
+    if (!deal_counts) return -1;
+    
+    for (int i = 0; i < snap->deal_count; i++) {
+        int m = snap_makler_index(snap, snap->deal_makler[i]);
+        if (m >= 0) deal_counts[m]++;
+    }
+    
+    int best = -1;
+    for (int m = 0; m < snap->makler_count; m++) {
+        if (deal_counts[m] > 0 && (best < 0 || deal_counts[m] > deal_counts[best])) best = m;
+    }
+    if (best < 0) {
+        free(deal_counts);
+        return 0;
+    }
+    
+    static const ReportColumn makler_columns[] = {
+        { "Makler Name", "makler_name", REPORT_COL_TEXT, 30 },
+        { "Deal Count", "deal_count", REPORT_COL_INT, 15 },
+    };
+    const SnapshotMakler *makler = &snap->maklers[best];
+    const char *makler_name = snap_string(snap, makler->name);
+    
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "max_deals_makler", "Makler with Maximum Deals",
+                        makler_columns, REPORT_COLUMN_COUNT(makler_columns));
+    report_writer_text(rw, makler_name);
+    report_writer_int(rw, deal_counts[best]);
+    report_writer_end(rw);
+    
+    char *seen = calloc(snap->supplier_count ? snap->supplier_count : 1, 1);
+    for (int i = 0; seen && i < snap->deal_count; i++) {
+        if (snap->deal_makler[i] != makler->id) continue;
+        if (snap->deal_supplier[i] != SNAPSHOT_NO_CODE) seen[snap->deal_supplier[i]] = 1;
+    }
+    
+    static const ReportColumn supplier_columns[] = {
+        { "Supplier", "supplier", REPORT_COL_TEXT, 30 },
+    };
+    char title[160];
+    snprintf(title, sizeof(title), "Suppliers for '%s'", makler_name);
+    
+    report_writer_begin(rw, "makler_suppliers", title, supplier_columns, REPORT_COLUMN_COUNT(supplier_columns));
+    for (int s = 0; seen && s < snap->supplier_count; s++) {
+        if (!seen[s]) continue;
+        report_writer_text(rw, snap_dict(snap, snap->suppliers, (uint32_t)s));
+        report_writer_end_row(rw);
+    }
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    
+    free(seen);
+    free(deal_counts);
+    return 0;
+}
+
+static int snap_sales_by_supplier(const Snapshot *snap, const ReportParams *p) {
+    METRICS_FUNC();
+    (void)p;
+    int suppliers = snap->supplier_count + 1;  // the last one is "(none)"
+    int maklers = snap->makler_count ? snap->makler_count : 1;
+    SnapTotals *totals = calloc(suppliers, sizeof(SnapTotals));
+    char *sold_by = calloc((size_t)suppliers * maklers, 1);  // supplier x makler
+    if (!totals || !sold_by) {
+        free(totals);
+        free(sold_by);
+        return -1;
+    }
+    
+    for (int i = 0; i < snap->deal_count; i++) {
+        uint32_t supplier = snap->deal_supplier[i];
+        int m = snap_makler_index(snap, snap->deal_makler[i]);
+        if (m < 0) continue;
+        if (supplier == SNAPSHOT_NO_CODE) supplier = (uint32_t)snap->supplier_count;
+        SnapTotals *t = &totals[supplier];
+        t->deals++;
+        t->quantity += snap->deal_quantity[i];
+        t->amount += snap->deal_amount[i];
+        sold_by[(size_t)supplier * maklers + m] = 1;
+    }
+    
+    static const ReportColumn columns[] = {
+        { "Supplier", "supplier", REPORT_COL_TEXT, 30 },
+        { "Deal Count", "deal_count", REPORT_COL_INT, 12 },
+        { "Total Quantity", "total_quantity", REPORT_COL_INT, 15 },
+        { "Total Amount", "total_amount", REPORT_COL_REAL, 15 },
+        { "Maklers", "maklers", REPORT_COL_TEXT, 0 },
+    };
+    
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "sales_by_supplier", "Sales by Supplier", columns, REPORT_COLUMN_COUNT(columns));
+    
+    SnapBuffer names = {0};
+    for (int s = 0; s < suppliers; s++) {
+        if (totals[s].deals == 0) continue;
+        
+        names.size = 0;
+        for (int m = 0; m < snap->makler_count; m++) {
+            if (!sold_by[(size_t)s * maklers + m]) continue;
+            if (names.size > 0) buffer_append(&names, ",", 1);
+            const char *name = snap_string(snap, snap->maklers[m].name);
+            buffer_append(&names, name, strlen(name));
+        }
+        
+        report_writer_text(rw, s == snap->supplier_count ? REPORTS_NONE : snap_dict(snap, snap->suppliers, (uint32_t)s));
+        report_writer_int(rw, totals[s].deals);
+        report_writer_int(rw, totals[s].quantity);
+        report_writer_real(rw, totals[s].amount);
+        report_writer_text_n(rw, names.data ? names.data : "", (int)names.size);
+        report_writer_end_row(rw);
+    }
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    
+    free(names.data);
+    free(totals);
+    free(sold_by);
+    return 0;
+}
+
+static void write_deal_fields(ReportWriter *rw, const Snapshot *snap, int i, int with_ids) {
+    char date[20];
+    format_datetime(snap->deal_time[i], date, sizeof(date));
+    
+    report_writer_int(rw, snap->deal_id[i]);
+    report_writer_text(rw, date);
+    report_writer_text(rw, snap_dict(snap, snap->good_names, snap->deal_name[i]));
+    report_writer_text(rw, snap_dict(snap, snap->good_types, snap->deal_type[i]));
+    report_writer_int(rw, snap->deal_quantity[i]);
+    report_writer_real(rw, snap->deal_amount[i]);
+    if (with_ids) {
+        report_writer_int(rw, snap->deal_makler[i]);
+        report_writer_int(rw, snap->deal_good[i]);
+    }
+    report_writer_text(rw, snap_dict(snap, snap->buyers, snap->deal_buyer[i]));
+    report_writer_end_row(rw);
+}
+
+static int snap_makler_deals(const Snapshot *snap, const ReportParams *p) {
+    METRICS_FUNC();
+    int first, last;
+    if (snap_day_range(snap, p->date, p->date, &first, &last) != 0) {
+        return bad_date("makler-deals");
+    }
+    
+    static const ReportColumn columns[] = {
+        { "ID", "id", REPORT_COL_INT, 5 },
+        { "Date", "deal_date", REPORT_COL_TEXT, 20 },
+        { "Good Name", "good_name", REPORT_COL_TEXT, 30 },
+        { "Type", "good_type", REPORT_COL_TEXT, 20 },
+        { "Quantity", "quantity", REPORT_COL_INT, 10 },
+        { "Amount", "total_amount", REPORT_COL_REAL, 15 },
+        { "Buyer", "buyer", REPORT_COL_TEXT, 30 },
+    };
+    char title[128];
+    snprintf(title, sizeof(title), "Deals for Makler ID %d on %s", p->makler_id, p->date);
+    
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "makler_deals", title, columns, REPORT_COLUMN_COUNT(columns));
+    
+    int found = 0;
+    for (int i = first; i < last; i++) {
+        if (snap->deal_makler[i] != p->makler_id) continue;
+        found = 1;
+        write_deal_fields(rw, snap, i, 0);
+    }
+    if (!found) {
+        report_writer_note(rw, "No deals found for this date.");
+    }
+    
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    return 0;
+}
+
+static int snap_deals(const Snapshot *snap, const ReportParams *p) {
+    METRICS_FUNC();
+    int first, last;
+    if (snap_day_range(snap, p->start_date, p->end_date, &first, &last) != 0) {
+        return bad_date("deals");
+    }
+    
+    static const ReportColumn columns[] = {
+        { "ID", "id", REPORT_COL_INT, 5 },
+        { "Date", "deal_date", REPORT_COL_TEXT, 20 },
+        { "Good Name", "good_name", REPORT_COL_TEXT, 30 },
+        { "Type", "good_type", REPORT_COL_TEXT, 20 },
+        { "Quantity", "quantity", REPORT_COL_INT, 10 },
+        { "Amount", "total_amount", REPORT_COL_REAL, 15 },
+        { "Makler", "makler_id", REPORT_COL_INT, 8 },
+        { "Good", "good_id", REPORT_COL_INT, 6 },
+        { "Buyer", "buyer", REPORT_COL_TEXT, 30 },
+    };
+    char title[128];
+    snprintf(title, sizeof(title), "Deals (from %s to %s)",
+             p->start_date ? p->start_date : "start", p->end_date ? p->end_date : "today");
+    
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "deals", title, columns, REPORT_COLUMN_COUNT(columns));
+    for (int i = first; i < last; i++) {
+        write_deal_fields(rw, snap, i, 1);
+    }
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    return 0;
+}
+
+static int snap_goods(const Snapshot *snap, const ReportParams *p) {
+    METRICS_FUNC();
+    (void)p;
+    static const ReportColumn columns[] = {
+        { "ID", "id", REPORT_COL_INT, 5 },
+        { "Name", "name", REPORT_COL_TEXT, 30 },
+        { "Type", "type", REPORT_COL_TEXT, 20 },
+        { "Price", "unit_price", REPORT_COL_REAL, 10 },
+        { "Supplier", "supplier", REPORT_COL_TEXT, 25 },
+        { "Expiry", "expiry_date", REPORT_COL_TEXT, 11 },
+        { "Quantity", "quantity", REPORT_COL_INT, 8 },
+    };
+    
+    ReportWriter *rw = reports_output();
+    report_writer_begin(rw, "goods", "Goods", columns, REPORT_COLUMN_COUNT(columns));
+    for (int i = 0; i < snap->good_count; i++) {
+        const SnapshotGood *g = &snap->goods[i];
+        report_writer_int(rw, g->id);
+        report_writer_text(rw, snap_string(snap, g->name));
+        report_writer_text(rw, snap_string(snap, g->type));
+        report_writer_real(rw, g->unit_price);
+        report_writer_text(rw, g->supplier == SNAPSHOT_NO_CODE ? "" : snap_dict(snap, snap->suppliers, g->supplier));
+        report_writer_text(rw, snap_string(snap, g->expiry_date));
+        report_writer_int(rw, g->quantity);
+        report_writer_end_row(rw);
+    }
+    report_writer_end(rw);
+    report_writer_flush(rw);
+    return 0;
+}
+
+// Totals are accumulated per dimension key in one pass over the date
+// range, then streamed through the heap; only the K best are sorted
+static int snap_top(const Snapshot *snap, const ReportParams *p) {
+    METRICS_FUNC();
+    int first, last;
+    if (snap_day_range(snap, p->start_date, p->end_date, &first, &last) != 0) {
+        return bad_date("top");
+    }
+    
+    TopKDimension dimension = (TopKDimension)topk_parse_dimension(p->by);
+    TopKMetric metric = p->metric ? (TopKMetric)topk_parse_metric(p->metric) : TOPK_QUANTITY;
+    // Suppliers get one more key past the dictionary for "(none)"
+    int keys = dimension == TOPK_GOOD ? snap->good_count :
+               dimension == TOPK_MAKLER ? snap->makler_count :
+               dimension == TOPK_BUYER ? snap->buyer_count : snap->supplier_count + 1;
+    
+    TopK *topk = topk_create(p->limit ? p->limit : TOPK_DEFAULT_LIMIT);
+    SnapTotals *totals = calloc(keys ? keys : 1, sizeof(SnapTotals));
+    if (!topk || !totals) {
+        topk_free(topk);
+        free(totals);
+        return -1;
+    }
+    topk_set_metric(topk, metric);
+    
+    for (int i = first; i < last; i++) {
+        int key;
+        if (dimension == TOPK_BUYER) {
+            key = (int)snap->deal_buyer[i];
+        } else if (dimension == TOPK_MAKLER) {
+            key = snap_makler_index(snap, snap->deal_makler[i]);
+        } else if (dimension == TOPK_SUPPLIER) {
+            // The supplier at commit, as the rollup files it
+            key = snap->deal_supplier[i] == SNAPSHOT_NO_CODE ? snap->supplier_count : (int)snap->deal_supplier[i];
+        } else {
+            const SnapshotGood *good = snap_good(snap, snap->deal_good[i]);
+            if (!good) continue;
+            key = (int)(good - snap->goods);
+        }
+        if (key < 0) continue;
+        SnapTotals *t = &totals[key];
+        t->deals++;
+        t->quantity += snap->deal_quantity[i];
+        t->amount += snap->deal_amount[i];
+    }
+    
+    for (int k = 0; k < keys; k++) {
+        if (totals[k].deals == 0) continue;
+        long long id = 0;
+        const char *label;
+        if (dimension == TOPK_GOOD) {
+            id = snap->goods[k].id;
+            label = snap_string(snap, snap->goods[k].name);
+        } else if (dimension == TOPK_MAKLER) {
+            id = snap->maklers[k].id;
+            label = snap_string(snap, snap->maklers[k].name);
+        } else if (dimension == TOPK_BUYER) {
+            label = snap_dict(snap, snap->buyers, (uint32_t)k);
+        } else {
+            label = k == snap->supplier_count ? REPORTS_NONE : snap_dict(snap, snap->suppliers, (uint32_t)k);
+        }
+        topk_offer(topk, id, label, totals[k].deals, totals[k].quantity, totals[k].amount);
+    }
+    
+    ReportWriter *rw = reports_output();
+    reports_write_top(rw, topk, dimension, metric, p->start_date, p->end_date);
+    report_writer_flush(rw);
+    
+    topk_free(topk);
+    free(totals);
+    return 0;
+}
+
+typedef struct {
+    const char *name;
+    int (*run)(const Snapshot *snap, const ReportParams *params);
+} SnapshotReport;
+
+static const SnapshotReport snapshot_reports[] = {
+    { "sales-by-good",     snap_sales_by_good },
+    { "buyers-by-good",    snap_buyers_by_good },
+    { "popular-good-type", snap_popular_good_type },
+    { "max-deals-makler",  snap_max_deals_makler },
+    { "sales-by-supplier", snap_sales_by_supplier },
+    { "makler-deals",      snap_makler_deals },
+    { "deals",             snap_deals },
+    { "goods",             snap_goods },
+    { "top",               snap_top },
+};
+
+int snapshot_run_report(const Snapshot *snap, const char *name, const ReportParams *params) {
+    // Parameter checks are shared with the live reports
+    if (reports_check_params(name, params) != 0) {
+        return -1;
+    }
+    
+    for (size_t i = 0; i < sizeof(snapshot_reports) / sizeof(snapshot_reports[0]); i++) {
+        if (strcmp(snapshot_reports[i].name, name) == 0) {
+            return snapshot_reports[i].run(snap, params);
+        }
+    }
+    fprintf(stderr, "Report '%s' is not available from a snapshot\n", name);
+    return -1;
+}
@@ -0,0 +1,325 @@
+#include "statstore.h"
+#include "database.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Entries live in one array in table order and are found through an
+// open-addressing table of indexes. A deal's totals wait in the change
+// log until its transaction commits, so a rollback only trims the log.
+
+typedef struct {
+    MaklerStats stats;       // totals including unflushed deals
+    int pending_quantity;    // the part not yet in PERFUME_MAKLERSTATS
+    double pending_amount;
+    int dirty;
+} StatEntry;
+
+typedef struct {
+    int makler_id;
+    char good_name[100];
+    char good_type[50];
+    int quantity;
+    double amount;
+    time_t at;
+} StatChange;
+
+static StatEntry *entries = NULL;
+static int entry_count = 0;
+static int entry_capacity = 0;
+
+static int *slots = NULL;        // entry index or -1, power-of-two size
+static int slot_count = 0;
+
+static StatChange *changes = NULL;
+static size_t change_count = 0;
+static size_t change_capacity = 0;
+
+static int loaded = 0;
+static long long loaded_version = 0;   // PRAGMA data_version at load
+static int unflushed = 0;
+static uint64_t last_flush_ns = 0;
+static int flushing = 0;
+
+static unsigned key_hash(int makler_id, const char *good_name, const char *good_type) {
+    unsigned hash = 2166136261u ^ (unsigned)makler_id;
+    for (const char *p = good_name; *p; p++) hash = (hash ^ (unsigned char)*p) * 16777619u;
+    hash = (hash ^ 0xFF) * 16777619u;
+    for (const char *p = good_type; *p; p++) hash = (hash ^ (unsigned char)*p) * 16777619u;
+    return hash;
+}
+
+static int slots_resize(int size) {
+    int *resized = malloc(sizeof(int) * size);
+    if (!resized) return -1;
+    for (int i = 0; i < size; i++) resized[i] = -1;
+    
+    for (int e = 0; e < entry_count; e++) {
+        const MaklerStats *s = &entries[e].stats;
+        unsigned slot = key_hash(s->makler_id, s->good_name, s->good_type) & (unsigned)(size - 1);
+        while (resized[slot] >= 0) slot = (slot + 1) & (unsigned)(size - 1);
+        resized[slot] = e;
+    }
+    free(slots);
+    slots = resized;
+    slot_count = size;
+    return 0;
+}
+
+// Index of the entry for the key, created empty if missing; -1 on OOM
+static int entry_find(int makler_id, const char *good_name, const char *good_type) {
+    if (entry_count * 2 >= slot_count && slots_resize(slot_count ? slot_count * 2 : 64) != 0) {
+        return -1;
+    }
+    
+    unsigned mask = (unsigned)(slot_count - 1);
+    unsigned slot = key_hash(makler_id, good_name, good_type) & mask;
+    for (; slots[slot] >= 0; slot = (slot + 1) & mask) {
+        const MaklerStats *s = &entries[slots[slot]].stats;
+        if (s->makler_id == makler_id && strcmp(s->good_name, good_name) == 0 &&
+            strcmp(s->good_type, good_type) == 0) {
+            return slots[slot];
+        }
+    }
+    
+    if (entry_count == entry_capacity) {
+        int capacity = entry_capacity ? entry_capacity * 2 : 64;
+        StatEntry *grown = realloc(entries, sizeof(StatEntry) * capacity);
+        if (!grown) return -1;
+        entries = grown;
+        entry_capacity = capacity;
+    }
+    
+    StatEntry *entry = &entries[entry_count];
+    memset(entry, 0, sizeof(*entry));
+    entry->stats.makler_id = makler_id;
+    snprintf(entry->stats.good_name, sizeof(entry->stats.good_name), "%s", good_name);
+    snprintf(entry->stats.good_type, sizeof(entry->stats.good_type), "%s", good_type);
+    slots[slot] = entry_count;
+    return entry_count++;
+}
+
+static void entries_clear() {
+    entry_count = 0;
+    for (int i = 0; i < slot_count; i++) slots[i] = -1;
+    loaded = 0;
+    unflushed = 0;
+}
+
+static long long data_version() {
+    sqlite3_stmt *stmt;
+    if (db_prepare("PRAGMA data_version;", &stmt) != SQLITE_OK) return -1;
+    long long version = db_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : -1;
+    db_finalize(stmt);
+    return version;
+}
+
+static int load() {
+    METRICS_FUNC();
+    entries_clear();
+    
+    sqlite3_stmt *stmt;
+    int rc = db_prepare("SELECT id, makler_id, good_name, good_type, total_quantity, total_amount, updated_at "
+                        "FROM PERFUME_MAKLERSTATS ORDER BY id;", &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db_get_connection()));
+        return -1;
+    }
+    
+    while (db_step(stmt) == SQLITE_ROW) {
+        int e = entry_find(sqlite3_column_int(stmt, 1), (const char *)sqlite3_column_text(stmt, 2),
+                           (const char *)sqlite3_column_text(stmt, 3));
+        if (e < 0) {
+            db_finalize(stmt);
+            entries_clear();
+            return -1;
+        }
+        MaklerStats *s = &entries[e].stats;
+        s->id = sqlite3_column_int(stmt, 0);
+        s->total_quantity = sqlite3_column_int(stmt, 4);
+        s->total_amount = sqlite3_column_double(stmt, 5);
+        s->updated_at = (time_t)sqlite3_column_int64(stmt, 6);
+    }
+    db_finalize(stmt);
+    
+    loaded_version = data_version();
+    last_flush_ns = metrics_now_ns();
+    loaded = 1;
+    return 0;
+}
+
+// Loads on first use, and again once another connection has committed
+// (after writing out our own changes, which the reload would drop)
+static int ensure_current() {
+    if (!loaded) return load();
+    
+    long long version = data_version();
+    if (version == loaded_version) return 0;
+    if (statstore_flush() != 0) return -1;
+    // Inside a transaction nothing can be flushed yet; reload after it
+    if (unflushed > 0) return 0;
+    return load();
+}
+
+static void apply(const StatChange *change) {
+    int e = entry_find(change->makler_id, change->good_name, change->good_type);
+    if (e < 0) {
+        fprintf(stderr, "Out of memory for makler statistics\n");
+        return;
+    }
+    StatEntry *entry = &entries[e];
+    entry->stats.total_quantity += change->quantity;
+    entry->stats.total_amount += change->amount;
+    entry->stats.updated_at = change->at;
+    entry->pending_quantity += change->quantity;
+    entry->pending_amount += change->amount;
+    entry->dirty = 1;
+}
+
+int statstore_add(const Deal *deal) {
+    if (change_count == change_capacity) {
+        size_t capacity = change_capacity ? change_capacity * 2 : 64;
+        StatChange *grown = realloc(changes, sizeof(StatChange) * capacity);
+        if (!grown) return -1;
+        changes = grown;
+        change_capacity = capacity;
+    }
+    
+    StatChange *change = &changes[change_count++];
+    change->makler_id = deal->makler_id;
+    snprintf(change->good_name, sizeof(change->good_name), "%s", deal->good_name);
+    snprintf(change->good_type, sizeof(change->good_type), "%s", deal->good_type);
+    change->quantity = deal->quantity;
+    change->amount = deal->total_amount;
+    change->at = deal->deal_date;
+    
+    if (db_transaction_depth() == 0) {
+        statstore_commit();
+    }
+    return 0;
+}
+
+size_t statstore_mark() {
+    return change_count;
+}
+
+void statstore_rollback_to(size_t mark) {
+    if (mark < change_count) change_count = mark;
+}
+
+void statstore_commit() {
+    // A flush commits its own transaction; the changes wait for the caller
+    if (change_count == 0 || flushing) return;
+    
+    if (ensure_current() != 0) {
+        // The table still has everything up to the last flush; rebuilding
+        // it from the deals (journal-replay) recovers the rest
+        fprintf(stderr, "Makler statistics could not be loaded, %zu deal(s) not counted\n", change_count);
+        change_count = 0;
+        return;
+    }
+    for (size_t i = 0; i < change_count; i++) {
+        apply(&changes[i]);
+    }
+    unflushed += (int)change_count;
+    change_count = 0;
+    
+    if (unflushed >= STATSTORE_FLUSH_DEALS ||
+        metrics_now_ns() - last_flush_ns >= (uint64_t)STATSTORE_FLUSH_MS * 1000000) {
+        statstore_flush();
+    }
+}
+
+int statstore_flush() {
+    METRICS_FUNC();
+    // Inside a transaction the write would be undone by a rollback the
+    // store can't see, so flushing waits for the next commit
+    if (!loaded || unflushed == 0 || flushing || db_transaction_depth() > 0) return 0;
+    
+    flushing = 1;
+    if (db_begin_transaction() != 0) {
+        flushing = 0;
+        return -1;
+    }
+    
+    sqlite3_stmt *stmt;
+    int rc = db_prepare("INSERT INTO PERFUME_MAKLERSTATS (makler_id, good_name, good_type, total_quantity, total_amount) "
+                        "VALUES (?, ?, ?, ?, ?) "
+                        "ON CONFLICT(makler_id, good_name, good_type) DO UPDATE SET "
+                        "total_quantity = total_quantity + excluded.total_quantity, "
+                        "total_amount = total_amount + excluded.total_amount, "
+                        "updated_at = CURRENT_TIMESTAMP "
+                        "RETURNING id;", &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db_get_connection()));
+        db_rollback_transaction();
+        flushing = 0;
+        return -1;
+    }
+    
+    for (int e = 0; e < entry_count && rc != -1; e++) {
+        StatEntry *entry = &entries[e];
+        if (!entry->dirty) continue;
+        
+        sqlite3_reset(stmt);
+        sqlite3_bind_int(stmt, 1, entry->stats.makler_id);
+        sqlite3_bind_text(stmt, 2, entry->stats.good_name, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 3, entry->stats.good_type, -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 4, entry->pending_quantity);
+        sqlite3_bind_double(stmt, 5, entry->pending_amount);
+        if (db_step(stmt) != SQLITE_ROW) {
+            fprintf(stderr, "Execution failed: %s\n", sqlite3_errmsg(db_get_connection()));
+            rc = -1;
+            break;
+        }
+        entry->stats.id = sqlite3_column_int(stmt, 0);
+        db_step(stmt);
+    }
+    db_finalize(stmt);
+    
+    if (rc == -1 || db_commit_transaction() != 0) {
+        // Pending totals are kept for the next attempt
+        db_rollback_transaction();
+        flushing = 0;
+        return -1;
+    }
+    
+    for (int e = 0; e < entry_count; e++) {
+        entries[e].pending_quantity = 0;
+        entries[e].pending_amount = 0.0;
+        entries[e].dirty = 0;
+    }
+    unflushed = 0;
+    last_flush_ns = metrics_now_ns();
+    flushing = 0;
+    return 0;
+}
+
+int statstore_unflushed() {
+    return unflushed;
+}
+
+MaklerStats* statstore_get(int makler_id, int *count) {
+    METRICS_FUNC();
+    *count = 0;
+    if (ensure_current() != 0) return NULL;
+    
+    int matches = 0;
+    for (int e = 0; e < entry_count; e++) {
+        if (entries[e].stats.makler_id == makler_id) matches++;
+    }
+    if (matches == 0) return NULL;
+    
+    MaklerStats *stats = malloc(sizeof(MaklerStats) * matches);
+    if (!stats) return NULL;
+    for (int e = 0; e < entry_count; e++) {
+        if (entries[e].stats.makler_id == makler_id) stats[(*count)++] = entries[e].stats;
+    }
+    return stats;
+}
+
+void statstore_reset() {
+    entries_clear();
+    change_count = 0;
+}
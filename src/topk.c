@@ -0,0 +1,142 @@
+#include "topk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// entries[0] is the weakest kept candidate, so a full heap rejects most
+// of a long tail with one comparison and no copying
+struct TopK {
+    int limit;
+    int count;
+    int sorted;
+    TopKMetric metric;
+    TopKEntry entries[];
+};
+
+static const char *dimension_names[] = { "good", "makler", "buyer", "supplier" };
+static const char *dimension_titles[] = { "Goods", "Maklers", "Buyers", "Suppliers" };
+static const char *metric_names[] = { "quantity", "amount", "deals" };
+static const char *metric_titles[] = { "Quantity", "Amount", "Deal Count" };
+
+TopK* topk_create(int limit) {
+    if (limit <= 0 || limit > TOPK_MAX_LIMIT) {
+        fprintf(stderr, "Top-K limit must be between 1 and %d\n", TOPK_MAX_LIMIT);
+        return NULL;
+    }
+    
+    TopK *topk = calloc(1, sizeof(TopK) + (size_t)limit * sizeof(TopKEntry));
+    if (!topk) return NULL;
+    topk->limit = limit;
+    topk->metric = TOPK_QUANTITY;
+    return topk;
+}
+
+void topk_free(TopK *topk) {
+    free(topk);
+}
+
+void topk_set_metric(TopK *topk, TopKMetric metric) {
+    topk->metric = metric;
+}
+
+// Positive if a ranks above b
+static int rank_compare(const TopKEntry *a, const TopKEntry *b) {
+    if (a->score != b->score) return a->score > b->score ? 1 : -1;
+    int cmp = strcmp(b->label, a->label);
+    if (cmp != 0) return cmp;
+    if (a->id != b->id) return a->id < b->id ? 1 : -1;
+    return 0;
+}
+
+static void swap_entries(TopKEntry *a, TopKEntry *b) {
+    TopKEntry tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static void sift_up(TopKEntry *heap, int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (rank_compare(&heap[parent], &heap[i]) <= 0) break;
+        swap_entries(&heap[parent], &heap[i]);
+        i = parent;
+    }
+}
+
+static void sift_down(TopKEntry *heap, int count, int i) {
+    for (;;) {
+        int weakest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < count && rank_compare(&heap[left], &heap[weakest]) < 0) weakest = left;
+        if (right < count && rank_compare(&heap[right], &heap[weakest]) < 0) weakest = right;
+        if (weakest == i) break;
+        swap_entries(&heap[i], &heap[weakest]);
+        i = weakest;
+    }
+}
+
+int topk_offer(TopK *topk, long long id, const char *label,
+               long long deals, long long quantity, double amount) {
+    if (topk->sorted) return 0;
+    
+    double score = topk->metric == TOPK_AMOUNT ? amount :
+                   topk->metric == TOPK_DEALS ? (double)deals : (double)quantity;
+    int full = topk->count == topk->limit;
+    if (full && score < topk->entries[0].score) return 0;
+    
+    TopKEntry candidate;
+    candidate.id = id;
+    snprintf(candidate.label, sizeof(candidate.label), "%s", label ? label : "");
+    candidate.score = score;
+    candidate.deals = deals;
+    candidate.quantity = quantity;
+    candidate.amount = amount;
+    
+    if (!full) {
+        topk->entries[topk->count] = candidate;
+        sift_up(topk->entries, topk->count++);
+        return 1;
+    }
+    if (rank_compare(&candidate, &topk->entries[0]) <= 0) return 0;
+    topk->entries[0] = candidate;
+    sift_down(topk->entries, topk->count, 0);
+    return 1;
+}
+
+int topk_sorted(TopK *topk, const TopKEntry **entries) {
+    // Heap sort: moving the weakest to the back leaves the best in front
+    if (!topk->sorted) {
+        for (int end = topk->count - 1; end > 0; end--) {
+            swap_entries(&topk->entries[0], &topk->entries[end]);
+            sift_down(topk->entries, end, 0);
+        }
+        topk->sorted = 1;
+    }
+    *entries = topk->entries;
+    return topk->count;
+}
+
+static int find_name(const char *names[], int count, const char *name) {
+    if (!name) return -1;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(names[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+int topk_parse_dimension(const char *name) {
+    return find_name(dimension_names, sizeof(dimension_names) / sizeof(dimension_names[0]), name);
+}
+
+int topk_parse_metric(const char *name) {
+    return find_name(metric_names, sizeof(metric_names) / sizeof(metric_names[0]), name);
+}
+
+const char* topk_dimension_title(TopKDimension dimension) {
+    return dimension_titles[dimension];
+}
+
+const char* topk_metric_title(TopKMetric metric) {
+    return metric_titles[metric];
+}
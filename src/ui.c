@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 
 #ifdef _WIN32
 #define CLEAR_SCREEN "cls"
@@ -16,7 +17,8 @@ void ui_clear_screen() {
 
 void ui_wait_enter() {
     printf("\nPress Enter to continue...");
-    while (getchar() != '\n');
+    int c;
+    while ((c = getchar()) != '\n' && c != EOF);
 }
 
 void ui_show_main_menu() {
@@ -40,7 +42,8 @@ void ui_show_admin_menu() {
     printf("4. Sales Report by Period\n");
     printf("5. Popular Good Type\n");
     printf("6. Top Makler\n");
-    printf("7. Logout\n");
+    printf("7. System Statistics\n");
+    printf("8. Logout\n");
     printf("==================================\n");
 }
 
@@ -53,7 +56,11 @@ void ui_show_makler_menu() {
     printf("2. View My Deals\n");
     printf("3. View My Statistics\n");
     printf("4. View Available Goods\n");
-    printf("5. Logout\n");
+    printf("5. Search Goods and Buyers\n");
+    printf("6. Hold Stock\n");
+    printf("7. Confirm Hold\n");
+    printf("8. Release Hold\n");
+    printf("9. Logout\n");
     printf("==================================\n");
 }
 
@@ -65,21 +72,25 @@ void ui_login_screen() {
 }
 
 int ui_get_int(const char *prompt) {
-    int value;
+    int value = 0;
     char buffer[100];
     
     printf("%s", prompt);
-    fgets(buffer, sizeof(buffer), stdin);
+    if (fgets(buffer, sizeof(buffer), stdin) == NULL) {
+        return 0;
+    }
     sscanf(buffer, "%d", &value);
     return value;
 }
 
 double ui_get_double(const char *prompt) {
-    double value;
+    double value = 0.0;
     char buffer[100];
     
     printf("%s", prompt);
-    fgets(buffer, sizeof(buffer), stdin);
+    if (fgets(buffer, sizeof(buffer), stdin) == NULL) {
+        return 0.0;
+    }
     sscanf(buffer, "%lf", &value);
     return value;
 }
@@ -101,16 +112,23 @@ void ui_get_string(const char *prompt, char *buffer, size_t size) {
 }
 
 void ui_get_date(const char *prompt, char *buffer) {
+    char line[100];
+    
     printf("%s", prompt);
-    fgets(buffer, 11, stdin);
-    // Remove newline if present
-    buffer[strcspn(buffer, "\n")] = 0;
+    if (fgets(line, sizeof(line), stdin) == NULL) {
+        buffer[0] = '\0';
+        return;
+    }
+    
+    // Read the whole line so the newline is not left for the next prompt
+    line[strcspn(line, "\n")] = 0;
+    snprintf(buffer, 11, "%.10s", line);
 }
 
 void ui_display_user(const User *user) {
     printf("User: %s (Role: %s)\n", 
            user->username, 
-           user->role == ROLE_ADMIN ? "Admin" : "Makler");
+           user->role == ROLE_ADMIN ? "Admin" : user->role == ROLE_ANALYST ? "Analyst" : "Makler");
 }
 
 void ui_display_makler(const Makler *makler) {
@@ -135,6 +153,39 @@ void ui_display_deal(const Deal *deal) {
     printf("------------------------\n");
 }
 
+// SQL NULL prints as empty
+#define VIEW_ARGS(view) (view).length, (view).text ? (view).text : ""
+
+int ui_display_good_view(const GoodView *good, void *ctx) {
+    (void)ctx;
+    printf("ID: %d - %.*s (%.*s)\n", good->id, VIEW_ARGS(good->name), VIEW_ARGS(good->type));
+    printf("Price: %.2f, Stock: %d\n", good->unit_price, good->quantity);
+    printf("Supplier: %.*s\n", VIEW_ARGS(good->supplier));
+    printf("Expires: %.*s\n", VIEW_ARGS(good->expiry_date));
+    printf("------------------------\n");
+    return 0;
+}
+
+int ui_display_deal_view(const DealView *deal, void *ctx) {
+    (void)ctx;
+    // Same local-time reading of the stored date as the Deal loaders
+    struct tm tm = {0};
+    if (deal->deal_date.text) {
+        sscanf(deal->deal_date.text, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    time_t date = mktime(&tm);
+    
+    printf("Deal #%d - Date: %s", deal->id, ctime(&date));
+    printf("Good: %.*s (%.*s) - Qty: %d\n", VIEW_ARGS(deal->good_name), VIEW_ARGS(deal->good_type),
+           deal->quantity);
+    printf("Total: %.2f - Buyer: %.*s\n", deal->total_amount, VIEW_ARGS(deal->buyer));
+    printf("------------------------\n");
+    return 0;
+}
+
 void ui_display_stats(const MaklerStats *stats) {
     printf("Good: %s (%s)\n", stats->good_name, stats->good_type);
     printf("Total Sold: %d units for %.2f\n", stats->total_quantity, stats->total_amount);
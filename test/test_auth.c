@@ -3,21 +3,52 @@
 #include <string.h>
 #include <stdlib.h>
 #include "auth.h"
+#include "scrypt.h"
 #include "database.h"
+#include "metrics.h"
+
+static void assert_hex(const uint8_t *bytes, size_t size, const char *expected) {
+    char hex[2 * 64 + 1];
+    for (size_t i = 0; i < size; i++) sprintf(hex + i * 2, "%02x", bytes[i]);
+    assert(strcmp(hex, expected) == 0);
+}
+
+void test_key_derivation() {
+    printf("Testing key derivation...\n");
+    
+    uint8_t out[64];
+    sha256("abc", 3, out);
+    assert_hex(out, 32, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    
+    // RFC 7914 test vectors
+    pbkdf2_sha256("passwd", 6, "salt", 4, 1, out, 64);
+    assert_hex(out, 64, "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc"
+                        "49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783");
+    assert(scrypt("", 0, "", 0, 16, 1, 1, out, 64) == 0);
+    assert_hex(out, 64, "77d6576238657b203b19ca42c18a0497f16b4844e3074ae8dfdffa3fede21442"
+                        "fcd0069ded0948f8326a753a0fc81f17e8d3e0fb2e0d3628cf35e20c38d18906");
+    assert(scrypt("password", 8, "NaCl", 4, 1024, 8, 16, out, 64) == 0);
+    assert_hex(out, 64, "fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b373162"
+                        "2eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640");
+    
+    assert(scrypt("", 0, "", 0, 15, 1, 1, out, 64) == -1);  // n not a power of two
+    
+    printf("✓ Key derivation passed\n");
+}
 
 void test_password_hashing() {
     printf("Testing password hashing...\n");
     
     char *hash1 = auth_hash_password("test123");
     char *hash2 = auth_hash_password("test123");
-    char *hash3 = auth_hash_password("different");
     
-    assert(strcmp(hash1, hash2) == 0);
-    assert(strcmp(hash1, hash3) != 0);
+    // Salted: the same password never gives the same hash
+    assert(strncmp(hash1, "$scrypt$ln=14,r=8,p=1$", 22) == 0);
+    assert(strcmp(hash1, hash2) != 0);
+    assert(strstr(hash1, "test123") == NULL);
     
     free(hash1);
     free(hash2);
-    free(hash3);
     
     printf("✓ Password hashing passed\n");
 }
@@ -29,6 +60,13 @@ void test_password_verification() {
     
     assert(auth_verify_password("mypassword", hash) == 1);
     assert(auth_verify_password("wrongpassword", hash) == 0);
+    hash[strlen(hash) - 1] = hash[strlen(hash) - 1] == '0' ? '1' : '0';
+    assert(auth_verify_password("mypassword", hash) == 0);
+    assert(auth_verify_password("mypassword", "$scrypt$ln=14,r=8,p=1$zz$zz") == 0);
+    
+    // Plain passwords from before hashing still verify
+    assert(auth_verify_password("legacy", "legacy") == 1);
+    assert(auth_verify_password("legacy", "legacy2") == 0);
     
     free(hash);
     
@@ -39,7 +77,7 @@ void test_login_logout() {
     printf("Testing login/logout...\n");
     
     // Initialize database and create test user
-    db_init("test_auth.db");
+    assert(db_init_memory(NULL, NULL) == 0);
     
     User user = {0};
     strcpy(user.username, "testuser");
@@ -64,7 +102,6 @@ void test_login_logout() {
     assert(auth_is_logged_in() == 0);
     
     db_close();
-    remove("test_auth.db");
     
     printf("✓ Login/logout passed\n");
 }
@@ -72,7 +109,7 @@ void test_login_logout() {
 void test_permissions() {
     printf("Testing permission checks...\n");
     
-    db_init("test_auth.db");
+    assert(db_init_memory(NULL, NULL) == 0);
     
     // Create admin and makler users
     User admin_user = {0};
@@ -100,7 +137,6 @@ void test_permissions() {
     auth_logout(makler);
     
     db_close();
-    remove("test_auth.db");
     
     printf("✓ Permission checks passed\n");
 }
@@ -108,7 +144,7 @@ void test_permissions() {
 void test_session_management() {
     printf("Testing session management...\n");
     
-    db_init("test_auth.db");
+    assert(db_init_memory(NULL, NULL) == 0);
     
     User user = {0};
     strcpy(user.username, "session_user");
@@ -127,19 +163,201 @@ void test_session_management() {
     
     db_free_user(logged_in);
     db_close();
-    remove("test_auth.db");
     
     printf("✓ Session management passed\n");
 }
 
+void test_legacy_upgrade() {
+    printf("Testing password upgrade...\n");
+    
+    assert(db_init_memory(NULL, NULL) == 0);
+    
+    User user = {0};
+    strcpy(user.username, "legacy_user");
+    strcpy(user.password_hash, "plain123");
+    user.role = ROLE_MAKLER;
+    db_create_user(&user);
+    
+    // Prefixes and extensions of a plain password don't match it
+    auth_reset_limits();
+    assert(auth_login("legacy_user", "plain12") == NULL);
+    assert(auth_login("legacy_user", "plain1234") == NULL);
+    
+    User *logged_in = auth_login("legacy_user", "plain123");
+    assert(logged_in != NULL);
+    auth_logout(logged_in);
+    
+    // The row now holds a hash, and the password still works
+    User *stored = db_get_user_by_username("legacy_user");
+    assert(strncmp(stored->password_hash, "$scrypt$", 8) == 0);
+    db_free_user(stored);
+    logged_in = auth_login("legacy_user", "plain123");
+    assert(logged_in != NULL);
+    auth_logout(logged_in);
+    assert(auth_login("legacy_user", "$scrypt$") == NULL);
+    
+    db_close();
+    
+    printf("✓ Password upgrade passed\n");
+}
+
+void test_session_tokens() {
+    printf("Testing session tokens...\n");
+    
+    assert(db_init_memory(NULL, NULL) == 0);
+    
+    char *hash = auth_hash_password("tokenpass");
+    User user = {0};
+    strcpy(user.username, "token_user");
+    snprintf(user.password_hash, sizeof(user.password_hash), "%s", hash);
+    user.role = ROLE_MAKLER;
+    int user_id = db_create_user(&user);
+    free(hash);
+    
+    User *logged_in = auth_login("token_user", "tokenpass");
+    assert(logged_in != NULL);
+    char token[AUTH_TOKEN_SIZE];
+    snprintf(token, sizeof(token), "%s", auth_session_token());
+    assert(strlen(token) == AUTH_TOKEN_SIZE - 1);
+    auth_end_session();
+    db_free_user(logged_in);
+    
+    // Ending the session revoked its token
+    assert(auth_login_token(token) == NULL);
+    
+    logged_in = auth_login("token_user", "tokenpass");
+    snprintf(token, sizeof(token), "%s", auth_session_token());
+    auth_start_session(NULL);
+    db_free_user(logged_in);
+    
+    User *by_token = auth_login_token(token);
+    assert(by_token != NULL);
+    assert(by_token->id == user_id);
+    assert(strcmp(by_token->username, "token_user") == 0);
+    assert(by_token->role == ROLE_MAKLER);
+    assert(by_token->password_hash[0] == '\0');
+    assert(auth_get_current_user() == by_token);
+    auth_start_session(NULL);
+    db_free_user(by_token);
+    
+    // A changed secret or slot is rejected
+    char forged[AUTH_TOKEN_SIZE];
+    snprintf(forged, sizeof(forged), "%s", token);
+    forged[10] = forged[10] == 'a' ? 'b' : 'a';
+    assert(auth_login_token(forged) == NULL);
+    assert(auth_login_token("ffff") == NULL);
+    assert(auth_login_token(NULL) == NULL);
+    
+    auth_revoke_user(user_id);
+    assert(auth_login_token(token) == NULL);
+    
+    db_close();
+    
+    printf("✓ Session tokens passed\n");
+}
+
+void test_login_throttling() {
+    printf("Testing login throttling...\n");
+    
+    assert(db_init_memory(NULL, NULL) == 0);
+    auth_reset_limits();
+    
+    User user = {0};
+    strcpy(user.username, "throttled");
+    strcpy(user.password_hash, "rightpass");
+    user.role = ROLE_MAKLER;
+    db_create_user(&user);
+    
+    // The username's burst is used up by wrong guesses; after that even
+    // the right password is refused without looking at the database
+    for (int i = 0; i < AUTH_USER_BURST; i++) {
+        assert(auth_login_from("throttled", "guess", "10.0.0.1") == NULL);
+    }
+    uint64_t throttled = metrics_counter_value("auth_throttled_user");
+    assert(auth_login_from("throttled", "rightpass", "10.0.0.2") == NULL);
+    if (metrics_enabled()) {
+        assert(metrics_counter_value("auth_throttled_user") == throttled + 1);
+    }
+    
+    // One source spraying usernames runs out of its own bucket
+    char name[32];
+    int allowed = 0;
+    uint64_t start = metrics_now_ns();
+    for (int i = 0; i < AUTH_SOURCE_BURST + 5; i++) {
+        snprintf(name, sizeof(name), "spray%d", i);
+        uint64_t before = metrics_counter_value("auth_throttled_source");
+        assert(auth_login_from(name, "guess", "10.0.0.3") == NULL);
+        if (metrics_counter_value("auth_throttled_source") == before) allowed++;
+    }
+    // Every refused username costs a key derivation, during which the
+    // bucket refills a little
+    double refilled = (double)(metrics_now_ns() - start) / 1e9 * AUTH_SOURCE_PER_SECOND;
+    if (metrics_enabled()) {
+        assert(allowed >= AUTH_SOURCE_BURST && allowed <= AUTH_SOURCE_BURST + (int)refilled + 1);
+    }
+    
+    // Other users and sources are unaffected
+    User other = {0};
+    strcpy(other.username, "unthrottled");
+    strcpy(other.password_hash, "otherpass");
+    other.role = ROLE_MAKLER;
+    db_create_user(&other);
+    User *logged_in = auth_login_from("unthrottled", "otherpass", "10.0.0.4");
+    assert(logged_in != NULL);
+    auth_logout(logged_in);
+    
+    auth_reset_limits();
+    logged_in = auth_login("throttled", "rightpass");
+    assert(logged_in != NULL);
+    auth_logout(logged_in);
+    
+    db_close();
+    
+    printf("✓ Login throttling passed\n");
+}
+
+void test_unknown_user_timing() {
+    printf("Testing login timing for unknown users...\n");
+    
+    assert(db_init_memory(NULL, NULL) == 0);
+    auth_reset_limits();
+    
+    char *hash = auth_hash_password("timedpass");
+    User user = {0};
+    strcpy(user.username, "timed_user");
+    snprintf(user.password_hash, sizeof(user.password_hash), "%s", hash);
+    user.role = ROLE_MAKLER;
+    db_create_user(&user);
+    free(hash);
+    
+    // A username that doesn't exist still pays for a key derivation, so
+    // refusing it takes about as long as refusing a wrong password
+    uint64_t start = metrics_now_ns();
+    assert(auth_login("timed_user", "wrongpass") == NULL);
+    uint64_t known = metrics_now_ns() - start;
+    start = metrics_now_ns();
+    assert(auth_login("missing_user", "wrongpass") == NULL);
+    uint64_t unknown = metrics_now_ns() - start;
+    assert(unknown * 2 > known);
+    
+    db_close();
+    
+    printf("✓ Login timing for unknown users passed\n");
+}
+
 int main() {
     printf("Starting authentication tests...\n\n");
     
+    test_key_derivation();
     test_password_hashing();
     test_password_verification();
     test_login_logout();
     test_permissions();
     test_session_management();
+    test_legacy_upgrade();
+    test_session_tokens();
+    test_login_throttling();
+    test_unknown_user_timing();
     
     printf("\n✅ All authentication tests passed!\n");
     return 0;
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include "database.h"
+#include "auth.h"
 
 void test_db_init() {
     printf("Testing database initialization...\n");
@@ -174,14 +175,372 @@ void test_stats_operations() {
     printf("✓ Statistics operations passed\n");
 }
 
+void test_version_operations() {
+    printf("Testing row versions...\n");
+    db_init("test.db");
+    
+    Good good = {0};
+    strcpy(good.name, "Versioned Good");
+    strcpy(good.type, "type");
+    good.unit_price = 10.0;
+    good.quantity = 5;
+    int good_id = db_create_good(&good);
+    
+    Good *first = db_get_good_by_id(good_id);
+    Good *second = db_get_good_by_id(good_id);
+    assert(first->version == 0);
+    
+    // The first writer wins, the second one sees a conflict
+    first->unit_price = 12.0;
+    assert(db_update_good_if_version(first) == 0);
+    assert(first->version == 1);
+    second->quantity = 50;
+    assert(db_update_good_if_version(second) == DB_CONFLICT);
+    
+    // Unconditional updates bump the version too
+    assert(db_update_good(first) == 0);
+    Good *current = db_get_good_by_id(good_id);
+    assert(current->version == 2);
+    assert(current->unit_price == 12.0 && current->quantity == 5);
+    assert(db_update_good_if_version(first) == DB_CONFLICT);
+    
+    Makler makler = {0};
+    strcpy(makler.name, "Versioned Makler");
+    int makler_id = db_create_makler(&makler);
+    Makler *m = db_get_makler_by_id(makler_id);
+    Makler stale = *m;
+    strcpy(m->address, "New Street 1");
+    assert(db_update_makler_if_version(m) == 0);
+    assert(db_update_makler_if_version(&stale) == DB_CONFLICT);
+    
+    db_free_good(first);
+    db_free_good(second);
+    db_free_good(current);
+    db_free_makler(m);
+    db_close();
+    printf("✓ Row versions passed\n");
+}
+
+void test_busy_count() {
+    printf("Testing busy count...\n");
+    db_init("test.db");
+    
+    // A second connection holding the write lock makes our write busy
+    sqlite3 *other;
+    assert(sqlite3_open("test.db", &other) == SQLITE_OK);
+    assert(sqlite3_exec(other, "BEGIN IMMEDIATE;", NULL, NULL, NULL) == SQLITE_OK);
+    
+    uint64_t before = db_busy_count();
+    Good good = {0};
+    strcpy(good.name, "Busy Good");
+    strcpy(good.expiry_date, "2030-01-01");
+    assert(db_create_good(&good) < 0);
+    assert(db_busy_count() > before);
+    
+    sqlite3_exec(other, "ROLLBACK;", NULL, NULL, NULL);
+    sqlite3_close(other);
+    before = db_busy_count();
+    assert(db_create_good(&good) > 0);
+    assert(db_busy_count() == before);
+    
+    db_close();
+    printf("✓ Busy count passed\n");
+}
+
+static int query_int(const char *sql) {
+    sqlite3_stmt *stmt;
+    assert(db_prepare(sql, &stmt) == SQLITE_OK);
+    int value = db_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : -1;
+    db_finalize(stmt);
+    return value;
+}
+
+void test_dimensions() {
+    printf("Testing supplier and type dimensions...\n");
+    remove("test.db");
+    db_init("test.db");
+    
+    Makler makler = {0};
+    strcpy(makler.name, "Dimension Makler");
+    int makler_id = db_create_makler(&makler);
+    
+    Good good = {0};
+    strcpy(good.name, "Dimension Good");
+    strcpy(good.type, "perfume");
+    strcpy(good.supplier, "First Supplier");
+    strcpy(good.expiry_date, "2030-01-01");
+    good.unit_price = 10.0;
+    good.quantity = 100;
+    int good_id = db_create_good(&good);
+    strcpy(good.name, "Other Good");
+    assert(db_create_good(&good) > 0);
+    
+    // Goods with the same names share one row in each dimension
+    assert(query_int("SELECT COUNT(*) FROM PERFUME_SUPPLIERS;") == 1);
+    assert(query_int("SELECT COUNT(*) FROM PERFUME_GOOD_TYPES;") == 1);
+    int first_supplier = query_int("SELECT id FROM PERFUME_SUPPLIERS WHERE name = 'First Supplier';");
+    assert(query_int("SELECT COUNT(DISTINCT supplier_id) FROM PERFUME_GOODS;") == 1);
+    assert(query_int("SELECT MIN(supplier_id) FROM PERFUME_GOODS;") == first_supplier);
+    
+    Deal deal = {0};
+    deal.deal_date = time(NULL);
+    strcpy(deal.good_name, good.name);
+    strcpy(deal.good_type, good.type);
+    deal.quantity = 1;
+    deal.total_amount = 10.0;
+    deal.makler_id = makler_id;
+    deal.good_id = good_id;
+    strcpy(deal.buyer, "Dimension Buyer");
+    int first_deal = db_create_deal(&deal);
+    assert(first_deal > 0);
+    
+    // A deal keeps the supplier it was made under
+    Good *current = db_get_good_by_id(good_id);
+    strcpy(current->supplier, "Second Supplier");
+    assert(db_update_good(current) == 0);
+    db_free_good(current);
+    int second_supplier = query_int("SELECT id FROM PERFUME_SUPPLIERS WHERE name = 'Second Supplier';");
+    assert(second_supplier > 0 && second_supplier != first_supplier);
+    char sql[512];
+    snprintf(sql, sizeof(sql), "SELECT supplier_id FROM PERFUME_GOODS WHERE id = %d;", good_id);
+    assert(query_int(sql) == second_supplier);
+    
+    int second_deal = db_create_deal(&deal);
+    snprintf(sql, sizeof(sql), "SELECT supplier_id FROM PERFUME_DEALS WHERE id = %d;", first_deal);
+    assert(query_int(sql) == first_supplier);
+    snprintf(sql, sizeof(sql), "SELECT supplier_id FROM PERFUME_DEALS WHERE id = %d;", second_deal);
+    assert(query_int(sql) == second_supplier);
+    
+    // Deals written with plain SQL are tagged by the trigger
+    snprintf(sql, sizeof(sql),
+             "INSERT INTO PERFUME_DEALS (deal_date, good_name, good_type, quantity, total_amount, makler_id, good_id, buyer) "
+             "VALUES ('2024-01-01 10:00:00', 'Dimension Good', 'oils', 1, 10.0, %d, %d, 'Raw Buyer');",
+             makler_id, good_id);
+    assert(sqlite3_exec(db_get_connection(), sql, NULL, NULL, NULL) == SQLITE_OK);
+    assert(query_int("SELECT COUNT(*) FROM PERFUME_DEALS WHERE supplier_id IS NULL OR type_id IS NULL;") == 0);
+    assert(query_int("SELECT t.name = 'oils' FROM PERFUME_DEALS d JOIN PERFUME_GOOD_TYPES t ON t.id = d.type_id "
+                     "WHERE d.buyer = 'Raw Buyer';") == 1);
+    
+    db_close();
+    printf("✓ Supplier and type dimensions passed\n");
+}
+
+void test_dimension_backfill() {
+    printf("Testing dimension backfill...\n");
+    remove("test.db");
+    
+    // Goods and deals as an older version of the schema wrote them
+    sqlite3 *old;
+    assert(sqlite3_open("test.db", &old) == SQLITE_OK);
+    assert(sqlite3_exec(old,
+        "CREATE TABLE PERFUME_GOODS (id INTEGER PRIMARY KEY AUTOINCREMENT, name VARCHAR(100) NOT NULL, "
+        "type VARCHAR(50) NOT NULL, unit_price DECIMAL(10,2) NOT NULL, supplier VARCHAR(100), expiry_date DATE, "
+        "quantity INTEGER NOT NULL DEFAULT 0, created_at DATETIME DEFAULT CURRENT_TIMESTAMP);"
+        "CREATE TABLE PERFUME_DEALS (id INTEGER PRIMARY KEY AUTOINCREMENT, deal_date DATETIME NOT NULL, "
+        "good_name VARCHAR(100) NOT NULL, good_type VARCHAR(50) NOT NULL, quantity INTEGER NOT NULL, "
+        "total_amount DECIMAL(12,2) NOT NULL, makler_id INTEGER NOT NULL, good_id INTEGER NOT NULL, "
+        "buyer VARCHAR(100) NOT NULL, created_at DATETIME DEFAULT CURRENT_TIMESTAMP);"
+        "CREATE TABLE PERFUME_DAILY_SALES (day DATE NOT NULL, good_id INTEGER NOT NULL, "
+        "makler_id INTEGER NOT NULL, deal_count INTEGER NOT NULL DEFAULT 0, "
+        "total_quantity INTEGER NOT NULL DEFAULT 0, total_amount DECIMAL(12,2) NOT NULL DEFAULT 0, "
+        "PRIMARY KEY (day, good_id, makler_id));"
+        "INSERT INTO PERFUME_DAILY_SALES VALUES ('2024-01-01', 1, 1, 1, 1, 5);"
+        "INSERT INTO PERFUME_GOODS (name, type, unit_price, supplier) VALUES "
+        "('Old Rose', 'perfume', 5, 'Old Supplier'), ('Old Cream', 'cosmetics', 6, NULL);"
+        "INSERT INTO PERFUME_DEALS (deal_date, good_name, good_type, quantity, total_amount, makler_id, good_id, buyer) VALUES "
+        "('2024-01-01 10:00:00', 'Old Rose', 'perfume', 1, 5, 1, 1, 'Old Buyer'),"
+        "('2024-01-02 10:00:00', 'Old Cream', 'cosmetics', 1, 6, 1, 2, 'Old Buyer');",
+        NULL, NULL, NULL) == SQLITE_OK);
+    sqlite3_close(old);
+    
+    assert(db_init("test.db") == 0);
+    assert(query_int("SELECT COUNT(*) FROM PERFUME_GOOD_TYPES;") == 2);
+    assert(query_int("SELECT COUNT(*) FROM PERFUME_SUPPLIERS;") == 1);
+    assert(query_int("SELECT COUNT(*) FROM PERFUME_GOODS WHERE type_id IS NULL;") == 0);
+    assert(query_int("SELECT COUNT(*) FROM PERFUME_DEALS WHERE type_id IS NULL;") == 0);
+    // Only the good with a supplier has one
+    assert(query_int("SELECT COUNT(*) FROM PERFUME_DEALS d JOIN PERFUME_SUPPLIERS s ON s.id = d.supplier_id "
+                     "WHERE s.name = 'Old Supplier';") == 1);
+    assert(query_int("SELECT COUNT(*) FROM PERFUME_DEALS WHERE supplier_id IS NULL;") == 1);
+    
+    // The rollup is rebuilt keyed by the dimensions
+    assert(query_int("SELECT COUNT(*) FROM PERFUME_DAILY_SALES;") == 2);
+    assert(query_int("SELECT COUNT(*) FROM PERFUME_DAILY_SALES WHERE supplier_id = 0;") == 1);
+    assert(query_int("SELECT COUNT(*) FROM PERFUME_DAILY_SALES s JOIN PERFUME_GOOD_TYPES t ON t.id = s.type_id;") == 2);
+    db_close();
+    
+    // Nothing is done again on the next start
+    assert(db_init("test.db") == 0);
+    assert(query_int("SELECT COUNT(*) FROM PERFUME_GOOD_TYPES;") == 2);
+    db_close();
+    printf("✓ Dimension backfill passed\n");
+}
+
+typedef struct {
+    int rows;
+    int stop_after;
+    int last_id;
+    char buyers[256];
+} VisitLog;
+
+static int log_deal(const DealView *deal, void *ctx) {
+    VisitLog *log = ctx;
+    assert(deal->buyer.length == (int)strlen(deal->buyer.text));
+    assert(deal->deal_date.length == 19);
+    strncat(log->buyers, deal->buyer.text, deal->buyer.length);
+    strcat(log->buyers, ";");
+    log->last_id = deal->id;
+    return ++log->rows == log->stop_after;
+}
+
+static int log_good(const GoodView *good, void *ctx) {
+    VisitLog *log = ctx;
+    assert(good->id > log->last_id);
+    log->last_id = good->id;
+    if (good->supplier.text == NULL) assert(good->supplier.length == 0);
+    log->rows++;
+    return 0;
+}
+
+void test_visitors() {
+    printf("Testing row visitors...\n");
+    remove("test.db");
+    db_init("test.db");
+    
+    Makler makler = {0};
+    strcpy(makler.name, "Visit Makler");
+    int first_makler = db_create_makler(&makler);
+    int second_makler = db_create_makler(&makler);
+    
+    Good good = {0};
+    strcpy(good.name, "Visited Good");
+    strcpy(good.type, "perfume");
+    strcpy(good.expiry_date, "2030-01-01");
+    good.unit_price = 4.0;
+    good.quantity = 100;
+    int good_id = db_create_good(&good);
+    assert(good_id > 0);
+    assert(sqlite3_exec(db_get_connection(), "INSERT INTO PERFUME_GOODS (name, type, unit_price) VALUES ('No Supplier', 'oils', 1);",
+                        NULL, NULL, NULL) == SQLITE_OK);
+    
+    // Inserted out of date order
+    const char *dates[] = { "2024-03-01 09:00:00", "2024-01-01 09:00:00", "2024-02-01 09:00:00" };
+    const char *buyers[] = { "March", "January", "February" };
+    for (int i = 0; i < 3; i++) {
+        Deal deal = {0};
+        struct tm tm = {0};
+        sscanf(dates[i], "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        deal.deal_date = mktime(&tm);
+        strcpy(deal.good_name, good.name);
+        strcpy(deal.good_type, good.type);
+        deal.quantity = 1;
+        deal.total_amount = 4.0;
+        deal.makler_id = i == 1 ? second_makler : first_makler;
+        deal.good_id = good_id;
+        strcpy(deal.buyer, buyers[i]);
+        assert(db_create_deal(&deal) > 0);
+    }
+    
+    VisitLog log = {0};
+    assert(db_visit_deals(0, NULL, NULL, log_deal, &log) == 3);
+    assert(strcmp(log.buyers, "January;February;March;") == 0);
+    
+    // Makler and inclusive date filters
+    memset(&log, 0, sizeof(log));
+    assert(db_visit_deals(first_makler, NULL, NULL, log_deal, &log) == 2);
+    assert(strcmp(log.buyers, "February;March;") == 0);
+    memset(&log, 0, sizeof(log));
+    assert(db_visit_deals(0, "2024-01-01", "2024-02-01", log_deal, &log) == 2);
+    assert(strcmp(log.buyers, "January;February;") == 0);
+    memset(&log, 0, sizeof(log));
+    assert(db_visit_deals(0, "2024-02-01", NULL, log_deal, &log) == 2);
+    assert(strcmp(log.buyers, "February;March;") == 0);
+    memset(&log, 0, sizeof(log));
+    assert(db_visit_deals(0, NULL, "2024-01-15", log_deal, &log) == 1);
+    assert(strcmp(log.buyers, "January;") == 0);
+    
+    // Date ranges seek on the index, which the schema setup creates
+    assert(query_int("SELECT COUNT(*) FROM sqlite_master WHERE name = 'idx_deals_date';") == 1);
+    
+    // A visitor can stop the walk
+    memset(&log, 0, sizeof(log));
+    log.stop_after = 1;
+    assert(db_visit_deals(0, NULL, NULL, log_deal, &log) == 1);
+    assert(strcmp(log.buyers, "January;") == 0);
+    
+    memset(&log, 0, sizeof(log));
+    assert(db_visit_goods(log_good, &log) == 2);
+    assert(log.rows == 2);
+    
+    db_close();
+    printf("✓ Row visitors passed\n");
+}
+
+void test_memory_databases() {
+    printf("Testing in-memory databases...\n");
+    
+    // Build a dataset once and keep it as a template
+    assert(db_init_memory(NULL, NULL) == 0);
+    Good good = {0};
+    strcpy(good.name, "Template Good");
+    strcpy(good.type, "perfume");
+    strcpy(good.expiry_date, "2030-01-01");
+    good.unit_price = 7.0;
+    good.quantity = 10;
+    int good_id = db_create_good(&good);
+    assert(good_id > 0);
+    assert(db_save_template("test_template.db") == 0);
+    db_close();
+    
+    // Every start from the template sees it as saved
+    for (int run = 0; run < 2; run++) {
+        assert(db_init_memory(NULL, "test_template.db") == 0);
+        assert(query_int("SELECT COUNT(*) FROM PERFUME_GOODS;") == 1);
+        assert(query_int("SELECT COUNT(*) FROM PERFUME_SUPPLIERS;") == 0);
+        strcpy(good.name, "Scratch Good");
+        assert(db_create_good(&good) > 0);
+        db_close();
+    }
+    
+    // A named database is shared with the connections opened for it
+    assert(db_init_memory("test_shared", "test_template.db") == 0);
+    sqlite3 *other = db_open_connection();
+    assert(other != NULL);
+    assert(sqlite3_exec(other, "UPDATE PERFUME_GOODS SET quantity = 3;", NULL, NULL, NULL) == SQLITE_OK);
+    Good *stored = db_get_good_by_id(good_id);
+    assert(stored && stored->quantity == 3);
+    db_free_good(stored);
+    sqlite3_close(other);
+    db_close();
+    
+    // Gone with its last connection
+    assert(db_init_memory("test_shared", NULL) == 0);
+    assert(query_int("SELECT COUNT(*) FROM PERFUME_GOODS;") == 0);
+    db_close();
+    
+    assert(db_init_memory(NULL, "missing_template.db") == -1);
+    assert(db_get_connection() == NULL);
+    remove("test_template.db");
+    printf("✓ In-memory databases passed\n");
+}
+
 int main() {
     printf("Starting database tests...\n\n");
+    auth_set_capabilities(CAP_ALL);
     
     test_db_init();
     test_user_operations();
     test_good_operations();
     test_deal_operations();
     test_stats_operations();
+    test_version_operations();
+    test_busy_count();
+    test_dimensions();
+    test_dimension_backfill();
+    test_visitors();
+    test_memory_databases();
     
     // Cleanup
     remove("test.db");
@@ -4,6 +4,10 @@
 #include <stdlib.h>
 #include "deals.h"
 #include "database.h"
+#include "auth.h"
+
+// Maklers and goods every test starts from, copied into memory
+#define FIXTURE_DB "test_deals_fixture.db"
 
 void setup_test_data() {
     // Create user and makler
@@ -37,8 +41,7 @@ void setup_test_data() {
 void test_create_deal() {
     printf("Testing deal creation...\n");
     
-    db_init("test_deals.db");
-    setup_test_data();
+    assert(db_init_memory(NULL, FIXTURE_DB) == 0);
     
     // Test creating a deal
     int deal_id = deals_create_deal(1, 5, "Test Buyer", 1);
@@ -54,7 +57,6 @@ void test_create_deal() {
     assert(deal_id == -1);
     
     db_close();
-    remove("test_deals.db");
     
     printf("✓ Deal creation passed\n");
 }
@@ -62,8 +64,7 @@ void test_create_deal() {
 void test_deal_retrieval() {
     printf("Testing deal retrieval...\n");
     
-    db_init("test_deals.db");
-    setup_test_data();
+    assert(db_init_memory(NULL, FIXTURE_DB) == 0);
     
     // Create deals
     deals_create_deal(1, 10, "Buyer1", 1);
@@ -91,7 +92,6 @@ void test_deal_retrieval() {
     free(deals);
     
     db_close();
-    remove("test_deals.db");
     
     printf("✓ Deal retrieval passed\n");
 }
@@ -99,8 +99,7 @@ void test_deal_retrieval() {
 void test_deal_calculations() {
     printf("Testing deal calculations...\n");
     
-    db_init("test_deals.db");
-    setup_test_data();
+    assert(db_init_memory(NULL, FIXTURE_DB) == 0);
     
     // Test calculating total
     double total = deals_calculate_total(1, 10);
@@ -110,7 +109,6 @@ void test_deal_calculations() {
     assert(total == 1000.0); // 200.0 * 5
     
     db_close();
-    remove("test_deals.db");
     
     printf("✓ Deal calculations passed\n");
 }
@@ -118,7 +116,7 @@ void test_deal_calculations() {
 void test_deal_validations() {
     printf("Testing deal validations...\n");
     
-    db_init("test_deals.db");
+    assert(db_init_memory(NULL, NULL) == 0);
     
     // Create goods with specific quantities
     Good good1 = {0};
@@ -142,7 +140,6 @@ void test_deal_validations() {
     // Skip expiry date validation as strptime is not portable
     
     db_close();
-    remove("test_deals.db");
     
     printf("✓ Deal validations passed\n");
 }
@@ -150,8 +147,7 @@ void test_deal_validations() {
 void test_deal_statistics() {
     printf("Testing deal statistics...\n");
     
-    db_init("test_deals.db");
-    setup_test_data();
+    assert(db_init_memory(NULL, FIXTURE_DB) == 0);
     
     // Create multiple deals for statistics
     deals_create_deal(1, 10, "Buyer1", 1);
@@ -165,19 +161,66 @@ void test_deal_statistics() {
     deals_show_sales_by_suppliers();
     
     db_close();
-    remove("test_deals.db");
     
     printf("✓ Deal statistics passed\n");
 }
 
+void test_deal_conflicts() {
+    printf("Testing deals against concurrent good updates...\n");
+    
+    assert(db_init_memory("test_deals", FIXTURE_DB) == 0);
+    assert(deals_create_deal(1, 5, "Buyer1", 1) > 0);
+    
+    // Another connection raises the price behind the cached copy
+    sqlite3 *other = db_open_connection();
+    assert(other != NULL);
+    assert(sqlite3_exec(other, "UPDATE PERFUME_GOODS SET unit_price = 150.0, version = version + 1 WHERE id = 1;",
+                        0, 0, NULL) == SQLITE_OK);
+    sqlite3_close(other);
+    
+    int deal_id = deals_create_deal(1, 2, "Buyer2", 1);
+    assert(deal_id > 0);
+    int count;
+    Deal **deals = deals_get_all_deals(&count);
+    assert(count == 2);
+    assert(deals[1]->total_amount == 300.0);
+    for (int i = 0; i < count; i++) {
+        db_free_deal(deals[i]);
+    }
+    free(deals);
+    
+    // A rolled back deal doesn't leave the cache ahead of the database
+    assert(db_begin_transaction() == 0);
+    assert(deals_create_deal(1, 40, "Rolled Back", 1) > 0);
+    assert(db_rollback_transaction() == 0);
+    assert(deals_create_deal(1, 43, "Buyer3", 1) > 0);
+    
+    Good *good = db_get_good_by_id(1);
+    assert(good->quantity == 0);
+    assert(good->version == 4);
+    db_free_good(good);
+    
+    db_close();
+    
+    printf("✓ Deal conflicts passed\n");
+}
+
 int main() {
     printf("Starting deals tests...\n\n");
+    auth_set_capabilities(CAP_ALL);
+    
+    assert(db_init_memory(NULL, NULL) == 0);
+    setup_test_data();
+    assert(db_save_template(FIXTURE_DB) == 0);
+    db_close();
     
     test_create_deal();
     test_deal_retrieval();
     test_deal_calculations();
     test_deal_validations();
     test_deal_statistics();
+    test_deal_conflicts();
+    remove(FIXTURE_DB);
     
     printf("\n✅ All deals tests passed!\n");
     return 0;
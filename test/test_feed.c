@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "feed.h"
+#include "database.h"
+#include "deals.h"
+#include "auth.h"
+#include "test_fixture.h"
+
+#define FEED_DB "test_feed.db"
+
+typedef struct {
+    long long seqs[16];
+    int count;
+    long long stop_at;  // stop following once this seq is seen
+} Collected;
+
+static int collect(const FeedEvent *event, void *ctx) {
+    Collected *c = (Collected *)ctx;
+    if (c->count < 16) c->seqs[c->count] = event->seq;
+    c->count++;
+    return c->stop_at > 0 && event->seq >= c->stop_at;
+}
+
+static void setup_data() {
+    db_init(FEED_DB);
+    
+    fixture_add_makler("feeduser", "Feed Makler");
+    fixture_add_good("Feed Good", "perfume", "Supplier F", 20.0, 100);
+}
+
+void test_feed_sequence() {
+    printf("Testing feed sequence numbers...\n");
+    
+    assert(feed_last_seq() == 0);
+    assert(deals_create_deal(1, 1, "Buyer A", 1) > 0);
+    assert(deals_create_deal(1, 2, "Buyer B", 1) > 0);
+    
+    // A rolled back deal never gets a sequence number
+    assert(db_begin_transaction() == 0);
+    assert(deals_create_deal(1, 3, "Rolled Back", 1) > 0);
+    assert(db_rollback_transaction() == 0);
+    
+    assert(deals_create_deal(1, 4, "Buyer C", 1) > 0);
+    assert(feed_last_seq() == 3);
+    
+    printf("✓ Feed sequence numbers passed\n");
+}
+
+void test_feed_read() {
+    printf("Testing feed reads...\n");
+    
+    Collected c = {0};
+    long long last = -1;
+    assert(feed_read(0, 0, collect, &c, &last) == 3);
+    assert(c.seqs[0] == 1 && c.seqs[1] == 2 && c.seqs[2] == 3);
+    assert(last == 3);
+    
+    // Deltas only: resume from a cursor, bounded by a limit
+    memset(&c, 0, sizeof(c));
+    assert(feed_read(1, 1, collect, &c, &last) == 1);
+    assert(c.seqs[0] == 2 && last == 2);
+    assert(feed_read(3, 0, collect, &c, &last) == 0);
+    assert(last == 3);
+    
+    printf("✓ Feed reads passed\n");
+}
+
+void test_feed_follow() {
+    printf("Testing feed follow...\n");
+    
+    // Catch-up delivers the backlog in small batches
+    Collected c = {0};
+    c.stop_at = 3;
+    assert(feed_follow(0, 2, 10, collect, &c) == 3);
+    assert(c.count == 3);
+    
+    // Then new commits from another process are picked up
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        usleep(100 * 1000);
+        sqlite3 *other;
+        if (sqlite3_open(FEED_DB, &other) != SQLITE_OK) _exit(1);
+        sqlite3_busy_timeout(other, 5000);
+        int rc = sqlite3_exec(other,
+            "BEGIN;"
+            "INSERT INTO PERFUME_DEALS (deal_date, good_name, good_type, quantity, total_amount, makler_id, good_id, buyer) "
+            "VALUES ('2025-01-01 10:00:00', 'Feed Good', 'perfume', 1, 20.0, 1, 1, 'Other Process');"
+            "INSERT INTO PERFUME_DEAL_FEED (deal_id) VALUES (last_insert_rowid());"
+            "COMMIT;", 0, 0, NULL);
+        sqlite3_close(other);
+        _exit(rc == SQLITE_OK ? 0 : 1);
+    }
+    
+    memset(&c, 0, sizeof(c));
+    c.stop_at = 4;
+    assert(feed_follow(3, 2, 10, collect, &c) == 4);
+    assert(c.count == 1 && c.seqs[0] == 4);
+    
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    
+    printf("✓ Feed follow passed\n");
+}
+
+int main() {
+    printf("Starting feed tests...\n\n");
+    auth_set_capabilities(CAP_ALL);
+    
+    remove(FEED_DB);
+    setup_data();
+    test_feed_sequence();
+    test_feed_read();
+    test_feed_follow();
+    
+    db_close();
+    remove(FEED_DB);
+    
+    printf("\n✅ All feed tests passed!\n");
+    return 0;
+}
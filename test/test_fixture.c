@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include "test_fixture.h"
+#include "database.h"
+
+int fixture_add_makler(const char *username, const char *name) {
+    User user = {0};
+    snprintf(user.username, sizeof(user.username), "%s", username);
+    strcpy(user.password_hash, "hash");
+    user.role = ROLE_MAKLER;
+    Makler makler = {0};
+    snprintf(makler.name, sizeof(makler.name), "%s", name);
+    makler.user_id = db_create_user(&user);
+    assert(makler.user_id > 0);
+    
+    int makler_id = db_create_makler(&makler);
+    assert(makler_id > 0);
+    return makler_id;
+}
+
+int fixture_add_good(const char *name, const char *type, const char *supplier,
+                     double unit_price, int quantity) {
+    Good good = {0};
+    snprintf(good.name, sizeof(good.name), "%s", name);
+    snprintf(good.type, sizeof(good.type), "%s", type);
+    snprintf(good.supplier, sizeof(good.supplier), "%s", supplier ? supplier : "");
+    strcpy(good.expiry_date, FIXTURE_EXPIRY);
+    good.unit_price = unit_price;
+    good.quantity = quantity;
+    
+    int good_id = db_create_good(&good);
+    assert(good_id > 0);
+    return good_id;
+}
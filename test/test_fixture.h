@@ -0,0 +1,16 @@
+#ifndef TEST_FIXTURE_H
+#define TEST_FIXTURE_H
+
+// Rows most suites start from. Each asserts it was created and returns
+// its id.
+
+#define FIXTURE_EXPIRY "2030-01-01"  // far enough out for every test
+
+// A makler with a login of its own
+int fixture_add_makler(const char *username, const char *name);
+
+// A good expiring on FIXTURE_EXPIRY; supplier may be NULL
+int fixture_add_good(const char *name, const char *type, const char *supplier,
+                     double unit_price, int quantity);
+
+#endif // TEST_FIXTURE_H
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "hll.h"
+#include "database.h"
+#include "deals.h"
+#include "auth.h"
+#include "test_fixture.h"
+
+static double relative_error(double estimate, double exact) {
+    return fabs(estimate - exact) / exact;
+}
+
+void test_estimates() {
+    printf("Testing sketch estimates...\n");
+    
+    static Hll hll, left, right;
+    hll_clear(&hll);
+    hll_clear(&left);
+    hll_clear(&right);
+    
+    char value[32];
+    for (int i = 0; i < 200000; i++) {
+        int length = snprintf(value, sizeof(value), "buyer-%d", i);
+        uint64_t hash = hll_hash(value, (size_t)length);
+        hll_add(&hll, hash);
+        hll_add(i % 2 ? &left : &right, hash);
+        // Duplicates don't count
+        hll_add(&hll, hash);
+        
+        if (i + 1 == 10 || i + 1 == 1000 || i + 1 == 50000) {
+            assert(relative_error(hll_estimate(&hll), i + 1) < 0.03);
+        }
+    }
+    assert(relative_error(hll_estimate(&hll), 200000) < 0.03);
+    
+    // Merging two halves gives the sketch of the whole
+    uint8_t encoded[HLL_DENSE_SIZE];
+    encoded[0] = HLL_FORMAT_DENSE;
+    memcpy(encoded + 1, right.registers, HLL_REGISTERS);
+    assert(hll_merge_encoded(&left, encoded, sizeof(encoded)) == 0);
+    assert(memcmp(left.registers, hll.registers, HLL_REGISTERS) == 0);
+    
+    encoded[0] = 'X';
+    assert(hll_merge_encoded(&left, encoded, sizeof(encoded)) == -1);
+    
+    printf("✓ Sketch estimates passed\n");
+}
+
+static long long query_int(const char *sql) {
+    sqlite3_stmt *stmt;
+    assert(sqlite3_prepare_v2(db_get_connection(), sql, -1, &stmt, NULL) == SQLITE_OK);
+    assert(sqlite3_step(stmt) == SQLITE_ROW);
+    long long value = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    return value;
+}
+
+void test_deal_sketches() {
+    printf("Testing distinct buyers from deals...\n");
+    
+    remove("test_hll.db");
+    db_init("test_hll.db");
+    
+    int makler_id = fixture_add_makler("hlluser", "Sketch Makler");
+    int good_id = fixture_add_good("Sketch Good", "perfume", "Sketch Supplier", 1.0, 100000);
+    
+    assert(deals_create_deal(good_id, 1, "Shop One", makler_id) > 0);
+    assert(deals_create_deal(good_id, 1, "Shop Two", makler_id) > 0);
+    assert(deals_create_deal(good_id, 1, "Shop One", makler_id) > 0);
+    
+    char makler_key[16];
+    snprintf(makler_key, sizeof(makler_key), "%d", makler_id);
+    assert(db_distinct_buyers("type", "perfume", NULL, NULL) == 2);
+    assert(db_distinct_buyers("makler", makler_key, NULL, NULL) == 2);
+    assert(db_distinct_buyers("supplier", "Sketch Supplier", NULL, NULL) == 2);
+    assert(db_distinct_buyers("type", "cosmetics", NULL, NULL) == 0);
+    assert(db_distinct_buyers("type", "perfume", "2001-01-01", "2001-12-31") == 0);
+    
+    // Rolled back deals leave the sketches alone
+    assert(db_begin_transaction() == 0);
+    assert(deals_create_deal(good_id, 1, "Shop Three", makler_id) > 0);
+    assert(db_rollback_transaction() == 0);
+    assert(db_distinct_buyers("type", "perfume", NULL, NULL) == 2);
+    
+    // Enough buyers to turn the day's sketch dense; later deals update
+    // single registers in place
+    assert(db_begin_transaction() == 0);
+    char buyer[32];
+    for (int i = 0; i < 3000; i++) {
+        snprintf(buyer, sizeof(buyer), "Buyer %d", i % 2500);
+        assert(deals_create_deal(good_id, 1, buyer, makler_id) > 0);
+    }
+    assert(db_commit_transaction() == 0);
+    
+    assert(query_int("SELECT length(sketch) FROM PERFUME_BUYER_SKETCHES WHERE dimension = 'type'") == HLL_DENSE_SIZE);
+    long long estimate = db_distinct_buyers("type", "perfume", NULL, NULL);
+    assert(relative_error((double)estimate, 2502) < 0.03);
+    
+    // A rebuilt sketch (as the schema backfill makes) matches the one kept up to date
+    assert(query_int("SELECT hll_count(hll_sketch(buyer)) FROM PERFUME_DEALS") == estimate);
+    assert(query_int("SELECT (SELECT sketch FROM PERFUME_BUYER_SKETCHES WHERE dimension = 'supplier') = "
+                     "(SELECT hll_sketch(buyer) FROM PERFUME_DEALS)") == 1);
+    
+    // A deal after the good changed supplier counts for the new one, and
+    // rebuilding the aggregates keeps every deal under its own supplier
+    Good *changed = db_get_good_by_id(good_id);
+    strcpy(changed->supplier, "Other Supplier");
+    assert(db_update_good(changed) == 0);
+    db_free_good(changed);
+    
+    Deal deal = {0};
+    deal.deal_date = time(NULL);
+    strcpy(deal.good_name, "Sketch Good");
+    strcpy(deal.good_type, "perfume");
+    deal.quantity = 1;
+    deal.total_amount = 1.0;
+    deal.makler_id = makler_id;
+    deal.good_id = good_id;
+    strcpy(deal.buyer, "Shop Four");
+    deal.id = db_create_deal(&deal);
+    assert(deal.id > 0);
+    assert(db_distinct_buyers("supplier", "Other Supplier", NULL, NULL) == 1);
+    
+    // Replayed as the journal records it, with the supplier at commit
+    char sql[96];
+    snprintf(sql, sizeof(sql), "SELECT supplier_id FROM PERFUME_DEALS WHERE id = %d", deal.id);
+    deal.supplier_id = (int)query_int(sql);
+    assert(query_int("SELECT hll_count(sketch) FROM PERFUME_BUYER_SKETCHES WHERE dimension = 'supplier' "
+                     "AND key = 'Sketch Supplier'") == estimate);
+    
+    assert(db_reset_aggregates() == 0);
+    assert(db_apply_deal_aggregates(&deal) == 0);
+    assert(db_distinct_buyers("supplier", "Other Supplier", NULL, NULL) == 1);
+    assert(db_distinct_buyers("supplier", "Sketch Supplier", NULL, NULL) == 0);
+    
+    db_close();
+    remove("test_hll.db");
+    
+    printf("✓ Distinct buyers from deals passed\n");
+}
+
+int main() {
+    printf("Starting sketch tests...\n\n");
+    auth_set_capabilities(CAP_ALL);
+    
+    test_estimates();
+    test_deal_sketches();
+    
+    printf("\n✅ All sketch tests passed!\n");
+    return 0;
+}
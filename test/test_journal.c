@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include "journal.h"
+#include "database.h"
+#include "deals.h"
+#include "auth.h"
+#include "test_fixture.h"
+
+#define JOURNAL_FILE "test_journal.jrnl"
+
+static int count_visitor(const JournalRecord *record, void *ctx) {
+    int *counts = (int *)ctx;
+    counts[record->type]++;
+    return 0;
+}
+
+// Sums a column of a table so aggregates can be compared before and after replay
+static double sum_column(const char *sql) {
+    sqlite3_stmt *stmt;
+    assert(db_prepare(sql, &stmt) == SQLITE_OK);
+    double total = db_step(stmt) == SQLITE_ROW ? sqlite3_column_double(stmt, 0) : 0;
+    db_finalize(stmt);
+    return total;
+}
+
+static void setup_data() {
+    db_init("test_journal.db");
+    assert(journal_open(JOURNAL_FILE, 1, 0) == 0);
+    
+    fixture_add_makler("journaluser", "Journal Makler");
+    fixture_add_good("Journal Good 0", "perfume", "Supplier J", 12.5, 100);
+    fixture_add_good("Journal Good 1", "perfume", "Supplier J", 12.5, 100);
+}
+
+void test_journal_append() {
+    printf("Testing journal append...\n");
+    
+    assert(deals_create_deal(1, 3, "Buyer One", 1) > 0);
+    assert(deals_create_deal(2, 5, "Buyer Two", 1) > 0);
+    assert(deals_create_deal(1, 2, "Buyer One", 1) > 0);
+    
+    int counts[3] = {0};
+    long truncated = -1;
+    assert(journal_read(JOURNAL_FILE, count_visitor, counts, &truncated) == 5);
+    assert(counts[JOURNAL_STOCK_SET] == 2);
+    assert(counts[JOURNAL_DEAL] == 3);
+    assert(truncated == 0);
+    
+    printf("✓ Journal append passed\n");
+}
+
+void test_journal_rollback() {
+    printf("Testing journal rollback...\n");
+    
+    // A rolled back deal never reaches the journal
+    assert(db_begin_transaction() == 0);
+    assert(deals_create_deal(1, 1, "Rolled Back", 1) > 0);
+    assert(db_rollback_transaction() == 0);
+    
+    // Only the outer part of a partially rolled back transaction is kept
+    assert(db_begin_transaction() == 0);
+    assert(deals_create_deal(2, 1, "Kept", 1) > 0);
+    assert(db_begin_transaction() == 0);
+    assert(deals_create_deal(2, 1, "Dropped", 1) > 0);
+    assert(db_rollback_transaction() == 0);
+    assert(db_commit_transaction() == 0);
+    
+    assert(journal_read(JOURNAL_FILE, NULL, NULL, NULL) == 6);
+    printf("✓ Journal rollback passed\n");
+}
+
+void test_journal_replay() {
+    printf("Testing journal replay...\n");
+    
+    const char *by_supplier = "SELECT SUM(s.deal_count) FROM PERFUME_DAILY_SALES s "
+                              "JOIN PERFUME_SUPPLIERS sp ON sp.id = s.supplier_id WHERE sp.name = 'Supplier J';";
+    double deals = sum_column("SELECT SUM(deal_count) FROM PERFUME_DAILY_SALES;");
+    double amount = sum_column("SELECT SUM(total_amount) FROM PERFUME_MAKLERSTATS;");
+    double stock = sum_column("SELECT SUM(quantity) FROM PERFUME_GOODS;");
+    assert(deals == 4);
+    assert(sum_column(by_supplier) == 4);
+    
+    // Lose the derived state and the deal rows, as update-stock deletes
+    // them, then rebuild it from the journal
+    journal_close();
+    sqlite3_stmt *stmt;
+    assert(db_prepare("DELETE FROM PERFUME_DEALS;", &stmt) == SQLITE_OK);
+    assert(db_step(stmt) == SQLITE_DONE);
+    db_finalize(stmt);
+    assert(db_reset_aggregates() == 0);
+    assert(db_set_good_quantity(1, 0) == 0);
+    assert(sum_column("SELECT COUNT(*) FROM PERFUME_DAILY_SALES;") == 0);
+    
+    JournalReplayStats stats;
+    assert(journal_replay(JOURNAL_FILE, &stats) == 0);
+    assert(stats.records == 6);
+    assert(stats.deals == 4);
+    assert(stats.stock_sets == 2);
+    assert(stats.truncated_bytes == 0);
+    
+    assert(sum_column("SELECT SUM(deal_count) FROM PERFUME_DAILY_SALES;") == deals);
+    assert(sum_column(by_supplier) == deals);
+    assert(sum_column("SELECT SUM(total_amount) FROM PERFUME_MAKLERSTATS;") == amount);
+    assert(sum_column("SELECT SUM(quantity) FROM PERFUME_GOODS;") == stock);
+    
+    printf("✓ Journal replay passed\n");
+}
+
+void test_journal_uncovered_deals() {
+    printf("Testing replay of a journal missing deals...\n");
+    
+    // A deal made while the journal is off would lose its statistics
+    double deals = sum_column("SELECT SUM(deal_count) FROM PERFUME_DAILY_SALES;");
+    assert(deals_create_deal(2, 1, "Unjournaled", 1) > 0);
+    
+    JournalReplayStats stats;
+    assert(journal_replay(JOURNAL_FILE, &stats) == -1);
+    assert(sum_column("SELECT SUM(deal_count) FROM PERFUME_DAILY_SALES;") == deals + 1);
+    
+    printf("✓ Replay of a journal missing deals passed\n");
+}
+
+void test_journal_torn_tail() {
+    printf("Testing journal torn tail...\n");
+    
+    // Cut the last record in half as a crash mid-write would
+    FILE *f = fopen(JOURNAL_FILE, "rb");
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    assert(truncate(JOURNAL_FILE, size - 10) == 0);
+    
+    long truncated = 0;
+    assert(journal_read(JOURNAL_FILE, NULL, NULL, &truncated) == 5);
+    assert(truncated > 0);
+    
+    // Reopening drops the torn bytes, so records appended after them can
+    // still be read
+    f = fopen(JOURNAL_FILE, "ab");
+    fputs("xyz", f);
+    fclose(f);
+    assert(journal_open(JOURNAL_FILE, 1, 0) == 0);
+    assert(deals_create_deal(1, 1, "After Crash", 1) > 0);
+    journal_close();
+    truncated = -1;
+    int counts[3] = {0};
+    assert(journal_read(JOURNAL_FILE, count_visitor, counts, &truncated) == 6);
+    assert(truncated == 0);
+    assert(counts[JOURNAL_DEAL] == 4 && counts[JOURNAL_STOCK_SET] == 2);
+    
+    // A file that isn't a journal is refused
+    f = fopen(JOURNAL_FILE, "r+b");
+    fputs("NOTJRNL!", f);
+    fclose(f);
+    assert(journal_read(JOURNAL_FILE, NULL, NULL, NULL) == -1);
+    assert(journal_open(JOURNAL_FILE, 1, 0) == -1);
+    assert(journal_read("missing.jrnl", NULL, NULL, NULL) == -1);
+    
+    printf("✓ Journal torn tail passed\n");
+}
+
+void test_journal_failed_write() {
+    printf("Testing journal failed write...\n");
+    
+    // The database lives in memory so only the journal hits the file size
+    // limit, which makes the next record's write stop part way
+    db_close();
+    remove(JOURNAL_FILE);
+    assert(db_init_memory(NULL, NULL) == 0);
+    assert(journal_open(JOURNAL_FILE, 1, 0) == 0);
+    int makler_id = fixture_add_makler("journaluser", "Journal Makler");
+    int good_id = fixture_add_good("Journal Good 0", "perfume", "Supplier J", 12.5, 100);
+    assert(deals_create_deal(good_id, 1, "Before Limit", makler_id) > 0);
+    
+    FILE *f = fopen(JOURNAL_FILE, "rb");
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    
+    struct rlimit saved, limit;
+    assert(getrlimit(RLIMIT_FSIZE, &saved) == 0);
+    limit = saved;
+    limit.rlim_cur = (rlim_t)size + 20;
+    signal(SIGXFSZ, SIG_IGN);
+    assert(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+    assert(deals_create_deal(good_id, 1, "Cut Off", makler_id) > 0);
+    assert(setrlimit(RLIMIT_FSIZE, &saved) == 0);
+    signal(SIGXFSZ, SIG_DFL);
+    
+    // The partial frame is gone, so the next record can be read
+    assert(deals_create_deal(good_id, 1, "After Limit", makler_id) > 0);
+    journal_close();
+    long truncated = -1;
+    int counts[3] = {0};
+    assert(journal_read(JOURNAL_FILE, count_visitor, counts, &truncated) == 3);
+    assert(counts[JOURNAL_DEAL] == 2 && counts[JOURNAL_STOCK_SET] == 1);
+    assert(truncated == 0);
+    
+    printf("✓ Journal failed write passed\n");
+}
+
+int main() {
+    printf("Starting journal tests...\n\n");
+    auth_set_capabilities(CAP_ALL);
+    
+    remove("test_journal.db");
+    remove(JOURNAL_FILE);
+    setup_data();
+    test_journal_append();
+    test_journal_rollback();
+    test_journal_replay();
+    test_journal_uncovered_deals();
+    test_journal_torn_tail();
+    test_journal_failed_write();
+    
+    db_close();
+    remove("test_journal.db");
+    remove(JOURNAL_FILE);
+    
+    printf("\n✅ All journal tests passed!\n");
+    return 0;
+}
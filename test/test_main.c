@@ -23,6 +23,76 @@ int main() {
     printf("========================================\n");
     failures += system("bin/test_deals");
     
+    printf("\n========================================\n");
+    printf("Running reports tests...\n");
+    printf("========================================\n");
+    failures += system("bin/test_reports");
+    
+    printf("\n========================================\n");
+    printf("Running CLI tests...\n");
+    printf("========================================\n");
+    failures += system("bin/test_cli");
+    
+    printf("\n========================================\n");
+    printf("Running snapshot tests...\n");
+    printf("========================================\n");
+    failures += system("bin/test_snapshot");
+    
+    printf("\n========================================\n");
+    printf("Running journal tests...\n");
+    printf("========================================\n");
+    failures += system("bin/test_journal");
+    
+    printf("\n========================================\n");
+    printf("Running feed tests...\n");
+    printf("========================================\n");
+    failures += system("bin/test_feed");
+    
+    printf("\n========================================\n");
+    printf("Running reservation tests...\n");
+    printf("========================================\n");
+    failures += system("bin/test_reservations");
+    
+    printf("\n========================================\n");
+    printf("Running search tests...\n");
+    printf("========================================\n");
+    failures += system("bin/test_search");
+    
+    printf("\n========================================\n");
+    printf("Running top-K tests...\n");
+    printf("========================================\n");
+    failures += system("bin/test_topk");
+    
+    printf("\n========================================\n");
+    printf("Running sketch tests...\n");
+    printf("========================================\n");
+    failures += system("bin/test_hll");
+    
+    printf("\n========================================\n");
+    printf("Running statistics store tests...\n");
+    printf("========================================\n");
+    failures += system("bin/test_statstore");
+    
+    printf("\n========================================\n");
+    printf("Running rate limit tests...\n");
+    printf("========================================\n");
+    failures += system("bin/test_ratelimit");
+    
+    printf("\n========================================\n");
+    printf("Running fuzz tests...\n");
+    printf("========================================\n");
+    failures += system("bin/test_fuzz");
+    
+    printf("\n========================================\n");
+    printf("Running scheduler tests...\n");
+    printf("========================================\n");
+    failures += system("bin/test_scheduler");
+    
+    printf("\n========================================\n");
+    printf("Running report cache tests...\n");
+    printf("========================================\n");
+    failures += system("bin/test_report_cache");
+    
     printf("\n==========================================\n");
     if (failures == 0) {
         printf("✅ ALL TESTS PASSED SUCCESSFULLY!\n");
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include "ratelimit.h"
+
+#define SECOND 1000000000ULL
+
+void test_burst_and_refill() {
+    printf("Testing burst and refill...\n");
+    
+    RateLimiter *limiter = ratelimit_create(64, 3, 0.5);
+    assert(limiter != NULL);
+    
+    uint64_t now = 100 * SECOND;
+    for (int i = 0; i < 3; i++) assert(ratelimit_take(limiter, "alice", now) == 1);
+    assert(ratelimit_take(limiter, "alice", now) == 0);
+    
+    // Keys don't share buckets
+    assert(ratelimit_take(limiter, "bob", now) == 1);
+    
+    // Half a token per second: one more after two seconds, not before
+    assert(ratelimit_take(limiter, "alice", now + SECOND) == 0);
+    assert(ratelimit_take(limiter, "alice", now + 2 * SECOND) == 1);
+    assert(ratelimit_take(limiter, "alice", now + 2 * SECOND) == 0);
+    
+    // Refill stops at the burst size
+    now += 1000 * SECOND;
+    for (int i = 0; i < 3; i++) assert(ratelimit_take(limiter, "alice", now) == 1);
+    assert(ratelimit_take(limiter, "alice", now) == 0);
+    
+    ratelimit_reset(limiter);
+    assert(ratelimit_take(limiter, "alice", now) == 1);
+    
+    ratelimit_free(limiter);
+    assert(ratelimit_create(64, 0, 1.0) == NULL);
+    
+    printf("✓ Burst and refill passed\n");
+}
+
+void test_bounded_table() {
+    printf("Testing bounded table...\n");
+    
+    // Eight slots: every key's probe window is the whole table
+    RateLimiter *limiter = ratelimit_create(8, 2, 1.0);
+    char key[32];
+    for (int i = 0; i < 7; i++) {
+        snprintf(key, sizeof(key), "key-%d", i);
+        assert(ratelimit_take(limiter, key, 0) == 1);
+    }
+    assert(ratelimit_take(limiter, "target", SECOND) == 1);
+    assert(ratelimit_take(limiter, "target", SECOND) == 1);
+    
+    // The table is full; new keys replace the buckets that refilled
+    // rather than the exhausted one
+    for (int i = 0; i < 7; i++) {
+        snprintf(key, sizeof(key), "new-%d", i);
+        assert(ratelimit_take(limiter, key, SECOND) == 1);
+    }
+    assert(ratelimit_take(limiter, "target", SECOND) == 0);
+    ratelimit_free(limiter);
+    
+    // With nothing refilled a new key is refused rather than evicting one
+    limiter = ratelimit_create(8, 2, 0.001);
+    for (int i = 0; i < 8; i++) {
+        snprintf(key, sizeof(key), "key-%d", i);
+        assert(ratelimit_take(limiter, key, (uint64_t)i * SECOND) == 1);
+    }
+    assert(ratelimit_take(limiter, "newcomer", 10 * SECOND) == 0);
+    assert(ratelimit_take(limiter, "key-0", 10 * SECOND) == 1);  // kept: one token left
+    assert(ratelimit_take(limiter, "key-0", 10 * SECOND) == 0);
+    ratelimit_free(limiter);
+    
+    // A drained key can't get a fresh burst by filling its window with others
+    limiter = ratelimit_create(8, 5, 0.1);
+    for (int i = 0; i < 5; i++) {
+        assert(ratelimit_take(limiter, "alice", 0) == 1);
+    }
+    assert(ratelimit_take(limiter, "alice", 0) == 0);
+    for (int i = 0; i < 8; i++) {
+        snprintf(key, sizeof(key), "other-%d", i);
+        ratelimit_take(limiter, key, SECOND);
+    }
+    assert(ratelimit_take(limiter, "alice", SECOND) == 0);
+    ratelimit_free(limiter);
+    
+    printf("✓ Bounded table passed\n");
+}
+
+int main() {
+    printf("Starting rate limit tests...\n\n");
+    
+    test_burst_and_refill();
+    test_bounded_table();
+    
+    printf("\n✅ All rate limit tests passed!\n");
+    return 0;
+}
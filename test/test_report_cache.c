@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include "report_cache.h"
+#include "database.h"
+#include "deals.h"
+#include "reports.h"
+#include "auth.h"
+#include "test_fixture.h"
+
+#define TEST_DB "test_report_cache.db"
+
+static int good_id = 0;
+static int makler_id = 0;
+
+static void setup() {
+    remove(TEST_DB);
+    assert(db_init(TEST_DB) == 0);
+    
+    makler_id = fixture_add_makler("cachemakler", "Cache Makler");
+    good_id = fixture_add_good("Cached Scent", "perfume", "Cache Supplier", 10.0, 1000);
+    assert(deals_create_deal(good_id, 2, "First Buyer", makler_id) > 0);
+}
+
+// Runs a report into a fresh CSV writer and returns what it wrote
+static char* run_csv(const char *name, const ReportParams *params) {
+    char *buffer = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buffer, &length);
+    ReportWriter *rw = report_writer_create(out, REPORT_FORMAT_CSV);
+    reports_set_output(rw);
+    assert(reports_run(name, params) == 0);
+    reports_set_output(NULL);
+    report_writer_free(rw);
+    fclose(out);
+    return buffer;
+}
+
+static ReportCacheStats stats_now() {
+    ReportCacheStats stats;
+    report_cache_stats(&stats);
+    return stats;
+}
+
+void test_lru_and_accounting() {
+    printf("Testing LRU and memory accounting...\n");
+    ReportCacheVersion v1 = { NULL, 1, 0 }, v2 = { NULL, 2, 0 };
+    size_t length;
+    int sections;
+    
+    report_cache_set_limits(2, REPORT_CACHE_MAX_BYTES);
+    assert(report_cache_put("a", &v1, "alpha", 5, 1) == 0);
+    assert(report_cache_put("b", &v1, "beta", 4, 1) == 0);
+    
+    // Reading "a" makes "b" the least recently used
+    const char *output = report_cache_get("a", &v1, &length, &sections);
+    assert(output && length == 5 && sections == 1 && memcmp(output, "alpha", 5) == 0);
+    assert(report_cache_put("c", &v1, "gamma", 5, 2) == 0);
+    assert(report_cache_get("b", &v1, &length, &sections) == NULL);
+    assert(report_cache_get("a", &v1, &length, &sections) != NULL);
+    assert(report_cache_get("c", &v1, &length, &sections) != NULL);
+    ReportCacheStats stats = stats_now();
+    assert(stats.entries == 2 && stats.evictions == 1);
+    
+    // Another version drops the entry
+    assert(report_cache_get("a", &v2, &length, &sections) == NULL);
+    assert(report_cache_get("a", &v1, &length, &sections) == NULL);
+    assert(stats_now().entries == 1);
+    
+    // Replacing a key keeps one entry, with the new output
+    assert(report_cache_put("c", &v2, "delta", 5, 1) == 0);
+    output = report_cache_get("c", &v2, &length, &sections);
+    assert(output && memcmp(output, "delta", 5) == 0 && stats_now().entries == 1);
+    
+    // Bytes are charged for the entry and its key as well as the output
+    size_t one = stats_now().bytes;
+    assert(one > 5 + 2);
+    report_cache_set_limits(16, one * 2);
+    assert(report_cache_put("d", &v1, "delta", 5, 1) == 0);
+    assert(stats_now().bytes == one * 2);
+    assert(report_cache_put("e", &v1, "delta", 5, 1) == 0);
+    assert(stats_now().entries == 2 && stats_now().bytes <= one * 2);
+    
+    // Too big to keep at all, and nothing kept when turned off
+    char big[256] = {0};
+    assert(report_cache_put("big", &v1, big, sizeof(big), 1) == -1);
+    report_cache_set_limits(0, REPORT_CACHE_MAX_BYTES);
+    assert(stats_now().entries == 0 && stats_now().bytes == 0);
+    assert(report_cache_put("f", &v1, "x", 1, 1) == -1);
+    
+    report_cache_set_limits(REPORT_CACHE_MAX_ENTRIES, REPORT_CACHE_MAX_BYTES);
+    report_cache_clear();
+    printf("✓ LRU and memory accounting passed\n");
+}
+
+void test_repeated_reports() {
+    printf("Testing repeated reports...\n");
+    ReportParams range = { .start_date = "2000-01-01", .end_date = "2100-01-01" };
+    
+    char *first = run_csv("sales-by-good", &range);
+    ReportCacheStats before = stats_now();
+    char *second = run_csv("sales-by-good", &range);
+    ReportCacheStats after = stats_now();
+    assert(after.hits == before.hits + 1);
+    assert(strcmp(first, second) == 0);
+    free(second);
+    
+    // Different parameters are a different entry
+    ReportParams narrow = { .start_date = "2000-01-01", .end_date = "2000-12-31" };
+    char *empty = run_csv("sales-by-good", &narrow);
+    assert(stats_now().hits == after.hits);
+    assert(strcmp(empty, first) != 0);
+    free(empty);
+    
+    // A deal commit moves the version
+    assert(deals_create_deal(good_id, 3, "Second Buyer", makler_id) > 0);
+    before = stats_now();
+    char *third = run_csv("sales-by-good", &range);
+    assert(stats_now().hits == before.hits && stats_now().misses == before.misses + 1);
+    assert(strcmp(first, third) != 0);
+    free(first);
+    free(third);
+    printf("✓ Repeated reports passed\n");
+}
+
+void test_other_connection() {
+    printf("Testing commits from another connection...\n");
+    ReportParams params = {0};
+    char *first = run_csv("goods", &params);
+    
+    sqlite3 *other;
+    assert(sqlite3_open(TEST_DB, &other) == SQLITE_OK);
+    assert(sqlite3_exec(other, "UPDATE PERFUME_GOODS SET quantity = quantity + 7;", NULL, NULL, NULL) == SQLITE_OK);
+    sqlite3_close(other);
+    
+    ReportCacheStats before = stats_now();
+    char *second = run_csv("goods", &params);
+    assert(stats_now().hits == before.hits);
+    assert(strcmp(first, second) != 0);
+    
+    char *third = run_csv("goods", &params);
+    assert(stats_now().hits == before.hits + 1);
+    assert(strcmp(second, third) == 0);
+    free(first);
+    free(second);
+    free(third);
+    printf("✓ Commits from another connection passed\n");
+}
+
+void test_transactions() {
+    printf("Testing reports inside transactions...\n");
+    ReportParams params = {0};
+    char *committed = run_csv("popular-good-type", &params);
+    
+    // What a report sees inside a transaction may be rolled back, so it
+    // is neither cached nor answered from the cache
+    assert(db_begin_transaction() == 0);
+    assert(deals_create_deal(good_id, 5, "Rolled Back", makler_id) > 0);
+    ReportCacheStats before = stats_now();
+    char *inside = run_csv("popular-good-type", &params);
+    ReportCacheStats after = stats_now();
+    assert(after.hits == before.hits && after.misses == before.misses);
+    assert(strcmp(inside, committed) != 0);
+    assert(db_rollback_transaction() == 0);
+    
+    char *again = run_csv("popular-good-type", &params);
+    assert(strcmp(again, committed) == 0);
+    free(committed);
+    free(inside);
+    free(again);
+    printf("✓ Reports inside transactions passed\n");
+}
+
+void test_shared_writer() {
+    printf("Testing reports sharing a writer...\n");
+    ReportParams params = {0};
+    const char *names[] = { "popular-good-type", "max-deals-makler" };
+    char *outputs[2];
+    
+    // The second section of a CSV starts with a blank line, so the same
+    // report is cached apart when it follows another
+    for (int run = 0; run < 2; run++) {
+        size_t length = 0;
+        FILE *out = open_memstream(&outputs[run], &length);
+        ReportWriter *rw = report_writer_create(out, REPORT_FORMAT_CSV);
+        reports_set_output(rw);
+        for (int i = 0; i < 2; i++) {
+            assert(reports_run(names[i], &params) == 0);
+        }
+        reports_set_output(NULL);
+        report_writer_free(rw);
+        fclose(out);
+    }
+    assert(strcmp(outputs[0], outputs[1]) == 0);
+    assert(strstr(outputs[0], "\n\n") != NULL);
+    free(outputs[0]);
+    free(outputs[1]);
+    
+    // Reports answered from memory skip the cache
+    ReportCacheStats before = stats_now();
+    params.makler_id = makler_id;
+    free(run_csv("makler-stats", &params));
+    assert(stats_now().misses == before.misses);
+    printf("✓ Reports sharing a writer passed\n");
+}
+
+int main() {
+    printf("Starting report cache tests...\n\n");
+    auth_set_capabilities(CAP_ALL);
+    
+    test_lru_and_accounting();
+    setup();
+    test_repeated_reports();
+    test_other_connection();
+    test_transactions();
+    test_shared_writer();
+    
+    db_close();
+    assert(stats_now().entries == 0);
+    remove(TEST_DB);
+    
+    printf("\n✅ All report cache tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include "reports.h"
+#include "report_writer.h"
+#include "database.h"
+#include "deals.h"
+#include "auth.h"
+
+static const ReportColumn test_columns[] = {
+    { "Name", "name", REPORT_COL_TEXT, 10 },
+    { "Count", "count", REPORT_COL_INT, 6 },
+    { "Amount", "amount", REPORT_COL_REAL, 8 },
+};
+
+// Writes one section with a plain and an awkward row, returns the output
+static char* write_sample(ReportFormat format) {
+    char *buffer = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buffer, &length);
+    
+    ReportWriter *rw = report_writer_create(out, format);
+    report_writer_begin(rw, "sample", "Sample", test_columns, REPORT_COLUMN_COUNT(test_columns));
+    report_writer_text(rw, "Plain");
+    report_writer_int(rw, 3);
+    report_writer_real(rw, 1.5);
+    report_writer_end_row(rw);
+    report_writer_text(rw, "Shop \"Lux\", Ltd");
+    report_writer_int(rw, 1);
+    report_writer_real(rw, 2.0);
+    report_writer_end_row(rw);
+    report_writer_end(rw);
+    report_writer_free(rw);
+    
+    fclose(out);
+    return buffer;
+}
+
+void test_table_format() {
+    printf("Testing table format...\n");
+    
+    char *output = write_sample(REPORT_FORMAT_TABLE);
+    assert(strstr(output, "\nSample:\n") != NULL);
+    assert(strstr(output, "Name       Count  Amount  \n") != NULL);
+    assert(strstr(output, "Plain      3      1.50    \n") != NULL);
+    free(output);
+    
+    printf("✓ Table format passed\n");
+}
+
+void test_csv_format() {
+    printf("Testing CSV format...\n");
+    
+    char *output = write_sample(REPORT_FORMAT_CSV);
+    assert(strcmp(output,
+                  "name,count,amount\n"
+                  "Plain,3,1.50\n"
+                  "\"Shop \"\"Lux\"\", Ltd\",1,2.00\n") == 0);
+    free(output);
+    
+    printf("✓ CSV format passed\n");
+}
+
+void test_jsonl_format() {
+    printf("Testing JSON Lines format...\n");
+    
+    char *output = write_sample(REPORT_FORMAT_JSONL);
+    assert(strcmp(output,
+                  "{\"section\":\"sample\",\"name\":\"Plain\",\"count\":3,\"amount\":1.50}\n"
+                  "{\"section\":\"sample\",\"name\":\"Shop \\\"Lux\\\", Ltd\",\"count\":1,\"amount\":2.00}\n") == 0);
+    free(output);
+    
+    printf("✓ JSON Lines format passed\n");
+}
+
+void test_recording() {
+    printf("Testing recording and replay...\n");
+    
+    char *buffer = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buffer, &length);
+    ReportWriter *rw = report_writer_create(out, REPORT_FORMAT_CSV);
+    report_writer_begin(rw, "before", NULL, test_columns, REPORT_COLUMN_COUNT(test_columns));
+    report_writer_text(rw, "Unrecorded");
+    report_writer_end(rw);
+    size_t prefix = strlen("name,count,amount\nUnrecorded,,\n");
+    
+    // Past several buffer drains, and one field bigger than the buffer
+    assert(report_writer_record(rw, 1 << 20) == 0);
+    report_writer_begin(rw, "sample", "Sample", test_columns, REPORT_COLUMN_COUNT(test_columns));
+    for (int i = 0; i < 5000; i++) {
+        report_writer_text(rw, "Recorded row");
+        report_writer_int(rw, i);
+        report_writer_end_row(rw);
+    }
+    char *big = malloc(REPORT_WRITER_BUFFER_SIZE + 100);
+    memset(big, 'x', REPORT_WRITER_BUFFER_SIZE + 100);
+    report_writer_text_n(rw, big, REPORT_WRITER_BUFFER_SIZE + 100);
+    report_writer_end(rw);
+    
+    size_t recorded_length;
+    int sections;
+    char *recorded = report_writer_stop_recording(rw, &recorded_length, &sections);
+    report_writer_free(rw);
+    fclose(out);
+    assert(recorded && sections == 1);
+    assert(length == prefix + recorded_length);
+    assert(memcmp(buffer + prefix, recorded, recorded_length) == 0);
+    
+    // Replaying into a writer that is also past one section gives the same bytes
+    char *replayed = NULL;
+    size_t replayed_length = 0;
+    out = open_memstream(&replayed, &replayed_length);
+    rw = report_writer_create(out, REPORT_FORMAT_CSV);
+    report_writer_begin(rw, "before", NULL, test_columns, REPORT_COLUMN_COUNT(test_columns));
+    report_writer_text(rw, "Unrecorded");
+    report_writer_end(rw);
+    report_writer_replay(rw, recorded, recorded_length, sections);
+    assert(report_writer_sections(rw) == 2);
+    report_writer_free(rw);
+    fclose(out);
+    assert(replayed_length == length && memcmp(replayed, buffer, length) == 0);
+    free(replayed);
+    free(recorded);
+    free(buffer);
+    
+    // Output past the limit stops the recording, not the output
+    buffer = NULL;
+    out = open_memstream(&buffer, &length);
+    rw = report_writer_create(out, REPORT_FORMAT_CSV);
+    assert(report_writer_record(rw, 100) == 0);
+    report_writer_begin(rw, "sample", NULL, test_columns, REPORT_COLUMN_COUNT(test_columns));
+    report_writer_text_n(rw, big, 200);
+    report_writer_end(rw);
+    assert(report_writer_stop_recording(rw, &recorded_length, &sections) == NULL);
+    report_writer_free(rw);
+    fclose(out);
+    assert(length > 200);
+    free(buffer);
+    free(big);
+    
+    printf("✓ Recording and replay passed\n");
+}
+
+void test_run_report_by_name() {
+    printf("Testing reports by name...\n");
+    
+    db_init("test_reports.db");
+    
+    User user = {0};
+    strcpy(user.username, "reportsuser");
+    strcpy(user.password_hash, "hash");
+    user.role = ROLE_MAKLER;
+    Makler makler = {0};
+    strcpy(makler.name, "Report Makler");
+    makler.user_id = db_create_user(&user);
+    int makler_id = db_create_makler(&makler);
+    
+    Good good = {0};
+    strcpy(good.name, "Report Good");
+    strcpy(good.type, "type");
+    strcpy(good.supplier, "Report Supplier");
+    good.unit_price = 10.0;
+    good.quantity = 100;
+    int good_id = db_create_good(&good);
+    
+    deals_create_deal(good_id, 4, "Buyer A", makler_id);
+    deals_create_deal(good_id, 6, "Buyer B", makler_id);
+    
+    // A good without a supplier is still counted, under "(none)"
+    Good loose = {0};
+    strcpy(loose.name, "Loose Good");
+    strcpy(loose.type, "type");
+    loose.unit_price = 5.0;
+    loose.quantity = 100;
+    deals_create_deal(db_create_good(&loose), 3, "Buyer C", makler_id);
+    
+    char *buffer = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buffer, &length);
+    ReportWriter *rw = report_writer_create(out, REPORT_FORMAT_CSV);
+    reports_set_output(rw);
+    
+    ReportParams params = {0};
+    assert(reports_run("sales-by-supplier", &params) == 0);
+    assert(reports_run("no-such-report", &params) == -1);
+    assert(reports_run("buyers-by-good", &params) == -1);  // --good is required
+    
+    reports_set_output(NULL);
+    report_writer_free(rw);
+    fclose(out);
+    
+    assert(strstr(buffer, "Report Supplier,2,10,100.00,Report Makler\n(none),1,3,15.00,Report Makler\n") != NULL);
+    free(buffer);
+    
+    db_close();
+    remove("test_reports.db");
+    
+    printf("✓ Reports by name passed\n");
+}
+
+static char* run_report_csv(const char *name, const ReportParams *params) {
+    char *buffer = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buffer, &length);
+    ReportWriter *rw = report_writer_create(out, REPORT_FORMAT_CSV);
+    reports_set_output(rw);
+    
+    assert(reports_run(name, params) == 0);
+    
+    reports_set_output(NULL);
+    report_writer_free(rw);
+    fclose(out);
+    return buffer;
+}
+
+void test_sales_series() {
+    printf("Testing sales series...\n");
+    
+    remove("test_reports.db");
+    db_init("test_reports.db");
+    
+    Good good = {0};
+    strcpy(good.name, "Series Good");
+    strcpy(good.type, "perfume");
+    strcpy(good.supplier, "Series Supplier");
+    good.unit_price = 10.0;
+    good.quantity = 100;
+    int good_id = db_create_good(&good);
+    
+    // Rollup rows written directly: January and March, nothing in February
+    char sql[512];
+    snprintf(sql, sizeof(sql),
+             "INSERT INTO PERFUME_DAILY_SALES (day, good_id, makler_id, supplier_id, type_id, deal_count, total_quantity, total_amount) "
+             "SELECT v.column1, g.id, v.column2, g.supplier_id, g.type_id, v.column3, v.column4, v.column5 "
+             "FROM (VALUES ('2024-01-03', 1, 1, 4, 40), ('2024-01-20', 1, 1, 6, 60), "
+             "('2024-03-04', 1, 2, 9, 90), ('2024-03-10', 2, 1, 3, 30)) v, PERFUME_GOODS g WHERE g.id = %d;",
+             good_id);
+    assert(sqlite3_exec(db_get_connection(), sql, NULL, NULL, NULL) == SQLITE_OK);
+    
+    ReportParams params = {0};
+    params.by = "type";
+    params.window = 2;
+    char *monthly = run_report_csv("sales-series", &params);
+    assert(strcmp(monthly,
+                  "period,name,deal_count,total_quantity,total_amount,moving_avg,change\n"
+                  "2024-01-01,perfume,2,10,100.00,10.00,\n"
+                  "2024-02-01,perfume,0,0,0.00,5.00,-10.00\n"
+                  "2024-03-01,perfume,3,12,120.00,6.00,12.00\n") == 0);
+    free(monthly);
+    
+    // Weeks start on Monday; the window bounds the rollup days read
+    params.bucket = "week";
+    params.metric = "amount";
+    params.start_date = "2024-03-01";
+    char *weekly = run_report_csv("sales-series", &params);
+    assert(strstr(weekly, "\n2024-03-04,perfume,3,12,120.00,120.00,\n") != NULL);
+    assert(strstr(weekly, "2024-01") == NULL);
+    free(weekly);
+    
+    params.bucket = "year";
+    assert(reports_run("sales-series", &params) == -1);
+    params.bucket = NULL;
+    params.by = "buyer";  // buyers aren't rolled up
+    assert(reports_run("sales-series", &params) == -1);
+    
+    db_close();
+    remove("test_reports.db");
+    
+    printf("✓ Sales series passed\n");
+}
+
+static int count_deals() {
+    sqlite3_stmt *stmt;
+    assert(sqlite3_prepare_v2(db_get_connection(), "SELECT COUNT(*) FROM PERFUME_DEALS", -1, &stmt, NULL) == SQLITE_OK);
+    assert(sqlite3_step(stmt) == SQLITE_ROW);
+    int count = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    return count;
+}
+
+void test_read_session() {
+    printf("Testing read sessions...\n");
+    
+    remove("test_reports.db");
+    db_init("test_reports.db");
+    
+    User user = {0};
+    strcpy(user.username, "sessionuser");
+    strcpy(user.password_hash, "hash");
+    user.role = ROLE_MAKLER;
+    Makler makler = {0};
+    strcpy(makler.name, "Session Makler");
+    makler.user_id = db_create_user(&user);
+    int makler_id = db_create_makler(&makler);
+    
+    Good good = {0};
+    strcpy(good.name, "Session Good");
+    strcpy(good.type, "perfume");
+    strcpy(good.supplier, "Session Supplier");
+    good.unit_price = 5.0;
+    good.quantity = 100;
+    int good_id = db_create_good(&good);
+    assert(deals_create_deal(good_id, 1, "Buyer A", makler_id) > 0);
+    
+    // Another connection commits while the session is open: no waiting,
+    // and the session keeps seeing the state it started with
+    sqlite3 *other;
+    assert(sqlite3_open("test_reports.db", &other) == SQLITE_OK);
+    char sql[256];
+    snprintf(sql, sizeof(sql),
+             "INSERT INTO PERFUME_DEALS (deal_date, good_name, good_type, quantity, total_amount, makler_id, good_id, buyer) "
+             "VALUES ('2024-01-01', 'Session Good', 'perfume', 2, 10, %d, %d, 'Buyer B');", makler_id, good_id);
+    
+    assert(db_begin_read() == 0);
+    assert(count_deals() == 1);
+    assert(sqlite3_exec(other, sql, NULL, NULL, NULL) == SQLITE_OK);
+    assert(count_deals() == 1);
+    assert(db_end_read() == 0);
+    assert(count_deals() == 2);
+    assert(db_transaction_depth() == 0);
+    
+    // Inside a transaction the session also sees its uncommitted writes
+    assert(db_begin_transaction() == 0);
+    assert(deals_create_deal(good_id, 1, "Buyer C", makler_id) > 0);
+    assert(db_begin_read() == 0);
+    assert(count_deals() == 3);
+    assert(db_end_read() == 0);
+    assert(db_rollback_transaction() == 0);
+    assert(count_deals() == 2);
+    
+    ReportParams params = {0};
+    char *output = run_report_csv("popular-good-type", &params);
+    assert(strstr(output, "good_type,total_quantity,total_amount\nperfume,3,15.00\n") != NULL);
+    assert(strstr(output, "\nBuyer B,1,2,10.00\n") != NULL);
+    free(output);
+    assert(db_transaction_depth() == 0);
+    
+    sqlite3_close(other);
+    db_close();
+    remove("test_reports.db");
+    
+    printf("✓ Read sessions passed\n");
+}
+
+int main() {
+    printf("Starting reports tests...\n\n");
+    auth_set_capabilities(CAP_ALL);
+    
+    test_table_format();
+    test_csv_format();
+    test_jsonl_format();
+    test_recording();
+    test_run_report_by_name();
+    test_sales_series();
+    test_read_session();
+    
+    printf("\n✅ All reports tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include "reservations.h"
+#include "database.h"
+#include "deals.h"
+#include "auth.h"
+#include "test_fixture.h"
+
+static uint64_t fake_now_ms = 1000000;
+
+static uint64_t fake_clock() {
+    return fake_now_ms;
+}
+
+static int good_quantity(int good_id) {
+    Good *good = db_get_good_by_id(good_id);
+    assert(good != NULL);
+    int quantity = good->quantity;
+    db_free_good(good);
+    return quantity;
+}
+
+static void setup_data() {
+    db_init("test_reservations.db");
+    reservations_set_clock(fake_clock);
+    
+    fixture_add_makler("holduser", "Hold Makler");
+    fixture_add_good("Hold Good 0", "perfume", "Supplier H", 10.0, 10);
+    fixture_add_good("Hold Good 1", "perfume", "Supplier H", 10.0, 5000);
+}
+
+void test_hold_and_confirm() {
+    printf("Testing hold and confirm...\n");
+    
+    int hold = reservations_hold(1, 6, 1, 60);
+    assert(hold > 0);
+    assert(reservations_reserved(1) == 6);
+    
+    // Held stock is off limits to other holds and deals
+    assert(reservations_hold(1, 5, 1, 60) == -1);
+    assert(deals_create_deal(1, 5, "Walk-in", 1) == -1);
+    assert(!deals_validate_availability(1, 5));
+    assert(deals_create_deal(1, 4, "Walk-in", 1) > 0);
+    
+    // Confirming turns the held quantity into a deal
+    assert(reservations_confirm(hold, "Shop A") > 0);
+    assert(reservations_reserved(1) == 0);
+    assert(good_quantity(1) == 0);
+    assert(reservations_confirm(hold, "Shop A") == -1);
+    assert(reservations_active_count() == 0);
+    
+    printf("✓ Hold and confirm passed\n");
+}
+
+void test_release() {
+    printf("Testing release...\n");
+    
+    int hold = reservations_hold(2, 100, 1, 60);
+    assert(hold > 0);
+    assert(reservations_release(hold) == 0);
+    assert(reservations_release(hold) == -1);
+    assert(reservations_reserved(2) == 0);
+    assert(good_quantity(2) == 5000);
+    
+    printf("✓ Release passed\n");
+}
+
+void test_expiry() {
+    printf("Testing expiry...\n");
+    
+    int short_hold = reservations_hold(2, 10, 1, 5);
+    int long_hold = reservations_hold(2, 20, 1, 600);  // longer than one wheel revolution
+    assert(short_hold > 0 && long_hold > 0);
+    
+    fake_now_ms += 4900;
+    assert(reservations_reserved(2) == 30);
+    fake_now_ms += 100;
+    assert(reservations_reserved(2) == 20);
+    assert(reservations_confirm(short_hold, "Late Shop") == -1);
+    
+    // Revolutions pass without releasing the long hold early
+    fake_now_ms += 500 * 1000;
+    assert(reservations_reserved(2) == 20);
+    fake_now_ms += 100 * 1000;
+    assert(reservations_reserved(2) == 0);
+    assert(reservations_active_count() == 0);
+    
+    printf("✓ Expiry passed\n");
+}
+
+void test_many_holds() {
+    printf("Testing many holds...\n");
+    
+    int ids[2000];
+    for (int i = 0; i < 2000; i++) {
+        ids[i] = reservations_hold(2, 1, 1, 1 + i % 50);
+        assert(ids[i] > 0);
+    }
+    assert(reservations_reserved(2) == 2000);
+    
+    for (int i = 0; i < 2000; i += 2) {
+        assert(reservations_release(ids[i]) == 0);
+    }
+    assert(reservations_active_count() == 1000);
+    
+    fake_now_ms += 50 * 1000;
+    assert(reservations_expire() == 1000);
+    assert(reservations_active_count() == 0);
+    
+    reservations_reset();
+    printf("✓ Many holds passed\n");
+}
+
+int main() {
+    printf("Starting reservation tests...\n\n");
+    auth_set_capabilities(CAP_ALL);
+    
+    remove("test_reservations.db");
+    setup_data();
+    test_hold_and_confirm();
+    test_release();
+    test_expiry();
+    test_many_holds();
+    
+    db_close();
+    remove("test_reservations.db");
+    
+    printf("\n✅ All reservation tests passed!\n");
+    return 0;
+}
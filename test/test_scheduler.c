@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "scheduler.h"
+#include "database.h"
+#include "deals.h"
+#include "metrics.h"
+#include "auth.h"
+#include "test_fixture.h"
+
+#define TEST_DB "test_scheduler.db"
+
+// Rows enough to take many slices
+#define LONG_ROWS 1000000
+
+static int good_id = 0;
+static int makler_id = 0;
+
+static void setup() {
+    remove(TEST_DB);
+    assert(db_init(TEST_DB) == 0);
+    
+    makler_id = fixture_add_makler("schedmakler", "Scheduler Makler");
+    good_id = fixture_add_good("Scheduled Scent", "perfume", "Slice Supplier", 10.0, 1000);
+    assert(deals_create_deal(good_id, 2, "First Buyer", makler_id) > 0);
+}
+
+static char* run_csv(const char *name, const ReportParams *params, int scheduled) {
+    char *buffer = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buffer, &length);
+    ReportWriter *rw = report_writer_create(out, REPORT_FORMAT_CSV);
+    
+    if (scheduled) {
+        int task = scheduler_submit_report(name, params, rw, 0);
+        assert(task > 0);
+        assert(scheduler_run_all() == 0);
+        assert(scheduler_state(task) == TASK_DONE);
+    } else {
+        reports_set_output(rw);
+        assert(reports_run(name, params) == 0);
+        reports_set_output(NULL);
+    }
+    
+    report_writer_free(rw);
+    fclose(out);
+    return buffer;
+}
+
+// Steps through LONG_ROWS rows one at a time, counting them
+static int count_rows(void *arg) {
+    long long *rows = arg;
+    sqlite3_stmt *stmt;
+    if (db_prepare("WITH RECURSIVE n(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM n WHERE x < ?) "
+                   "SELECT x FROM n;", &stmt) != SQLITE_OK) {
+        return -1;
+    }
+    sqlite3_bind_int(stmt, 1, LONG_ROWS);
+    int rc;
+    while ((rc = db_step(stmt)) == SQLITE_ROW) {
+        (*rows)++;
+    }
+    db_finalize(stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+// All the work happens before the first row, so it can't yield
+static int aggregate_rows(void *arg) {
+    (void)arg;
+    sqlite3_stmt *stmt;
+    if (db_prepare("WITH RECURSIVE n(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM n WHERE x < 100000000) "
+                   "SELECT SUM(x) FROM n;", &stmt) != SQLITE_OK) {
+        return -1;
+    }
+    int rc = db_step(stmt);
+    db_finalize(stmt);
+    return rc == SQLITE_ROW ? 0 : -1;
+}
+
+// Counts the deals twice in one read session, yielding in between
+static int count_deals_twice(void *arg) {
+    int *counts = arg;
+    if (db_begin_read() != 0) return -1;
+    
+    for (int i = 0; i < 2; i++) {
+        sqlite3_stmt *stmt;
+        db_prepare("SELECT COUNT(*) FROM PERFUME_DEALS;", &stmt);
+        db_step(stmt);
+        counts[i] = sqlite3_column_int(stmt, 0);
+        db_finalize(stmt);
+        
+        if (i == 0) {
+            long long rows = 0;
+            count_rows(&rows);
+        }
+    }
+    return db_end_read();
+}
+
+void test_report_output() {
+    printf("Testing scheduled report output...\n");
+    ReportParams params = {0};
+    const char *names[] = { "popular-good-type", "sales-by-supplier", "goods" };
+    for (int i = 0; i < 3; i++) {
+        char *direct = run_csv(names[i], &params, 0);
+        char *scheduled = run_csv(names[i], &params, 1);
+        assert(strcmp(direct, scheduled) == 0);
+        free(direct);
+        free(scheduled);
+    }
+    
+    // Parameters are checked before anything is queued
+    assert(scheduler_submit_report("sales-by-good", &params, NULL, 0) == -1);
+    assert(scheduler_submit_report("no-such-report", &params, NULL, 0) == -1);
+    printf("✓ Scheduled report output passed\n");
+}
+
+void test_slices() {
+    printf("Testing slices...\n");
+    long long rows = 0;
+    int task = scheduler_submit(count_rows, &rows, NULL, 0);
+    assert(task > 0);
+    assert(scheduler_state(task) == TASK_READY);
+    
+    // Deals go through between slices, each waiting at most one slice
+    int slices = 0, deals = 0;
+    uint64_t worst_deal_ns = 0;
+    while (scheduler_run_slice() > 0) {
+        slices++;
+        assert(rows > 0 && rows < LONG_ROWS);
+        if (deals < 5) {
+            uint64_t start = metrics_now_ns();
+            assert(deals_create_deal(good_id, 1, "Between Slices", makler_id) > 0);
+            uint64_t elapsed = metrics_now_ns() - start;
+            if (elapsed > worst_deal_ns) worst_deal_ns = elapsed;
+            deals++;
+        }
+    }
+    assert(scheduler_state(task) == TASK_DONE);
+    assert(rows == LONG_ROWS);
+    assert(slices > 5 && deals == 5);
+    assert(worst_deal_ns < 100000000ULL);
+    printf("✓ Slices passed (%d slices)\n", slices);
+}
+
+void test_deadline() {
+    printf("Testing deadlines...\n");
+    uint64_t start = metrics_now_ns();
+    int task = scheduler_submit(aggregate_rows, NULL, NULL, 50);
+    assert(task > 0);
+    assert(scheduler_run_all() == 0);
+    uint64_t elapsed = metrics_now_ns() - start;
+    assert(scheduler_state(task) == TASK_TIMED_OUT);
+    // The statement was stopped inside its single step
+    assert(elapsed < 1000000000ULL);
+    
+    // A task whose deadline passes before its first turn never runs
+    long long rows = 0;
+    task = scheduler_submit(count_rows, &rows, NULL, 1);
+    struct timespec pause = { 0, 5000000 };
+    nanosleep(&pause, NULL);
+    assert(scheduler_run_all() == 0);
+    assert(scheduler_state(task) == TASK_TIMED_OUT);
+    assert(rows == 0);
+    printf("✓ Deadlines passed\n");
+}
+
+void test_cancel() {
+    printf("Testing cancellation...\n");
+    long long rows = 0, other_rows = 0;
+    int task = scheduler_submit(count_rows, &rows, NULL, 0);
+    int other = scheduler_submit(count_rows, &other_rows, NULL, 0);
+    assert(task > 0 && other > 0 && task != other);
+    
+    assert(scheduler_run_slice() == 2);
+    assert(scheduler_cancel(task) == 0);
+    assert(scheduler_run_all() == 0);
+    assert(scheduler_state(task) == TASK_CANCELLED);
+    assert(rows < LONG_ROWS);
+    assert(scheduler_state(other) == TASK_DONE);
+    assert(other_rows == LONG_ROWS);
+    assert(scheduler_cancel(task) == -1);
+    
+    // Cancelled before its first turn
+    task = scheduler_submit(count_rows, &rows, NULL, 0);
+    assert(scheduler_cancel(task) == 0);
+    assert(scheduler_run_all() == 0);
+    assert(scheduler_state(task) == TASK_CANCELLED);
+    assert(scheduler_state(12345) == TASK_UNKNOWN);
+    printf("✓ Cancellation passed\n");
+}
+
+void test_isolation() {
+    printf("Testing task snapshots...\n");
+    int counts[2] = { -1, -1 };
+    int task = scheduler_submit(count_deals_twice, counts, NULL, 0);
+    
+    // The task has read once and is now in its long query
+    assert(scheduler_run_slice() == 1);
+    assert(counts[0] >= 0);
+    assert(deals_create_deal(good_id, 1, "Unseen Buyer", makler_id) > 0);
+    assert(scheduler_run_all() == 0);
+    assert(scheduler_state(task) == TASK_DONE);
+    assert(counts[1] == counts[0]);
+    
+    // Slices aren't run from inside a transaction on the main connection
+    task = scheduler_submit(count_rows, &(long long){0}, NULL, 0);
+    assert(db_begin_transaction() == 0);
+    assert(scheduler_run_slice() == -1);
+    assert(db_rollback_transaction() == 0);
+    assert(scheduler_run_all() == 0);
+    printf("✓ Task snapshots passed\n");
+}
+
+static int do_nothing(void *arg) {
+    (void)arg;
+    return 0;
+}
+
+void test_stopped_reports() {
+    printf("Testing stopped reports...\n");
+    
+    // Enough deals that listing them takes several slices
+    sqlite3_stmt *stmt;
+    assert(db_prepare("INSERT INTO PERFUME_DEALS (deal_date, good_name, good_type, quantity, total_amount, "
+                      "makler_id, good_id, buyer) "
+                      "WITH RECURSIVE n(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM n WHERE x < 50000) "
+                      "SELECT datetime('now'), 'Scheduled Scent', 'perfume', 1, 10.0, ?1, ?2, 'Bulk ' || x FROM n;",
+                      &stmt) == SQLITE_OK);
+    sqlite3_bind_int(stmt, 1, makler_id);
+    sqlite3_bind_int(stmt, 2, good_id);
+    assert(db_step(stmt) == SQLITE_DONE);
+    db_finalize(stmt);
+    
+    ReportParams params = {0};
+    char *expected = run_csv("deals", &params, 0);
+    
+    char *buffer = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buffer, &length);
+    ReportWriter *rw = report_writer_create(out, REPORT_FORMAT_CSV);
+    int task = scheduler_submit_report("deals", &params, rw, 0);
+    assert(scheduler_run_slice() == 1);
+    assert(scheduler_cancel(task) == 0);
+    assert(scheduler_run_all() == 0);
+    assert(scheduler_state(task) == TASK_CANCELLED);
+    report_writer_free(rw);
+    fclose(out);
+    assert(strlen(buffer) < strlen(expected));
+    free(buffer);
+    
+    // Ids cycle through the slots, so after SCHEDULER_MAX_TASKS tasks the
+    // same slot and connection run the report again, in full
+    for (int i = 1; i < SCHEDULER_MAX_TASKS; i++) {
+        assert(scheduler_submit(do_nothing, NULL, NULL, 0) > 0);
+    }
+    assert(scheduler_run_all() == 0);
+    char *full = run_csv("deals", &params, 1);
+    assert(strcmp(full, expected) == 0);
+    free(full);
+    free(expected);
+    printf("✓ Stopped reports passed\n");
+}
+
+int main() {
+    printf("Starting scheduler tests...\n\n");
+    auth_set_capabilities(CAP_ALL);
+    
+    setup();
+    test_report_output();
+    test_slices();
+    test_deadline();
+    test_cancel();
+    test_isolation();
+    test_stopped_reports();
+    
+    db_close();
+    remove(TEST_DB);
+    
+    printf("\n✅ All scheduler tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include "search.h"
+#include "database.h"
+#include "deals.h"
+#include "auth.h"
+#include "test_fixture.h"
+
+#define MAX_RESULTS 10
+
+static void setup_data() {
+    db_init("test_search.db");
+    
+    fixture_add_makler("searchuser", "Search Makler");
+    
+    const char *goods[][3] = {
+        { "Chanel No 5", "perfume", "Chanel France" },
+        { "Dior Sauvage", "perfume", "Dior Europe" },
+        { "Night Cream", "cosmetics", "Beauty Labs" },
+        { "Роза Парфюм", "парфюмерия", "Красная Линия" },
+    };
+    for (int i = 0; i < 4; i++) {
+        fixture_add_good(goods[i][0], goods[i][1], goods[i][2], 10.0, 100);
+    }
+    
+    assert(deals_create_deal(1, 1, "Boutique \"Elite\"", 1) > 0);
+    assert(deals_create_deal(2, 1, "Chanel Corner", 1) > 0);
+}
+
+static int find(const SearchResult *results, int count, SearchKind kind, const char *label) {
+    for (int i = 0; i < count; i++) {
+        if (results[i].kind == kind && strcmp(results[i].label, label) == 0) return i;
+    }
+    return -1;
+}
+
+void test_prefix_search() {
+    printf("Testing prefix search...\n");
+    
+    SearchResult results[MAX_RESULTS];
+    int count = search_query("chan", SEARCH_ALL, results, MAX_RESULTS);
+    assert(count >= 3);
+    assert(find(results, count, SEARCH_GOOD, "Chanel No 5") >= 0);
+    assert(find(results, count, SEARCH_SUPPLIER, "Chanel France") >= 0);
+    assert(find(results, count, SEARCH_BUYER, "Chanel Corner") >= 0);
+    assert(!results[0].fuzzy);
+    
+    // Every word must match, and the good id comes back
+    count = search_query("dior sau", SEARCH_GOOD, results, MAX_RESULTS);
+    assert(count >= 1);
+    assert(strcmp(results[0].label, "Dior Sauvage") == 0);
+    assert(results[0].ref_id == 2);
+    
+    // Cyrillic is case-folded too, types and suppliers match goods
+    count = search_query("роза", SEARCH_GOOD, results, MAX_RESULTS);
+    assert(count >= 1 && results[0].ref_id == 4);
+    count = search_query("cosmetics", SEARCH_GOOD, results, MAX_RESULTS);
+    assert(count >= 1 && results[0].ref_id == 3);
+    
+    printf("✓ Prefix search passed\n");
+}
+
+void test_fuzzy_search() {
+    printf("Testing fuzzy search...\n");
+    
+    SearchResult results[MAX_RESULTS];
+    int count = search_query("sauvaeg", SEARCH_GOOD, results, MAX_RESULTS);
+    assert(count >= 1);
+    assert(results[0].fuzzy && results[0].ref_id == 2);
+    
+    // Quotes and operators in the query are just text
+    count = search_query("\"Elite", SEARCH_BUYER, results, MAX_RESULTS);
+    assert(count >= 1 && strcmp(results[0].label, "Boutique \"Elite\"") == 0);
+    assert(search_query("OR AND NOT (", SEARCH_ALL, results, MAX_RESULTS) >= 0);
+    
+    // More results than the cap are refused
+    assert(search_query("chan", SEARCH_ALL, results, SEARCH_MAX_RESULTS + 1) == -1);
+    
+    printf("✓ Fuzzy search passed\n");
+}
+
+void test_index_follows_changes() {
+    printf("Testing index maintenance...\n");
+    
+    Good *good = db_get_good_by_id(3);
+    strcpy(good->name, "Morning Lotion");
+    assert(db_update_good(good) == 0);
+    db_free_good(good);
+    
+    SearchResult results[MAX_RESULTS];
+    assert(search_query("night", SEARCH_GOOD, results, MAX_RESULTS) == 0);
+    int count = search_query("morn", SEARCH_GOOD, results, MAX_RESULTS);
+    assert(count == 1 && results[0].ref_id == 3);
+    
+    assert(db_delete_good(3) == 0);
+    assert(search_query("morn", SEARCH_GOOD, results, MAX_RESULTS) == 0);
+    
+    // A buyer is indexed once however many deals it has
+    assert(deals_create_deal(1, 1, "Chanel Corner", 1) > 0);
+    count = search_query("corner", SEARCH_BUYER, results, MAX_RESULTS);
+    assert(count == 1);
+    
+    printf("✓ Index maintenance passed\n");
+}
+
+int main() {
+    printf("Starting search tests...\n\n");
+    auth_set_capabilities(CAP_ALL);
+    
+    remove("test_search.db");
+    setup_data();
+    test_prefix_search();
+    test_fuzzy_search();
+    test_index_follows_changes();
+    
+    db_close();
+    remove("test_search.db");
+    
+    printf("\n✅ All search tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include "snapshot.h"
+#include "reports.h"
+#include "database.h"
+#include "deals.h"
+#include "auth.h"
+#include "test_fixture.h"
+
+#define SNAPSHOT_FILE "test_snapshot.snap"
+
+static void setup_data() {
+    db_init("test_snapshot.db");
+    
+    const char *makler_names[] = { "Alpha Makler", "Beta Makler" };
+    for (int i = 0; i < 2; i++) {
+        char username[16];
+        snprintf(username, sizeof(username), "snapuser%d", i);
+        fixture_add_makler(username, makler_names[i]);
+    }
+    
+    const char *goods[][3] = {
+        { "Rose Water", "perfume", "Supplier A" },
+        { "Night Cream", "cosmetics", "Supplier B" },
+        { "Cedar Oil", "perfume", "Supplier A" },
+    };
+    for (int i = 0; i < 3; i++) {
+        fixture_add_good(goods[i][0], goods[i][1], goods[i][2], 10.0 * (i + 1), 1000);
+    }
+    
+    // Supplier B is only sold by makler 2 so the makler lists are unambiguous
+    assert(deals_create_deal(1, 5, "Shop \"One\"", 1) > 0);
+    assert(deals_create_deal(3, 2, "Shop Two", 1) > 0);
+    assert(deals_create_deal(1, 7, "Shop Two", 1) > 0);
+    assert(deals_create_deal(2, 4, "Shop One", 2) > 0);
+    assert(deals_create_deal(2, 1, "Shop Three", 2) > 0);
+}
+
+// Runs a report into a CSV string, from the snapshot if one is given
+static char* run_csv(const Snapshot *snap, const char *name, const ReportParams *params) {
+    char *buffer = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buffer, &length);
+    ReportWriter *rw = report_writer_create(out, REPORT_FORMAT_CSV);
+    reports_set_output(rw);
+    
+    int rc = snap ? snapshot_run_report(snap, name, params) : reports_run(name, params);
+    assert(rc == 0);
+    
+    reports_set_output(NULL);
+    report_writer_free(rw);
+    fclose(out);
+    return buffer;
+}
+
+void test_snapshot_matches_database() {
+    printf("Testing snapshot reports against the database...\n");
+    
+    assert(snapshot_write(SNAPSHOT_FILE) == 5);
+    Snapshot *snap = snapshot_open(SNAPSHOT_FILE);
+    assert(snap != NULL);
+    assert(snapshot_deal_count(snap) == 5);
+    assert(snapshot_good_count(snap) == 3);
+    
+    char today[11];
+    time_t now = time(NULL);
+    strftime(today, sizeof(today), "%Y-%m-%d", localtime(&now));
+    
+    ReportParams params = {0};
+    params.start_date = today;
+    params.end_date = today;
+    params.date = today;
+    params.good_name = "Rose Water";
+    params.makler_id = 1;
+    
+    const char *names[] = {
+        "sales-by-good", "buyers-by-good", "popular-good-type", "max-deals-makler",
+        "sales-by-supplier", "makler-deals", "deals", "goods",
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        char *expected = run_csv(NULL, names[i], &params);
+        char *actual = run_csv(snap, names[i], &params);
+        if (strcmp(expected, actual) != 0) {
+            printf("Mismatch in %s:\n%s---\n%s", names[i], expected, actual);
+        }
+        assert(strcmp(expected, actual) == 0);
+        free(expected);
+        free(actual);
+    }
+    
+    // Unsupported and malformed requests are refused
+    assert(snapshot_run_report(snap, "all-stats", &params) == -1);
+    params.start_date = "yesterday";
+    assert(snapshot_run_report(snap, "deals", &params) == -1);
+    
+    snapshot_close(snap);
+    printf("✓ Snapshot reports match the database\n");
+}
+
+void test_snapshot_rejects_corruption() {
+    printf("Testing snapshot validation...\n");
+    
+    FILE *f = fopen(SNAPSHOT_FILE, "r+b");
+    assert(f != NULL);
+    fseek(f, -4, SEEK_END);
+    int c = fgetc(f);
+    fseek(f, -4, SEEK_END);
+    fputc(c ^ 0xFF, f);
+    fclose(f);
+    assert(snapshot_open(SNAPSHOT_FILE) == NULL);
+    
+    f = fopen(SNAPSHOT_FILE, "r+b");
+    fputs("NOTSNAP!", f);
+    fclose(f);
+    assert(snapshot_open(SNAPSHOT_FILE) == NULL);
+    
+    assert(snapshot_open("missing.snap") == NULL);
+    
+    printf("✓ Snapshot validation passed\n");
+}
+
+void test_snapshot_supplier_change() {
+    printf("Testing deals across a supplier change...\n");
+    
+    // Deals made before the change stay with the old supplier
+    Good *good = db_get_good_by_id(3);
+    assert(good != NULL);
+    strcpy(good->supplier, "Supplier C");
+    assert(db_update_good(good) == 0);
+    db_free_good(good);
+    assert(deals_create_deal(3, 3, "Shop Four", 2) > 0);
+    
+    assert(snapshot_write(SNAPSHOT_FILE) == 6);
+    Snapshot *snap = snapshot_open(SNAPSHOT_FILE);
+    assert(snap != NULL);
+    
+    ReportParams params = {0};
+    const char *names[] = { "sales-by-supplier", "max-deals-makler" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        char *expected = run_csv(NULL, names[i], &params);
+        char *actual = run_csv(snap, names[i], &params);
+        assert(strcmp(expected, actual) == 0);
+        if (strcmp(names[i], "sales-by-supplier") == 0) {
+            assert(strstr(actual, "Supplier A") && strstr(actual, "Supplier C"));
+        }
+        free(expected);
+        free(actual);
+    }
+    
+    snapshot_close(snap);
+    printf("✓ Deals across a supplier change passed\n");
+}
+
+int main() {
+    printf("Starting snapshot tests...\n\n");
+    auth_set_capabilities(CAP_ALL);
+    
+    remove("test_snapshot.db");
+    setup_data();
+    test_snapshot_matches_database();
+    test_snapshot_rejects_corruption();
+    test_snapshot_supplier_change();
+    
+    db_close();
+    remove("test_snapshot.db");
+    remove(SNAPSHOT_FILE);
+    
+    printf("\n✅ All snapshot tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include "statstore.h"
+#include "database.h"
+#include "deals.h"
+#include "auth.h"
+#include "test_fixture.h"
+
+static int makler_id;
+static int good_id;
+
+static long long table_quantity(sqlite3 *db) {
+    sqlite3_stmt *stmt;
+    assert(sqlite3_prepare_v2(db, "SELECT COALESCE(SUM(total_quantity), 0) FROM PERFUME_MAKLERSTATS",
+                              -1, &stmt, NULL) == SQLITE_OK);
+    assert(sqlite3_step(stmt) == SQLITE_ROW);
+    long long quantity = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    return quantity;
+}
+
+static int memory_quantity() {
+    int count;
+    MaklerStats *stats = db_get_makler_stats(makler_id, &count);
+    int quantity = 0;
+    for (int i = 0; i < count; i++) quantity += stats[i].total_quantity;
+    free(stats);
+    return quantity;
+}
+
+static void setup_data() {
+    db_init("test_statstore.db");
+    
+    makler_id = fixture_add_makler("statsuser", "Stats Makler");
+    good_id = fixture_add_good("Stats Good", "perfume", NULL, 2.0, 10000);
+}
+
+void test_batched_flush() {
+    printf("Testing batched statistics...\n");
+    
+    sqlite3 *db = db_get_connection();
+    
+    // Reads see every committed deal; the table trails by the unflushed ones
+    for (int i = 0; i < 10; i++) {
+        assert(deals_create_deal(good_id, 1, "Shop", makler_id) > 0);
+        assert(memory_quantity() == i + 1);
+        assert(table_quantity(db) == memory_quantity() - statstore_unflushed());
+    }
+    
+    // Rolled back deals are never counted
+    assert(db_begin_transaction() == 0);
+    assert(deals_create_deal(good_id, 5, "Shop", makler_id) > 0);
+    assert(db_rollback_transaction() == 0);
+    assert(memory_quantity() == 10);
+    
+    // A full batch is written out
+    for (int i = 0; i < STATSTORE_FLUSH_DEALS; i++) {
+        assert(deals_create_deal(good_id, 1, "Shop", makler_id) > 0);
+    }
+    assert(memory_quantity() == 10 + STATSTORE_FLUSH_DEALS);
+    assert(table_quantity(db) == memory_quantity() - statstore_unflushed());
+    assert(statstore_unflushed() < STATSTORE_FLUSH_DEALS);
+    
+    int count;
+    MaklerStats *stats = db_get_makler_stats(makler_id, &count);
+    assert(count == 1);
+    assert(strcmp(stats[0].good_name, "Stats Good") == 0);
+    assert(stats[0].total_amount == 2.0 * stats[0].total_quantity);
+    free(stats);
+    
+    assert(db_get_makler_stats(makler_id + 100, &count) == NULL);
+    assert(count == 0);
+    
+    printf("✓ Batched statistics passed\n");
+}
+
+void test_flush_on_close() {
+    printf("Testing statistics across connections...\n");
+    
+    int expected = memory_quantity();
+    db_close();
+    
+    sqlite3 *other;
+    assert(sqlite3_open("test_statstore.db", &other) == SQLITE_OK);
+    assert(table_quantity(other) == expected);
+    
+    db_init("test_statstore.db");
+    assert(memory_quantity() == expected);
+    assert(deals_create_deal(good_id, 1, "Shop", makler_id) > 0);
+    
+    // Another connection's commit is picked up without losing ours
+    assert(sqlite3_exec(other, "UPDATE PERFUME_MAKLERSTATS SET total_quantity = total_quantity + 1000",
+                        NULL, NULL, NULL) == SQLITE_OK);
+    assert(memory_quantity() == expected + 1 + 1000);
+    assert(statstore_unflushed() == 0);
+    assert(table_quantity(other) == expected + 1 + 1000);
+    
+    sqlite3_close(other);
+    printf("✓ Statistics across connections passed\n");
+}
+
+int main() {
+    printf("Starting statistics store tests...\n\n");
+    auth_set_capabilities(CAP_ALL);
+    
+    remove("test_statstore.db");
+    setup_data();
+    test_batched_flush();
+    test_flush_on_close();
+    
+    db_close();
+    remove("test_statstore.db");
+    
+    printf("\n✅ All statistics store tests passed!\n");
+    return 0;
+}
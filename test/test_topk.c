@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include "topk.h"
+#include "snapshot.h"
+#include "reports.h"
+#include "database.h"
+#include "deals.h"
+#include "auth.h"
+#include "test_fixture.h"
+
+#define SNAPSHOT_FILE "test_topk.snap"
+
+void test_heap_keeps_best() {
+    printf("Testing bounded heap...\n");
+    
+    // Every candidate is offered; the heap must match a full sort
+    enum { CANDIDATES = 500, K = 7 };
+    long long quantities[CANDIDATES];
+    srand(36);
+    TopK *topk = topk_create(K);
+    assert(topk != NULL);
+    for (int i = 0; i < CANDIDATES; i++) {
+        quantities[i] = rand() % 50;
+        char label[16];
+        snprintf(label, sizeof(label), "c%03d", i);
+        topk_offer(topk, i, label, 1, quantities[i], 0.0);
+    }
+    
+    const TopKEntry *entries;
+    assert(topk_sorted(topk, &entries) == K);
+    for (int r = 0; r < K; r++) {
+        // Best remaining: highest quantity, lowest label among ties
+        int best = -1;
+        for (int i = 0; i < CANDIDATES; i++) {
+            if (quantities[i] >= 0 && (best < 0 || quantities[i] > quantities[best])) best = i;
+        }
+        assert(entries[r].id == best);
+        assert(entries[r].quantity == quantities[best]);
+        quantities[best] = -1;
+    }
+    
+    // Sorting is final; later offers are refused
+    assert(topk_offer(topk, 1000, "late", 1, 1000, 0.0) == 0);
+    topk_free(topk);
+    
+    // Fewer candidates than K
+    topk = topk_create(5);
+    topk_set_metric(topk, TOPK_AMOUNT);
+    topk_offer(topk, 1, "low", 9, 9, 1.5);
+    topk_offer(topk, 2, "high", 1, 1, 2.5);
+    assert(topk_sorted(topk, &entries) == 2);
+    assert(strcmp(entries[0].label, "high") == 0);
+    assert(strcmp(entries[1].label, "low") == 0);
+    topk_free(topk);
+    
+    assert(topk_create(0) == NULL);
+    assert(topk_create(TOPK_MAX_LIMIT + 1) == NULL);
+    assert(topk_parse_dimension("supplier") == TOPK_SUPPLIER);
+    assert(topk_parse_dimension("shop") == -1);
+    assert(topk_parse_metric("deals") == TOPK_DEALS);
+    assert(topk_parse_metric(NULL) == -1);
+    
+    printf("✓ Bounded heap passed\n");
+}
+
+static void setup_data() {
+    db_init("test_topk.db");
+    
+    char username[16], name[32], supplier[16];
+    for (int i = 0; i < 3; i++) {
+        snprintf(username, sizeof(username), "topuser%d", i);
+        snprintf(name, sizeof(name), "Makler %c", 'A' + i);
+        fixture_add_makler(username, name);
+    }
+    
+    for (int i = 0; i < 6; i++) {
+        snprintf(name, sizeof(name), "Good %d", i + 1);
+        snprintf(supplier, sizeof(supplier), "Supplier %c", 'A' + i % 3);
+        fixture_add_good(name, i % 2 ? "cosmetics" : "perfume", supplier, 5.0 * (i + 1), 10000);
+    }
+    
+    const char *buyers[] = { "Shop One", "Shop Two", "Shop Three", "Shop Four" };
+    srand(7);
+    for (int i = 0; i < 60; i++) {
+        assert(deals_create_deal(rand() % 6 + 1, rand() % 9 + 1, buyers[rand() % 4], rand() % 3 + 1) > 0);
+    }
+}
+
+static char* run_csv(const Snapshot *snap, const ReportParams *params) {
+    char *buffer = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&buffer, &length);
+    ReportWriter *rw = report_writer_create(out, REPORT_FORMAT_CSV);
+    reports_set_output(rw);
+    
+    int rc = snap ? snapshot_run_report(snap, "top", params) : reports_run("top", params);
+    assert(rc == 0);
+    
+    reports_set_output(NULL);
+    report_writer_free(rw);
+    fclose(out);
+    return buffer;
+}
+
+void test_top_reports() {
+    printf("Testing top reports against the snapshot...\n");
+    
+    assert(snapshot_write(SNAPSHOT_FILE) == 60);
+    Snapshot *snap = snapshot_open(SNAPSHOT_FILE);
+    assert(snap != NULL);
+    
+    char today[11];
+    time_t now = time(NULL);
+    strftime(today, sizeof(today), "%Y-%m-%d", localtime(&now));
+    
+    // The rollup and the column scan rank the same groups the same way
+    const char *dimensions[] = { "good", "makler", "buyer", "supplier" };
+    const char *metrics[] = { "quantity", "amount", "deals" };
+    for (int d = 0; d < 4; d++) {
+        for (int m = 0; m < 3; m++) {
+            ReportParams params = {0};
+            params.by = dimensions[d];
+            params.metric = metrics[m];
+            params.limit = 2;
+            params.start_date = m == 1 ? today : NULL;
+            char *expected = run_csv(NULL, &params);
+            char *actual = run_csv(snap, &params);
+            if (strcmp(expected, actual) != 0) {
+                printf("Mismatch for %s by %s:\n%s---\n%s", dimensions[d], metrics[m], expected, actual);
+            }
+            assert(strcmp(expected, actual) == 0);
+            // Header plus two ranked rows
+            assert(strncmp(expected, "rank,", 5) == 0);
+            assert(strstr(expected, "\n1,") && strstr(expected, "\n2,") && !strstr(expected, "\n3,"));
+            free(expected);
+            free(actual);
+        }
+    }
+    
+    // A window with no deals ranks nothing
+    ReportParams params = {0};
+    params.by = "good";
+    params.start_date = "2001-01-01";
+    params.end_date = "2001-12-31";
+    char *empty = run_csv(NULL, &params);
+    assert(strcmp(empty, "rank,name,deal_count,total_quantity,total_amount\n") == 0);
+    free(empty);
+    
+    // Unknown dimensions or metrics and bad limits are refused
+    params.by = "shop";
+    assert(reports_run("top", &params) == -1);
+    params.by = "good";
+    params.metric = "profit";
+    assert(snapshot_run_report(snap, "top", &params) == -1);
+    params.metric = NULL;
+    params.limit = TOPK_MAX_LIMIT + 1;
+    assert(reports_run("top", &params) == -1);
+    
+    snapshot_close(snap);
+    printf("✓ Top reports passed\n");
+}
+
+int main() {
+    printf("Starting top-K tests...\n\n");
+    auth_set_capabilities(CAP_ALL);
+    
+    test_heap_keeps_best();
+    
+    remove("test_topk.db");
+    setup_data();
+    test_top_reports();
+    
+    db_close();
+    remove("test_topk.db");
+    remove(SNAPSHOT_FILE);
+    
+    printf("\n✅ All top-K tests passed!\n");
+    return 0;
+}
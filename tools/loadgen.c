@@ -0,0 +1,364 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include "auth.h"
+#include "database.h"
+#include "deals.h"
+#include "reports.h"
+#include "metrics.h"
+
+// Load generator: forks one process per simulated makler, each with its
+// own connection to the same database file, runs a weighted mix of deal
+// creation, deal listing and reports, and prints throughput, latency
+// percentiles and how often SQLite answered SQLITE_BUSY.
+
+#define DEFAULT_DB "loadgen.db"
+#define DEFAULT_MAKLERS 8
+#define DEFAULT_OPS 500
+#define GOOD_COUNT 20
+#define BUYER_COUNT 50
+#define MAX_MAKLERS 256
+
+typedef enum {
+    OP_CREATE,
+    OP_LIST,
+    OP_REPORT,
+    OP_COUNT
+} Operation;
+
+static const char *op_names[] = { "create-deal", "list-deals", "report" };
+
+typedef struct {
+    const char *db_path;
+    int maklers;
+    int ops;
+    int weights[OP_COUNT];
+    int busy_ms;
+    unsigned seed;
+    int keep;
+    int verbose;
+} Options;
+
+// Sent from each worker to the parent when it is done
+typedef struct {
+    int errors[OP_COUNT];
+    uint64_t busy[OP_COUNT];
+    MetricsHistogram latency[OP_COUNT];
+} WorkerTotals;
+
+static void usage(const char *prog) {
+    printf("Usage: %s [--db PATH] [--maklers N] [--ops N] [--mix CREATE,LIST,REPORT]\n", prog);
+    printf("          [--busy-ms N] [--seed N] [--keep] [--verbose]\n");
+    printf("  --db PATH      Database file, recreated unless --keep (default: %s)\n", DEFAULT_DB);
+    printf("  --maklers N    Concurrent simulated maklers, one process each (default: %d)\n", DEFAULT_MAKLERS);
+    printf("  --ops N        Operations per makler (default: %d)\n", DEFAULT_OPS);
+    printf("  --mix C,L,R    Relative weights of deal creation, listing and reports (default: 70,20,10)\n");
+    printf("  --busy-ms N    SQLite busy timeout per connection (default: 0, as the application)\n");
+    printf("  --seed N       Seed for the operation mix (default: 1)\n");
+    printf("  --keep         Use the existing database and its data\n");
+    printf("  --verbose      Keep the workers' error messages\n");
+}
+
+static unsigned next_random(unsigned *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static int write_all(int fd, const void *data, size_t size) {
+    const char *p = data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *data, size_t size) {
+    char *p = data;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+// Maklers and goods with enough stock that deals never run out
+static int seed_database(const Options *opt, int *makler_ids, int *good_ids) {
+    if (!opt->keep) {
+        char path[512];
+        remove(opt->db_path);
+        snprintf(path, sizeof(path), "%s-wal", opt->db_path);
+        remove(path);
+        snprintf(path, sizeof(path), "%s-shm", opt->db_path);
+        remove(path);
+    }
+    if (db_init(opt->db_path) != 0) return -1;
+    auth_set_capabilities(auth_role_capabilities(ROLE_ADMIN));
+    
+    if (db_begin_transaction() != 0) return -1;
+    for (int i = 0; i < opt->maklers; i++) {
+        User user = {0};
+        snprintf(user.username, sizeof(user.username), "load%d_%d", (int)getpid(), i);
+        strcpy(user.password_hash, "-");
+        user.role = ROLE_MAKLER;
+        Makler makler = {0};
+        snprintf(makler.name, sizeof(makler.name), "Load Makler %d", i);
+        makler.user_id = db_create_user(&user);
+        makler_ids[i] = db_create_makler(&makler);
+        if (makler.user_id <= 0 || makler_ids[i] <= 0) {
+            db_rollback_transaction();
+            return -1;
+        }
+    }
+    
+    static const char *types[] = { "perfume", "cosmetics", "candles", "soap" };
+    for (int i = 0; i < GOOD_COUNT; i++) {
+        Good good = {0};
+        snprintf(good.name, sizeof(good.name), "Load Good %d", i);
+        snprintf(good.type, sizeof(good.type), "%s", types[i % 4]);
+        snprintf(good.supplier, sizeof(good.supplier), "Load Supplier %d", i % 5);
+        strcpy(good.expiry_date, "2099-12-31");
+        good.unit_price = 10.0 + i;
+        good.quantity = 100000000;
+        good_ids[i] = db_create_good(&good);
+        if (good_ids[i] <= 0) {
+            db_rollback_transaction();
+            return -1;
+        }
+    }
+    int rc = db_commit_transaction();
+    db_close();
+    return rc;
+}
+
+static int run_report(unsigned *rng) {
+    static const char *names[] = {
+        "sales-by-good", "popular-good-type", "max-deals-makler", "sales-by-supplier", "top",
+    };
+    ReportParams params = {0};
+    params.start_date = "2000-01-01";
+    params.end_date = "2099-12-31";
+    params.by = "good";
+    return reports_run(names[next_random(rng) % 5], &params);
+}
+
+static int run_operation(Operation op, int makler_id, const int *good_ids, unsigned *rng) {
+    switch (op) {
+        case OP_CREATE: {
+            char buyer[32];
+            snprintf(buyer, sizeof(buyer), "Load Buyer %u", next_random(rng) % BUYER_COUNT);
+            int good_id = good_ids[next_random(rng) % GOOD_COUNT];
+            return deals_create_deal(good_id, 1 + (int)(next_random(rng) % 3), buyer, makler_id) > 0 ? 0 : -1;
+        }
+        case OP_LIST: {
+            int count = 0;
+            Deal **deals = deals_get_makler_deals(makler_id, &count);
+            for (int i = 0; i < count; i++) db_free_deal(deals[i]);
+            free(deals);
+            return 0;
+        }
+        default:
+            return run_report(rng);
+    }
+}
+
+// Opens its connection, waits for the start signal, runs the workload
+// and sends the results
+static void worker(const Options *opt, int index, int makler_id, const int *good_ids,
+                   int start_fd, int result_fd) {
+    if (!opt->verbose) freopen("/dev/null", "w", stderr);
+    
+    WorkerTotals totals;
+    memset(&totals, 0, sizeof(totals));
+    FILE *devnull = fopen("/dev/null", "w");
+    if (!devnull || db_init(opt->db_path) != 0) _exit(1);
+    sqlite3_busy_timeout(db_get_connection(), opt->busy_ms);
+    ReportWriter *rw = report_writer_create(devnull, REPORT_FORMAT_CSV);
+    reports_set_output(rw);
+    
+    unsigned rng = opt->seed * 2654435761u + (unsigned)index + 1;
+    int total_weight = opt->weights[OP_CREATE] + opt->weights[OP_LIST] + opt->weights[OP_REPORT];
+    
+    // Opening runs the schema setup, which would collide with the other
+    // workers' if they opened at the same time, so the parent starts the
+    // next worker only after this one reports ready
+    char ready = 'r', go;
+    if (write_all(result_fd, &ready, 1) != 0 || read(start_fd, &go, 1) < 0) _exit(1);
+    
+    for (int i = 0; i < opt->ops; i++) {
+        int pick = (int)(next_random(&rng) % (unsigned)total_weight);
+        Operation op = pick < opt->weights[OP_CREATE] ? OP_CREATE :
+                       pick < opt->weights[OP_CREATE] + opt->weights[OP_LIST] ? OP_LIST : OP_REPORT;
+        
+        // Deals and lists run as a makler's session, reports as an analyst's
+        auth_set_capabilities(auth_role_capabilities(op == OP_REPORT ? ROLE_ANALYST : ROLE_MAKLER));
+        
+        uint64_t busy = db_busy_count();
+        uint64_t start = metrics_now_ns();
+        int rc = run_operation(op, makler_id, good_ids, &rng);
+        metrics_hist_record(&totals.latency[op], metrics_now_ns() - start);
+        
+        if (rc != 0) totals.errors[op]++;
+        totals.busy[op] += db_busy_count() - busy;
+    }
+    
+    reports_set_output(NULL);
+    report_writer_free(rw);
+    db_close();
+    
+    _exit(write_all(result_fd, &totals, sizeof(totals)) == 0 ? 0 : 1);
+}
+
+static void print_row(const char *name, const MetricsHistogram *latency, int errors,
+                      uint64_t busy, double seconds) {
+    printf("%-12s %8llu %7d %8llu %10.1f %9.3f %9.3f %9.3f\n", name, (unsigned long long)latency->total,
+           errors, (unsigned long long)busy, seconds > 0 ? latency->total / seconds : 0.0,
+           metrics_hist_percentile(latency, 50.0) / 1e6, metrics_hist_percentile(latency, 99.0) / 1e6,
+           metrics_hist_percentile(latency, 99.9) / 1e6);
+}
+
+static int parse_options(int argc, char *argv[], Options *opt) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--db") == 0 && i + 1 < argc) {
+            opt->db_path = argv[++i];
+        } else if (strcmp(argv[i], "--maklers") == 0 && i + 1 < argc) {
+            opt->maklers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+            opt->ops = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--mix") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d,%d,%d", &opt->weights[OP_CREATE], &opt->weights[OP_LIST],
+                       &opt->weights[OP_REPORT]) != 3) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--busy-ms") == 0 && i + 1 < argc) {
+            opt->busy_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            opt->seed = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--keep") == 0) {
+            opt->keep = 1;
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            opt->verbose = 1;
+        } else {
+            return -1;
+        }
+    }
+    
+    int total = opt->weights[OP_CREATE] + opt->weights[OP_LIST] + opt->weights[OP_REPORT];
+    if (opt->maklers < 1 || opt->maklers > MAX_MAKLERS || opt->ops < 1 || opt->busy_ms < 0 ||
+        opt->weights[OP_CREATE] < 0 || opt->weights[OP_LIST] < 0 || opt->weights[OP_REPORT] < 0 ||
+        total <= 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Options opt = { DEFAULT_DB, DEFAULT_MAKLERS, DEFAULT_OPS, { 70, 20, 10 }, 0, 1, 0, 0 };
+    if (parse_options(argc, argv, &opt) != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    int makler_ids[MAX_MAKLERS], good_ids[GOOD_COUNT];
+    if (seed_database(&opt, makler_ids, good_ids) != 0) {
+        fprintf(stderr, "Failed to prepare %s\n", opt.db_path);
+        return 1;
+    }
+    
+    // Workers block on the start pipe until every one of them is forked
+    int start_pipe[2];
+    if (pipe(start_pipe) != 0) {
+        perror("pipe");
+        return 1;
+    }
+    pid_t pids[MAX_MAKLERS];
+    int result_fds[MAX_MAKLERS];
+    fflush(NULL);
+    for (int i = 0; i < opt.maklers; i++) {
+        int result_pipe[2];
+        if (pipe(result_pipe) != 0) {
+            perror("pipe");
+            return 1;
+        }
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pids[i] == 0) {
+            close(start_pipe[1]);
+            close(result_pipe[0]);
+            worker(&opt, i, makler_ids[i], good_ids, start_pipe[0], result_pipe[1]);
+        }
+        close(result_pipe[1]);
+        result_fds[i] = result_pipe[0];
+        
+        char ready;
+        if (read_all(result_fds[i], &ready, 1) != 0) {
+            fprintf(stderr, "Worker %d could not open %s\n", i, opt.db_path);
+            return 1;
+        }
+    }
+    
+    close(start_pipe[0]);
+    uint64_t started = metrics_now_ns();
+    close(start_pipe[1]);
+    
+    // Results arrive as workers finish; WorkerTotals is larger than a pipe
+    // buffer, so a worker may wait here, but only after it stopped timing
+    static WorkerTotals sum, totals;
+    int failed = 0;
+    for (int i = 0; i < opt.maklers; i++) {
+        if (read_all(result_fds[i], &totals, sizeof(totals)) != 0) {
+            failed++;
+        } else {
+            for (int op = 0; op < OP_COUNT; op++) {
+                sum.errors[op] += totals.errors[op];
+                sum.busy[op] += totals.busy[op];
+                metrics_hist_merge(&sum.latency[op], &totals.latency[op]);
+            }
+        }
+        close(result_fds[i]);
+    }
+    double seconds = (metrics_now_ns() - started) / 1e9;
+    
+    for (int i = 0; i < opt.maklers; i++) {
+        int status;
+        waitpid(pids[i], &status, 0);
+    }
+    if (failed > 0) {
+        fprintf(stderr, "%d worker(s) failed\n", failed);
+        return 1;
+    }
+    
+    printf("%d maklers x %d operations, mix %d/%d/%d, busy timeout %d ms, %s\n\n", opt.maklers, opt.ops,
+           opt.weights[OP_CREATE], opt.weights[OP_LIST], opt.weights[OP_REPORT], opt.busy_ms, opt.db_path);
+    printf("%-12s %8s %7s %8s %10s %9s %9s %9s\n", "Operation", "Count", "Errors", "Busy",
+           "Ops/s", "p50 ms", "p99 ms", "p999 ms");
+    
+    static MetricsHistogram all;
+    int all_errors = 0;
+    uint64_t all_busy = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        metrics_hist_merge(&all, &sum.latency[op]);
+        all_errors += sum.errors[op];
+        all_busy += sum.busy[op];
+        print_row(op_names[op], &sum.latency[op], sum.errors[op], sum.busy[op], seconds);
+    }
+    print_row("all", &all, all_errors, all_busy, seconds);
+    
+    printf("\nWall time %.2f s, %llu SQLITE_BUSY results (%.2f per 100 operations), %d failed operations\n",
+           seconds, (unsigned long long)all_busy, all.total ? 100.0 * all_busy / all.total : 0.0, all_errors);
+    return 0;
+}